@@ -0,0 +1,381 @@
+// Allocator microbenchmarks. Run under LD_PRELOAD with any of the noprefix
+// builds, or without to get the numbers for the system allocator. Each run
+// prints one line of JSON, see bench_report
+//
+// bench small|large|jumbo|xthread|realloc|sweep [options]
+//   -t threads   worker threads (default 4)
+//   -n ops       operations per thread (default depends on the benchmark)
+//   -z bytes     largest block reached by the realloc benchmark (default 1 MB)
+//   -m mbytes    heap size of the sweep benchmark (default 64)
+//   -o bytes     object size of the sweep benchmark (default 128)
+//   -d percent   words of each sweep benchmark object that hold a pointer
+//                to another object (default 25)
+
+#define USE_FF_PREFIX
+#include "../ffmalloc.h"
+#include "common.h"
+
+#include <dlfcn.h>
+#include <pthread.h>
+#include <sched.h>
+#include <unistd.h>
+
+// Slots per pair of threads in the producer/consumer benchmark
+#define RING_SIZE 4096
+
+typedef struct ring_struct {
+	void* slots[RING_SIZE];
+	uint64_t head __attribute__((aligned(64)));
+	uint64_t tail __attribute__((aligned(64)));
+} ring_t;
+
+typedef struct worker_struct {
+	pthread_t thread;
+	unsigned int id;
+	uint64_t ops;
+	uint64_t* samples;
+	size_t sampleCount;
+	ring_t* ring;
+} worker_t;
+
+static struct {
+	unsigned int threads;
+	uint64_t ops;
+	size_t minSize;
+	size_t maxSize;
+	size_t window;
+	size_t reallocMax;
+	size_t heapMB;
+	size_t objectSize;
+	unsigned int density;
+} config = { 4, 0, 0, 0, 0, 1048576, 64, 128, 25 };
+
+static pthread_barrier_t startBarrier;
+
+// Objects of the sweep benchmark
+static void** objects;
+static size_t objectCount;
+
+static inline void sample(worker_t* worker, uint64_t start) {
+	worker->samples[worker->sampleCount++] = bench_now() - start;
+}
+
+static inline size_t random_size(uint64_t* seed) {
+	return config.minSize + bench_random(seed) % (config.maxSize - config.minSize + 1);
+}
+
+// Each thread keeps a window of live blocks and replaces a random one per
+// operation, so that frees land all over the pools rather than in LIFO order
+static void* size_class_worker(void* arg) {
+	worker_t* worker = (worker_t*)arg;
+	uint64_t seed = 0x9E3779B97F4A7C15ULL * (worker->id + 1);
+	char** window = calloc(config.window, sizeof(char*));
+
+	pthread_barrier_wait(&startBarrier);
+	for(uint64_t i = 0; i < worker->ops; i++) {
+		size_t slot = bench_random(&seed) % config.window;
+		size_t size = random_size(&seed);
+		uint64_t start = 0;
+
+		free(window[slot]);
+		if(i % SAMPLE_EVERY == 0) {
+			start = bench_now();
+		}
+		char* block = malloc(size);
+		if(i % SAMPLE_EVERY == 0) {
+			sample(worker, start);
+		}
+		block[0] = 1;
+		block[size - 1] = 1;
+		window[slot] = block;
+	}
+
+	for(size_t slot = 0; slot < config.window; slot++) {
+		free(window[slot]);
+	}
+	free(window);
+	return NULL;
+}
+
+// Producers allocate and hand every block to their consumer which frees it,
+// so each free comes from a thread other than the allocating one
+static void* producer_worker(void* arg) {
+	worker_t* worker = (worker_t*)arg;
+	ring_t* ring = worker->ring;
+	uint64_t seed = 0x9E3779B97F4A7C15ULL * (worker->id + 1);
+
+	pthread_barrier_wait(&startBarrier);
+	for(uint64_t i = 0; i < worker->ops; i++) {
+		size_t size = random_size(&seed);
+		uint64_t start = 0;
+
+		if(i % SAMPLE_EVERY == 0) {
+			start = bench_now();
+		}
+		char* block = malloc(size);
+		if(i % SAMPLE_EVERY == 0) {
+			sample(worker, start);
+		}
+		block[0] = 1;
+
+		while(i - __atomic_load_n(&ring->tail, __ATOMIC_ACQUIRE) == RING_SIZE) {
+			sched_yield();
+		}
+		ring->slots[i % RING_SIZE] = block;
+		__atomic_store_n(&ring->head, i + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+static void* consumer_worker(void* arg) {
+	worker_t* worker = (worker_t*)arg;
+	ring_t* ring = worker->ring;
+
+	pthread_barrier_wait(&startBarrier);
+	for(uint64_t i = 0; i < worker->ops; i++) {
+		uint64_t start = 0;
+
+		while(__atomic_load_n(&ring->head, __ATOMIC_ACQUIRE) == i) {
+			sched_yield();
+		}
+		void* block = ring->slots[i % RING_SIZE];
+		if(i % SAMPLE_EVERY == 0) {
+			start = bench_now();
+		}
+		free(block);
+		if(i % SAMPLE_EVERY == 0) {
+			sample(worker, start);
+		}
+		__atomic_store_n(&ring->tail, i + 1, __ATOMIC_RELEASE);
+	}
+	return NULL;
+}
+
+// Grows a block by a quarter at a time up to config.reallocMax then starts
+// over with a fresh one
+static void* realloc_worker(void* arg) {
+	worker_t* worker = (worker_t*)arg;
+	char* block = NULL;
+	size_t size = 0;
+
+	pthread_barrier_wait(&startBarrier);
+	for(uint64_t i = 0; i < worker->ops; i++) {
+		uint64_t start = 0;
+
+		size = size == 0 ? 16 : size + size / 4 + 8;
+		if(i % SAMPLE_EVERY == 0) {
+			start = bench_now();
+		}
+		block = realloc(block, size);
+		if(i % SAMPLE_EVERY == 0) {
+			sample(worker, start);
+		}
+		block[size - 1] = 1;
+
+		if(size >= config.reallocMax) {
+			free(block);
+			block = NULL;
+			size = 0;
+		}
+	}
+	free(block);
+	return NULL;
+}
+
+// Fills an object with pointers to other objects at the configured density
+// and with values that do not look like heap pointers everywhere else
+static void fill_object(void** object, uint64_t* seed) {
+	size_t words = config.objectSize / sizeof(void*);
+
+	for(size_t w = 0; w < words; w++) {
+		uint64_t r = bench_random(seed);
+		if(r % 100 < config.density) {
+			object[w] = __atomic_load_n(&objects[(r >> 8) % objectCount], __ATOMIC_RELAXED);
+		}
+		else {
+			object[w] = (void*)(uintptr_t)(r | 1);
+		}
+	}
+}
+
+// Replaces random objects owned by this thread. Stale pointers to the old
+// objects stay behind in the rest of the heap, which is what keeps the
+// sweeper busy
+static void* sweep_worker(void* arg) {
+	worker_t* worker = (worker_t*)arg;
+	uint64_t seed = 0x9E3779B97F4A7C15ULL * (worker->id + 1);
+	size_t owned = objectCount / config.threads;
+
+	pthread_barrier_wait(&startBarrier);
+	for(uint64_t i = 0; i < worker->ops; i++) {
+		size_t index = (bench_random(&seed) % owned) * config.threads + worker->id;
+		uint64_t start = 0;
+
+		free(__atomic_load_n(&objects[index], __ATOMIC_RELAXED));
+		if(i % SAMPLE_EVERY == 0) {
+			start = bench_now();
+		}
+		void** object = malloc(config.objectSize);
+		if(i % SAMPLE_EVERY == 0) {
+			sample(worker, start);
+		}
+		fill_object(object, &seed);
+		__atomic_store_n(&objects[index], object, __ATOMIC_RELAXED);
+	}
+	return NULL;
+}
+
+static void build_heap(void) {
+	uint64_t seed = 42;
+
+	objectCount = config.heapMB * 1048576 / config.objectSize;
+	if(objectCount < config.threads) {
+		objectCount = config.threads;
+	}
+	objects = calloc(objectCount, sizeof(void*));
+	for(size_t i = 0; i < objectCount; i++) {
+		objects[i] = malloc(config.objectSize);
+	}
+	for(size_t i = 0; i < objectCount; i++) {
+		fill_object((void**)objects[i], &seed);
+	}
+}
+
+// Looks up the HushVac statistics, which are missing when the benchmark runs
+// on another allocator
+static int get_sweep_statistics(ffsweepstats_t* stats) {
+	ffresult_t (*getStats)(ffsweepstats_t*) =
+		(ffresult_t (*)(ffsweepstats_t*))dlsym(RTLD_DEFAULT, "ffget_sweep_statistics");
+
+	memset(stats, 0, sizeof(ffsweepstats_t));
+	return getStats != NULL && getStats(stats) == FFSUCCESS;
+}
+
+static void usage(void) {
+	fprintf(stderr, "usage: bench small|large|jumbo|xthread|realloc|sweep "
+		"[-t threads] [-n ops] [-z bytes] [-m mbytes] [-o bytes] [-d percent]\n");
+	exit(2);
+}
+
+int main(int argc, char** argv) {
+	void* (*body)(void*) = size_class_worker;
+	const char* name;
+	ffsweepstats_t before, after;
+	char extra[512];
+	int haveStats = 0;
+	int opt;
+
+	if(argc < 2) {
+		usage();
+	}
+	name = argv[1];
+
+	while((opt = getopt(argc - 1, argv + 1, "t:n:z:m:o:d:")) != -1) {
+		switch(opt) {
+		case 't': config.threads = (unsigned int)strtoul(optarg, NULL, 0); break;
+		case 'n': config.ops = strtoull(optarg, NULL, 0); break;
+		case 'z': config.reallocMax = strtoull(optarg, NULL, 0); break;
+		case 'm': config.heapMB = strtoull(optarg, NULL, 0); break;
+		case 'o': config.objectSize = strtoull(optarg, NULL, 0); break;
+		case 'd': config.density = (unsigned int)strtoul(optarg, NULL, 0); break;
+		default: usage();
+		}
+	}
+	if(config.threads == 0 || config.objectSize < sizeof(void*)) {
+		usage();
+	}
+
+	if(strcmp(name, "small") == 0) {
+		config.minSize = 16;
+		config.maxSize = 2048;
+		config.window = 1024;
+		config.ops = config.ops ? config.ops : 1000000;
+	}
+	else if(strcmp(name, "large") == 0) {
+		config.minSize = 4096;
+		config.maxSize = 524288;
+		config.window = 64;
+		config.ops = config.ops ? config.ops : 20000;
+	}
+	else if(strcmp(name, "jumbo") == 0) {
+		config.minSize = 2097152;
+		config.maxSize = 8388608;
+		config.window = 2;
+		config.ops = config.ops ? config.ops : 1000;
+	}
+	else if(strcmp(name, "xthread") == 0) {
+		// One consumer per producer
+		config.threads = config.threads < 2 ? 2 : config.threads & ~1U;
+		config.minSize = 16;
+		config.maxSize = 2048;
+		config.ops = config.ops ? config.ops : 1000000;
+		body = producer_worker;
+	}
+	else if(strcmp(name, "realloc") == 0) {
+		config.ops = config.ops ? config.ops : 20000;
+		body = realloc_worker;
+	}
+	else if(strcmp(name, "sweep") == 0) {
+		config.ops = config.ops ? config.ops : 1000000;
+		body = sweep_worker;
+		build_heap();
+	}
+	else {
+		usage();
+	}
+
+	worker_t* workers = calloc(config.threads, sizeof(worker_t));
+	ring_t* rings = calloc(config.threads, sizeof(ring_t));
+	for(unsigned int t = 0; t < config.threads; t++) {
+		workers[t].id = t;
+		workers[t].ops = config.ops;
+		workers[t].samples = malloc((config.ops / SAMPLE_EVERY + 1) * sizeof(uint64_t));
+		workers[t].ring = &rings[t / 2];
+	}
+
+	haveStats = get_sweep_statistics(&before);
+	pthread_barrier_init(&startBarrier, NULL, config.threads + 1);
+	for(unsigned int t = 0; t < config.threads; t++) {
+		void* (*start)(void*) = body == producer_worker && (t & 1) ? consumer_worker : body;
+		if(pthread_create(&workers[t].thread, NULL, start, &workers[t]) != 0) {
+			perror("pthread_create");
+			return 1;
+		}
+	}
+
+	pthread_barrier_wait(&startBarrier);
+	uint64_t begin = bench_now();
+	for(unsigned int t = 0; t < config.threads; t++) {
+		pthread_join(workers[t].thread, NULL);
+	}
+	uint64_t elapsed = bench_now() - begin;
+
+	// Gather the samples of all threads into the first one's buffer
+	size_t sampleCount = 0;
+	uint64_t* samples = malloc(config.threads * (config.ops / SAMPLE_EVERY + 1) * sizeof(uint64_t));
+	for(unsigned int t = 0; t < config.threads; t++) {
+		memcpy(samples + sampleCount, workers[t].samples, workers[t].sampleCount * sizeof(uint64_t));
+		sampleCount += workers[t].sampleCount;
+	}
+
+	extra[0] = '\0';
+	if(haveStats && get_sweep_statistics(&after)) {
+		snprintf(extra, sizeof(extra),
+			"\"sweeps\":%zu,\"pauses\":%zu,\"pause_ns\":%zu,\"max_pause_ns\":%zu,"
+			"\"pages_scanned\":%zu,\"bytes_released\":%zu",
+			after.sweeps - before.sweeps, after.pauses - before.pauses,
+			after.total.pauseTime - before.total.pauseTime, after.maxPauseTime,
+			after.total.pagesScanned - before.total.pagesScanned,
+			after.total.bytesReleased - before.total.bytesReleased);
+	}
+	if(body == sweep_worker) {
+		size_t length = strlen(extra);
+		snprintf(extra + length, sizeof(extra) - length, "%s\"heap_mb\":%zu,\"density\":%u",
+			length ? "," : "", config.heapMB, config.density);
+	}
+
+	// Cross-thread ops count the blocks passed from producer to consumer
+	uint64_t ops = config.ops * (body == producer_worker ? config.threads / 2 : config.threads);
+	bench_report(name, config.threads, ops, elapsed, samples, sampleCount, extra[0] ? extra : NULL);
+	return 0;
+}
@@ -0,0 +1,64 @@
+// Helpers shared by the microbenchmarks and the trace replayer
+
+#pragma once
+
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+#include <sys/resource.h>
+
+// Every SAMPLE_EVERY'th call is timed on its own for the latency percentiles
+#define SAMPLE_EVERY 16
+
+static inline uint64_t bench_now(void) {
+	struct timespec ts;
+	clock_gettime(CLOCK_MONOTONIC, &ts);
+	return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+// Cheap per-thread generator so that the benchmark does not contend on rand()
+static inline uint64_t bench_random(uint64_t* state) {
+	*state ^= *state << 13;
+	*state ^= *state >> 7;
+	*state ^= *state << 17;
+	return *state;
+}
+
+static int compare_u64(const void* a, const void* b) {
+	uint64_t x = *(const uint64_t*)a;
+	uint64_t y = *(const uint64_t*)b;
+	return x < y ? -1 : (x > y ? 1 : 0);
+}
+
+static uint64_t percentile(const uint64_t* sorted, size_t count, unsigned int perMille) {
+	if(count == 0) {
+		return 0;
+	}
+	return sorted[(count - 1) * perMille / 1000];
+}
+
+// Prints one JSON object per line: throughput, latency percentiles of the
+// sampled calls and the peak RSS of the process. extra, when not NULL, holds
+// further "key":value pairs that are appended to the object
+static void bench_report(const char* name, unsigned int threads, uint64_t ops,
+		uint64_t elapsed, uint64_t* samples, size_t sampleCount, const char* extra) {
+	struct rusage usage;
+	double seconds = (double)elapsed / 1e9;
+
+	qsort(samples, sampleCount, sizeof(uint64_t), compare_u64);
+	getrusage(RUSAGE_SELF, &usage);
+
+	printf("{\"bench\":\"%s\",\"threads\":%u,\"ops\":%llu,\"seconds\":%.3f,"
+		"\"ops_per_sec\":%.0f,\"p50_ns\":%llu,\"p99_ns\":%llu,\"p999_ns\":%llu,"
+		"\"max_ns\":%llu,\"peak_rss_kb\":%ld%s%s}\n",
+		name, threads, (unsigned long long)ops, seconds,
+		seconds > 0 ? (double)ops / seconds : 0.0,
+		(unsigned long long)percentile(samples, sampleCount, 500),
+		(unsigned long long)percentile(samples, sampleCount, 990),
+		(unsigned long long)percentile(samples, sampleCount, 999),
+		(unsigned long long)(sampleCount ? samples[sampleCount - 1] : 0),
+		usage.ru_maxrss, extra ? "," : "", extra ? extra : "");
+	fflush(stdout);
+}
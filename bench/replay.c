@@ -0,0 +1,270 @@
+// Replays an allocation trace recorded with the instrumented build and
+// HUSHVAC_TRACE. Calls go to the process allocator, so LD_PRELOAD any of the
+// noprefix builds to replay on it. -l loads one of the prefixed builds
+// instead and calls its ff functions directly
+//
+// replay [-l libhushvacmt.so] trace
+
+#define USE_FF_PREFIX
+#include "../ffmalloc.h"
+#include "common.h"
+
+#include <dlfcn.h>
+#include <unistd.h>
+
+// One trace record with the recorded addresses turned into dense slot
+// numbers so that the timed loop only indexes an array
+typedef struct event_struct {
+	unsigned int op;
+	size_t size;
+	size_t alignment;
+	long in;
+	long out;
+} event_t;
+
+static void* (*doMalloc)(size_t) = malloc;
+static void* (*doCalloc)(size_t, size_t) = calloc;
+static void* (*doRealloc)(void*, size_t) = realloc;
+static void (*doFree)(void*) = free;
+static int (*doMemalign)(void**, size_t, size_t) = posix_memalign;
+
+// Open addressing map from a recorded address to its slot. The set up runs
+// before timing starts so it is kept simple
+static unsigned long long* mapKeys;
+static long* mapSlots;
+static size_t mapCapacity;
+static size_t mapUsed;
+
+// Slots freed by the trace, reused so that the live array stays small
+static long* freeSlots;
+static size_t freeCount;
+static long slotCount;
+
+#define MAP_EMPTY 0ULL
+#define MAP_DELETED 1ULL
+
+static size_t map_hash(unsigned long long key) {
+	return (size_t)((key >> 3) * 0x9E3779B97F4A7C15ULL) & (mapCapacity - 1);
+}
+
+static void map_insert(unsigned long long key, long slot);
+
+static void map_grow(void) {
+	unsigned long long* oldKeys = mapKeys;
+	long* oldSlots = mapSlots;
+	size_t oldCapacity = mapCapacity;
+
+	mapCapacity = mapCapacity ? mapCapacity * 2 : 4096;
+	mapKeys = calloc(mapCapacity, sizeof(unsigned long long));
+	mapSlots = calloc(mapCapacity, sizeof(long));
+	mapUsed = 0;
+	for(size_t i = 0; i < oldCapacity; i++) {
+		if(oldKeys[i] > MAP_DELETED) {
+			map_insert(oldKeys[i], oldSlots[i]);
+		}
+	}
+	free(oldKeys);
+	free(oldSlots);
+}
+
+static void map_insert(unsigned long long key, long slot) {
+	if((mapUsed + 1) * 2 > mapCapacity) {
+		map_grow();
+	}
+
+	size_t i = map_hash(key);
+	while(mapKeys[i] > MAP_DELETED && mapKeys[i] != key) {
+		i = (i + 1) & (mapCapacity - 1);
+	}
+	if(mapKeys[i] == MAP_EMPTY) {
+		mapUsed++;
+	}
+	mapKeys[i] = key;
+	mapSlots[i] = slot;
+}
+
+// Returns the slot of a recorded address and forgets it, or -1 when the
+// address was never returned by a recorded call
+static long map_remove(unsigned long long key) {
+	if(mapCapacity == 0) {
+		return -1;
+	}
+
+	size_t i = map_hash(key);
+	while(mapKeys[i] != MAP_EMPTY) {
+		if(mapKeys[i] == key) {
+			mapKeys[i] = MAP_DELETED;
+			freeSlots[freeCount++] = mapSlots[i];
+			return mapSlots[i];
+		}
+		i = (i + 1) & (mapCapacity - 1);
+	}
+	return -1;
+}
+
+static long new_slot(unsigned long long key) {
+	long slot = freeCount ? freeSlots[--freeCount] : slotCount++;
+	map_insert(key, slot);
+	return slot;
+}
+
+static event_t* load_trace(const char* path, size_t* count) {
+	FILE* file = fopen(path, "rb");
+	char magic[8];
+
+	if(file == NULL) {
+		perror(path);
+		exit(1);
+	}
+	if(fread(magic, 1, 8, file) != 8 || memcmp(magic, FFTRACE_MAGIC, 8) != 0) {
+		fprintf(stderr, "%s is not an allocation trace\n", path);
+		exit(1);
+	}
+
+	fseek(file, 0, SEEK_END);
+	size_t records = (size_t)(ftell(file) - 8) / sizeof(fftrace_t);
+	fseek(file, 8, SEEK_SET);
+
+	fftrace_t* trace = malloc(records * sizeof(fftrace_t));
+	event_t* events = malloc(records * sizeof(event_t));
+	freeSlots = malloc(records * sizeof(long));
+	if(fread(trace, sizeof(fftrace_t), records, file) != records) {
+		fprintf(stderr, "Short read on %s\n", path);
+		exit(1);
+	}
+	fclose(file);
+
+	for(size_t i = 0; i < records; i++) {
+		event_t* event = &events[i];
+		event->op = (unsigned int)(trace[i].info >> 56);
+		event->size = (size_t)(trace[i].info & 0x00FFFFFFFFFFFFFFULL);
+		event->alignment = 0;
+		event->in = -1;
+		event->out = -1;
+
+		switch(event->op) {
+		case FFTRACE_FREE:
+			event->in = map_remove(trace[i].ptr);
+			break;
+		case FFTRACE_REALLOC:
+			// A failed realloc leaves the old block alone
+			if(trace[i].ptr != 0 && (trace[i].result != 0 || event->size == 0)) {
+				event->in = map_remove(trace[i].ptr);
+			}
+			break;
+		case FFTRACE_MEMALIGN:
+			event->alignment = (size_t)trace[i].ptr;
+			break;
+		case FFTRACE_MALLOC:
+		case FFTRACE_CALLOC:
+			break;
+		default:
+			fprintf(stderr, "Unknown trace record %zu\n", i);
+			exit(1);
+		}
+		if(trace[i].result != 0) {
+			event->out = new_slot(trace[i].result);
+		}
+	}
+
+	free(trace);
+	*count = records;
+	return events;
+}
+
+static void load_library(const char* path) {
+	void* handle = dlopen(path, RTLD_NOW | RTLD_LOCAL);
+	if(handle == NULL) {
+		fprintf(stderr, "%s\n", dlerror());
+		exit(1);
+	}
+
+	doMalloc = (void* (*)(size_t))dlsym(handle, "ffmalloc");
+	doCalloc = (void* (*)(size_t, size_t))dlsym(handle, "ffcalloc");
+	doRealloc = (void* (*)(void*, size_t))dlsym(handle, "ffrealloc");
+	doFree = (void (*)(void*))dlsym(handle, "fffree");
+	doMemalign = (int (*)(void**, size_t, size_t))dlsym(handle, "ffposix_memalign");
+	if(!doMalloc || !doCalloc || !doRealloc || !doFree || !doMemalign) {
+		fprintf(stderr, "%s has no ff prefixed API, run noprefix builds with LD_PRELOAD\n", path);
+		exit(1);
+	}
+}
+
+int main(int argc, char** argv) {
+	const char* library = NULL;
+	size_t count;
+	int opt;
+
+	while((opt = getopt(argc, argv, "l:")) != -1) {
+		if(opt == 'l') {
+			library = optarg;
+		}
+		else {
+			fprintf(stderr, "usage: replay [-l library] trace\n");
+			return 2;
+		}
+	}
+	if(optind != argc - 1) {
+		fprintf(stderr, "usage: replay [-l library] trace\n");
+		return 2;
+	}
+
+	event_t* events = load_trace(argv[optind], &count);
+	free(mapKeys);
+	free(mapSlots);
+	free(freeSlots);
+	if(library != NULL) {
+		load_library(library);
+	}
+
+	char** live = calloc((size_t)slotCount + 1, sizeof(char*));
+	uint64_t* samples = malloc((count / SAMPLE_EVERY + 1) * sizeof(uint64_t));
+	size_t sampleCount = 0;
+
+	uint64_t begin = bench_now();
+	for(size_t i = 0; i < count; i++) {
+		event_t* event = &events[i];
+		char* in = event->in >= 0 ? live[event->in] : NULL;
+		char* out = NULL;
+		uint64_t start = 0;
+
+		if(i % SAMPLE_EVERY == 0) {
+			start = bench_now();
+		}
+		switch(event->op) {
+		case FFTRACE_MALLOC:
+			out = doMalloc(event->size);
+			break;
+		case FFTRACE_CALLOC:
+			out = doCalloc(1, event->size);
+			break;
+		case FFTRACE_REALLOC:
+			out = doRealloc(in, event->size);
+			break;
+		case FFTRACE_MEMALIGN:
+			if(doMemalign((void**)&out, event->alignment, event->size) != 0) {
+				out = NULL;
+			}
+			break;
+		case FFTRACE_FREE:
+			doFree(in);
+			break;
+		}
+		if(i % SAMPLE_EVERY == 0) {
+			samples[sampleCount++] = bench_now() - start;
+		}
+
+		if(event->out >= 0) {
+			live[event->out] = out;
+			if(out != NULL) {
+				out[0] = 1;
+			}
+		}
+	}
+	uint64_t elapsed = bench_now() - begin;
+
+	char extra[64];
+	snprintf(extra, sizeof(extra), "\"max_live\":%ld", slotCount);
+	bench_report("replay", 1, count, elapsed, samples, sampleCount, extra);
+	return 0;
+}
@@ -1,5476 +1,10046 @@
-// FFMalloc - an experimental alternative memory allocator
-// Unlike conventional allocators, maximizing space efficiency
-// is not a design goal. Instead, FFMalloc makes exploiting
-// use-after-free bugs in calling applications impossible
-// because freed memory is never reused (only released back to
-// the operating system when possible). FFMalloc depends on the
-// extensive virtual address space available on 64-bit operating
-// systems and is unsuitable for a 32-bit OS
-
-#ifdef _WIN64
-#include <SDKDDKVer.h>
-#define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
-
-#include <Windows.h>
-#endif
-
-/*** Compilation control ***/
-// If the target application is single threaded then defining
-// FFSINGLE_THREADED will remove threading support which slightly
-// reduces the library size but also simplifies debugging.
-// On Windows, FFSINGLE_THREADED must be defined if FFmalloc is
-// compiled as a static library. Thread safety is only supported when
-// compiled as a DLL
-#if defined(_WIN64) && !defined(_WINDLL)
-#define FFSINGLE_THREADED
-#endif
-
-// To include statistics collection in the library, define
-// FF_PROFILE. There is a small size and time cost to doing so
-//#define FF_PROFILE
-
-// On x86_64 allocation alignment is usually 16-byte. However, this is only
-// required to support certain SSE instructions. If those are not used then
-// alignment can be 8-byte and therefore more efficient. Pointers don't seem
-// to ever require 16-byte allignment and so 8-byte alignment will always be 
-// used for allocations of 8 bytes or less. This is backed up in practice by
-// TCMalloc. To enable 8-byte alignment, define FF_EIGHTBYTEALIGN during
-// library compilation
-//#define FF_EIGHTBYTEALIGN
-
-/*** Headers ***/
-#include "ffmalloc.h"
-
-#include <stddef.h>
-#include <stdint.h>
-#include <stdlib.h>
-#include <stdio.h>
-#include <string.h>
-
-#include <stdbool.h>
-#include <pthread.h>
-#include <signal.h>
-#include <sys/syscall.h>
-#include <fcntl.h>
-#include <sys/ioctl.h>
-#include <math.h>
-
-#ifdef _WIN64
-#ifdef FF_PROFILE
-#include <Psapi.h>
-#endif
-#else
-#include <unistd.h>
-#include <sys/mman.h>
-#include <limits.h>
-#include <errno.h>
-
-#ifndef FFSINGLE_THREADED
-#include <sched.h>
-#include <pthread.h>
-#endif
-#ifdef FF_PROFILE
-#include <sys/time.h>
-#include <sys/resource.h>
-#endif
-
-// Caution - defining this symbol allows cross compilation on older Linuxes
-// however running on those kernels risks ffmalloc overwriting other
-// memory allocations. ffmalloc is only intended for Linux kernel 4.17 or later
-#ifndef MAP_FIXED_NOREPLACE
-#define MAP_FIXED_NOREPLACE    0x100000
-#endif
-#endif
-
-// MAP_POPULATE is Linux-specific.
-#ifndef MAP_POPULATE
-#define MAP_POPULATE 0
-#endif
-
-typedef unsigned char byte;
-
-/*** Library Constants ***/
-// GCC and Visual C++ disagree on how many bits "long" is. Define
-// key constants to make sure bitwise operations aren't truncated
-#define ONE64        UINT64_C(1)
-#define TWO64        UINT64_C(2)
-#define THREE64      UINT64_C(3)
-#define FOUR64       UINT64_C(4)
-#define SEVEN64      UINT64_C(7)
-#define EIGHT64      UINT64_C(8)
-#define FIFTEEN64    UINT64_C(15)
-#define SIXTYTHREE64 UINT64_C(63)
-
-// The maximum size of a single memory pool. Must be a power of
-// two greater than or equal to either 1MB or the size of a page if
-// large (2MB or 1GB) pages are used instead of 4KB
-#define POOL_SIZE_BITS 21
-#define POOL_SIZE (ONE64 << POOL_SIZE_BITS)
-
-// The size of a single page of memory from the OS
-#define PAGE_SIZE UINT64_C(4096)
-
-// Half of an OS memory page
-#define HALF_PAGE UINT64_C(2048)
-
-// The number of pages to assign from a pool to a thread cache
-// when a thread cache is out of free pages. Must be an integral
-// divisor of (POOL_SIZE / PAGE_SIZE)
-#define PAGES_PER_REFILL 128
-
-// The minimum number of consecutive pages ready to return to the
-// OS required before calling munmap/VirtualFree. Higher values
-// help mitigate against VMA growth on Linux and reduce expensive
-// system calls on either OS at the cost of holding onto unneeded
-// pages longer than strictly necessary.
-#define MIN_PAGES_TO_FREE 1
-
-// The maximum number of arenas allowed to exist at the same time
-#define MAX_ARENAS 256
-
-// The maximum number of large allocation pool lists allowed per
-// arena regardless of processor count
-#define MAX_LARGE_LISTS 8
-
-// The maximum number of large allocation pools per each arena per
-// CPU list. In other words, each arena including the default will
-// have at most MAX_LARGE_LISTS * MAX_POOLS_PER_LIST large pools in
-// use at any one time
-#define MAX_POOLS_PER_LIST 16
-
-// The number of bits matched at the root level of
-// the page pool radix tree. Current x86_64 hardware supports only
-// 48-bits in a pointer. Assuming POOL_SIZE is kept at its default
-// value of 4MB then 26 bits total need to be tracked.
-// Depending on build and processor, Windows might only supports 44-bit
-// pointers, but go ahead and pretend it will always use 48 too
-#define ROOT_BITS 8
-#define STEM_COUNT (ONE64 << ROOT_BITS)
-
-// The number of bits matched at the intermediate level of the page pool
-// radix tree
-#define STEM_BITS 8
-#define LEAVES_PER_STEM (ONE64 << STEM_BITS)
-
-// The number of bits matched at the leaf level of the page pool radix tree
-#define LEAF_BITS (48 - ROOT_BITS - STEM_BITS - POOL_SIZE_BITS)
-#define POOLS_PER_LEAF (ONE64 << LEAF_BITS)
-
-#ifdef FFSINGLE_THREADED
-// For a single threaded process, making lots of small allocations
-// from the page pool to the one-and-only thread cache is pointless
-#undef PAGES_PER_REFILL
-#define PAGES_PER_REFILL (POOL_SIZE / PAGE_SIZE) 
-
-// When single threaded, having multiple parallel large pool lists has
-// no advantage and wastes resources
-#undef MAX_LARGE_LISTS
-#define MAX_LARGE_LISTS 1
-#endif
-
-/*** Compiler compatibility ***/
-#ifdef _WIN64
-#define __attrUnusedParam
-#else
-// Disable warning about unused size parameter in non-profiling mode
-#define __attrUnusedParam __attribute__((unused))
-#endif
-
-/*** Alignment control constants and macros ***/
-
-#ifdef FF_EIGHTBYTEALIGN
-// Defines the minimum alignment
-#define MIN_ALIGNMENT 8
-
-// The number of small allocation bins in a thread cache when using 8-byte 
-// alignment
-#define BIN_COUNT 45
-
-// Used by init_tcache to indicate the inflection point between evenly spaced
-// bins and bins spaced by maximum packing
-#define BIN_INFLECTION 19
-
-// Rounds requested allocation size up to the next multiple of 8
-#define ALIGN_SIZE(SIZE) ((SIZE + SEVEN64) & ~SEVEN64)
-
-// Select the bin to allocate from based on the size. Below 208 bytes, bins are 
-// every 8 bytes. Above 208, bins are unevenly spaced based on the maximal size
-// that divides into PAGE_SIZE for a given number of slots then rounded down to 
-// the nearest multiple of 8
-#define GET_BIN(SIZE) (SIZE <= 208 ? BIN_COUNT - (SIZE >> 3) : PAGE_SIZE / SIZE)
-
-#else
-// Defines the minimum alignment
-#define MIN_ALIGNMENT 16
-
-// The number of small allocation bins in a thread cache when using 16-byte
-// alignment
-#define BIN_COUNT 32
-
-// Used by init_tcache to indicate the inflection point between evenly spaced
-// bins and bins spaced by maximum packing
-#define BIN_INFLECTION 13
-
-// Rounds requested allocation size up to the next multiple of 16
-#define ALIGN_SIZE(SIZE) (SIZE <= 8 ? 8 : ((SIZE + FIFTEEN64) & ~FIFTEEN64))
-
-// Select the bin to allocate from based on the size. Allocations smaller than
-// eight bytes always come from the eight byte bin. Otherwise, below 304 bytes,
-// bins are every 16 bytes. Above 304, bins are unevenly spaced based on the 
-// maximal size that divides into PAGE_SIZE for a given number of slots then 
-// rounded down to the nearest multiple of 16
-#define GET_BIN(SIZE) (SIZE <= 8 ? 0 : SIZE <= 304 ? BIN_COUNT - (SIZE >> 4) : PAGE_SIZE / SIZE)
-#endif
-
-#define ALIGN_TO(VALUE, ALIGNMENT) ((VALUE + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
-
-
-/*** OS Intrinsic Translation Macros ***/
-
-#ifdef _WIN64
-// Counts the number of 1s in an integer. Useful for checking if an integer is
-// a power of two
-#define FFPOPCOUNT64 _mm_popcnt_u64
-
-// Counts the number of leading (most significant) zeros in a 64-bit integer.
-// Used to round up sizes to a power of two
-#define FFCOUNTLEADINGZEROS64 __lzcnt64
-#else
-#define FFPOPCOUNT64 __builtin_popcountl
-#define FFCOUNTLEADINGZEROS64 __builtin_clzl
-#endif
-
-
-/*** OS Threading Translation Macros ***/
-
-// These macros substitute in the correct OS specific synchronization
-// functions. Or when the library is being compiled for single threading,
-// the macros disable the synchronization calls entirely eliminating the
-// need for repetative #ifdefs
-#ifdef FFSINGLE_THREADED
-// When single threaded on any OS, null out all synchronization calls
-#define FFEnterCriticalSection(LOCK)
-#define FFLeaveCriticalSection(LOCK)
-#define FFTryEnterCriticalSection(LOCK) 1
-#define FFInitializeCriticalSection(LOCK)
-#define FFDeleteCriticalSection(LOCK)
-
-// Atomic operations redefined as basic C statements
-#define FFAtomicAnd(DEST, VALUE)                DEST &= VALUE
-#define FFAtomicOr(DEST, VALUE)                 DEST |= VALUE
-#define FFAtomicAdd(DEST, VALUE)                DEST += VALUE
-#define FFAtomicSub(DEST, VALUE)                DEST -= VALUE
-#define FFAtomicIncrement(DEST)                 DEST++
-#define FFAtomicExchangeAdvancePtr(DEST, VALUE) DEST; DEST += VALUE
-#define FFAtomicCompareExchangePtr(DEST, NEW, OLD) (*DEST = *DEST == OLD ? NEW : *DEST) == NEW
-
-// "Thread" local storage functions
-#define FFTlsAlloc(INDEX, FUNC) get_free_arena_index(&INDEX)
-#define FFTlsFree(INDEX) free_arena_index(INDEX)
-#define TLS_CLEANUP_CALLBACK NULL
-
-// Swallow the lock variable declaration
-#define FFLOCK(NAME)
-#define FFLOCKSTATIC(NAME)
-
-// "Thread" local storage key type
-#define FFTLSINDEX size_t
-
-// No threads so no need for volatile variables
-#define volatile
-
-#elif defined(_WIN64)
-// Synchronization functions on Windows
-#define FFEnterCriticalSection(LOCK)      EnterCriticalSection(LOCK)
-#define FFLeaveCriticalSection(LOCK)      LeaveCriticalSection(LOCK)
-#define FFTryEnterCriticalSection(LOCK)   TryEnterCriticalSection(LOCK)
-#define FFInitializeCriticalSection(LOCK) InitializeCriticalSection(LOCK)
-#define FFDeleteCriticalSection(LOCK)     DeleteCriticalSection(LOCK)
-
-// Atomic operations
-#define FFAtomicAnd(DEST, VALUE)                   InterlockedAnd64(&DEST, VALUE)
-#define FFAtomicOr(DEST, VALUE)                    InterlockedOr64(&DEST, VALUE)
-#define FFAtomicAdd(DEST, VALUE)                   InterlockedAdd64(&DEST, VALUE)
-#define FFAtomicSub(DEST, VALUE)                   InterlockedAdd64(&(LONG64)DEST, -(LONG64)(VALUE))
-#define FFAtomicIncrement(DEST)                    InterlockedIncrement64(&DEST);
-#define FFAtomicExchangeAdvancePtr(DEST, VALUE)    InterlockedExchangeAdd64(&(uintptr_t)DEST, VALUE)
-#define FFAtomicCompareExchangePtr(DEST, NEW, OLD) (InterlockedCompareExchangePointer(DEST, NEW, OLD) == OLD)
-
-// Thread local storage functions
-#define FFTlsAlloc(INDEX, FUNC) ((INDEX = TlsAlloc()) != TLS_OUT_OF_INDEXES)
-#define FFTlsFree(INDEX) TlsFree(INDEX)
-#define TLS_CLEANUP_CALLBACK NULL
-
-// Synchronization types
-#define FFLOCK(NAME)       CRITICAL_SECTION NAME;
-#define FFLOCKSTATIC(NAME) static CRITICAL_SECTION NAME;
-
-// Thread local storage key type
-#define FFTLSINDEX DWORD 
-
-#else
-// Synchronization functions on Linux
-#define FFEnterCriticalSection(LOCK)      pthread_mutex_lock(LOCK)
-#define FFLeaveCriticalSection(LOCK)      pthread_mutex_unlock(LOCK)
-#define FFTryEnterCriticalSection(LOCK)   (pthread_mutex_trylock(LOCK) == 0)
-#define FFInitializeCriticalSection(LOCK) pthread_mutex_init(LOCK, NULL)
-#define FFDeleteCriticalSection(LOCK)     pthread_mutex_destroy(LOCK)
-
-// Atomic Operations
-#define FFAtomicAnd(DEST, VALUE)                   __sync_and_and_fetch(&DEST, VALUE)
-#define FFAtomicOr(DEST, VALUE)                    __sync_or_and_fetch(&DEST, VALUE)
-#define FFAtomicAdd(DEST, VALUE)                   __sync_add_and_fetch(&DEST, VALUE)
-#define FFAtomicSub(DEST, VALUE)                   __sync_sub_and_fetch(&DEST, VALUE)
-#define FFAtomicIncrement(DEST)                    __sync_add_and_fetch(&DEST, 1)
-#define FFAtomicExchangeAdvancePtr(DEST, VALUE)    __sync_fetch_and_add(&(DEST), (byte*)VALUE)
-#define FFAtomicCompareExchangePtr(DEST, NEW, OLD) __sync_bool_compare_and_swap(DEST, OLD, NEW)
-
-// Thread local storage functions
-#define FFTlsAlloc(INDEX, FUNC) (pthread_key_create(&INDEX, FUNC) == 0)
-#define FFTlsFree(INDEX) pthread_key_delete(INDEX)
-#define TLS_CLEANUP_CALLBACK cleanup_thread
-
-// Synchronization types
-#define FFLOCK(NAME)       pthread_mutex_t NAME;
-#define FFLOCKSTATIC(NAME) static pthread_mutex_t NAME;
-
-// Thread local storage key type
-#define FFTLSINDEX pthread_key_t
-#endif
-
-/*** Metadata Structures ***/
-
-// When a page allocates objects smaller than 64 bytes, interpret the
-// bitmap field in the page map as a pointer to an array of bitmaps. 
-// Otherwise, the field is the bitmap
-union bitmap_t {
-	uint64_t single;
-	uint64_t* array;
-};
-
-// A page map holds the metadata about a page that has been
-// allocated from a small allocation page pool
-struct pagemap_t {
-	// The starting address of the page. Guaranteed to be page aligned
-	byte* start;
-
-	// The size of allocations on this page; always a multiple of 8
-	size_t allocSize;
-
-	// Individual allocations on the page are tracked by setting
-	// or clearing the corresponding bit in the bitmap
-	union bitmap_t bitmap;
-
-#ifdef MARK_SWEEP
-#ifdef SUB_PAGE
-    struct pagemap_t *next;
-
-    volatile int epochCounter;
-    volatile int numEpochSinceLastFree;
-
-	union bitmap_t safemap;
-#endif
-#endif
-};
-
-// Interprets the metadata allocation for a pool as either and array
-// of page maps (small allocation pools) or an array of pointers to
-// the allocations (large allocation pools)
-union tracking_t {
-	struct pagemap_t* pageMaps;
-	uintptr_t* allocations;
-#ifdef MARK_SWEEP
-    struct pagepool_t* next;
-#endif
-};
-
-// A page pool is an initially contiguous region of memory
-// from which individual pages are assigned to the thread
-// cache's bins. "Holes" in the pool will develop over time
-// when enough allocations have been freed that entire pages
-// can be returned to the OS
-struct pagepool_t {
-	// The starting address of the pool. This value is constant
-	// and is not incremented even if the initial page is freed
-	byte* start;
-
-	// The final address (exclusive) of the pool
-	byte* end;
-
-	// The starting address of the next unallocated page in the pool
-	byte* nextFreePage;
-
-	// Pool metadata - either an array of page maps or of allocation pointers
-	union tracking_t tracking;
-
-	// The index of the next pointer in a large pool to be allocated.
-	// The pointer in this slot is not yet allocated, but it
-	// is needed so that the size of the last allocated 
-	// pointer can still be computed
-	size_t nextFreeIndex;
-
-	// The address of the first page not yet freed
-	byte* startInUse;
-
-	// The address of the free page block that is continguous to the end of the pool
-	byte* endInUse;
-
-	// The arena this pool is a part of
-	struct arena_t* arena;
-
-	// Critical section used to lock certain updates on the pool
-	FFLOCK(poolLock)
-};
-
-// All small (less than half a page) allocations are assigned to a
-// size bin based on maximum packing of similar sizes. All allocations
-// on a single page are in the same bin.
-struct bin_t {
-	// Pointer to the next free slot for allocation
-	byte* nextAlloc;
-
-	// The size of allocations in this bin. Always a multiple of 8
-	size_t allocSize;
-
-	// The number of allocations made so far in this bin. It is
-	// reset to 0 when the page is filled and a new page is
-	// assigned to the bin
-	size_t allocCount;
-
-	// The maximum number of allocations that can be made on one
-	// page in this bin
-	size_t maxAlloc;
-
-	// Points to the page map object with the tracking bitmap
-	struct pagemap_t* page;
-
-#ifdef FF_PROFILE
-	// The cummulative number of allocations made from this bin
-	// across all pages
-	size_t totalAllocCount;
-#endif
-};
-
-// Each thread is given its own cache of pages to allocate from
-struct threadcache_t {
-	// The array of small allocation bins for this thread
-	struct bin_t bins[BIN_COUNT];
-
-	// To reduce round trips to the page pool, a small number of
-	// blank pages are assigned to the thread cache to add to a 
-	// bin when it gets full. This points to the next available
-	// free page
-	struct pagemap_t* nextUnusedPage;
-
-	// The end address (exclusive) of the range of free pages
-	// available to the cache
-	struct pagemap_t* endUnusedPage;
-
-	// The arena this thread cache allocates from and the source of
-	// its free pages
-	struct arena_t* arena;
-};
-
-// A leaf node in a radix tree that points to a page pool
-struct radixleaf_t {
-	// Radix leaf node has two arrays, one for start and one for end.
-	// The reason is that we can't assume that each pool allocation
-	// will be POOL_SIZE aligned (and in fact for ASLR purposes it's
-	// better that they aren't). Therefore, looking only at the high
-	// order bits of a pointer, we can't tell if its from a pool that
-	// starts in the middle of the prefix or ends there
-
-	// Pointers to pools that start on the matching prefix
-	struct pagepool_t* poolStart[POOLS_PER_LEAF];
-
-	// Pointers to pools that end on the matching prefix
-	struct pagepool_t* poolEnd[POOLS_PER_LEAF];
-};
-
-// Intermediate node in a radix tree
-struct radixstem_t {
-	struct radixleaf_t* leaves[LEAVES_PER_STEM];
-};
-
-// Root node of the page pool radix tree
-struct radixroot_t {
-	struct radixstem_t* stems[STEM_COUNT];
-};
-
-// Node in a list of allocation pools
-struct poollistnode_t {
-	// Pointer to the next node in the list
-	struct poollistnode_t* next;
-
-	// Pointer to an allocation page pool
-	struct pagepool_t* pool;
-};
-
-// An arena is a collection of large and small pools that allocations can be
-// specifically drawn from using the ffmalloc extended API. Arenas allow the
-// calling application to free all allocations from that arena with one call
-// which benefits performance through fewer system calls to VirtualFree or
-// munmap and simplifies memory management since each allocation doesn't have
-// to be individually freed. Allocations from the standard malloc API come
-// from a default arena, but that arena is persistent and allocations need to
-// be individually freed.
-struct arena_t {
-	// List of small pools created in this arena. The head of the list is
-	// the pool currently being allocated from
-	struct poollistnode_t* volatile smallPoolList;
-
-	// Array of lists of large pools created in this arena. Typically one
-	// list per CPU in the system. The head of the list is usually where
-	// allocations come from but pools further down will be searched for
-	// available space if the first node is locked by another thread
-	struct poollistnode_t* volatile largePoolList[MAX_LARGE_LISTS];
-
-	// List of jumbo allocation pools create in this arena
-	struct poollistnode_t* volatile jumboPoolList;
-
-	// Index to get the correct thread local storage value for this arena
-	// which holds the pointer to the thread cache for invoking thread
-	FFTLSINDEX tlsIndex;
-
-	// Lock that protects modifying the small pool list header
-	FFLOCK(smallListLock)
-
-	// Locks that protect each large list
-	FFLOCK(largeListLock[MAX_LARGE_LISTS])
-
-#ifdef FF_PROFILE
-	// Structure to hold arena usage statistics
-	ffprofile_t profile;
-#endif
-
-#ifdef MARK_SWEEP
-    struct poollistnode_t* volatile largePoolListHead[MAX_LARGE_LISTS];
-
-    struct poollistnode_t* volatile freePoolListHead;
-    struct poollistnode_t* volatile freePoolListTail;
-
-    struct poollistnode_t* volatile freeHugeListHead;
-    struct poollistnode_t* volatile freeHugeListTail;
-
-    size_t volatile pendingPool;
-
-#ifdef SUB_PAGE
-    struct pagemap_t* volatile reuseMapHead[256];
-    struct pagemap_t* volatile reuseMapTail[256];
-#endif
-#endif
-};
-
-// Reinterprets freed metadata allocations as a pointer to the next
-// available free block
-struct usedmd_t {
-	byte* next;
-};
-
-/*** Library Globals ***/
-static int isInit = 0;
-
-// Number of pools currently allocated
-// TODO: move this into future global profiling structure
-static size_t poolCount = 0;
-
-// The highest pool end address seen yet. The next pool will attempt
-// to start at this address
-//static byte* volatile poolHighWater;
-static byte* poolHighWater;
-#ifdef MARK_SWEEP
-static byte* poolLowAddr;
-#endif
-
-// Root node of radix tree containing all pools
-static struct radixroot_t poolTree;
-
-// Array of arenas. The default arena used by the standard malloc API is
-// at index 0
-static struct arena_t* volatile arenas[MAX_ARENAS];
-
-// The start of the global metadata allocation pool
-static byte* metadataPool;
-
-// The top of the metadata pool - i.e. the next unallocated block
-static byte* metadataFree;
-
-// The end of the currently available metadata address space
-static byte* metadataEnd;
-
-// Bin headers for the metadata pool
-static byte* bins[256];
-static byte* metadatabins[2];
-
-// Lock that protects modifications to the pool radix tree
-FFLOCKSTATIC(poolTreeLock)
-
-// Locks that protect access to the metadata allocation bins
-FFLOCKSTATIC(binLocks[256])
-FFLOCKSTATIC(mdBinLocks[2])
-
-// Lock that protects access to the metadata allocation pool
-FFLOCKSTATIC(mdPoolLock)
-
-FFLOCKSTATIC(poolAllocLock);
-
-#ifdef FF_PROFILE
-// The interval (in calls to malloc) to print usage statistics
-unsigned int usagePrintInterval;
-
-// The file that interval usage statistics will be sent to
-FILE * usagePrintFile;
-#endif // FF_PROFILE
-
-
-#ifdef MARK_SWEEP
-/*** Mark-Sweep Mode  ***/
-
-struct hugelistnode_t {
-    uint64_t start;
-    uint64_t end;
-    struct hugelistnode_t *next;
-};
-
-
-//
-// AddrStore
-//
-#define ENTRY 131072
-
-FFLOCKSTATIC(addrStoreLock);
-
-static volatile int addrStoreFront = -1;
-static volatile int addrStoreRear = -1;
-
-static volatile uint64_t addrStore[ENTRY]; 
-
-static int push_addr_store(uint64_t addr)
-{
-    FFEnterCriticalSection(&addrStoreLock);
-    if (addrStoreFront == (addrStoreRear + 1) % ENTRY) {
-        FFLeaveCriticalSection(&addrStoreLock);
-        return 0;
-    }
-    else if (addrStoreFront == -1) {
-        addrStoreFront = 0;
-        addrStoreRear = 0;
-        addrStore[addrStoreRear] = addr;
-        FFLeaveCriticalSection(&addrStoreLock);
-    }
-
-    addrStore[addrStoreRear] = addr;
-    addrStoreRear = (addrStoreRear + 1) % ENTRY;
-    FFLeaveCriticalSection(&addrStoreLock);
-    return 1;
-}
-
-static uint64_t pop_addr_store(void)
-{
-    uint64_t ret;
-    FFEnterCriticalSection(&addrStoreLock);
-    if (addrStoreFront == -1) {
-        FFLeaveCriticalSection(&addrStoreLock);
-        return 0;
-    }
-    if (addrStoreFront == addrStoreRear) {
-        ret = addrStore[addrStoreFront];
-        addrStore[addrStoreFront] = 0;
-
-        addrStoreFront = -1;
-        addrStoreRear = -1;
-        FFLeaveCriticalSection(&addrStoreLock);
-        return ret;
-    }
-
-    ret = addrStore[addrStoreFront];
-    addrStore[addrStoreFront] = 0;
-    addrStoreFront = (addrStoreFront + 1) % ENTRY;
-    FFLeaveCriticalSection(&addrStoreLock);
-    return ret;
-}
-
-
-//
-// FreeeHugeList
-//
-struct hugelistnode_t* volatile safePoolListHead = NULL;
-struct hugelistnode_t* volatile safePoolListTail = NULL;
-
-FFLOCKSTATIC(freePoolLock);
-
-static uint64_t unsafe_enqueue(struct hugelistnode_t *newNode) {
-    FFEnterCriticalSection(&freePoolLock);
-    if (!safePoolListTail) {
-        safePoolListTail = newNode; 
-    }
-    else {
-        safePoolListTail->next = newNode;
-        safePoolListTail = newNode;
-    }
-
-    if (!safePoolListHead) {
-        safePoolListHead = newNode;
-    }
-    FFLeaveCriticalSection(&freePoolLock);
-    return 1;
-}
-
-//
-// Sub Page Reuse
-//
-#ifdef SUB_PAGE
-
-#define GET_REUSEBIN(SIZE) ((SIZE >> 3) - 1)
-
-FFLOCKSTATIC(reuseLock);
-#endif
-#endif
-
-/*** Forward declarations ***/
-static int create_pagepool(struct pagepool_t* newPool);
-static int create_largepagepool(struct pagepool_t* newPool);
-static void destroy_pool_list(struct poollistnode_t* node);
-static struct pagepool_t* find_pool_for_ptr(const byte* ptr);
-static void init_tcache(struct threadcache_t* tcache, struct arena_t* arena);
-static void initialize();
-static void init_threading();
-static void* ffmetadata_alloc(size_t size);
-static void ffmetadata_free(void* ptr, size_t size);
-static void free_large_pointer(struct pagepool_t* pool, size_t index, size_t size);
-void ffprint_stats_wrapper(void);
-
-#ifdef FF_PROFILE
-static void print_current_usage();
-#endif
-
-#if !defined(FFSINGLE_THREADED) && !defined(_WIN64)
-static void cleanup_thread(void* ptr);
-#endif
-
-/*** OS compatibility functions ***/
-static size_t os_alloc_total = 0;
-static size_t os_alloc_count = 0;
-static size_t os_free_count = 0;
-#ifdef _WIN64
-#define MAP_FAILED NULL
-static inline LPVOID os_alloc(LPVOID startAddress, size_t size) {
-	void* alloc = VirtualAlloc(startAddress, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
-	os_alloc_total += size;
-	os_alloc_count++;
-	return alloc;
-}
-
-// Obtains memory from the OS whose starting virtual address is no lower than
-// the previous highest address
-static inline LPVOID os_alloc_highwater(size_t size) {
-	MEM_ADDRESS_REQUIREMENTS addressReqs = { 0 };
-	MEM_EXTENDED_PARAMETER param = { 0 };
-
-	addressReqs.LowestStartingAddress = poolHighWater;
-
-	param.Type = MemExtendedParameterAddressRequirements;
-	param.Pointer = &addressReqs;
-
-	LPVOID result = VirtualAlloc2(NULL, NULL, size, MEM_RESERVE | MEM_COMMIT,
-		PAGE_READWRITE, &param, 1);
-
-	if (result != NULL) {
-		// Incrementing by extra 64K leaves guard pages in between pools for a weak
-		// buffer overflow protection
-		byte* newHigh = (byte*)result + size + 65536ULL;
-		byte* oldHigh = poolHighWater;
-		byte* update;
-		os_alloc_total += size;
-		os_alloc_count++;
-		while ((update = InterlockedCompareExchangePointer(&poolHighWater, newHigh, oldHigh)) < newHigh) {
-			oldHigh = update;
-		}
-	}
-
-	return result;
-}
-
-// Returns memory to the OS but holds onto the memory addresses
-static inline BOOL os_decommit(LPVOID startAddress, size_t size) {
-	return VirtualFree(startAddress, size, MEM_DECOMMIT);
-}
-
-// Returns memory to the OS and releases the virutal address space
-static inline BOOL os_free(LPVOID startAddress) {
-	os_free_count++;
-	return VirtualFree(startAddress, 0, MEM_RELEASE);
-}
-
-#else
-
-static inline void* os_alloc_highwater(size_t size) {
-	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE;
-	void* result = NULL;
-	void* localHigh;
-
-	// If we need more space from the OS, its likely to get used immediately
-	// after, so go ahead and pre-fault the pages for faster access. Except
-	// don't do that for jumbo allocations since that could cause swapping if
-	// the allocation is sufficiently large and the system is under pressure
-	if(size == POOL_SIZE) {
-		flags |= MAP_POPULATE;
-	}
-
-#ifdef MARK_SWEEP
-    if (size == POOL_SIZE) {
-        uint64_t poolBase = pop_addr_store();
-        if (poolBase != 0) {
-            return (void *)poolBase;
-        }
-    }
-#endif
-	localHigh = FFAtomicExchangeAdvancePtr(poolHighWater, size);
-
-	while(result == NULL) {
-		// TODO: Add wrap around if we hit the top of address space
-		result = mmap(localHigh, size, PROT_READ | PROT_WRITE,
-				flags, -1, 0);
-		if(result == MAP_FAILED) {
-			// If the failure was because the requested address already has
-			// a mapping associated then jump up by POOL_SIZE (since a new 
-			// pool created on another thread is the most likely reason)
-			// and try again
-			if(errno == EEXIST) {
-				localHigh = FFAtomicExchangeAdvancePtr(poolHighWater, POOL_SIZE);
-				result = NULL;
-			}
-			else {
-				fprintf(stderr, "[ffmalloc] Warning: os_alloc_highwater failed\n");
-				return MAP_FAILED;
-			}
-		}
-	}
-
-	return result;
-}
-
-#define FALSE -1
-static inline int os_decommit(void* startAddress, size_t size) {
-#ifdef FFMALLOC_PLUS
-    void *ret = (void *)mmap(startAddress, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_FIXED | MAP_PRIVATE, -1, 0);
-    if ((int64_t)ret == -1) {
-        lf_dbg("Remap failed %016lx, %016lx(%d)", (uint64_t)ret, startAddress, size);
-        abort();
-    }
-
-    return 0;
-#else
-	// Surprisingly, benchmarking seems to suggest that unmapping is actually
-	// faster than madvise. Revisit in the future
-	return munmap(startAddress, size);
-	//return madvise(startAddress, size, MADV_FREE);
-#endif
-}
-
-static inline int os_free(void* startAddress) {
-	// On Windows, this helper can only completely decommit and unreserve
-	// an entire reservation, so no size parameter. Here, we'll look for
-	// the pool getting the axe and figure out the size
-	struct pagepool_t* pool = find_pool_for_ptr((const byte*)startAddress);
-	if (pool != NULL) {
-#ifdef FFMALLOC_PLUS
-        void *ret = (void *)mmap(pool->start, pool->end - pool->start, PROT_NONE, MAP_ANONYMOUS | MAP_FIXED | MAP_PRIVATE, -1, 0);
-        if ((int64_t)ret == -1) {
-            lf_dbg("Remap failed %016lx", (uint64_t)pool->start);
-            lf_dbg("Remap failed %016lx", (uint64_t)ret);
-            abort();
-        }
-
-        return 0;
-#else
-		return munmap(pool->start, pool->end - pool->start);
-#endif
-	}
-	else {
-		// Wasn't a pool - that shouldn't happen
-		// Likely a bug if we get here
-		abort();
-	}
-
-	errno = EINVAL;
-	return -1; 
-}
-#endif
-
-
-/*** Dynamic metadata allocation ***/
-// FFmalloc has several metadata structures that need to be dynamically allocated
-// If we restricted usage to Windows or requiring use of the ff prefix on Linux
-// then LocalAlloc or libc malloc respectively could be used. But, we'd like to 
-// allow non-prefixed usage via LD_PRELOAD on Linux (or static compilation so long
-// as we're the first library). Therefore, we have a mini-allocator for metadata
-// allocations. Because this should only be used internally, it does *not*
-// implement the forward-only principal. Also note that the "free" equivalent
-// requires a size parameter. This simplifies the amount of metadata for the 
-// metadata stored
-
-static void* ffpoolmetadata_alloc(int isSmallPool) {
-	byte* allocation;
-	size_t size = isSmallPool ? (POOL_SIZE / PAGE_SIZE) * sizeof(struct pagemap_t) : 
-		(POOL_SIZE >> 20) * PAGE_SIZE;
-	size = ALIGN_SIZE(size);
-
-	FFEnterCriticalSection(&mdBinLocks[isSmallPool]);
-	if(metadatabins[isSmallPool] == NULL) {
-		FFEnterCriticalSection(&mdPoolLock);
-		allocation = metadataFree;
-		if(allocation + size > metadataEnd) {
-			// Need to grow metadata pool space
-#ifdef _WIN64
-			VirtualAlloc(metadataEnd, POOL_SIZE, MEM_COMMIT, PAGE_READWRITE);
-#else
-			mprotect(metadataEnd, POOL_SIZE, PROT_READ | PROT_WRITE);
-			madvise(metadataEnd, PAGE_SIZE * 16, MADV_WILLNEED);
-#endif
-			metadataEnd += POOL_SIZE;
-#ifdef FF_PROFILE
-			FFAtomicAdd(arenas[0]->profile.currentOSBytesMapped, POOL_SIZE);
-			if(arenas[0]->profile.currentOSBytesMapped > arenas[0]->profile.maxOSBytesMapped) {
-				arenas[0]->profile.maxOSBytesMapped = arenas[0]->profile.currentOSBytesMapped;
-			}
-#endif
-		}
-		metadataFree += size;
-		FFLeaveCriticalSection(&mdPoolLock);
-	}
-	else {
-		allocation = metadatabins[isSmallPool];
-		metadatabins[isSmallPool] = ((struct usedmd_t*)allocation)->next;
-	}
-	FFLeaveCriticalSection(&mdBinLocks[isSmallPool]);
-
-	memset(allocation, 0, size);
-	return allocation;
-}
-
-static void ffpoolmetadata_free(void* ptr, int isSmallPool) {
-	size_t size = isSmallPool ? (POOL_SIZE / PAGE_SIZE) * sizeof(struct pagemap_t) : 
-		(POOL_SIZE >> 20) * PAGE_SIZE;
-	size = ALIGN_SIZE(size);
-
-	if (ptr > (void*)metadataFree || ptr < (void*)metadataPool) {
-		abort();
-	}
-
-	FFEnterCriticalSection(&mdBinLocks[isSmallPool]);
-
-	// Put the freed block at the front of the list and have it point to
-	// the former head of the line
-	((struct usedmd_t*)ptr)->next = metadatabins[isSmallPool];
-	metadatabins[isSmallPool] = (byte*)ptr;
-
-	FFLeaveCriticalSection(&mdBinLocks[isSmallPool]);
-}
-
-
-static void* ffmetadata_alloc(size_t size) {
-	// Ensure 16 byte alignment
-	size = ALIGN_TO(size, UINT64_C(16));
-
-	// Making the assumption that the radix leaf nodes are the only metadata
-	// structures that are bigger than a page. If that changes then we'll be
-	// in a bit of a bind here. But for now, go with it
-	size_t binID = size >=4096 ? 255 : (size >> 4) - 1;
-
-	byte* allocation;
-
-	FFEnterCriticalSection(&binLocks[binID]);
-	if (bins[binID] == NULL) {
-		// No freed chunks of this size exist. Allocate space from the top
-		// of the pool. Keeping things simple for now and not trying to 
-		// break a free 64-byte chunk into 4*16-byte chunks or whatever
-		FFEnterCriticalSection(&mdPoolLock);
-		allocation = metadataFree;
-		if(allocation + size > metadataEnd) {
-			// Need to grow metadata pool space
-#ifdef _WIN64
-			VirtualAlloc(metadataEnd, POOL_SIZE, MEM_COMMIT, PAGE_READWRITE);
-#else
-			mprotect(metadataEnd, POOL_SIZE, PROT_READ | PROT_WRITE);
-			madvise(metadataEnd, PAGE_SIZE * 4, MADV_WILLNEED);
-#endif
-			metadataEnd += POOL_SIZE;
-#ifdef FF_PROFILE
-			FFAtomicAdd(arenas[0]->profile.currentOSBytesMapped, POOL_SIZE);
-			if(arenas[0]->profile.currentOSBytesMapped > arenas[0]->profile.maxOSBytesMapped) {
-				arenas[0]->profile.maxOSBytesMapped = arenas[0]->profile.currentOSBytesMapped;
-			}
-#endif
-		}
-		metadataFree += size;
-		FFLeaveCriticalSection(&mdPoolLock);
-	}
-	else {
-		// Take the first available chunk from the front of the list
-		// and the advance the header to the next chunk
-		allocation = bins[binID];
-		bins[binID] = ((struct usedmd_t*)allocation)->next;
-	}
-
-	FFLeaveCriticalSection(&binLocks[binID]);
-
-	// Simplify logic elsewhere by guaranteeing zeroed blocks
-	//memset(allocation, 0, size);
-	return allocation;
-}
-
-static void ffmetadata_free(void* ptr, size_t size) {
-	// Ensure 16 byte alignment to find right bin
-	size = ALIGN_TO(size, UINT64_C(16));
-	size_t binID = size >= 4096 ? 255 : (size >> 4) - 1;
-
-	if (ptr > (void*)metadataFree || ptr < (void*)metadataPool) {
-		abort();
-	}
-
-	FFEnterCriticalSection(&binLocks[binID]);
-
-	// Put the freed block at the front of the list and have it point to
-	// the former head of the line
-	((struct usedmd_t*)ptr)->next = bins[binID];
-	bins[binID] = (byte*)ptr;
-
-	FFLeaveCriticalSection(&binLocks[binID]);
-}
-
-
-/*** Radix tree implementation ***/
-
-// Gets the page pool that matches the page prefix. Returns NULL if no matching
-// pool could be found
-struct pagepool_t* find_pool_for_ptr(const byte* ptr) {
-	// Compute the index for each level
-	size_t stemIndex = (uintptr_t)ptr >> (POOL_SIZE_BITS + LEAF_BITS + STEM_BITS);
-	size_t leafIndex = ((uintptr_t)ptr >> (POOL_SIZE_BITS + LEAF_BITS)) & (LEAVES_PER_STEM - 1);
-
-	// Find the correct leaf node
-	struct radixleaf_t* leaf = poolTree.stems[stemIndex] != NULL ? poolTree.stems[stemIndex]->leaves[leafIndex] : NULL;
-	if (leaf != NULL) {
-		// Check if there is a pool that starts or ends in this leaf
-		// that could possibly contain the given pointer
-		struct pagepool_t* pool = leaf->poolStart[((uintptr_t)ptr >> POOL_SIZE_BITS) & (POOLS_PER_LEAF - 1)];
-		if (pool != NULL && ptr >= pool->start) {
-			return pool;
-		}
-		pool = leaf->poolEnd[((uintptr_t)ptr >> POOL_SIZE_BITS) & (POOLS_PER_LEAF - 1)];
-		if (pool != NULL && ptr < pool->end) {
-			return pool;
-		}
-	}
-
-	return NULL;
-}
-
-// Inserts a newly created page pool into the radix tree
-void add_pool_to_tree(struct pagepool_t* pool) {
-	// Compute the level indexes for both the start and end addresses
-	size_t startStemIndex = (uintptr_t)pool->start >> (POOL_SIZE_BITS + LEAF_BITS + STEM_BITS);
-	size_t startLeafIndex = ((uintptr_t)pool->start >> (POOL_SIZE_BITS + LEAF_BITS)) & (LEAVES_PER_STEM - 1);
-	size_t startPoolIndex = ((uintptr_t)pool->start >> POOL_SIZE_BITS) & (POOLS_PER_LEAF - 1);
-	size_t endStemIndex = (uintptr_t)pool->end >> (POOL_SIZE_BITS + LEAF_BITS + STEM_BITS);
-	size_t endLeafIndex = ((uintptr_t)pool->end >> (POOL_SIZE_BITS + LEAF_BITS)) & (LEAVES_PER_STEM - 1);
-	size_t endPoolIndex = ((uintptr_t)pool->end >> POOL_SIZE_BITS) & (POOLS_PER_LEAF - 1);
-	
-	// Pool creation should be infrequent enough that trying to come up
-	// with a fancy lock-free update structure probably isn't worth it
-	FFEnterCriticalSection(&poolTreeLock);
-
-	// Make sure that the nodes in the tree exist
-	if(poolTree.stems[startStemIndex] == NULL) {
-		poolTree.stems[startStemIndex] = (struct radixstem_t*)ffmetadata_alloc(sizeof(struct radixstem_t));
-	}
-	if(poolTree.stems[startStemIndex]->leaves[startLeafIndex] == NULL) {
-		poolTree.stems[startStemIndex]->leaves[startLeafIndex] = (struct radixleaf_t*)ffmetadata_alloc(sizeof(struct radixleaf_t));
-	}
-	if(poolTree.stems[endStemIndex] == NULL) {
-		poolTree.stems[endStemIndex] = (struct radixstem_t*)ffmetadata_alloc(sizeof(struct radixstem_t));
-	}
-	if(poolTree.stems[endStemIndex]->leaves[endLeafIndex] == NULL) {
-		poolTree.stems[endStemIndex]->leaves[endLeafIndex] = (struct radixleaf_t*)ffmetadata_alloc(sizeof(struct radixleaf_t));
-	}
-
-	// Add the pool to the tree
-	poolTree.stems[startStemIndex]->leaves[startLeafIndex]->poolStart[startPoolIndex] = pool;
-	poolTree.stems[endStemIndex]->leaves[endLeafIndex]->poolEnd[endPoolIndex] = pool;
-
-	poolCount++;
-	FFLeaveCriticalSection(&poolTreeLock);
-}
-
-// Removes a page pool from the lookup tree
-void remove_pool_from_tree(struct pagepool_t* pool) {
-	// Compute the level indexes for the start and end of the pool
-	size_t startStemIndex = (uintptr_t)pool->start >> (POOL_SIZE_BITS + LEAF_BITS + STEM_BITS);
-	size_t startLeafIndex = ((uintptr_t)pool->start >> (POOL_SIZE_BITS + LEAF_BITS)) & (LEAVES_PER_STEM - 1);
-	size_t startPoolIndex = ((uintptr_t)pool->start >> POOL_SIZE_BITS) & (POOLS_PER_LEAF - 1);
-	size_t endStemIndex = (uintptr_t)pool->end >> (POOL_SIZE_BITS + LEAF_BITS + STEM_BITS);
-	size_t endLeafIndex = ((uintptr_t)pool->end >> (POOL_SIZE_BITS + LEAF_BITS)) & (LEAVES_PER_STEM - 1);
-	size_t endPoolIndex = ((uintptr_t)pool->end >> POOL_SIZE_BITS) & (POOLS_PER_LEAF - 1);
-
-	// Not checking path validity. Caller is responsible for calling only
-	// if the pool has definitively been added the tree already
-	FFEnterCriticalSection(&poolTreeLock);
-	poolTree.stems[startStemIndex]->leaves[startLeafIndex]->poolStart[startPoolIndex] = NULL;
-	poolTree.stems[endStemIndex]->leaves[endLeafIndex]->poolEnd[endPoolIndex] = NULL;
-
-	poolCount--;
-	FFLeaveCriticalSection(&poolTreeLock);
-}
-
-
-/*** Multi-threaded application support ***/
-#ifdef FFSINGLE_THREADED
-// Support single threaded applications only
-
-// Array of thread caches, one per arena. Thread caches are still needed even
-// when compiled without threading support because they serve as the interface
-// for small allocations.
-struct threadcache_t* arenaCaches[MAX_ARENAS];
-
-// Single threaded implementation of FFTlsAlloc
-static int get_free_arena_index(FFTLSINDEX* index) {
-	for(FFTLSINDEX i=0; i<MAX_ARENAS; i++) {
-		if(arenaCaches[i] == NULL) {
-			arenaCaches[i] = ffmetadata_alloc(sizeof(struct threadcache_t));
-			*index = i;
-			return 1;
-		}
-	}
-
-	return 0;
-}
-
-// Single threaded implementation of FFTlsFree
-static int free_arena_index(FFTLSINDEX index) {
-	ffmetadata_free(arenaCaches[index], sizeof(struct threadcache_t));
-	arenaCaches[index] = NULL;
-	return 0;
-}
-
-// One time initialization of the default arena thread cache
-static void init_threading() {
-	arenaCaches[0] = ffmetadata_alloc(sizeof(struct threadcache_t));
-	init_tcache(arenaCaches[0], arenas[0]);
-}
-
-// Returns the thread cache for the associated arena
-static inline struct threadcache_t* get_threadcache(struct arena_t* arena) {
-	if(arenaCaches[arena->tlsIndex]->arena == NULL) {
-		init_tcache(arenaCaches[arena->tlsIndex], arena);
-	}
-	return arenaCaches[arena->tlsIndex];
-}
-
-// Returns the index of the large pool list to use - always zero
-static unsigned int get_large_list_index() {
-	return 0;
-}
-
-// End FFSINGLE_THREADED
-#else
-// Multi-threaded but OS neutral code
-// TODO: this should be updated to be null-op for non-default arenas
-void destroy_tcache(struct threadcache_t* tcache) {
-	if (tcache->nextUnusedPage != NULL && (tcache->nextUnusedPage < tcache->endUnusedPage)) {
-		// While it would be better to return unused pages to the pool of origin, that's more
-		// complicated than I want to handle right now. So, just give them back to the OS
-		os_decommit(tcache->nextUnusedPage->start, (tcache->endUnusedPage - tcache->nextUnusedPage) * PAGE_SIZE);
-	}
-}
-// End OS neutral multi-threaded 
-#ifdef _WIN64
-// Begin Windows specific multi-threaded support
-
-// Index that retrieves the pointer to the per-thread cache
-//static DWORD threadIndex;
-
-static void init_threading() {
-	// Nothing to do on Windows. All threading related initialization is handled
-	// in DllMain
-}
-
-// Windows DLL entry point - handles TLS allocation and cleanup
-BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved)
-{
-	struct threadcache_t* tcache;
-	// Pretty much just following the skeleton code here:
-	// https://docs.microsoft.com/en-us/windows/desktop/Dlls/using-thread-local-storage-in-a-dynamic-link-library
-	switch (ul_reason_for_call)
-	{
-	case DLL_PROCESS_ATTACH:
-		// Initialize library and create the default arena
-		initialize();
-
-		break;
-	case DLL_THREAD_ATTACH:
-
-		break;
-	case DLL_THREAD_DETACH:
-		// Thread is shutting down. Look for any associated caches
-		// to clean up in all active arenas
-		for (int i = 0; i < MAX_ARENAS; i++) {
-			if(arenas[i] != NULL) {
-				tcache = (struct threadcache_t*)TlsGetValue(arenas[i]->tlsIndex);
-				if (tcache != NULL) {
-					destroy_tcache(tcache);
-					ffmetadata_free(tcache, sizeof(struct threadcache_t));
-				}
-			}
-		}
-		break;
-	case DLL_PROCESS_DETACH:
-		// The whole process is being shut down or this library is being unloaded
-		// Presents a philosophical question about what to clean up. Should all
-		// pages allocated from here be unmapped if they aren't yet freed?
-
-		// At least clean up any TLS
-		tcache = (struct threadcache_t*)TlsGetValue(arenas[0]->tlsIndex);
-		if (tcache != NULL) {
-			destroy_tcache(tcache);
-			ffmetadata_free(tcache, sizeof(struct threadcache_t));
-		}
-
-		// Give the TLS index back to the OS
-		TlsFree(arenas[0]->tlsIndex);
-		FFDeleteCriticalSection(&poolTreeLock);
-		break;
-	}
-	return TRUE;
-}
-
-// Gets the thread cache associated with the current thread. On the
-// first call from a given thread, a new cache is created 
-static inline struct threadcache_t* get_threadcache(struct arena_t* arena) {
-	struct threadcache_t* tcache = TlsGetValue(arena->tlsIndex);
-	if (tcache == NULL) {
-		// No thread cache found so create one
-		tcache = (struct threadcache_t*)ffmetadata_alloc(sizeof(struct threadcache_t));
-		init_tcache(tcache, arena);
-
-		// Save the pointer in the thread local storage
-		TlsSetValue(arena->tlsIndex, tcache);
-	}
-
-	return tcache;
-}
-
-// Returns the index of the large pool list to use based on the active CPU
-static inline unsigned int get_large_list_index() {
-	return GetCurrentProcessorNumber() % MAX_LARGE_LISTS;
-}
-
-// End Windows specific threading
-#else
-// Start Linux specific threading
-
-// Key that retrieves the pointer to the per-thread cache
-//pthread_key_t threadKey;
-
-static __attribute__((constructor)) void linux_mt_init() {
-	initialize();
-}
-
-// One time initialization of the per-thread local storage
-static void init_threading() {
-//	pthread_key_create(&threadKey, cleanup_thread);
-}
-
-// Thread exit cleanup
-static void cleanup_thread(void* ptr) {
-	if (ptr != NULL) {
-		destroy_tcache((struct threadcache_t*)ptr);
-		ffmetadata_free(ptr, sizeof(struct threadcache_t));
-	}
-}
-
-// Retrieves the specific cache for the currently running thread
-static inline struct threadcache_t* get_threadcache(struct arena_t* arena) {
-	struct threadcache_t* tcache = (struct threadcache_t*)pthread_getspecific(arena->tlsIndex);
-	if (tcache == NULL) {
-		// No thread cache found so create one
-		tcache = (struct threadcache_t*)ffmetadata_alloc(sizeof(struct threadcache_t));
-		init_tcache(tcache, arena);
-
-		// Save the pointer in the thread local storage
-		pthread_setspecific(arena->tlsIndex, tcache);
-	}
-
-	return tcache;
-}
-
-// Returns the index of the large list index to use based on the current CPU
-static unsigned int get_large_list_index() {
-	int cpuId = sched_getcpu();
-	return cpuId < 0 ? 0 : (unsigned int)cpuId % MAX_LARGE_LISTS;
-}
-
-// End Linux specific threading
-#endif
-#endif
-
-/*** Page allocation ***/
-
-// Called when a thread cache is out of pages and needs to be assigned
-// more from a pool. The active small pool for the arena is out of pages
-// then a new small pool is created
-static void assign_pages_to_tcache(struct threadcache_t* tcache) {
-	size_t nextFreePageMapIndex;
-	byte* nextFreePage;
-
-	// First, select which pool to assign pages from
-	struct pagepool_t* pool = tcache->arena->smallPoolList->pool;
-
-	// Advance the free page pointer atomically so that concurrent threads
-	// get distinct ranges
-	nextFreePage = (byte*)FFAtomicExchangeAdvancePtr(pool->nextFreePage, (PAGES_PER_REFILL * PAGE_SIZE));
-
-	nextFreePageMapIndex = (nextFreePage - pool->start) / PAGE_SIZE;
-
-	// Make sure that the range of pages selected from the pool are
-	// actually within the pool. If not, then the pool is full and needs to
-	// be retired and a new one created.
-	// Counting on PAGES_PER_REFILL to evenly divide POOL_SIZE
-	while (nextFreePage + (PAGES_PER_REFILL * PAGE_SIZE) > pool->end) {
-		FFEnterCriticalSection(&tcache->arena->smallListLock);
-		// Check that while waiting for the lock that the pool wasn't already
-		// replaced. If it wasn't, then we can create the new pool
-		if (pool == tcache->arena->smallPoolList->pool) {
-			struct poollistnode_t* newListHeader = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
-			newListHeader->pool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
-			newListHeader->pool->arena = tcache->arena;
-			if (create_pagepool(newListHeader->pool) == -1) {
-				ffmetadata_free(newListHeader->pool, sizeof(struct pagepool_t));
-				ffmetadata_free(newListHeader, sizeof(struct poollistnode_t));
-				// TODO: handle failure more gracefully
-				abort();
-			}
-			add_pool_to_tree(newListHeader->pool);
-			newListHeader->next = tcache->arena->smallPoolList;
-			tcache->arena->smallPoolList = newListHeader;
-		}
-		pool = tcache->arena->smallPoolList->pool;
-		FFLeaveCriticalSection(&tcache->arena->smallListLock);
-
-		nextFreePage = (byte*)FFAtomicExchangeAdvancePtr(pool->nextFreePage, (PAGES_PER_REFILL * PAGE_SIZE));
-		nextFreePageMapIndex = (nextFreePage - pool->start) / PAGE_SIZE;
-	}
-
-	// Create new page maps
-	for (size_t i = 0; i < PAGES_PER_REFILL; i++) {
-		pool->tracking.pageMaps[nextFreePageMapIndex + i].start = nextFreePage + (i * PAGE_SIZE);
-	}
-
-	// Assign the new page maps to the thread cache
-	tcache->nextUnusedPage = pool->tracking.pageMaps + nextFreePageMapIndex;
-	tcache->endUnusedPage = tcache->nextUnusedPage + PAGES_PER_REFILL;
-}
-
-/*** Initialization functions ***/
-
-// Creates a new arena. Applications do not call this directly but rather
-// through the public ffcreate_arena function
-static ffresult_t create_arena(struct arena_t* newArena) {
-	if(newArena == NULL) {
-		return FFBAD_PARAM;
-	}
-
-	// Each arena has a unique TLS index that allows the correct arena
-	// specific thread cache to be retrieved. Each OS has a unique
-	// initialization required before use
-	if(!FFTlsAlloc(newArena->tlsIndex, TLS_CLEANUP_CALLBACK)) {
-		ffmetadata_free(newArena, sizeof(struct arena_t));
-		return FFSYS_LIMIT;
-	}		
-
-	// Create the small pool list header
-	newArena->smallPoolList = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
-	if(newArena->smallPoolList == NULL) {
-		ffmetadata_free(newArena, sizeof(struct arena_t));
-		return FFSYS_LIMIT;
-	}
-
-	// Create the first small pool and put it in the header node
-	newArena->smallPoolList->pool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
-	if(newArena->smallPoolList->pool == NULL) {
-		ffmetadata_free(newArena->smallPoolList, sizeof(struct poollistnode_t));
-		ffmetadata_free(newArena, sizeof(struct arena_t));
-		return FFSYS_LIMIT;
-	}
-
-	// Initialize the first small pool
-	newArena->smallPoolList->pool->arena = newArena;
-	if(create_pagepool(newArena->smallPoolList->pool) != 0) {
-		ffmetadata_free(newArena->smallPoolList->pool, sizeof(struct pagepool_t));
-		ffmetadata_free(newArena->smallPoolList, sizeof(struct poollistnode_t));
-		ffmetadata_free(newArena, sizeof(struct arena_t));
-		return FFNOMEM;
-	}
-	add_pool_to_tree(newArena->smallPoolList->pool);
-
-	// Initialize the lock that protects the small list header
-	FFInitializeCriticalSection(&newArena->smallListLock);
-
-	// Create the large pool lists
-	// TODO: limit to lesser of MAX_LARGE_LISTS and actual CPU count
-	for (int i = 0; i < MAX_LARGE_LISTS; i++) {
-		struct pagepool_t* pool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
-		pool->arena = newArena;
-		if (pool == NULL || create_largepagepool(pool) == -1) {
-			destroy_pool_list(newArena->smallPoolList);
-			// TODO: deconstruct any 
-			// successfully created large pools
-			ffmetadata_free(newArena, sizeof(struct arena_t));
-			return FFNOMEM;
-		}
-		add_pool_to_tree(pool);
-		newArena->largePoolList[i] = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
-		newArena->largePoolList[i]->pool = pool;
-#ifdef MARK_SWEEP
-        newArena->largePoolList[i]->next = NULL;
-#endif
-		FFInitializeCriticalSection(&newArena->largeListLock[i]);
-	}
-
-	return FFSUCCESS;
-}
-
-// Creates a new page pool by asking the OS for a block of memory
-static int create_pagepool(struct pagepool_t* newPool) {
-	// Get an initial range of virtual address space to hold the page maps and bitmaps
-	void* metadata = ffpoolmetadata_alloc(1);
-	if(metadata == NULL) {
-		fprintf(stderr, "create_pagepool metadata alloc failed: %d\n", errno);
-		return -1;
-	}
-
-	// Get the virtual address space block for the pool itself
-	void* poolReserve = os_alloc_highwater(POOL_SIZE);
-	if (poolReserve == MAP_FAILED) {
-		ffpoolmetadata_free(metadata, 1);
-		return -1;
-	}
-#ifdef FF_PROFILE
-	FFAtomicAdd(newPool->arena->profile.currentOSBytesMapped, POOL_SIZE);
-	if(newPool->arena->profile.currentOSBytesMapped > newPool->arena->profile.maxOSBytesMapped) {
-		// TODO: need thread safety
-		newPool->arena->profile.maxOSBytesMapped = newPool->arena->profile.currentOSBytesMapped;
-	}
-#endif
-	newPool->tracking.pageMaps = (struct pagemap_t*)metadata;
-	newPool->start = (byte*)poolReserve;
-	newPool->nextFreePage = newPool->start;
-	newPool->end = newPool->start + POOL_SIZE;
-	newPool->startInUse = newPool->start;
-	newPool->endInUse = newPool->end;
-
-	// Since nextFreeIndex isn't used by a small pool, we'll set it to SIZE_MAX
-	// as a flag to distinguish between the two types of pools in the find
-	// pointer code
-	newPool->nextFreeIndex = SIZE_MAX;
-
-	FFInitializeCriticalSection(&newPool->poolLock);
-
-	return 0;
-}
-
-// Creates a new large allocation pool
-static int create_largepagepool(struct pagepool_t* newPool) {
-	// Reserve an address range for the metadata
-	// Metadata should max out at about a page per 1MB of actual data:
-	// (1MB / 2048 bytes/allocations) * (8 bytes/allocation) = 4096 bytes
-	void* metadata = ffpoolmetadata_alloc(0);
-	if (metadata == NULL) {
-		return -1;
-	}
-
-	// Reserve an address range for the large pool itself
-	void* storage = os_alloc_highwater(POOL_SIZE);
-	if (storage == MAP_FAILED) {
-		ffpoolmetadata_free(metadata, 0);
-		return -1;
-	}
-#ifdef FF_PROFILE
-	FFAtomicAdd(newPool->arena->profile.currentOSBytesMapped, POOL_SIZE);
-	while(newPool->arena->profile.currentOSBytesMapped > newPool->arena->profile.maxOSBytesMapped) {
-		// TODO: need thread safety
-		newPool->arena->profile.maxOSBytesMapped = newPool->arena->profile.currentOSBytesMapped;
-	}
-#endif
-	
-	// Add the metadata to the pool
-	newPool->tracking.allocations = (uintptr_t*)metadata;
-
-	// Add the storage to the pool
-	newPool->start = (byte*)storage;
-	newPool->end = (byte*)storage + POOL_SIZE;
-	newPool->nextFreePage = (byte*)storage;
-	newPool->startInUse = newPool->start;
-	newPool->endInUse = newPool->end;
-
-	// There is always one more metadata entry than allocations so that size can
-	// be computed by subtracting the pointers. Record the first dummy entry now
-	newPool->tracking.allocations[0] = (uintptr_t)storage;
-
-	FFInitializeCriticalSection(&newPool->poolLock);
-	return 0;
-}
-
-// Helper function to initialize a new jumbo page
-static inline int create_jumbopool(struct pagepool_t* newPool, size_t size) {
-	// The only metadata required for a jumbo pool is just the size since
-	// there will only ever just be the one allocation. Therefore don't
-	// allocate a metadata block. Mark it NULL here just to make the point
-	newPool->tracking.allocations = NULL;
-
-	// Just like the small pool we'll recycle the nextFreeIndex field as
-	// a flag that this isn't a normal pool
-	newPool->nextFreeIndex = SIZE_MAX - 1;
-
-	// Since this allocation is coming straight from the OS it needs to be
-	// page aligned
-	size = ALIGN_TO(size, PAGE_SIZE);
-
-	// Ask the OS for memory
-	void* storage;
-	storage = os_alloc_highwater(size);
-	if(storage == MAP_FAILED) {
-		return -1;
-	}
-
-#ifdef FF_PROFILE
-	// Update statistics
-	FFAtomicAdd(newPool->arena->profile.totalBytesAllocated, size);
-	FFAtomicAdd(newPool->arena->profile.currentBytesAllocated, size);
-	FFAtomicAdd(newPool->arena->profile.currentOSBytesMapped, size);
-	if(newPool->arena->profile.currentBytesAllocated > newPool->arena->profile.maxBytesAllocated) {
-		// TODO: thread safety
-		newPool->arena->profile.maxBytesAllocated = newPool->arena->profile.currentBytesAllocated;
-	}
-	if(newPool->arena->profile.currentOSBytesMapped > newPool->arena->profile.maxOSBytesMapped) {
-		// TODO: need thread safety
-		newPool->arena->profile.maxOSBytesMapped = newPool->arena->profile.currentOSBytesMapped;
-	}
-#endif
-
-	// Record the size of this oddball	
-	newPool->start = (byte*)storage;
-	newPool->end = (byte*)storage + size;
-
-	// Return success
-	return 0;	
-}
-
-// Initializes a new thread cache by constructing the bins
-static void init_tcache(struct threadcache_t* tcache, struct arena_t* arena) {
-	// Initialize all of the bin headers
-	// First, the very small bins that are consecutive multiples of 8
-	// 8, 16, 24, 32, ... 192, 200, 208
-	// Or consecutive multiples of 16 after 16 when using 16 byte alignment
-	// 8, 16, 32, 48, ... 272, 288, 304
-	for (size_t b = 1; b <= (BIN_COUNT - BIN_INFLECTION); b++) {
-		tcache->bins[BIN_COUNT - b].allocSize = b * MIN_ALIGNMENT;
-		tcache->bins[BIN_COUNT - b].maxAlloc = PAGE_SIZE / (b * MIN_ALIGNMENT);
-
-		// Set allocCount equal to maxAlloc and not 0 even though its 
-		// empty so that the first allocation from bin will actually trigger
-		// allocating a page instead of pre-emptively doing that now and
-		// wasting it on a bin that might not get used
-		tcache->bins[BIN_COUNT - b].allocCount = tcache->bins[BIN_COUNT - b].maxAlloc;
-		tcache->bins[BIN_COUNT - b].page = NULL;
-#ifdef FF_PROFILE
-		tcache->bins[BIN_COUNT - b].totalAllocCount = 0;
-#endif
-	}
-
-	// Next, the bins that are consecutive in max allocation per page
-	// 336, 368, 400, ... 816, 1024, 1360, 2048, 4096+ when 16-byte aligned
-	// Note that additional bins in between wouldn't be any more space
-	// efficient. For example, you can get 3 * 1360 per page and 2 * 2048
-	// but also only 2 * 1536 so having a bin for that size is no more
-	// efficient than just dumping it into the 2048 bin
-	for (size_t b = 1; b < BIN_INFLECTION; b++) {
-		// Bin sizes need to be rounded down to correct alignment
-		tcache->bins[b].allocSize = ((PAGE_SIZE / b) & ~(MIN_ALIGNMENT - 1));
-		tcache->bins[b].maxAlloc = b;
-		tcache->bins[b].allocCount = b;
-		tcache->bins[b].page = NULL;
-#ifdef FF_PROFILE
-		tcache->bins[b].totalAllocCount = 0;
-#endif
-	}
-
-#ifndef FF_EIGHTBYTEALIGN
-	// The bin for 8 byte allocations doesn't fit the pattern when doing
-	// 16-byte alignment
-	tcache->bins[0].allocSize = 8;
-	tcache->bins[0].maxAlloc = PAGE_SIZE / 8;
-	tcache->bins[0].allocCount = PAGE_SIZE / 8;
-	tcache->bins[0].page = NULL;
-#ifdef FF_PROFILE
-	tcache->bins[0].totalAllocCount = 0;
-#endif
-#endif
-
-#ifdef MARK_SWEEP
-    arena->freePoolListHead = NULL;
-    arena->freePoolListTail = NULL;
-#endif
-
-	// Remember which arena this cache is connected to
-	tcache->arena = arena;
-
-	// Get some pages for this new cache to use
-	assign_pages_to_tcache(tcache);
-}
-
-#ifdef MARK_SWEEP
-
-#define MAX_THREAD 1
-#define MAX_SCANNER 10
-
-struct memrange_t {
-    uint64_t start;
-    uint64_t end;
-    struct memrange_t *next;
-};
-
-struct scanner_t {
-    pthread_t *t;
-    pthread_mutex_t *scanOperLock;
-    int id;
-    struct reclaim_t* volatile arg;
-};
-
-struct reclaim_t {
-    // Common
-    int id;
-    pid_t owner;
-    pid_t tid;
-
-    bool volatile concurrent;
-
-    pthread_t thread;
-    pthread_attr_t attr;
-
-    struct arena_t *arena;
-
-    pthread_t scanner[MAX_SCANNER];
-    pthread_mutex_t scanOperLock[MAX_SCANNER];
-    bool volatile scanOperDone[MAX_SCANNER];
-    bool volatile scanReady[MAX_SCANNER];
-    bool volatile scanOper;
-
-    /*** Memory Range List START ***/
-    FFLOCK(memRangeLock);
-    struct memrange_t* volatile memRangeList;
-    struct memrange_t* volatile memRangeHead;
-
-	struct poollistnode_t* volatile smallPoolList[MAX_ARENAS];
-	struct poollistnode_t* volatile largePoolList[MAX_ARENAS][MAX_LARGE_LISTS];
-	struct poollistnode_t* volatile jumboPoolList[MAX_ARENAS];
-    /*** Memory Range List END ***/
-
-    sigset_t wait_mask;
-    FFLOCK(stwLock)
-};
-
-
-
-static struct reclaim_t thread_list[MAX_THREAD];
-static int empty_thread = 0;
-static struct reclaim_t *reclaimer;
-
-static int volatile softDirty = 0;
-
-
-
-static void *reclaim_thread(void *data);
-
-
-
-static inline uint64_t bitCount(uint64_t v) {
-    return __builtin_popcountll(v);
-}
-
-/*** User-side Memory Scanner(from minesweeper) ***/
-
-//
-// Memory Scanning & Dirty Bits Handling
-//
-struct procmap_t {
-    void *startPtr;
-    void *endPtr;
-
-    bool readdable, writable, executable, CoW;
-    size_t offset;
-
-    uintptr_t inode;
-
-    bool has_path;
-    bool from_ffmalloc;
-    bool stack;
-    bool heap;
-
-    struct procmap_t *next;
-};
-
-static void clear_softdirty(void) {
-    int fd = open("/proc/self/clear_refs", O_WRONLY);
-    int ret;
-    if (fd < 0) {
-        lf_dbg("error to open clear_refs");
-        exit(-1);
-    }
-    ret = write(fd,"4", 1);
-    if (ret < 0) {
-        exit(-1);
-    }
-    close(fd);
-}
-
-#ifdef UNUSED
-static void clear_dirty(void) {
-    int ret = 0;
-
-    ret = ioctl(kmscan_fd, _IOWR('G', 2, uint64_t), 0); 
-    if (ret < 0) {
-        fprintf(stderr, "fail to send ioctl order: CLEAR_DIRTY\n");
-        exit(-1);
-    }
-}
-
-
-static bool check_pgdirty(uint64_t addr) {
-    int ret = 0;
-
-    if (addr & 0xFFF) {
-        exit(-1);
-    }
-
-    ret = ioctl(kmscan_fd, _IOWR('G', 3, uint64_t), &addr); 
-    if (ret < 0) {
-        fprintf(stderr, "fail to send ioctl order: CHECK_DIRTY\n");
-        exit(-1);
-    }
-
-    return ret;
-}
-#endif
-
-
-static inline bool check_soft_dirty(int fd, uint64_t addr) {
-    uint64_t data;
-    int ret = 0;
-    if (addr & 0xFFF) {
-        fprintf(stderr, "invalid address %016lx\n", addr);
-        exit(-1);
-    }
-
-    ret = pread(fd, &data, sizeof(data), (addr >> 12) * sizeof(data));
-    if (ret == 0) {
-        // Not exist... end of file
-        return false;
-    }
-    if (ret != sizeof(data)) {
-        lf_dbg("pread error\n");
-        exit(-1);
-    }
-
-    return (((data >> 55) & 0x1) == 1);
-}
-
-
-static inline bool check_present(int fd, uint64_t addr) {
-    uint64_t data;
-    int ret = 0;
-    if (addr & 0xFFF) {
-        exit(-1);
-    }
-
-    ret = pread(fd, &data, sizeof(data), (addr >> 12) * sizeof(data));
-    if (ret == 0) {
-        // Not exist... end of file
-        return false;
-    }
-
-    if (ret != sizeof(data)) {
-        lf_dbg("pread error\n");
-        exit(-1);
-    }
-
-    return (((data >> 63) & 0x1) == 1);
-}
-
-
-static inline int check_pagemap(int fd, uint64_t addr) {
-    uint64_t data;
-    int ret = 0;
-    if (addr & 0xFFF) {
-        fprintf(stderr, "invalid address %016lx\n", addr);
-        exit(-1);
-    }
-
-    ret = pread(fd, &data, sizeof(data), (addr >> 12) * sizeof(data));
-    if (ret == 0) {
-        // Not exist... end of file
-        return 0;
-    }
-
-    if (ret != sizeof(data)) {
-        fprintf(stderr, "pread error %d, %s, %d\n", ret, strerror(errno), fd);
-        lf_dbg("pread error\n");
-        exit(-1);
-    }
-
-    return (((data >> 63) & 0x1) == 1) | (((data >> 55) & 0x1) == 1) << 1;
-}
-
-
-static inline bool check_dirty(unsigned char *vec, uint64_t addr, uint64_t base) {
-    unsigned char data = vec[(addr - base) >> 12];
-    return data == 1; 
-}
-
-
-#define ALLOCA_ALIGN    3
-#define BIT_ALIGN       3
-#define BYTE_ALIGN      21
-#define MAP_ALIGN       21
-
-#define BIT_OFFSET      BIT_ALIGN
-#define BYTE_OFFSET     (BIT_OFFSET + ALLOCA_ALIGN)
-#define MAP_OFFSET      (BYTE_OFFSET + BYTE_ALIGN)
-
-#define ADDR_BITS       48
-
-#define ONE_MAP_SIZE    (1 << (MAP_OFFSET - BYTE_OFFSET))
-#define NUM_MAPS        (1 << MAP_ALIGN)
-
-struct pointermap_t {
-    uint8_t volatile *bitmap[NUM_MAPS];
-};
-
-typedef union {
-    struct {
-        uint64_t align  :   ALLOCA_ALIGN;
-        uint64_t bit    :   BIT_ALIGN;
-        uint64_t byte   :   BYTE_ALIGN;
-        uint64_t map    :   MAP_ALIGN;
-        uint64_t size   :   16;
-    };
-
-    uint64_t addr;
-} addr_t;
-
-static struct pointermap_t scanmap;
-FFLOCKSTATIC(scanmapLock);
-
-
-static void init_scanmap(void) {
-    FFInitializeCriticalSection(&scanmapLock);
-}
-
-
-static void scanmap_mark(uint64_t addr) {
-    addr_t ptr;
-
-    uint8_t volatile *map;
-    uint8_t volatile *entry;
-
-    //uint64_t map_id;
-
-    ptr.addr = addr;
-    map = scanmap.bitmap[ptr.map];
-    if (map == NULL) {
-        FFEnterCriticalSection(&scanmapLock);
-        map = scanmap.bitmap[ptr.map];
-        if (map == NULL) {
-            map = (uint8_t *)mmap(NULL, ONE_MAP_SIZE, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
-            scanmap.bitmap[ptr.map] = map;
-            if ((int64_t)map <= 0) {
-                lf_dbg("fail to map a sub-bitmap");
-                abort();
-            }
-        }
-        FFLeaveCriticalSection(&scanmapLock);
-    }
-
-    //map_id = ptr.map;
-    
-    entry = map + ptr.byte;
-    FFAtomicOr(*entry, (1 << ptr.bit));
-    return;
-}
-
-
-static inline uint64_t scanmap_check(addr_t ptr) {
-    uint8_t volatile *map;
-    uint8_t volatile *entry;
-    map = scanmap.bitmap[ptr.map];
-    if (map == NULL) return 0;
-
-    entry = map + ptr.byte;
-    return (*entry >> ptr.bit) & 0x1;
-}
-
-
-static uint64_t scanmap_read_pagepool(uint64_t start, uint64_t end) {
-    uint64_t data = 0;
-    uint8_t volatile *map;
-    addr_t ptr;
-    uint8_t volatile *entry;
-
-    for (ptr.addr = start; ptr.addr < end; ptr.addr += (1 << BYTE_OFFSET)) {
-        map = scanmap.bitmap[ptr.map];
-        if (map == NULL) continue;
-
-        entry = map + ptr.byte;
-        data |= *entry;
-    }
-
-    return data;
-}
-
-static void scanmap_clear(void) {
-    size_t mapId;
-    uint8_t volatile *map;
-
-    for (mapId = 0; mapId < NUM_MAPS; mapId++) {
-        map = scanmap.bitmap[mapId];
-        if (map == NULL) continue;
-        //memset((uint8_t *)map, 0, ONE_MAP_SIZE);
-        os_decommit((void*)map, ONE_MAP_SIZE);
-    }
-}
-
-
-static void map_scan(uint64_t startPtr, uint64_t endPtr, bool concurrent) {
-    // scan memory
-    uint64_t *ptr, pageBase;
-    uint64_t data, offset;
-
-    int pageStatus;
-
-    //size_t len = endPtr - startPtr;
-    for (pageBase = startPtr; pageBase < endPtr; pageBase += PAGE_SIZE) {
-        pageStatus = check_pagemap(softDirty, pageBase);
-        if ((concurrent || ((pageStatus >> 1) & 0x1)) && (pageStatus & 0x1)) {
-            for (offset = 0; offset < PAGE_SIZE; offset += 0x8) {
-                ptr = (uint64_t *)(pageBase + offset);
-                data = *ptr;
-                if ((uint64_t)poolLowAddr <= data && data < (uint64_t)poolHighWater) {
-                    scanmap_mark(data);
-                }
-            }
-        }
-    }
-}
-
-
-static void heap_page_scan(struct pagemap_t *pageMap, uint64_t addr) {
-    size_t allocSize = pageMap->allocSize & ~SEVEN64;
-    size_t maxAlloc;
-    
-    size_t index;
-    uint64_t block;
-    uint64_t *ptr, data;
-
-    size_t count = 0;
-
-    if (allocSize == 0) {
-        return;
-    }
-
-
-    maxAlloc = PAGE_SIZE / allocSize;
-    if (maxAlloc > 64) {
-        size_t maxBitmap = PAGE_SIZE / allocSize;
-
-        maxBitmap = (maxBitmap & SIXTYTHREE64) ?
-            (maxBitmap >> 6) + 1 : (maxBitmap >> 6);
-
-        for (index = 0; index < maxBitmap; index++) {
-            count += bitCount(FFAtomicAdd(pageMap->bitmap.array[index], 0));
-        }
-
-        if (count == 0) return;
-
-        for (block = addr; block < (addr + PAGE_SIZE); block += sizeof(uint64_t)) {
-            ptr = (uint64_t *)block;
-            data = *ptr;
-            if ((uint64_t)poolLowAddr <= data && data < (uint64_t)poolHighWater) {
-                scanmap_mark(data);
-            }
-        }
-    }
-    else {
-        size_t maxBitmap = PAGE_SIZE / allocSize;
-
-        maxBitmap = (maxBitmap & SIXTYTHREE64) ?
-            (maxBitmap >> 6) + 1 : (maxBitmap >> 6);
-
-        count += bitCount(FFAtomicAdd(pageMap->bitmap.single, 0));
-        if (count == 0) return;
-
-        for (block = addr; block < (addr + PAGE_SIZE); block += sizeof(uint64_t)) {
-            ptr = (uint64_t *)block;
-            data = *ptr;
-            if ((uint64_t)poolLowAddr <= data && data < (uint64_t)poolHighWater) {
-                scanmap_mark(data);
-            }
-        }
-    }
-}
-
-static void pagepool_scan(struct pagepool_t *pool, size_t mode, bool concurrent) {
-    //struct poollistnode_t *currPoolNode = NULL;
-    uint64_t start, curr, end;
-    uint64_t data, *ptr;
-
-    int pageStatus = 0;
-
-    if (mode == 0) return;
-
-
-    // Check small, large, jumbo 
-    if (mode == 1) {
-        size_t poolIndex;
-        struct pagemap_t *poolArray;
-
-        if (pool->startInUse >= pool->endInUse) {
-            return;
-        }
-
-        poolArray = pool->tracking.pageMaps;
-        start = (uint64_t)pool->start;
-        curr = (uint64_t)pool->startInUse;
-        end = (uint64_t)pool->endInUse;
-
-        for (; curr < end; curr += PAGE_SIZE) {
-            poolIndex = (curr - start) / PAGE_SIZE;
-
-            if ((poolArray[poolIndex].allocSize & 2UL) ||
-                    poolArray[poolIndex].allocSize & 1UL
-                    ) {
-                continue;
-            }
-
-            pageStatus = check_pagemap(softDirty, curr);
-            if ((concurrent || ((pageStatus >> 1) & 0x1)) && (pageStatus & 0x1)) {
-                heap_page_scan(&poolArray[poolIndex], curr);
-            }
-        }
-    }
-    else if (mode == 2) {
-        size_t maxMetaIndex, metaIndex;
-        uint64_t startPtr, endPtr;
-
-        if (pool->startInUse >= pool->endInUse)
-            return;
-
-        start = (uint64_t)pool->start;
-        maxMetaIndex = ((POOL_SIZE >> 20) * PAGE_SIZE) / sizeof(uint64_t);
-        for (metaIndex = 0; metaIndex < maxMetaIndex; metaIndex++) {
-            if (!(pool->tracking.allocations[metaIndex] & THREE64) && 
-                !(pool->tracking.allocations[metaIndex] & ONE64) 
-                    ) {
-                curr = pool->tracking.allocations[metaIndex] & ~SEVEN64;
-                if (!curr) return;
-
-                if (metaIndex == 0) {
-                    end = curr;
-                    curr = (uint64_t)pool->start;
-                }
-
-                if ((metaIndex + 1) < maxMetaIndex) {
-                    end = pool->tracking.allocations[metaIndex + 1] & ~SEVEN64;
-                }
-                else {
-                    end = (uint64_t)pool->end;
-                }
-
-                // Read pages
-                for (; curr < end; curr += PAGE_SIZE) {
-                    pageStatus = check_pagemap(softDirty, curr);
-                    if ((concurrent || ((pageStatus >> 1) & 0x1)) && (pageStatus & 0x1)) {
-                        startPtr = curr;
-                        if ((curr + PAGE_SIZE) > end) {
-                            endPtr = end;
-                        }
-                        else {
-                            endPtr = curr + PAGE_SIZE;
-                        }
-
-                        // Read a page
-                        for (; startPtr < endPtr; startPtr += sizeof(uint64_t)) {
-                            ptr = (uint64_t *)startPtr;
-                            data = *ptr;
-                            if ((uint64_t)poolLowAddr <= data && data < (uint64_t)poolHighWater) {
-                                scanmap_mark(data);
-                            }
-                        }
-                    }
-                }
-            }
-        }
-    }
-    else if (mode == 3) {
-        uint64_t base;
-
-        //uint64_t len = pool->end - pool->start;
-
-        if (pool->startInUse >= pool->endInUse)
-            return;
-        if (pool->nextFreeIndex == (SIZE_MAX - 1))
-            return;
-
-        start = (uint64_t)pool->start;
-        curr = (uint64_t)start;
-        end = (uint64_t)pool->end;
-        for (; curr < end; curr += PAGE_SIZE) {
-            pageStatus = check_pagemap(softDirty, curr);
-            if ((concurrent || ((pageStatus >> 1) & 0x1)) && (pageStatus & 0x1)) {
-                for (base = curr; base < (curr + PAGE_SIZE); base += sizeof(uint64_t)) {
-                    ptr = (uint64_t *)base;
-                    data = *ptr;
-
-                    if ((uint64_t)poolLowAddr <= data && data < (uint64_t)poolHighWater) {
-                        scanmap_mark(data);
-                    }
-                }
-            }
-        }
-    }
-}
-
-
-static bool strict_parse_maps(int mapsfd, struct procmap_t *memInfo) {
-    char start[17], end[17], blank[1], status[1], offset[9], inode[13], path[4096];
-    char *pstart = start;
-    char *pend = end;
-    char *poffset = offset;
-    char *pinode = inode;
-    int len;
-    size_t ret;
-
-    memset(memInfo, 0, sizeof(struct procmap_t));
-
-    // Read address until 64bits
-    len = 0;
-    ret = read(mapsfd, &start[len], sizeof(char));
-    if (ret == 0) {
-        return false;
-    }
-
-    while (start[len] != '-') {
-        len++;
-        ret = read(mapsfd, &start[len], sizeof(char));
-    }
-    start[len] = '\0';
-    memInfo->startPtr = (void *)strtoul(start, &pstart, 16); // start
-
-    len = 0;
-    ret = read(mapsfd, &end[len], sizeof(char));
-    while (end[len] != ' ') {
-        len++;
-        ret = read(mapsfd, &end[len], sizeof(char));
-    }
-    end[len] = '\0';
-    memInfo->endPtr = (void *)strtoul(end, &pend, 16); // end
-
-    ret = read(mapsfd, &status, sizeof(status)); // readdable
-    memInfo->readdable = (status[0] == 'r');
-    ret = read(mapsfd, &status, sizeof(status)); // writable
-    memInfo->writable = (status[0] == 'w');
-    ret = read(mapsfd, &status, sizeof(status)); // executable
-    memInfo->executable = (status[0] == 'x');
-    ret = read(mapsfd, &status, sizeof(status)); // CoW
-    memInfo->CoW = (status[0] == 'p');
-
-    ret = read(mapsfd, &blank, sizeof(blank));
-
-    ret = read(mapsfd, &offset, sizeof(offset) - 1);
-    offset[8] = '\0';
-    memInfo->offset = strtoul(offset, &poffset, 16); // offset
-
-    ret = read(mapsfd, &blank, sizeof(blank));
-
-    // Device
-    // 00:00 or fd:01
-    ret = read(mapsfd, &blank, sizeof(blank));
-    ret = read(mapsfd, &blank, sizeof(blank));
-    ret = read(mapsfd, &blank, sizeof(blank));
-    ret = read(mapsfd, &blank, sizeof(blank));
-    ret = read(mapsfd, &blank, sizeof(blank));
-
-    ret = read(mapsfd, &blank, sizeof(blank));
-
-    len = 0;
-    ret = read(mapsfd, &inode[len], sizeof(char));
-    while (inode[len] != ' ') {
-        len++;
-        ret = read(mapsfd, &inode[len], sizeof(char));
-    }
-    inode[len] = '\0';
-    memInfo->inode = strtoul(inode, &pinode, 10); // offset
-
-
-    ret = read(mapsfd, &blank, sizeof(blank));
-    if (ret == 0) {
-        return false;
-    }
-
-    if (blank[0] == '\n') {
-        return true;
-    }
-
-    while (blank[0] == ' ') {
-        ret = read(mapsfd, &blank, sizeof(blank));
-    }
-
-    path[0] = blank[0];
-    memInfo->has_path = (path[0] == '[') || (path[0] == '/');
-
-    len = 1;
-    ret = read(mapsfd, &path[len], sizeof(char));
-    while (path[len] != '\n') {
-        len++;
-        ret = read(mapsfd, &path[len], sizeof(char));
-    }
-    path[len] = '\0';
-
-    memInfo->from_ffmalloc = (strstr(path, "libffmalloc") != NULL);
-    memInfo->stack = (strcmp(path, "[stack]") == 0); 
-
-    return true;
-}
-
-static void destroy_memrange(struct reclaim_t *arg) {
-    struct memrange_t *mem;
-    struct memrange_t *mem_next;
-
-    mem = arg->memRangeHead;
-    while (mem != NULL) {
-        mem_next = mem->next;
-        ffmetadata_free(mem, sizeof(struct memrange_t));
-        mem = mem_next;
-    }
-    arg->memRangeList = NULL;
-    arg->memRangeHead = NULL;
-}
-
-static void register_memrange(struct reclaim_t *arg, uint64_t start, uint64_t end) {
-    struct memrange_t *mem = (struct memrange_t *)ffmetadata_alloc(sizeof(struct memrange_t));
-    
-    FFEnterCriticalSection(&arg->memRangeLock);
-    mem->start = start;
-    mem->end = end;
-    mem->next = NULL;
-
-    mem->next = arg->memRangeList;
-    arg->memRangeList = mem;
-    arg->memRangeHead = arg->memRangeList;
-    FFLeaveCriticalSection(&arg->memRangeLock);
-}
-
-static struct memrange_t *pop_memrange(struct reclaim_t *arg) {
-    struct memrange_t *mem = NULL;
-
-    FFEnterCriticalSection(&arg->memRangeLock);
-    mem = arg->memRangeList;
-    if (mem == NULL) {
-        FFLeaveCriticalSection(&arg->memRangeLock);
-        return NULL;
-    }
-
-    arg->memRangeList = mem->next;
-    FFLeaveCriticalSection(&arg->memRangeLock);
-    return mem;
-}
-
-
-static struct pagepool_t *pop_pagepool(struct reclaim_t *arg, size_t *mode) {
-    struct poollistnode_t *currPoolNode;
-    struct pagepool_t *pool = NULL;
-    struct arena_t *arena;
-
-    *mode = 0;
-
-    for (size_t arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
-        arena = arenas[arenaID];
-        if (!arena) continue;
-            
-        if (arg->smallPoolList[arenaID]) {
-            FFEnterCriticalSection(&arg->memRangeLock);
-            currPoolNode = arg->smallPoolList[arenaID];
-            if (currPoolNode == NULL) {
-                FFLeaveCriticalSection(&arg->memRangeLock);
-                return NULL;
-            }
-            arg->smallPoolList[arenaID] = currPoolNode->next;
-            FFLeaveCriticalSection(&arg->memRangeLock);
-            pool = currPoolNode->pool;
-            *mode = 1;
-        }
-        else if (arg->jumboPoolList[arenaID]) {
-            FFEnterCriticalSection(&arg->memRangeLock);
-            currPoolNode = arg->jumboPoolList[arenaID];
-            if (currPoolNode == NULL) {
-                FFLeaveCriticalSection(&arg->memRangeLock);
-                return NULL;
-            }
-            arg->jumboPoolList[arenaID] = currPoolNode->next;
-            FFLeaveCriticalSection(&arg->memRangeLock);
-            pool = currPoolNode->pool;
-            *mode = 2;
-        }
-        else {
-            size_t i = 0;
-            for (i = 0; i < MAX_LARGE_LISTS; i++) {
-                currPoolNode = arg->largePoolList[arenaID][i];
-                if (currPoolNode) break;
-            }
-
-
-            if (i < MAX_LARGE_LISTS) {
-                FFEnterCriticalSection(&arg->memRangeLock);
-                if (currPoolNode == NULL) {
-                    FFLeaveCriticalSection(&arg->memRangeLock);
-                    return NULL;
-                }
-                arg->largePoolList[arenaID][i] = currPoolNode->next;
-                FFLeaveCriticalSection(&arg->memRangeLock);
-                pool = currPoolNode->pool;
-                *mode = 3;
-            }
-        }
-    }
-
-    return pool;
-}
-
-
-static void user_memory_maps(struct reclaim_t *arg) {
-    int mapsfd;
-
-    mapsfd = open("/proc/self/maps", O_RDONLY);
-    if (mapsfd < 0) {
-        lf_dbg("cannot open /proc/self/maps");
-        exit(-1);
-    }
-
-    struct procmap_t memInfo;
-
-    // Register heap lists
-    for (size_t arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
-        struct arena_t *arena = arenas[arenaID];
-        if (!arena) continue;
-
-        arg->smallPoolList[arenaID] = arena->smallPoolList;
-
-        for (size_t i = 0; i < MAX_LARGE_LISTS; i++) {
-            arg->largePoolList[arenaID][i] = arg->arena->largePoolList[i];
-        }
-        arg->jumboPoolList[arenaID] = arg->arena->jumboPoolList;
-    }
-
-    // Register other pages
-    //arg->memRangeList = NULL;
-    while (strict_parse_maps(mapsfd, &memInfo)) {
-        if ((uint64_t)memInfo.startPtr == (uint64_t)metadataPool) {
-            continue;
-        }
-
-        if ((uint64_t)memInfo.startPtr >= (uint64_t)poolLowAddr && 
-                (uint64_t)memInfo.startPtr < (uint64_t)poolHighWater
-           ) { 
-            continue;
-        }
-
-        if ((uint64_t)memInfo.endPtr == ((uint64_t)metadataPool + 1024UL * 1048576UL)) {
-            continue;
-        }
-
-        if (!memInfo.readdable || !memInfo.writable || memInfo.executable) {
-            continue;
-        }
-
-        size_t mapId;
-        for (mapId = 0; mapId < NUM_MAPS; mapId++) {
-            if (scanmap.bitmap[mapId] == NULL) continue;
-            if ((uint64_t)memInfo.startPtr == (uint64_t)scanmap.bitmap[mapId]) {
-                break;
-            }
-        }
-
-        if ((uint64_t)memInfo.startPtr == (uint64_t)scanmap.bitmap[mapId]) {
-            continue;
-        }
-
-
-        // Do not scan shared mappings to mmap'd files(should not contain pointers)
-        // Note: .text, .bss and .data are mapped as private file mappings
-        if (!memInfo.CoW) {
-            continue;
-        }
-            
-        // Ignore regions mapped from ffmalloc. These may be for meatadata that should be
-        // conceptually non-garbage-collected.
-        if (memInfo.from_ffmalloc) {
-            continue;
-        }
-        
-
-        //map_scan(&memInfo, pagemapfd, NULL);
-        register_memrange(arg, (uint64_t)memInfo.startPtr, (uint64_t)memInfo.endPtr);
-    }
-
-    close(mapsfd);
-}
-
-
-
-#define BILLION 1000000000L
-
-long cal_nsclock(void) {
-    struct timespec curr;
-    clock_gettime(CLOCK_REALTIME, &curr);
-    return BILLION * curr.tv_sec + curr.tv_nsec;
-}
-
-static void save_caller_regs() { asm(""); }
-
-void stop_handler(int sigNum) {
-    pid_t tid;
-    size_t i;
-            
-    // Wait until SIGUSR2 comes
-    if (sigNum != SIGUSR1)
-        return;
-
-
-    // Get reclaimer's metadata
-    tid = syscall(SYS_gettid);
-    for (i = 0; i < MAX_THREAD; i++) {
-        if (thread_list[i].tid == tid) {
-            save_caller_regs();
-			FFEnterCriticalSection(&thread_list[i].stwLock);
-            sigsuspend(&thread_list[i].wait_mask);
-			FFLeaveCriticalSection(&thread_list[i].stwLock);
-        }
-    }
-    return;
-}
-
-void resume_handler(int sigNum) {
-    if (sigNum != SIGUSR2)
-        return;
-}
-
-void init_stw(struct reclaim_t *arg) {
-    struct sigaction sig_action;
-    struct sigaction old_action;
-
-    memset(&sig_action, 0, sizeof(sig_action));
-
-    sigfillset(&sig_action.sa_mask);
-    if (sigdelset(&sig_action.sa_mask, SIGINT) < 0) 
-        exit(-1);
-
-    if (sigdelset(&sig_action.sa_mask, SIGQUIT) < 0) 
-        exit(-1);
-
-    if (sigdelset(&sig_action.sa_mask, SIGABRT) < 0) 
-        exit(-1);
-
-    if (sigdelset(&sig_action.sa_mask, SIGTERM) < 0) 
-        exit(-1);
-
-    if (sigdelset(&sig_action.sa_mask, SIGALRM) < 0) 
-        exit(-1);
-
-    sig_action.sa_flags = SA_RESTART | SA_SIGINFO;
-
-    sig_action.sa_sigaction =(void *) stop_handler;
-    sigaction(SIGUSR1, &sig_action, &old_action);
-
-    sig_action.sa_sigaction = (void *)resume_handler;
-    sigaction(SIGUSR2, &sig_action, &old_action);
-
-    sigfillset(&arg->wait_mask);
-    sigdelset(&arg->wait_mask, SIGUSR2);
-}
-
-
-void send_stop_signal(struct reclaim_t *arg) {
-    kill(arg->owner, SIGUSR1);
-}
-
-void send_resume_signal(struct reclaim_t *arg) {
-    kill(arg->owner, SIGUSR2);
-}
-
-
-
-void reclaim_pagepool_handler(void) {
-    struct arena_t *arena;
-    size_t arenaID;
-
-    for (arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
-        arena = arenas[arenaID];
-        if (!arena) continue;
-
-        struct poollistnode_t *currPoolNode = NULL;
-        struct poollistnode_t *prevPoolNode = NULL;
-        struct poollistnode_t *safeNode;
-        uint64_t data;
-
-        FFEnterCriticalSection(&freePoolLock);
-        currPoolNode = arena->freePoolListHead;
-        while (currPoolNode != NULL) {
-            uint64_t start = (uint64_t)currPoolNode->pool;
-            bool isLarge = start & 0x1;
-            start = (start >> 1) << 1;
-
-            data = scanmap_read_pagepool(start, start + POOL_SIZE);
-            if (data == 0) {
-                if (prevPoolNode != NULL) {
-                    prevPoolNode->next = currPoolNode->next;
-                }
-                else {
-                    arena->freePoolListHead = currPoolNode->next;
-                    if (!arena->freePoolListHead) {
-                        arena->freePoolListTail = NULL;
-                    }
-                }
-
-                safeNode = currPoolNode;
-                currPoolNode = currPoolNode->next;
-
-                safeNode->next = NULL;
-                if (!isLarge) {
-                    if (mprotect((void *)start, POOL_SIZE, PROT_READ | PROT_WRITE) < 0) {
-                        fprintf(stderr, "mprotect error\n");
-                        exit(-1);
-                    }
-
-                    push_addr_store(start);
-                }
-                else if (isLarge) {
-                    munmap((void *)start, POOL_SIZE);
-                    // safe_enqueue(safeNode);
-                }
-
-                //memset(safeNode, 0, sizeof(struct poollistnode_t));
-                //ffmetadata_free(safeNode, sizeof(struct poollistnode_t));
-            }
-            else {
-                prevPoolNode = currPoolNode;
-                currPoolNode = currPoolNode->next;
-            }
-        }
-        FFLeaveCriticalSection(&freePoolLock);
-    }
-
-    uint64_t start = 0;
-    uint64_t end = 0;
-    struct hugelistnode_t *currNode = NULL;
-    struct hugelistnode_t *prevNode = NULL;
-    uint64_t data = 0;
-    FFEnterCriticalSection(&freePoolLock);
-    currNode = safePoolListHead;
-    while (currNode != NULL) {
-        start = currNode->start;
-        end = currNode->end;
-
-        data = scanmap_read_pagepool(start, end);
-        if (data == 0) {
-            if (prevNode != NULL) {
-                prevNode->next = currNode->next;
-            }
-            else {
-                safePoolListHead = currNode->next;
-                if (safePoolListHead) {
-                    safePoolListTail = NULL;
-                }
-            }
-
-            currNode = currNode->next;
-            munmap((void *)start, end - start);
-            //fprintf(stderr, "UNMAP %p\n", start);
-            //ffmetadata_free(oldNode, sizeof(struct hugelistnode_t));
-        }
-        else {
-            prevNode = currNode;
-            currNode = currNode->next;
-        }
-    }
-    FFLeaveCriticalSection(&freePoolLock);
-}
-
-#ifdef SUB_PAGE
-static volatile int epochCounter = 256;
-
-void reclaim_subpage(void) {
-    struct poollistnode_t *currPoolNode = NULL;
-    //struct poollistnode_t *prevPoolNode = NULL;
-
-    size_t mapID;
-    struct pagemap_t *poolArray;
-    struct pagepool_t *pool;
-
-    struct arena_t *arena;
-    size_t arenaID;
-
-    uint64_t flag;
-    size_t allocSize, maxAlloc, bitmapCount, totalAlloc;
-    uint64_t *bitmap;
-
-    for (arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
-        arena = arenas[arenaID];
-        if (!arena) continue;
-
-        for (size_t i = 0; i < 256; i++) {
-            arena->reuseMapHead[i] = NULL;
-        }
-
-        currPoolNode = arena->smallPoolList;
-        //prevPoolNode = NULL;
-
-        while (currPoolNode != NULL) {
-            pool = currPoolNode->pool;
-            if (pool == NULL) {
-                currPoolNode = currPoolNode->next;
-                continue;
-            }
-
-            poolArray = pool->tracking.pageMaps;
-            if (poolArray == NULL) {
-                FFLeaveCriticalSection(&pool->poolLock);
-                currPoolNode = currPoolNode->next;
-                continue;
-            }
-
-            for (mapID = 0; mapID < POOL_SIZE / PAGE_SIZE; mapID++) {
-                flag = poolArray[mapID].allocSize & SEVEN64;
-
-                // 1. 0b001: all allocations are now freed, mark pages as ready to be released
-                // 2. 0b010: all of pages have been returned to the OS
-                // 4. 0b100: fully allocated
-                // 5. 0b101: pages no longer actively being allocated, all allocations
-                //           have been freed, but page has not been returned to OS
-                if (flag == FOUR64) {
-                    uint64_t entry;
-                    //uint64_t offset;
-
-                    allocSize = poolArray[mapID].allocSize & ~SEVEN64;
-                    maxAlloc = PAGE_SIZE / allocSize;
-                    bitmapCount = (maxAlloc & SIXTYTHREE64) ?
-                        (maxAlloc >> 6) + 1 : (maxAlloc >> 6);
-                    totalAlloc = 0;
-
-
-                    // Check empty holes
-                    if (maxAlloc > 64) {
-                        bitmap = poolArray[mapID].bitmap.array;
-                        for (size_t i = 0; i < bitmapCount; i++) {
-                            entry = FFAtomicAdd(bitmap[i], 0);
-                            totalAlloc += bitCount(entry);
-                        }
-                    }
-                    else {
-                        entry = FFAtomicAdd(poolArray[mapID].bitmap.single, 0);
-                        totalAlloc += bitCount(entry);
-                    }
-
-
-                    if ((epochCounter != poolArray[mapID].epochCounter) && 
-                            totalAlloc < maxAlloc) {
-                        int factor = poolArray[mapID].numEpochSinceLastFree;
-                        uint64_t start = (uint64_t)poolArray[mapID].start;
-                        addr_t ptr;
-
-                        if (maxAlloc > 64) {
-                            size_t i = 0;
-                            for (i = 0; i < bitmapCount; i++) {
-                                FFAtomicAnd(poolArray[mapID].safemap.array[i], 0);
-                            }
-                        }
-                        else {
-                            FFAtomicAnd(poolArray[mapID].safemap.single, 0);
-                        }
-
-                        factor *= maxAlloc;
-                        if (totalAlloc == 0) {
-                            factor /= 1;
-                        }
-                        else {
-                            factor /= totalAlloc;
-                        }
-                        if (factor < 100) {
-                            uint64_t addr = 0;
-                            bool isUnsafe = false;
-                            int loc;
-                            int safeCount = 0;
-                            for (addr = start; addr < (start + PAGE_SIZE); addr += allocSize) {
-                                isUnsafe = false;
-                                for (ptr.addr = addr; ptr.addr < (addr + allocSize); ptr.addr += sizeof(uint64_t)) {
-                                    if (scanmap_check(ptr)) {
-                                        isUnsafe = true;
-                                    }
-                                }
-
-                                if (!isUnsafe) {
-                                    loc = (addr - start) / allocSize;
-                                    if (maxAlloc > 64) {
-                                        FFAtomicOr(poolArray[mapID].safemap.array[loc >> 6], ONE64 << (loc & SIXTYTHREE64));
-                                    }
-                                    else {
-                                        FFAtomicOr(poolArray[mapID].safemap.single, ONE64 << loc);
-                                    }
-
-                                    safeCount += 1;
-                                }
-                            }
-
-                            if (safeCount > 0) {
-                                struct pagemap_t *curr = &poolArray[mapID];
-                                curr->next = NULL;
-                                if (arena->reuseMapTail[GET_REUSEBIN(allocSize)] == NULL) {
-                                    arena->reuseMapTail[GET_REUSEBIN(allocSize)] = curr;
-                                }
-                                else {
-                                    struct pagemap_t *ptr = arena->reuseMapTail[GET_REUSEBIN(allocSize)];
-                                    struct pagemap_t *ptr_prev = NULL;
-                                    bool found = false;
-                                    while (ptr != NULL) {
-                                        if (ptr == curr) {
-                                            found = true;
-                                        }
-                                        ptr_prev = ptr;
-                                        ptr = ptr->next;
-                                    }
-
-                                    // Check Existance in free list
-                                    if (!found) {
-                                        if (ptr_prev) {
-                                            curr->next = NULL;
-                                            ptr_prev->next = curr;
-                                        }
-                                        else {
-                                            curr->next = arena->reuseMapTail[GET_REUSEBIN(allocSize)];
-                                            arena->reuseMapTail[GET_REUSEBIN(allocSize)] = curr;
-                                        }
-                                    }
-                                }
-                            }
-                        }
-                    }
-                    poolArray[mapID].numEpochSinceLastFree += 1;
-                    poolArray[mapID].epochCounter = epochCounter;
-                    //
-                }
-            }
-
-            currPoolNode = currPoolNode->next;
-        }
-    }
-
-}
-#endif
-
-
-//
-// Sweep metadata that are logically disable to free
-//
-#ifdef RECLAIM_META
-static void reclaim_metadata(struct reclaim_t *arg) {
-    struct poollistnode_t *currPoolNode = NULL;
-    struct poollistnode_t *prevPoolNode = NULL;
-
-    struct pagepool_t *pool;
-    struct arena_t *arena;
-    size_t arenaID;
-
-    size_t totalSize = 0;
-
-    for (arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
-        arena = arenas[arenaID];
-        if (!arena) continue;
-
-        currPoolNode = arena->smallPoolList;
-        prevPoolNode = NULL;
-        for (; currPoolNode != NULL; currPoolNode = currPoolNode->next) {
-            pool = currPoolNode->pool;
-            if (pool == NULL) {
-                prevPoolNode = currPoolNode;
-                continue;
-            }
-
-            if (pool->startInUse >= pool->endInUse) {
-                prevPoolNode->next = currPoolNode->next;
-
-                ffmetadata_free(pool, sizeof(struct pagepool_t));
-                ffmetadata_free(currPoolNode, sizeof(struct poollistnode_t));
-            }
-            
-            prevPoolNode = currPoolNode;
-        }
-    }
-
-    for (arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
-        arena = arenas[arenaID];
-        if (!arena) continue;
-
-        currPoolNode = arena->jumboPoolList;
-        prevPoolNode = NULL;
-        for (; currPoolNode != NULL; currPoolNode = currPoolNode->next) {
-            pool = currPoolNode->pool;
-            if (pool == NULL) {
-                prevPoolNode = currPoolNode;
-                continue;
-            }
-
-            if (pool->startInUse >= pool->endInUse) {
-                prevPoolNode->next = currPoolNode->next;
-
-                ffmetadata_free(pool, sizeof(struct pagepool_t));
-                ffmetadata_free(currPoolNode, sizeof(struct poollistnode_t));
-            }
-                
-            prevPoolNode = currPoolNode;
-        }
-    }
-
-    for (arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
-        arena = arenas[arenaID];
-        if (!arena) continue;
-
-        for (size_t i = 0; i < MAX_LARGE_LISTS; i++) {
-            currPoolNode = arena->largePoolList[i];
-            prevPoolNode = NULL;
-            for (; currPoolNode != NULL; currPoolNode = currPoolNode->next) {
-                pool = currPoolNode->pool;
-                if (pool == NULL) {
-                    prevPoolNode = currPoolNode;
-                    continue;
-                }
-
-                if (pool->startInUse >= pool->endInUse) {
-                    prevPoolNode->next = currPoolNode->next;
-
-                    ffmetadata_free(pool, sizeof(struct pagepool_t));
-                    ffmetadata_free(currPoolNode, sizeof(struct poollistnode_t));
-                }
-
-                prevPoolNode = currPoolNode;
-            }
-        }
-    }
-}
-#endif
-
-
-
-// Scanner Thread
-static void *scanner_thread(void *data) {
-    struct scanner_t *arg = (struct scanner_t *)data;
-    struct memrange_t *mem;
-
-    struct pagepool_t *pool;
-    size_t mode;
-
-    uint64_t start = 0, end = 0;
-
-    /*
-    // Wait utill first stop-the-world
-    while (!arg->arg->scanOper) {
-    }
-    */
-
-    while (true) {
-#ifdef NO_SCAN
-        sleep(10);
-        continue;
-#endif
-        // text/data/BSS sections
-        FFEnterCriticalSection(arg->scanOperLock);
-        //lf_dbg("[%02d] scanning", arg->id);
-        //fprintf(stderr, "[%02d] scanning\n", arg->id);
-        bool concurrent = arg->arg->concurrent;
-        arg->arg->scanReady[arg->id] = false;
-        while (!arg->arg->scanOperDone[arg->id]) {
-
-            mem = pop_memrange(arg->arg);
-            if (mem != NULL) {
-                start = mem->start;
-                end = mem->end;
-                /*
-                for (; start < end; start += POOL_SIZE) {
-                    if ((start + POOL_SIZE) > end) {
-                        map_scan(start, end, concurrent);
-                    }
-                    else {
-                        map_scan(start, start + POOL_SIZE, concurrent);
-                    }
-                }
-                */
-
-                map_scan(start, end, concurrent);
-                continue;
-            }
-
-            // heap scanning
-            pool = pop_pagepool(arg->arg, &mode);
-            if (pool == NULL || mode == 0) {
-                break;
-            }
-
-            pagepool_scan(pool, mode, concurrent);
-        }
-
-        //lf_dbg("[%02d] scanning...done", arg->id);
-        arg->arg->scanOperDone[arg->id] = true;
-        FFLeaveCriticalSection(arg->scanOperLock);
-
-        while (arg->arg->scanOper) { }
-
-        arg->arg->scanReady[arg->id] = true;
-    }
-    return NULL;
-}
-
-static inline void start_scanner(struct reclaim_t *arg) {
-    int prepare = 0;
-
-    arg->scanOper = true;
-
-    while (prepare < MAX_SCANNER) {
-        prepare = 0;
-        for (size_t i = 0; i < MAX_SCANNER; i++) {
-            if (arg->scanReady[i]) {
-                prepare += 1;
-            }
-        }
-    }
-
-    for (size_t i = 0; i < MAX_SCANNER; i++) {
-        arg->scanOperDone[i] = false;
-    }
-
-    for (size_t i = 0; i < MAX_SCANNER; i++) {
-	    FFLeaveCriticalSection(&arg->scanOperLock[i]);
-    }
-}
-
-static void stop_scanner(struct reclaim_t *arg) {
-    //bool threadStop[MAX_SCANNER];
-    //bool isDone = false;
-    int oper = 0;
-    
-    size_t i = 0;
-
-    while (oper < MAX_SCANNER) {
-        oper = 0;
-        for (size_t j = 0; j < MAX_SCANNER; j++) {
-            if (arg->scanOperDone[arg->id]) {
-                oper += 1;
-            }
-        }
-    }
-
-    while (i < MAX_SCANNER) {
-        if (FFTryEnterCriticalSection(&arg->scanOperLock[i])) {
-            i++;
-        }
-    }
-        
-    arg->scanOper = false;
-}
-
-static void create_and_stop_scanner(struct reclaim_t *arg) {
-    struct scanner_t *scanner;
-
-    arg->scanOper = false;
-
-    for (size_t i = 0; i < MAX_SCANNER; i++) {
-        lf_dbg("create %d", i);
-        scanner = ffmetadata_alloc(sizeof(struct scanner_t));
-        scanner->t = &arg->scanner[i];
-        scanner->arg = arg;
-        scanner->id = i;
-
-	    FFInitializeCriticalSection(&arg->scanOperLock[i]);
-        scanner->scanOperLock = &arg->scanOperLock[i];
-        FFEnterCriticalSection(&arg->scanOperLock[i]);
-
-        if (pthread_create(&arg->scanner[i], NULL, scanner_thread, scanner) < 0) {
-            fprintf(stderr, "reclaim: Fail to create scanner %ld\n", i);
-            exit(4);
-        }
-    }
-
-}
-
-
-static volatile int totalSmallAlloc = 0;
-static volatile size_t prevSmallAlloc[3601];
-static volatile int counter = 1;
-static volatile int scanOrder = 0;
-static volatile size_t descent = 0;
-
-#define DELTA 10
-#define PERIOD_DELAY 1000000
-//#define PERIOD_DELAY 0
-//#define PERIOD_DELAY 250000
-//#define PERIOD_DELAY 500000
-//#define PERIOD_DELAY 750000
-//#define PERIOD_DELAY 2000000
-//#define PERIOD_DELAY 5000000
-
-static int movingAverage(void) {
-    double avg = 0;
-    int i = 0;
-    int cnt = 0;
-    for (i = (counter - 1); i > (counter - DELTA) && i >= 1; i--) {
-        avg += prevSmallAlloc[i];
-        cnt++;
-    }
-
-    avg /= (double)cnt;
-
-    return (int)avg;
-}
-
-#ifdef MOVING_GEOMEAN
-static int movingGeomean(void) {
-    double avg = prevSmallAlloc[counter - 1];
-    int i = 0;
-    int cnt = 1;
-    for (i = (counter - 2); i > (counter - DELTA) && i >= 1; i--) {
-        avg *= prevSmallAlloc[i];
-        cnt++;
-    }
-
-    avg = pow(avg, (double)1 / cnt);
-    return (int)avg;
-}
-#endif
-
-// The number of consequtive STW
-
-static void *reclaim_thread(void *data)
-{
-    struct reclaim_t *arg = (struct reclaim_t *)data;
-
-    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
-    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
-
-    // Open pagemap file to check dirty bits
-    lf_dbg("open...done");
-
-    struct sigaction sig_action;
-
-#ifdef STW_TIME
-    sigfillset(&sig_action.sa_mask);
-    if (sigdelset(&sig_action.sa_mask, SIGALRM) < 0) 
-        exit(-1);
-#endif
-    long begin = cal_nsclock();
-    long curr;
-
-    long stw_time = 0;
-    int currSmallAlloc = 0;
-    //long stwStart = 0;
-
-    arg->scanOper = false;
-
-    //stwStart = cal_nsclock();
-    sleep(STW_TIME_VAL);
-
-    //size_t prevTotalSmallAlloc = 0;
-    prevSmallAlloc[0] = 1;
-
-
-    while (true) {
-        //long delta = cal_nsclock() - stwStart;
-
-        scanOrder = movingAverage();
-        //scanOrder = movingGeomean();
-        currSmallAlloc = totalSmallAlloc;
-        totalSmallAlloc = 0;
-        //if (currSmallAlloc == 0) currSmallAlloc = 1;
-
-        if (scanOrder > currSmallAlloc && currSmallAlloc > 0 && descent == 0) {
-            
-            prevSmallAlloc[counter] = currSmallAlloc;
-            counter += 1;
-            if (counter > 3600) {
-                counter = 0;
-            }
-
-#ifdef CONCURRENT
-            arg->concurrent = true;
-
-            clear_softdirty();
-
-            softDirty = open("/proc/self/pagemap", O_RDONLY);
-            if (softDirty < 0) {
-                lf_dbg("cannot open /proc/self/pagemap");
-                exit(-1);
-            }
-
-            user_memory_maps(arg);
-            start_scanner(arg);
-            stop_scanner(arg);
-            destroy_memrange(arg);
-
-            close(softDirty);
-            softDirty = -1;
-
-            //scanOrder = movingGeomean();
-            scanOrder = movingAverage();
-            currSmallAlloc = totalSmallAlloc;
-            totalSmallAlloc = 0;
-            prevSmallAlloc[counter] = currSmallAlloc;
-            if (scanOrder <= currSmallAlloc || currSmallAlloc == 0) {
-                counter += 1;
-                if (counter > 3600) {
-                    counter = 0;
-                }
-
-                if (scanOrder > currSmallAlloc) {
-                    descent = true;
-                }
-                else {
-                    descent = false;
-                }
-
-                usleep(PERIOD_DELAY);
-                continue;
-            }
-#endif
-
-            descent = true;
-
-#ifdef NO_SCAN
-            send_stop_signal(arg);
-            send_resume_signal(arg);
-            usleep(500000);
-            continue;
-#endif
-            
-            send_stop_signal(arg);
-
-            // Wait until user thread suspended
-            while(FFTryEnterCriticalSection(&arg->stwLock)) {
-                FFLeaveCriticalSection(&arg->stwLock);
-            }
-            begin = cal_nsclock();
-
-
-            arg->concurrent = false;
-
-            softDirty = open("/proc/self/pagemap", O_RDONLY);
-            if (softDirty < 0) {
-                lf_dbg("cannot open /proc/self/pagemap");
-                exit(-1);
-            }
-
-            user_memory_maps(arg);
-            start_scanner(arg);
-            stop_scanner(arg);
-            destroy_memrange(arg);
-
-            close(softDirty);
-
-            clear_softdirty();
-
-            send_resume_signal(arg);
-            curr = cal_nsclock();
-            //stwStart = curr;
-
-            lf_dbg("reclaim");
-            reclaim_pagepool_handler();
-            lf_dbg("reclaim...done");
-
-#ifdef SUB_PAGE
-            reclaim_subpage();
-#endif
-
-#ifdef PG_POOL
-            reclaim_pagepool(arg);
-#endif
-
-            stw_time += (curr - begin);
-
-            //fprintf(stderr, "STW %lf sec, %d(%d, %d)\n", (double)stw_time/BILLION, counter, scanOrder, currSmallAlloc);
-            // Before resuming user thread
-            scanmap_clear();
-
-            //
-            usleep(PERIOD_DELAY);
-        }
-        else {
-            if (scanOrder > currSmallAlloc) {
-                descent = true;
-            }
-            else {
-                descent = false;
-            }
-
-            prevSmallAlloc[counter] = currSmallAlloc;
-            counter += 1;
-            if (counter > 3600) {
-                counter = 0;
-            }
-
-            usleep(PERIOD_DELAY);
-        }
-    }
-
-    return NULL;
-}
-
-
-static volatile size_t initReclaimer = 0;
-int init_reclaim(struct arena_t *arena) {
-    if (!initReclaimer) {
-        initReclaimer = 1;
-
-        reclaimer = &thread_list[empty_thread];
-        reclaimer->id = empty_thread++;
-
-        reclaimer->owner = getpid();
-
-        reclaimer->tid = syscall(SYS_gettid);
-
-        reclaimer->arena = arena;
-
-        reclaimer->memRangeList = NULL;
-        reclaimer->memRangeHead = NULL;
-
-        for (size_t arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
-            reclaimer->smallPoolList[arenaID] = NULL;
-            for (size_t i = 0; i < MAX_LARGE_LISTS; i++) {
-                reclaimer->largePoolList[arenaID][i] = NULL;
-            }
-            reclaimer->jumboPoolList[arenaID] = NULL;
-        }
-
-        for (size_t i = 0; i < MAX_SCANNER; i++) {
-            reclaimer->scanReady[i] = true;
-        }
-
-	    FFInitializeCriticalSection(&reclaimer->stwLock);
-	    FFInitializeCriticalSection(&reclaimer->memRangeLock);
-
-        empty_thread += 1;
-
-        init_stw(reclaimer);
-        init_scanmap();
-
-        // Create multiple threads
-        create_and_stop_scanner(reclaimer);
-        
-        pthread_attr_init(&reclaimer->attr);
-        pthread_attr_setdetachstate(&reclaimer->attr, PTHREAD_CREATE_DETACHED);
-        if (pthread_create(&reclaimer->thread, &reclaimer->attr, reclaim_thread, reclaimer) < 0) {
-            fprintf(stderr, "reclaim: Fail to create a reclaimer\n");
-            exit(4);
-        }
-        pthread_attr_destroy(&reclaimer->attr);
-    }
-    return 0;
-}
-
-void exit_reclaim(void) {
-    // Terminate the reclaimer thread directly
-    for (size_t i = 0; i < MAX_THREAD; i++) {
-        if (thread_list[i].id != 0) {
-            pthread_cancel(thread_list[i].thread);
-        }
-    }
-}
-
-#endif // MARK_SWEEP
-
-// Performs one-time setup of metadata structures
-static void initialize() {
-	isInit = 2;
-
-	// Set up lock that protects modifications to the pool radix tree
-	FFInitializeCriticalSection(&poolTreeLock);
-
-	FFInitializeCriticalSection(&poolAllocLock);
-
-	// Initialize metadata pool locks
-	FFInitializeCriticalSection(&mdPoolLock);
-	for (int i = 0; i < 256; i++) {
-		FFInitializeCriticalSection(&binLocks[i]);
-	}
-	FFInitializeCriticalSection(&mdBinLocks[0]);
-	FFInitializeCriticalSection(&mdBinLocks[1]);
-
-#ifdef MARK_SWEEP
-	FFInitializeCriticalSection(&freePoolLock);
-
-	FFInitializeCriticalSection(&addrStoreLock);
-
-#ifdef SUB_PAGE
-    FFInitializeCriticalSection(&reuseLock);
-#endif
-#endif
-
-#ifndef _WIN64
-	// Find the top of the heap on Linux then add 1GB so that there is
-	// no contention with small mallocs from libc when used side-by-side
-	poolHighWater = (byte*)sbrk(0) + 0x40000000;
-#ifdef MARK_SWEEP
-    poolLowAddr = poolHighWater;
-#endif
-
-	// Create a large contiguous range of virtual address space but don't
-	// actually map the addresses to pages just yet
-	metadataPool = (byte*)mmap(NULL, 1024UL * 1048576UL, PROT_NONE, 
-			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
-	metadataFree = metadataPool;
-	metadataEnd = metadataPool + POOL_SIZE;
-
-	mprotect(metadataPool, POOL_SIZE, PROT_READ | PROT_WRITE);
-#else
-	metadataPool = (byte*)VirtualAlloc(NULL, 1024ULL * 1048576ULL, MEM_RESERVE, PAGE_NOACCESS);
-	VirtualAlloc(metadataPool, POOL_SIZE, MEM_COMMIT, PAGE_READWRITE);
-	metadataFree = metadataPool;
-	metadataEnd = metadataPool + POOL_SIZE;
-	poolHighWater = metadataPool + 1024ULL * 1048576ULL + 65536ULL;
-#endif
-
-	// Create the default arena used to handle standard malloc API calls
-	//arenas[0] = (struct arena_t*)ffmetadata_alloc(sizeof(struct arena_t));
-	// Manually allocate initial arena to prevent segfault since ffmetadata_alloc
-	// relies on arenas[0] to be initialized when profiling is enabled
-	arenas[0] = (struct arena_t*)metadataPool;
-	metadataFree += ALIGN_TO(sizeof(struct arena_t), UINT64_C(16));
-#ifdef FF_PROFILE
-	arenas[0]->profile.currentOSBytesMapped = POOL_SIZE;
-#endif
-	if(create_arena(arenas[0]) != FFSUCCESS) {
-		// Bad news, not much to do except quit
-		abort();
-	}
-
-	// Initialize OS threading support
-	init_threading();
-
-#ifdef FF_PROFILE
-	atexit(ffprint_stats_wrapper);
-#ifdef FF_INSTRUMENTED
-	ffprint_usage_on_interval(stderr, FF_INTERVAL);
-#endif
-#endif
-
-	isInit = 1;
-
-#ifdef MARK_SWEEP
-    atexit(exit_reclaim);
-    init_reclaim(arenas[0]);
-#endif
-}
-
-// Destroys a page pool returning all memory to the OS
-static void destroy_pool(struct pagepool_t* pool) {
-#ifdef MARK_SWEEP
-    bool isLarge = false;
-#endif
-
-	// Return the pool memory itself
-	if(os_free(pool->start) != 0) {
-		abort();
-	}
-
-	// Return the metadata depending on the pool type
-	if(pool->nextFreeIndex == SIZE_MAX) {
-		// Small pool
-		// Free bitmaps back to the internal allocator. That requires
-		// checking every page map for bitmaps
-		byte* lastPage = pool->nextFreePage < pool->end ? pool->nextFreePage : pool->end;
-		for(size_t i = 0; i < (lastPage - pool->start) / PAGE_SIZE; i++) {
-			size_t allocSize = pool->tracking.pageMaps[i].allocSize & ~SEVEN64;
-			if(allocSize > 0 && allocSize < 64) {
-				size_t bitmapCount = ((PAGE_SIZE / allocSize) & SIXTYTHREE64) != 0 ?
-					((PAGE_SIZE / allocSize) >> 6) + 1 : ((PAGE_SIZE / allocSize) >> 6);
-				ffmetadata_free(pool->tracking.pageMaps[i].bitmap.array, bitmapCount * 8);
-			}
-		}
-
-#ifdef MARK_SWEEP
-#ifdef SUB_PAGE
-		for(size_t i = 0; i < (lastPage - pool->start) / PAGE_SIZE; i++) {
-			size_t allocSize = pool->tracking.pageMaps[i].allocSize & ~SEVEN64;
-			if(allocSize > 0 && allocSize < 64) {
-				size_t bitmapCount = ((PAGE_SIZE / allocSize) & SIXTYTHREE64) != 0 ?
-					((PAGE_SIZE / allocSize) >> 6) + 1 : ((PAGE_SIZE / allocSize) >> 6);
-				ffmetadata_free(pool->tracking.pageMaps[i].safemap.array, bitmapCount * 8);
-			}
-            pool->tracking.pageMaps[i].safemap.array = NULL;
-        }
-#endif
-#endif
-		// Now free all of the page maps
-		ffpoolmetadata_free(pool->tracking.pageMaps, 1);
-	}
-	else if(pool->nextFreeIndex == SIZE_MAX - 1) {
-		// Jumbo pool
-		// Nothing else to do here since a jumbo pool has no additional
-		// metadata to clean up
-        
-#ifdef MARK_SWEEP
-        uint64_t start = (uint64_t)pool->start;
-        uint64_t end = (uint64_t)pool->end;
-
-        struct hugelistnode_t *newNode = (struct hugelistnode_t *)ffmetadata_alloc(sizeof(struct hugelistnode_t));
-        newNode->next = NULL;
-        newNode->start = start;
-        newNode->end = end;
-
-        unsafe_enqueue(newNode);
-#endif
-
-	    remove_pool_from_tree(pool);
-	    FFDeleteCriticalSection(&pool->poolLock);
-        return;
-	}
-	else {
-		// Large pool
-		ffpoolmetadata_free(pool->tracking.allocations, 0);
-#ifdef MARK_SWEEP
-        isLarge = true;
-#endif
-	}
-
-	remove_pool_from_tree(pool);
-	FFDeleteCriticalSection(&pool->poolLock);
-
-#ifdef MARK_SWEEP
-    if ((pool->end - pool->start) != POOL_SIZE) {
-        return;
-    }
-
-    // Allocate a node
-    struct poollistnode_t *newNode = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
-    newNode->pool = (struct pagepool_t *)((uint64_t)pool->start | isLarge);
-    newNode->next = NULL;
-
-
-    // Enqueue
-    FFEnterCriticalSection(&freePoolLock);
-    if (!pool->arena->freePoolListTail) {
-        pool->arena->freePoolListTail = newNode;
-    }
-    else {
-        pool->arena->freePoolListTail->next = newNode;
-        pool->arena->freePoolListTail = newNode;
-    }
-
-    if (!pool->arena->freePoolListHead) {
-        pool->arena->freePoolListHead = newNode;
-    }
-    FFLeaveCriticalSection(&freePoolLock);
-#endif
-}
-
-// Destroys each pool in a pool list as well as the list itself
-static void destroy_pool_list(struct poollistnode_t* node) {
-	struct poollistnode_t* lastNode;
-
-	while(node != NULL) {
-		destroy_pool(node->pool);
-		lastNode = node;
-		node = node->next;
-		ffmetadata_free(lastNode, sizeof(struct poollistnode_t));
-	}
-}
-
-// Destroys an arena by freeing all pools and associated metadata
-static void destroy_arena(struct arena_t* arena) {
-	destroy_pool_list(arena->smallPoolList);
-	destroy_pool_list(arena->jumboPoolList);
-	for(int i = 0; i < MAX_LARGE_LISTS; i++) {
-		if(arena->largePoolList[i] != NULL) {
-			destroy_pool_list(arena->largePoolList[i]);
-		}
-		FFDeleteCriticalSection(&arena->largeListLock[i]);
-	}
-
-	// TODO: When a thread ends before the arena is destroyed, the 
-	// appropriate OS specific handler will clean up its thread cache
-	// Here, we need to find a way to delete any thread caches for
-	// threads that haven't yet exited (but hopefully know not to
-	// allocate from this arena anymore)
-	
-	FFTlsFree(arena->tlsIndex);
-
-	FFDeleteCriticalSection(&arena->smallListLock);
-
-	ffmetadata_free(arena, sizeof(struct arena_t));
-}
-
-
-/*** Search functions ***/
-
-// Helper function to find the page within a pool that a small pointer was 
-// allocated from. On success, the function will return the index within the 
-// page where the pointer is located and pagemap will point to the pointer to
-// the pagemap. The return value will be less than 0 on failure
-static int64_t find_small_ptr(const byte* ptr, const struct pagepool_t* pool, struct pagemap_t** pageMap) {
-	// Find the location in the metadata where the page for this pointer is tracked
-	size_t mapIndex = (ptr - pool->start) / PAGE_SIZE;
-	struct pagemap_t* page = pool->tracking.pageMaps + mapIndex;
-	*pageMap = page;
-
-	// Found the page. Find the allocation's place in the bitmap
-	uint64_t index = (ptr - page->start) / (page->allocSize & ~SEVEN64);
-
-	// Validate that this is a potentially valid address - i.e. not an
-	// address in the middle of an allocation. Trusting compiler optimizations
-	// to not issue two divisions to keep things quick
-	if((ptr - page->start) % (page->allocSize & ~SEVEN64) != 0) {
-		return -2;
-	}
-	
-	// Is the pointer actually allocated?
-	if (page->allocSize < 64) {
-		uint64_t array = index >> 6;
-		uint64_t pos = index - (array << 6);
-		if (!(page->bitmap.array[array] & (ONE64 << pos))) {
-			return -1;
-		}
-	}
-	else {
-		if (!(page->bitmap.single & (ONE64 << index))) {
-			return -3;
-		}
-	}
-
-	return index;
-}
-
-// Helper function to find the location within a large allocation pool of a
-// specific allocation. Returns the size of the allocation on success or 0 if
-// the allocation is not found. Also, if the allocation is found then the 
-// index of the allocation in the metadata array is copied to the location 
-// pointed to by metadataIndex
-static size_t find_large_ptr(const byte* ptr, struct pagepool_t* pool, size_t* metadataIndex) {
-	size_t left = 0;
-	size_t right = pool->nextFreeIndex;
-	size_t current = (right - left) / 2;
-
-	// The metadata array is guaranteed to be sorted, so we can treat it like
-	// a binary search tree.
-	while (left != right) {
-		if (pool->tracking.allocations[current] == (uintptr_t)ptr) {
-			if (current == pool->nextFreeIndex) {
-				// The final entry in the metadata is not an actual allocation
-				return 0;
-			}
-			// Found the pointer
-			*metadataIndex = current;
-			return ((pool->tracking.allocations[current + 1] & ~SEVEN64) - pool->tracking.allocations[current]);
-		}
-		else if ((uintptr_t)ptr < pool->tracking.allocations[current]) {
-			// Search left
-			right = current;
-		}
-		else {
-			// Search right
-			left = current + 1;
-		}
-		current = left + ((right - left) / 2);
-	}
-
-	// The allocation was not found
-	return 0;
-}
-
-
-/*** Malloc helper functions ***/
-
-#ifdef MARK_SWEEP
-#ifdef SUB_PAGE
-static void* ffmalloc_small_reuse(size_t size, struct arena_t* arena) {
-    struct pagemap_t *prev, *curr, *head;
-    prev = NULL;
-    curr = arena->reuseMapHead[GET_REUSEBIN(size)];
-    head = curr;
-
-    /*
-    if (size == 32) {
-        int len = 0;
-        while (curr != NULL) {
-            len++;
-            curr = curr->next;
-        }
-        lf_dbg("%d\n", len);
-        curr = arena->reuseMapHead[GET_REUSEBIN(size)];
-    }
-    */
-
-    while (curr != NULL) {
-        if ((curr->allocSize & SEVEN64) == FOUR64) {
-            if ((curr->allocSize & ~SEVEN64) == size) {
-                uint64_t allocation;
-                size_t maxAlloc;
-                maxAlloc = PAGE_SIZE / size;
-                //bitmapCount = (maxAlloc & SIXTYTHREE64) ?
-                //    (maxAlloc >> 6) + 1 : (maxAlloc >> 6);
-
-                // check empty holes
-                if (maxAlloc > 64) {
-                    size_t chunkCount = 0;
-
-                    for (chunkCount = 0; chunkCount < maxAlloc; chunkCount++) {
-                        if (!(curr->bitmap.array[chunkCount >> 6] & (ONE64 << (chunkCount & SIXTYTHREE64))) &&
-                            (curr->safemap.array[chunkCount >> 6] & (ONE64 << (chunkCount & SIXTYTHREE64)))) {
-                        //if (!(curr->bitmap.array[chunkCount >> 6] & (ONE64 << (chunkCount - (chunkCount << 6)))) &&
-                        //    (curr->safemap.array[chunkCount >> 6] & (ONE64 << (chunkCount - (chunkCount << 6))))) {
-                            FFAtomicOr(curr->bitmap.array[chunkCount >> 6], ONE64 << (chunkCount & SIXTYTHREE64));
-                            FFAtomicAnd(curr->safemap.array[chunkCount >> 6], ~(ONE64 << (chunkCount & SIXTYTHREE64)));
-                            allocation = (uint64_t)(curr->start) + size * chunkCount;
-                            memset((void *)allocation, 0, size);
-                            //fprintf(stderr,"%016lx, %d, %d\n", allocation, size, chunkCount);
-                            return (void *)allocation;
-                        }
-                    }
-
-                    if (prev != NULL) {
-                        prev->next = curr->next;
-                    }
-                    else {
-                        head = curr->next;
-                    }
-
-                    arena->reuseMapHead[GET_REUSEBIN(size)] = head;
-                    curr = curr->next;
-                    continue;
-                }
-                else {
-                    size_t j;
-                    for (j = 0; j < maxAlloc; j++) {
-                        if (!((curr->bitmap.single >> j) & 0x1) && ((curr->safemap.single >> j) & 0x1)) {
-                            break;
-                        }
-                    }
-
-                    if (j == maxAlloc) {
-                        if (prev != NULL) {
-                            prev->next = curr->next;
-                        }
-                        else {
-                            head = curr->next;
-                        }
-                        arena->reuseMapHead[GET_REUSEBIN(size)] = head;
-                        curr = curr->next;
-                        continue;
-                    }
-
-                    FFAtomicOr(curr->bitmap.single, (ONE64 << j));
-                    FFAtomicAnd(curr->safemap.single, ~(ONE64 << j));
-                    allocation = (uint64_t)(curr->start) + size * j;
-                    memset((void *)allocation, 0, size);
-                    return (void *)allocation;
-                }
-            }
-        }
-        else {
-            if (prev != NULL)
-                prev->next = curr->next;
-        }
-
-        prev = curr;
-        curr = curr->next;
-    }
-                    
-    return NULL;
-}
-#endif
-#endif
-
-
-// Actual implementation of malloc for small sizes
-static void* ffmalloc_small(size_t size, struct arena_t* arena) {
-	struct bin_t* bin;
-
-	// Get the correct thread cache. By allocating
-	// from a per-thread cache, we don't have to 
-	// acquire and release locks 
-	struct threadcache_t* tcache = get_threadcache(arena);
-
-	// Select the correct bin based on size and alignment
-	bin = &tcache->bins[GET_BIN(size)];
-
-#ifdef FF_PROFILE
-	bin->totalAllocCount++;
-#endif
-
-#ifdef MARK_SWEEP
-#ifdef SUB_PAGE
-    // -- SMALL REUSE
-    // update reuse pool list
-    if (arena->reuseMapHead[GET_REUSEBIN(size)] == NULL) {
-        if (arena->reuseMapTail[GET_REUSEBIN(size)]) {
-            arena->reuseMapHead[GET_REUSEBIN(size)] = arena->reuseMapTail[GET_REUSEBIN(size)];
-            arena->reuseMapTail[GET_REUSEBIN(size)] = NULL;
-        }
-    }
-
-    if (arena->reuseMapHead[GET_REUSEBIN(size)] != NULL) {
-        FFEnterCriticalSection(&reuseLock);
-        void * ret = ffmalloc_small_reuse(size, arena);
-        if (ret != NULL) {
-            FFLeaveCriticalSection(&reuseLock);
-            return ret;
-        }
-        FFLeaveCriticalSection(&reuseLock);
-    }
-    // -- SMALL REUSE
-#endif
-#endif
-
-	// If the bin is full or first allocation then get a new page
-	if (bin->allocCount == bin->maxAlloc) {
-		// Do we have any pages left in the local free page cache?
-		if (tcache->nextUnusedPage >= tcache->endUnusedPage) {
-			// Local cache is empty. Need to go refresh from a page pool
-			assign_pages_to_tcache(tcache);
-		}
-
-		// Connect the bin to the page map
-		bin->page = tcache->nextUnusedPage;
-
-		// Remove the page map from the local free cache
-		tcache->nextUnusedPage++;
-
-		// Update the size record on the page map
-		bin->page->allocSize = bin->allocSize;
-
-		// Reset the allocation pointers for the bin
-		bin->allocCount = 0;
-		bin->nextAlloc = bin->page->start;
-
-		// If the bin holds more than 64 allocations, then point
-		// the page map to a new bitmap array
-		if (bin->maxAlloc > 64) {
-			size_t bitmapCount = (bin->maxAlloc & SIXTYTHREE64) ? 
-				(bin->maxAlloc >> 6) + 1 : (bin->maxAlloc >> 6);
-			bin->page->bitmap.array = (uint64_t*)ffmetadata_alloc(bitmapCount * 8);
-#ifdef SUB_PAGE
-            bin->page->safemap.array = (uint64_t *)ffmetadata_alloc(bitmapCount * 8);
-#endif
-		}
-	}
-
-	// Mark the next allocation on the page as in use on the bitmap. 
-	// Must use atomic operations to mark the bitmap because even though this is
-	// the only cache that can allocate from here, any thread could be freeing a
-	// previous allocation
-	if (bin->maxAlloc <= 64) {
-		FFAtomicOr(bin->page->bitmap.single, (ONE64 << bin->allocCount));
-	}
-	else {
-		FFAtomicOr(bin->page->bitmap.array[bin->allocCount >> 6], (ONE64 << (bin->allocCount & SIXTYTHREE64)));
-	}
-
-	// Save pointer to allocation. Advance bin to next allocation
-	byte* thisAlloc = bin->nextAlloc;
-	bin->nextAlloc += bin->allocSize;
-	bin->allocCount++;
-
-	// Mark the page as full if so
-	if (bin->allocCount == bin->maxAlloc) {
-		bin->page->allocSize |= 4UL;
-	}
-
-#ifdef FF_PROFILE
-	// Final statistics update
-	FFAtomicAdd(arena->profile.totalBytesAllocated, bin->allocSize);
-	FFAtomicAdd(arena->profile.currentBytesAllocated, bin->allocSize);
-	// TODO: thread safe update
-	if (arena->profile.currentBytesAllocated > arena->profile.maxBytesAllocated)
-		arena->profile.maxBytesAllocated = arena->profile.currentBytesAllocated;
-#endif
-
-	// Return successfully allocated buffer
-	return thisAlloc;
-}
-
-// Helper to actually implement a large allocation from a specific pool
-// Note: caller is responsible for acquiring/releasing pool lock if needed
-// before calling this function
-static inline void* ffmalloc_large_from_pool(size_t size, size_t alignment, struct pagepool_t* pool) {
-	uintptr_t alignedNext = ALIGN_TO((uintptr_t)pool->nextFreePage, alignment);
-
-	// Record the metadata
-	// For a standard 8 or 16 byte allignment we just record the address of
-	// the next allocation to the end of the list. This allocation was already
-	// recorded on the previous call. The reason is that size is stored 
-	// implicitly as the difference between consecutive pointers therefore,
-	// for N allocations we need N+1 pointers in the metadata.
-	// When the alignment is greater than 8/16, the returned pointer could
-	// be greater than what was recorded last time so we also have to 
-	// update that pointer - effectively growing the previous allocation.
-	// The alternative would be to create and immediately mark free the
-	// little spacer allocation in between but there isn't any obvious
-	// benefit to doing so
-#ifdef FF_PROFILE
-	FFAtomicAdd(pool->arena->profile.totalBytesAllocated, size + ((byte*)alignedNext - pool->nextFreePage));
-	FFAtomicAdd(pool->arena->profile.currentBytesAllocated, size + ((byte*)alignedNext - pool->nextFreePage));
-	if(pool->arena->profile.currentBytesAllocated > pool->arena->profile.maxBytesAllocated) {
-		// TODO: need thread safe update here
-		pool->arena->profile.maxBytesAllocated = pool->arena->profile.currentBytesAllocated;
-	}
-#endif
-	pool->nextFreePage = ((byte*)alignedNext + size);
-	if(alignment > MIN_ALIGNMENT) {
-		pool->tracking.allocations[pool->nextFreeIndex] = alignedNext;
-	}
-	pool->tracking.allocations[++pool->nextFreeIndex] = (uintptr_t)pool->nextFreePage;
-
-	// If there is less than the minimum large size allocation left, then 
-	// change the last metadata entry so that this allocation gets the remaining
-	// space
-	if (pool->end - pool->nextFreePage < (ptrdiff_t)(HALF_PAGE + MIN_ALIGNMENT)) {
-#ifdef FF_PROFILE
-		FFAtomicAdd(pool->arena->profile.currentBytesAllocated, pool->end - pool->nextFreePage);
-		FFAtomicAdd(pool->arena->profile.totalBytesAllocated, pool->end - pool->nextFreePage);
-#endif
-		pool->tracking.allocations[pool->nextFreeIndex] = (uintptr_t)pool->end;
-		pool->nextFreePage = pool->end;
-	}
-
-	// Return the allocation
-	return (void*)alignedNext;
-}
-
-
-// Release any remaining unallocated space in the pool when the pool is being
-// removed from the active allocation list. The pool may be destroyed if all
-// allocations have also already been freed
-static inline void trim_large_pool(struct pagepool_t* pool) {
-	if(pool->tracking.allocations[pool->nextFreeIndex] < (uintptr_t)pool->end) {
-		size_t remainingSize = (uintptr_t)pool->end - pool->tracking.allocations[pool->nextFreeIndex];
-#ifdef FF_PROFILE
-		// Must update counter here because it will be decremented
-		// inside call to free
-		FFAtomicAdd(pool->arena->profile.currentBytesAllocated, remainingSize);
-#endif
-		// Mark the balance of free space as a single allocation
-		pool->nextFreeIndex++;
-		pool->tracking.allocations[pool->nextFreeIndex] = (uintptr_t)pool->end;
-		pool->nextFreePage = pool->end;
-
-		// Release the slack space
-		free_large_pointer(pool, pool->nextFreeIndex - 1, remainingSize);
-	}
-
-	// Mark the pool as no longer being allocated from
-	pool->tracking.allocations[pool->nextFreeIndex] |= FOUR64;
-
-	// Destroy the pool if completely released
-	if(pool->startInUse >= pool->endInUse) {
-		destroy_pool(pool);
-	}
-}
-
-// Finds a suitable large pool to allocate from, or creates a new pool 
-// if neccessary
-static void* ffmalloc_large(size_t size, size_t alignment, struct arena_t* arena) {
-	struct poollistnode_t* node;
-	struct poollistnode_t* tailNode;
-	struct pagepool_t* pool = NULL;
-	byte* alignedNext;
-	unsigned int loopCount = 0;
-	const unsigned int listId = get_large_list_index();
-
-	node = arena->largePoolList[listId];
-	tailNode = node;
-
-	// Loop through the large pools assigned to this processor looking for one
-	// that has space. There may be pools on other CPUs that would be a better
-	// fit but we don't check those
-	while (node != NULL) {
-		pool = node->pool;
-		alignedNext = (byte*)ALIGN_TO((uintptr_t)pool->nextFreePage, alignment);
-		if (alignedNext + size > pool->end) {
-			// No space in this pool, advance to the next one
-			tailNode = node;
-			node = node->next;
-			loopCount++;
-		}
-		else {
-			// Space available allocate from here if possible
-#ifdef FFSINGLE_THREADED
-			return ffmalloc_large_from_pool(size, alignment, pool);
-#else
-			FFEnterCriticalSection(&pool->poolLock);
-			void* allocation;
-
-			// Since we don't lock before checking the size (to avoid a lock pileup)
-			// we have to check the size again here inside the lock to make sure that
-			// there is still space available
-			alignedNext = (byte*)ALIGN_TO((uintptr_t)pool->nextFreePage, alignment);
-			if (alignedNext + size <= pool->end) {
-				allocation = ffmalloc_large_from_pool(size, alignment, pool);
-				FFLeaveCriticalSection(&pool->poolLock);
-				return allocation;
-			}
-			else {
-				// Lost the race, try the next bin
-				node = node->next;
-			}
-			FFLeaveCriticalSection(&pool->poolLock);
-#endif
-		}
-	}
-
-	// None of the current pools on this CPU have space
-	FFEnterCriticalSection(&arena->largeListLock[listId]);
-
-	// While waiting for the lock, was a new pool created?
-	if (tailNode->next != NULL) {
-		pool = tailNode->next->pool;
-		FFEnterCriticalSection(&pool->poolLock);
-		alignedNext = (byte*)ALIGN_TO((uintptr_t)pool->nextFreePage, alignment);
-
-		// Does the new pool have enough space to service this request? If so,
-		// allocate and be done
-		if (alignedNext + size <= pool->end) {
-			void* allocation = ffmalloc_large_from_pool(size, alignment, pool);
-			FFLeaveCriticalSection(&pool->poolLock);
-			FFLeaveCriticalSection(&arena->largeListLock[listId]);
-			return allocation;
-		}
-		FFLeaveCriticalSection(&pool->poolLock);
-
-		while (tailNode->next != NULL) {
-			tailNode = tailNode->next;
-		}
-	}
-
-	// If we get here, either we entered the lock straight away or another pool
-	// was created while waiting for the lock, but we must have been in the back
-	// of the line because its already too small. Either way, create a new large
-	// allocation pool
-	pool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
-	if (pool == NULL) {
-		fprintf(stderr, "Out of metadata space creating large pool\n");
-		FFLeaveCriticalSection(&arena->largeListLock[listId]);
-		return NULL;
-	}
-	pool->arena = arena;
-	if (create_largepagepool(pool) == -1) {
-		// Maybe there is a way to recover here, but for the moment
-		// the caller is just all out of luck
-		ffmetadata_free(pool, sizeof(struct pagepool_t));
-		FFLeaveCriticalSection(&arena->largeListLock[listId]);
-		return NULL;
-	}
-
-	// Pool creation successful so add it to the tree for later pointer lookup
-	add_pool_to_tree(pool);
-
-	// Finally allocate the block requested 
-	// No need for locks here because nobody else can see this until
-	// it's added to the list
-	void* allocation = ffmalloc_large_from_pool(size, alignment, pool);
-
-	node = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
-	node->pool = pool;
-#ifdef MARK_SWEEP
-    node->next = NULL;
-#endif
-
-	tailNode->next = node;
-
-	if (loopCount >= MAX_POOLS_PER_LIST) {
-		node = arena->largePoolList[listId];
-		arena->largePoolList[listId] = arena->largePoolList[listId]->next;
-		trim_large_pool(node->pool);
-		// TODO: Pool needs to be held onto for destroy arena. Save it where?
-
-#ifdef MARK_SWEEP
-        if (arena->largePoolListHead[listId] == NULL) {
-            arena->largePoolListHead[listId] = node;
-            node->next = NULL;
-        }
-        else {
-            node->next = arena->largePoolListHead[listId];
-            arena->largePoolListHead[listId] = node;
-        }
-#endif
-	}
-	FFLeaveCriticalSection(&arena->largeListLock[listId]);
-
-	return allocation;
-}
-
-// Helper function to allocate larger than POOL_SIZE requests
-static void* ffmalloc_jumbo(size_t size, struct arena_t* arena) {
-	// A larger than POOL_SIZE request will require its own oddly sized pool
-	// Start by creating the pool object
-	struct pagepool_t* jumboPool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
-
-	if(jumboPool == NULL) {
-		errno = ENOMEM;
-		return NULL;
-	}
-
-	struct poollistnode_t* newNode = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
-	if(newNode == NULL) {
-		ffmetadata_free(jumboPool, sizeof(struct pagepool_t));
-		errno = ENOMEM;
-		return NULL;
-	}
-	
-	// Connect page to caller's arena and initialize
-	jumboPool->arena = arena;
-	if(create_jumbopool(jumboPool, size) == -1) {
-		ffmetadata_free(jumboPool, sizeof(struct pagepool_t));
-		ffmetadata_free(newNode, sizeof(struct poollistnode_t));
-		errno = ENOMEM;
-		return NULL;
-	}
-
-	// Record the pool in the global pool tree
-	add_pool_to_tree(jumboPool);
-
-	// Add to the list of jumbo pools in this arena
-	newNode->pool = jumboPool;
-#ifdef FFSINGLE_THREADED
-	newNode->next = arena->jumboPoolList;
-	arena->jumboPoolList = newNode;
-#else
-	struct poollistnode_t* currenthead;
-	do {
-		currenthead = arena->jumboPoolList;
-		newNode->next = currenthead;
-	} while (!FFAtomicCompareExchangePtr(&arena->jumboPoolList, newNode, currenthead));
-#endif
-
-	// Return the start of the pool as the new allocation
-	return jumboPool->start;
-}
-
-
-/*** Free helper functions ***/
-
-// Helper function to return a small pool page back to the OS
-static void free_page(struct pagepool_t* pool, struct pagemap_t* pageMap) {
-	byte* startAddress = pageMap->start;
-	byte* endAddress = startAddress + PAGE_SIZE;
-	unsigned int leftIsFreed = 0;
-	unsigned int rightIsFreed = 0;
-	struct pagemap_t* currentPage = pageMap;
-	struct pagemap_t* leftmostPage = pageMap;
-	struct pagemap_t* rightmostPage = pageMap;
-
-	FFEnterCriticalSection(&pool->poolLock);
-
-	// Check earlier pages to see if they are also unused but not yet returned
-	// to the OS. Stop when the beginning of the pool, an in use page, or a
-	// released page is reached
-	while (startAddress > pool->start) {
-		currentPage--;
-		if ((currentPage->allocSize & SEVEN64) == 5) {
-			// Page is no longer actively being allocated from, all allocations
-			// have been freed, but page has not been returned to OS
-			startAddress -= PAGE_SIZE;
-			leftmostPage = currentPage;
-		}
-		else if((currentPage->allocSize & SEVEN64) == 7) {
-			// Page has been returned to the OS
-			leftIsFreed++;
-			break;
-		}
-		else {
-			break;
-		}
-	}
-
-	if (startAddress == pool->start) {
-		leftIsFreed++;
-	}
-
-	// Same as above, except now check following pages
-	currentPage = pageMap;
-	while (endAddress < pool->end) {
-		currentPage++;
-		if ((currentPage->allocSize & SEVEN64) == 5) {
-			// Page is no longer actively being allocated from, all allocations
-			// have been freed, but page has not been returned to OS
-			endAddress += PAGE_SIZE;
-			rightmostPage = currentPage;
-		}
-		else if ((currentPage->allocSize & SEVEN64) == 7) {
-			// Page has been returned to the OS
-			rightIsFreed++;
-			break;
-		}
-		else {
-			break;
-		}
-	}
-
-	if (endAddress == pool->end) {
-		rightIsFreed++;
-	}
-
-	// Check if the computed range of pages meets either the minimum size 
-	// threshold or if the range constitutes an "island" connecting two
-	// freed regions. If so, then return the pages to the OS
-	if ((endAddress - startAddress >= (ptrdiff_t)(PAGE_SIZE * MIN_PAGES_TO_FREE)) || (leftIsFreed != 0 && rightIsFreed != 0)) {
-		if(os_decommit((void*)startAddress, endAddress - startAddress) == FALSE) {
-			if(errno == ENOMEM) {
-				// Likely out of VMAs. Don't die here - continue on in the hopes that
-				// more frees will allow VMAs to retire completely
-				FFLeaveCriticalSection(&pool->poolLock);
-				return;
-			}
-			fprintf(stderr, "Error: %d Couldn't unmap %p to %p\n", errno, startAddress, endAddress);
-			fflush(stderr);
-			abort();
-		}
-#ifdef FF_PROFILE
-		FFAtomicSub(pool->arena->profile.currentOSBytesMapped, endAddress - startAddress);
-#endif
-
-		// Mark all of the pages as returned to the OS
-		for (currentPage = leftmostPage; currentPage <= rightmostPage; currentPage++) {
-			currentPage->allocSize |= 2UL;
-		}
-
-		// Update the "in use" pointers which measure the earliest and latest address
-		// not yet freed in the pool. When those meet or cross then the whole pool is
-		// completely freed and its metadata data can be freed
-		if (startAddress <= pool->startInUse) {
-			for (currentPage = rightmostPage; ((currentPage->allocSize & TWO64) != 0) && (currentPage->start < pool->endInUse) && (currentPage->start + PAGE_SIZE < pool->end); currentPage++) {
-			}
-			if (currentPage->start > pool->start) {
-				pool->startInUse = currentPage->start;
-			}
-		}
-		if (endAddress >= pool->endInUse) {
-			for (currentPage = leftmostPage; ((currentPage->allocSize & TWO64) != 0) && currentPage->start >= pool->startInUse && (currentPage->start > pool->start); currentPage--) {
-				if (currentPage->start > pool->start) {
-					if ((currentPage - 1)->start == NULL) {
-						currentPage--;
-						break;
-					}
-				}
-			}
-			pool->endInUse = currentPage->start + PAGE_SIZE;
-		}
-		if (pool->startInUse >= pool->endInUse) {
-			// All space in the pool has been allocated and subsequently freed. Destroy
-			// this pool to free up metadata resources
-			FFLeaveCriticalSection(&pool->poolLock);
-			destroy_pool(pool);
-			return;
-		}
-	}
-	FFLeaveCriticalSection(&pool->poolLock);
-}
-
-// Helper function to mark a small allocation freed
-static inline void free_small_ptr(struct pagepool_t* pool, struct pagemap_t* pageMap, size_t index) {
-#ifdef FF_PROFILE
-	FFAtomicSub(pool->arena->profile.currentBytesAllocated, (pageMap->allocSize & ~SEVEN64));
-#endif
-#ifdef SUB_PAGE
-    pageMap->epochCounter -= 1;
-#endif
-	if (pageMap->allocSize < 64) {
-		// Find the right bitmap and location
-		size_t array = (index >> 6);
-		size_t pos = index - (array << 6);
-
-		// Clear the "allocated" flag
-		FFAtomicAnd(pageMap->bitmap.array[array], ~(ONE64 << pos));
-
-#ifdef SUB_PAGE
-        FFEnterCriticalSection(&reuseLock);
-#endif
-		// Check if the page can be released to the OS
-		if (pageMap->allocSize & 4UL) {
-			uint64_t result = 0;
-			size_t bitmaps = (PAGE_SIZE / (pageMap->allocSize & ~SEVEN64)) >> 6;
-			if ((PAGE_SIZE / (pageMap->allocSize & ~SEVEN64)) & SIXTYTHREE64) {
-				bitmaps++;
-			}
-			for (size_t i = 0; i < bitmaps; i++) {
-				result |= pageMap->bitmap.array[i];
-			}
-
-			if (result == 0) {
-				// All allocations are now freed
-				// Mark page as ready to be released
-				pageMap->allocSize |= 1;
-				//ffmetadata_free(pageMap->bitmap.array, bitmaps * 8);
-				free_page(pool, pageMap);
-			}
-        }
-
-#ifdef SUB_PAGE
-        FFLeaveCriticalSection(&reuseLock);
-#endif
-	}
-	else {
-		// Clear the "allocated" flag in the bitmap
-		FFAtomicAnd(pageMap->bitmap.single, ~(ONE64 << index));
-
-#ifdef SUB_PAGE
-        FFEnterCriticalSection(&reuseLock);
-#endif
-		// Check if the page can be released to the OS
-		if ((pageMap->allocSize & 4UL) && (pageMap->bitmap.single == 0)) {
-			pageMap->allocSize |= 1;
-			free_page(pool, pageMap);
-		}
-#ifdef SUB_PAGE
-        FFLeaveCriticalSection(&reuseLock);
-#endif
-	}
-}
-
-// Helper function that frees a large pointer
-static void free_large_pointer(struct pagepool_t* pool, size_t index, __attrUnusedParam size_t size) {
-	size_t firstFreeIndex;
-	size_t lastFreeIndex;
-
-	// Lock this pool while the free happens
-	FFEnterCriticalSection(&pool->poolLock);
-
-	// Mark the allocation as freed in the metadata
-	pool->tracking.allocations[index] |= ONE64;
-
-#ifdef FF_PROFILE
-	FFAtomicSub(pool->arena->profile.currentBytesAllocated, size);
-#endif
-	// Start searching for the start of the contiguous free region. The search ends when
-	// the beginning of the list is reached, an in use block is found, or a block that
-	// has already at least partially been unmapped
-	firstFreeIndex = index;
-	while ((firstFreeIndex > 0) && ((pool->tracking.allocations[firstFreeIndex - 1] & THREE64) == 1)) {
-		firstFreeIndex--;
-	}
-
-	unsigned int leftIsFreed = 0;
-	unsigned int rightIsFreed = 0;
-
-	// This is potentially the location to start unmapping from. However, it might need to
-	// be adjusted forward or backwards depending on what the previous block was marked as
-	uintptr_t startFreeAddr = (pool->tracking.allocations[firstFreeIndex] & ~THREE64);
-	if ((startFreeAddr & (PAGE_SIZE - 1)) != 0) {
-		if ((pool->tracking.allocations[firstFreeIndex - 1] & TWO64) != 0) {
-			// The previous allocation has been at least partially unmapped
-			// but there is still the remaining bit in this page. So, adjust
-			// the start address backwards to the start of this frame
-			startFreeAddr = (startFreeAddr & ~(PAGE_SIZE - 1));
-			leftIsFreed++;
-		}
-		else {
-			// The previous allocation is still in use, so this page cannot
-			// be unmapped. Adjust the start address forward to the start
-			// of the next page
-			startFreeAddr = ((startFreeAddr + PAGE_SIZE) & ~(PAGE_SIZE - 1));
-		}
-	}
-	else if(firstFreeIndex == 0 || (pool->tracking.allocations[firstFreeIndex - 1] & TWO64)) {
-		leftIsFreed++;
-	}
-
-	// Now start searching for the end of the contiguous free region. As before, stop when
-	// the end of the list is reached, an allocated block is reached, or a partially
-	// unmapped allocation is found
-	lastFreeIndex = index;
-	while ((lastFreeIndex < pool->nextFreeIndex) && ((pool->tracking.allocations[lastFreeIndex + 1] & THREE64) == 1)) {
-		lastFreeIndex++;
-	}
-
-	// Potentially the end of the region to unmap. If it doesn't fall on a page boundary
-	// it will need to be adjusted forward or backwards
-	uintptr_t endFreeAddr = (pool->tracking.allocations[lastFreeIndex + 1] & ~SEVEN64);
-	if(endFreeAddr == 0) {
-		fprintf(stderr, "endFreeAddr == 0 test 1\n");
-		fflush(stderr);
-		abort();
-	}
-
-	if ((endFreeAddr & (PAGE_SIZE - 1)) != 0) {
-		if ((pool->tracking.allocations[lastFreeIndex + 1] & TWO64) != 0) {
-			// The allocation following the region to be freed has already
-			// been partially freed, but the portion on this same page also
-			// needs to be freed so adjust the end address to the end of the page
-			endFreeAddr = ((endFreeAddr + PAGE_SIZE) & ~(PAGE_SIZE - 1));
-			if(endFreeAddr == 0) {
-				fprintf(stderr, "endFreeAddr == 0 test 2\n");
-				fflush(stderr);
-				abort();
-			}
-			rightIsFreed++;
-		}
-		else {
-			// The next allocation is still in use, so nothing on this page can
-			// be freed yet. Move the end address back to the start of the page
-			endFreeAddr = (endFreeAddr & ~(PAGE_SIZE - 1));
-		}
-	}
-	else {
-		if((byte*)endFreeAddr >= pool->end || (pool->tracking.allocations[lastFreeIndex + 1] & TWO64)) {
-			rightIsFreed++;
-		}
-	}
-
-	if((byte*)startFreeAddr <= pool->startInUse) {
-		if((byte*)endFreeAddr < pool->end) {
-			size_t contFreeIndex = lastFreeIndex; 
-			while(contFreeIndex < pool->nextFreeIndex && ((pool->tracking.allocations[contFreeIndex + 1] & TWO64) != 0)) {
-				contFreeIndex++;
-			}
-			pool->startInUse = (byte*)(pool->tracking.allocations[contFreeIndex + 1] & ~SEVEN64);
-		}
-		else {
-			pool->startInUse = pool->end;
-		}
-	}
-
-	// The whole pool is now empty, destroy it (which will also finish freeing up the indicated allocation)
-	if((pool->startInUse >= pool->endInUse) && (pool->tracking.allocations[pool->nextFreeIndex] >= (uintptr_t)pool->end + FOUR64)) {
-		FFLeaveCriticalSection(&pool->poolLock);
-		destroy_pool(pool);
-#ifdef FF_PROFILE
-		// Update the physical memory statistics
-		FFAtomicSub(pool->arena->profile.currentOSBytesMapped, (size_t)(endFreeAddr - startFreeAddr));
-#endif
-	}
-	else if (endFreeAddr > startFreeAddr) {
-		// Set a minimum number of pages before actually returning them to the OS
-		// On Linux, this helps reduce fragmentation which results in VMA bloat which
-		// can wrek our ability to request new pages. Alternately, if this is an island
-		// between two free regions, return it regardless of size so that 1) it doesn't
-		// get orphaned and 2) eliminates a VMA on Linux
-		if ((endFreeAddr - startFreeAddr >= (PAGE_SIZE * MIN_PAGES_TO_FREE)) || (leftIsFreed !=0 && rightIsFreed != 0)) {
-			if (os_decommit((void*)startFreeAddr, endFreeAddr - startFreeAddr) == FALSE) {
-#ifndef _WIN64
-				if(errno == ENOMEM) {
-					// Likely ran out of VMAs. Just continue without marking anything as
-					// being cleaned up, that way a future fffree can try again and hopefully
-					// make progress
-					FFLeaveCriticalSection(&pool->poolLock);
-					return;
-				}
-
-				fprintf(stderr, "Large pool decommit fail: %d, %p size: %ld\n", errno, (void*)startFreeAddr, endFreeAddr - startFreeAddr);
-#else
-				fprintf(stderr, "Large pool decommit fail: %d, %p size: %lld\n", GetLastError(), (void*)startFreeAddr, endFreeAddr - startFreeAddr);
-#endif
-				fflush(stderr);
-				abort();
-			}
-#ifdef FF_PROFILE
-			// Update the physical memory statistics
-			FFAtomicSub(pool->arena->profile.currentOSBytesMapped, (size_t)(endFreeAddr - startFreeAddr));
-#endif
-
-			// Lastly, mark all the pointers as unmapped
-			for (size_t i = firstFreeIndex; i <= lastFreeIndex; i++) {
-				pool->tracking.allocations[i] |= THREE64;
-			}
-		}
-	}
-	FFLeaveCriticalSection(&pool->poolLock);
-}
-
-// Frees a jumbo allocation by deleting the associated pool
-static inline void free_jumbo(struct pagepool_t* pool) {
-#ifdef FF_PROFILE
-	FFAtomicSub(pool->arena->profile.currentBytesAllocated, (size_t)(pool->end - pool->start));
-	FFAtomicSub(pool->arena->profile.currentOSBytesMapped, (size_t)(pool->end - pool->start));
-#endif
-	destroy_pool(pool);
-}
-
-/*** Public API functions ***/
-
-// Replacement for malloc. Returns a pointer to an available
-// memory region >= size or NULL upon failure
-void* ffmalloc(size_t size) {
-	void* allocation;
-#if defined(FFSINGLE_THREADED) || !defined(_WIN64)
-	if (isInit == 2) {
-		abort();
-	}
-	if (!isInit) {
-		initialize();
-	}
-#endif
-
-	// Returning NULL when size==0 would be legal according to the man
-	// pages. This would be the preferred behavior because an allocation
-	// of zero is almost certain to turn into a call to realloc and that's
-	// expensive for this library. However, at least one of the PARSEC 
-	// benchmarks won't run if we do that so begrudingly return a minimum
-	// allocation for size 0
-	if (size == 0) {
-		size = 8;
-	}
-
-#ifdef FF_PROFILE
-	FFAtomicIncrement(arenas[0]->profile.mallocCount);
-	FFAtomicAdd(arenas[0]->profile.totalBytesRequested, size);
-#endif
-	// If size is very close to SIZE_MAX, the ALIGN_SIZE macro will 
-	// return 0
-	if(size > SIZE_MAX - MIN_ALIGNMENT) {
-		errno = ENOMEM;
-		return NULL;
-	}
-
-	// All allocations are at least 8 byte aligned. Round up if needed
-	size = ALIGN_SIZE(size);
-
-#ifdef MARK_SWEEP
-    totalSmallAlloc += 1;
-#endif
-
-	// Small (less than half page size) allocations are allocated
-	// in matching sized bins per thread. Large allocations come
-	// out of a single central pool. Allocations larger than a single
-	// pool become their own pool
-	if (size <= (HALF_PAGE)) {
-		allocation = ffmalloc_small(size, arenas[0]);
-	}
-	else if (size < (POOL_SIZE - HALF_PAGE)) {
-		allocation = ffmalloc_large(size, MIN_ALIGNMENT, arenas[0]);
-	}
-	else {
-		allocation = ffmalloc_jumbo(size, arenas[0]);
-	}
-
-#ifdef FF_PROFILE
-	print_current_usage();
-#endif
-	if(allocation == NULL) {
-		errno = ENOMEM;
-	}
-
-	return allocation;
-}
-
-// Replacement for realloc. Returns a pointer to a memory region
-// that is >= size and also contains the contents pointed to by ptr
-// if ptr is not NULL. The return value may be equal to ptr and will
-// be NULL on error.
-void* ffrealloc(void* ptr, size_t size) {
-	// Per the man page for realloc, calling with ptr == NULL is
-	// equal to malloc(size). When ptr isn't NULL, calling
-	// realloc with size == 0 is the same as free(ptr)
-	if (ptr == NULL) {
-		return ffmalloc(size);
-	}
-	else if (size == 0) {
-		fffree(ptr);
-		return NULL;
-	}
-
-    size = ALIGN_SIZE(size);
-	
-	struct pagepool_t* pool = find_pool_for_ptr((const byte*)ptr);
-	if (pool == NULL) {
-		// Program is trying to free a bad pointer
-		// Or more likely there is a bug in this library
-		fprintf(stderr, "Attempt to realloc %p but no matching pool\n", ptr);
-		fflush(stderr);
-		abort();
-	}
-
-#ifdef FF_PROFILE
-	FFAtomicIncrement(arenas[0]->profile.reallocCount);
-#endif
-
-	// Was this a large or small allocation pool?
-	if (pool->nextFreeIndex < SIZE_MAX - 1) {
-		// Large allocation
-		size_t index = 0;
-		size_t oldSize = find_large_ptr((const byte*)ptr, pool, &index);
-
-		// Pointer not found - abort with extreme prejudice
-		// Likely a bug that needs cleaning up
-		if (oldSize == 0) {
-			fprintf(stderr, "realloc bad large ptr: %p\n", ptr);
-			fprintf(stderr, "pool:    %p\n", pool);
-			fprintf(stderr, "pool st: %p\n", pool->start);
-			fflush(stderr);
-			abort();
-		}
-
-		// When the reallocation size isn't bigger than the current size
-		// just quit and tell the app to keep using the same allocation
-		if (size <= oldSize) {
-			return ptr;
-		}
-
-#ifdef FF_GROWLARGEREALLOC
-		// Check if the allocation happens to be at the end of the large
-		// pool and thus can be grown without extending into previously
-		// allocated space. It seems like this would be uncommon but
-		// profiling the SPECint PerlBench test says that its at least
-		// occassionally very common
-
-		// Potential integer overflow issue below. Since inplace resize 
-		// is only possible if the new size would still fit within the 
-		// pool, checking that size < POOL_SIZE should be sufficient
-		if(size < POOL_SIZE) {
-			FFEnterCriticalSection(&pool->poolLock);
-			size_t additionalSize = ALIGN_SIZE(size) - oldSize;
-			if(index == pool->nextFreeIndex-1 && (pool->nextFreePage + additionalSize <= pool->end)) {
-#ifdef FF_PROFILE
-				FFAtomicIncrement(arenas[0]->profile.reallocCouldGrow);
-				FFAtomicAdd(arenas[0]->profile.currentBytesAllocated, additionalSize);
-				FFAtomicAdd(arenas[0]->profile.totalBytesAllocated, additionalSize);
-				FFAtomicAdd(arenas[0]->profile.totalBytesRequested, size - oldSize);
-#endif
-				pool->nextFreePage += additionalSize;
-				pool->tracking.allocations[pool->nextFreeIndex] += additionalSize;
-				FFLeaveCriticalSection(&pool->poolLock);
-				return ptr;
-			}
-			FFLeaveCriticalSection(&pool->poolLock);
-		}
-#endif
-
-		// A bigger reallocation size requires copying the old data to
-		// the new location and then freeing the old allocation
-		void* temp = ffmalloc(size);
-		memcpy(temp, ptr, oldSize);
-		free_large_pointer(pool, index, oldSize);
-		return temp;
-	}
-	else if (pool->nextFreeIndex == SIZE_MAX - 1) {
-		// Jumbo allocation - the pool is the allocation
-		// How big was it?
-		size_t jumboSize = pool->end - pool->start;
-
-		// Is it still big enough?
-		// TODO: Add code to trim pages from the end if the size is
-		// sufficiently smaller
-		// Also consider expansion if possible in the single threaded
-		// case
-		if(size <= jumboSize) {
-			return pool->start;
-		}
-
-		// Not big enough so we'll have to create a new allocation
-		void* newJumbo = ffmalloc(size);
-		if(newJumbo == NULL) {
-			errno = ENOMEM;
-			return NULL;
-		}
-
-		// Copy into the new buffer
-		memcpy(newJumbo, ptr, jumboSize);
-
-		// Release memory associated with the old allocation and cleanup metadata
-		free_jumbo(pool);
-
-		// Return success
-		return newJumbo;
-	}
-	else {
-		// Small allocation
-		struct pagemap_t* pageMap = NULL;
-
-		// Find the specific page and index of this allocation
-		int64_t index = find_small_ptr((const byte*)ptr, pool, &pageMap);
-
-		// For now, fail violently if we can't find the pointer
-		// (likely a bug in the library somewhere)
-		if (index < 0) {
-			// Not a valid pointer
-			fprintf(stderr, "realloc bad small ptr: %p\n", ptr);
-			fprintf(stderr, "pool: %p\n", pool);
-			fprintf(stderr, "pageMap: %p\n", pageMap);
-			fflush(stderr);
-			abort();
-		}
-
-		if (size <= (pageMap->allocSize & ~SEVEN64)) {
-			return ptr;
-		}
-
-		void* temp = ffmalloc(size);
-		memcpy(temp, ptr, (pageMap->allocSize & ~SEVEN64));
-#ifdef MARK_SWEEP
-        memset(ptr, 0, (pageMap->allocSize & ~SEVEN64));
-#endif
-		free_small_ptr(pool, pageMap, index);
-		return temp;
-	}
-}
-
-// Replacement for reallocarray. Equivalent to realloc(ptr, nmemb * size)
-// but will return NULL and signal ENOMEM if the multiplication overflows
-void* ffreallocarray(void* ptr, size_t nmemb, size_t size) {
-	// Overflow check. Existing allocation remains unaltered if there is overflow
-	if (nmemb && size > (SIZE_MAX / nmemb)) {
-		errno = ENOMEM;
-		return NULL;
-	}
-
-#ifdef FF_PROFILE
-	FFAtomicIncrement(arenas[0]->profile.reallocarrayCount);
-#endif
-
-	return ffrealloc(ptr, nmemb * size);
-}
-
-// Replacement for calloc. Returns a pointer to a memory region
-// that is >= nmemb * size and is guaranteed to be zeroed out.
-// Returns NULL on error
-void* ffcalloc(size_t nmemb, size_t size) {
-	// Ensure multiplication won't overflow
-	if (size > (SIZE_MAX / nmemb)) {
-        fprintf(stderr, "ffcalloc BUG\n");
-		return NULL;
-	}
-
-#if defined(FFSINGLE_THREADED) || !defined(_WIN64)
-	if(isInit == 2) {
-		abort();
-	}
-	if (!isInit) {
-		initialize();
-	}
-#endif
-#ifdef FF_PROFILE
-	FFAtomicIncrement(arenas[0]->profile.callocCount);
-#endif
-
-	// Either VirtualAlloc or mmap guarantee us zeroed pages and since
-	// we don't use mremap there is no chance of recycling a dirty
-	// page and therefore no need to explicitly zero out the allocation
-	//return ffmalloc(nmemb?nmemb * size:size);
-    return ffmalloc(nmemb*size);
-}
-
-// Replacment for free. Marks an allocation previously returned by
-// ffmalloc, ffrealloc, or ffcalloc as no longer in use. The memory
-// page might be returned to the OS depending on the status of other
-// allocations from the same page
-void fffree(void* ptr) {
-	// Per the specification for free, calling with ptr == NULL is
-	// legal and is a no-op
-	if (ptr == NULL)
-		return;
-
-	struct pagepool_t* pool = find_pool_for_ptr((const byte*)ptr);
-	if (pool == NULL) {
-		// Program is trying to free a bad pointer
-		// Or more likely there is a bug in this library
-		fprintf(stderr, "Attempt to free %p but no matching pool\n", ptr);
-		fflush(stderr);
-		abort();
-	}
-
-#ifdef FF_PROFILE
-	FFAtomicIncrement(arenas[0]->profile.freeCount);
-#endif
-
-	// Was this a large or small allocation pool?
-	if (pool->nextFreeIndex < SIZE_MAX - 1) {
-		// Large allocation
-		size_t index = 0;
-		size_t size = find_large_ptr((const byte*)ptr, pool, &index);
-
-		// Pointer not found - abort with extreme prejudice
-		// Likely a bug that needs cleaning up
-		if (size == 0) {
-			fprintf(stderr, "free bad large ptr: %p\n", ptr);
-			fprintf(stderr, "pool:    %p\n", pool);
-			fprintf(stderr, "pool st: %p\n", pool->start);
-			fflush(stderr);
-			abort();
-		}
-
-		free_large_pointer(pool, index, size);
-	}
-	else if (pool->nextFreeIndex == SIZE_MAX - 1) {
-		// Jumbo allocation
-		free_jumbo(pool);
-	}
-	else {
-		// Small allocation
-		struct pagemap_t* pageMap = NULL;
-
-		// Find the specific page and index of this allocation
-		int64_t index = find_small_ptr((const byte*)ptr, pool, &pageMap);
-
-		// For now, fail violently if we can't find the pointer
-		if (index < 0) {
-			// Not a valid pointer
-			fprintf(stderr, "free bad ptr: %p\n", ptr);
-			fprintf(stderr, "ptr size:     %ld\n", pageMap->allocSize & ~SEVEN64);
-			fprintf(stderr, "pool start:   %p\n", pool->start);
-			fprintf(stderr, "page start:   %p\n", pageMap->start);
-			fflush(stderr);
-			abort();
-		}
-
-#ifdef MARK_SWEEP
-        memset(ptr, 0, (pageMap->allocSize & ~SEVEN64));
-
-#ifdef SUB_PAGE
-        pageMap->numEpochSinceLastFree = 0;
-#endif
-#endif
-
-		free_small_ptr(pool, pageMap, index);
-	}
-}
-
-static inline void* ffmemalign_internal(size_t alignment, size_t size) {
-#ifdef FF_PROFILE
-	FFAtomicIncrement(arenas[0]->profile.posixAlignCount);
-	FFAtomicAdd(arenas[0]->profile.totalBytesRequested, size);
-#endif
-
-	// Allocation can be serviced from the small bin only if both the size
-	// and the alignment fit into the small bin
-	if(size <= HALF_PAGE && alignment <= HALF_PAGE) {
-		if(size <= alignment) {
-			// When size is less than alignment, just returning an
-			// allocation of size == alignment will guarantee the
-			// requested alignment
-			return ffmalloc_small(alignment, arenas[0]);
-		}
-		else {
-			// When size is greater than alignment, rounding size
-			// up to the next power of two will ensure alignment
-			return ffmalloc_small(ONE64<<(64-FFCOUNTLEADINGZEROS64(size-1)), arenas[0]);
-		}
-	}
-
-	// Either size or alignment won't fit into the normal small bins so
-	// even if the size is small, it will have to come out of the large
-	// allocation bin to get the requested alignment
-
-	// Round size up to a multiple of base alignment if needed
-	size = ALIGN_SIZE(size);
-
-	if(size >= POOL_SIZE) {
-		return ffmalloc_jumbo(size, arenas[0]);
-	}
-	else {
-		return ffmalloc_large(size, alignment, arenas[0]);
-	}
-
-	return NULL;
-}
-
-// Replacement for posix_memalign. Returns a pointer to a block of memory that
-// is >= size and that has at least the specified alignment, which must be a
-// power of two
-int ffposix_memalign(void** ptr, size_t alignment, size_t size) {
-	// Don't bother with zero byte allocations
-	// Also check against overflow below
-	if(size == 0 || (size >= SIZE_MAX - PAGE_SIZE )) {
-		*ptr = NULL;
-		return EINVAL;
-	}
-
-	// Alignment must be at least sizeof(void*) and alignment must be a
-	// power of two
-	if(alignment < 8 || FFPOPCOUNT64(alignment) != 1) {
-		*ptr = NULL;
-		return EINVAL;
-	}
-
-	// Current jumbo allocation code is missing alignment support but all
-	// jumbo allocations will be at least page aligned. For now it is an
-	// error to request more than page alignment for a jumbo allocation
-	if(size + PAGE_SIZE >= POOL_SIZE && alignment > PAGE_SIZE) {
-		*ptr = NULL;
-		return EINVAL;
-	}
-
-	*ptr = ffmemalign_internal(alignment, size);
-	if(*ptr == NULL) {
-		return ENOMEM;
-	}
-
-	return 0;
-}
-
-// Replacement for memalign. The man page says this is obsolete but it turns
-// up in PARSEC benchmark so here it is. The address of the returned allocation
-// will be a multiple of alignment and alignment must be a power of two.
-void* ffmemalign(size_t alignment, size_t size) {
-	// Forbid zero byte allocations
-	// Protect against integer overflow later
-	if(size == 0 || (size >= SIZE_MAX - PAGE_SIZE)) {
-		return NULL;
-	}
-
-	// Verify that alignment is a power of two
-	if(FFPOPCOUNT64(alignment) != 1) {
-		errno = EINVAL;
-		return NULL;
-	}
-
-	// The man page is silent on whether a minimum value for alignment is
-	// enforced (compare to posix_memalign). Since none is mentioned, 
-	// allow all values but anything less than pointer size will just be
-	// handled as a regular malloc
-	if(alignment <= sizeof(void*)) {
-		return ffmalloc(size);
-	}
-
-	// The jumbo allocation code doesn't support custom alignment right now
-	// but any jumbo alignment will be page aligned. So, error out if the
-	// request is bigger than page size otherwise carry on
-	if(size + PAGE_SIZE >= POOL_SIZE && alignment > PAGE_SIZE) {
-		errno = EINVAL;
-		return NULL;
-	}
-
-	return ffmemalign_internal(alignment, size);
-}
-
-// Replacment for aligned_alloc. Alignment must be a power of two and size
-// must be a multiple of alignment. Returned pointer will point to a region
-// that is >= size and at least alignment aligned or NULL on failure
-void *ffaligned_alloc(size_t alignment, size_t size) {
-	// Don't allow zero byte allocations
-	// Protect against integer overflow
-	if(size == 0 || (size >= SIZE_MAX - PAGE_SIZE)) {
-		return NULL;
-	}
-
-	// Alignment must be at least sizeof(void*) and alignment must be a
-	// power of two
-	if(alignment < 8 || FFPOPCOUNT64(alignment) != 1) {
-		errno = EINVAL;
-		return NULL;
-	}
-
-	// Description of aligned_alloc says that size must be a multiple of
-	// alignment
-	if(size < alignment || (size % alignment != 0)) {
-		errno = EINVAL;
-		return NULL;
-	}
-
-	// Missing alignment support in jumbo code so forbid greater than page
-	// alignment for jumbo allocations until that's fixed. All jumbo
-	// allocations will be page aligned anyways
-	if(size + PAGE_SIZE >= POOL_SIZE && alignment > PAGE_SIZE) {
-		errno = EINVAL;
-		return NULL;
-	}
-
-#ifdef FF_PROFILE
-	FFAtomicIncrement(arenas[0]->profile.allocAlignCount);
-	FFAtomicAdd(arenas[0]->profile.totalBytesRequested, size);
-#endif
-
-	if (size >= POOL_SIZE) {
-		return ffmalloc_jumbo(size, arenas[0]);
-	}
-	// Allocation can be serviced from the small bin only if both the size
-	// and the alignment fit into the small bin
-	else if(size <= HALF_PAGE && alignment <= HALF_PAGE) {
-		return ffmalloc_small(ONE64<<(64-FFCOUNTLEADINGZEROS64(size-1)), arenas[0]);
-	}
-	else {
-		// Either size or alignment won't fit into the normal small bins so
-		// even if the size is small, it will have to come out of the large
-		// allocation bin to get the requested alignment
-		return ffmalloc_large(size, alignment, arenas[0]);
-	}
-}
-
-// Replacement for malloc_usable_size. Returns the actual amount of space
-// allocated to a given pointer which could be greater than the requested size
-size_t ffmalloc_usable_size(const void* ptr) {
-	// The man page for this function is vague on how this function handles
-	// errors other than being explicit that a NULL value for ptr should
-	// return zero
-	if(ptr == NULL) {
-		return 0;
-	}
-
-	// Follow above logic and any invalid pointer will result in size of
-	// zero and errno will not be set
-	struct pagepool_t* pool = find_pool_for_ptr((const byte*)ptr);
-	if (pool == NULL) {
-		return 0;
-	}
-
-	// Was this a large or small allocation pool?
-	if (pool->nextFreeIndex < SIZE_MAX - 1) {
-		// Large allocation
-		size_t index = 0;
-		return find_large_ptr((const byte*)ptr, pool, &index);
-	}
-	else if(pool->nextFreeIndex == SIZE_MAX - 1) {
-		// Jumbo allocation
-		return pool->end - pool->start;
-	}
-	else {
-		// Small allocation
-		struct pagemap_t* pageMap = NULL;
-
-		// Find the specific page and index of this allocation
-		int64_t index = find_small_ptr((const byte*)ptr, pool, &pageMap);
-
-		if (index < 0) {
-			// Not a valid pointer
-			return 0;
-		}
-
-		// Mask out the low order status bits before returning size
-		return (pageMap->allocSize & ~SEVEN64);
-	}
-}
-
-/*** Deprecated malloc API - only included when not using FF prefix ***/
-#ifndef USE_FF_PREFIX
-// Allocates size bytes. The returned address will be page size aligned
-// Equivalent to memalign(PAGE_SIZE, size)
-void* valloc(size_t size) {
-	return ffmemalign(PAGE_SIZE, size);
-}
-
-// Rounds size up to a multiple of PAGE_SIZE. Returned address will be
-// page size aligned
-void* pvalloc(size_t size) {
-	if(size >= SIZE_MAX - PAGE_SIZE) {
-		return NULL;
-	}
-	return ffmemalign(PAGE_SIZE, ALIGN_TO(size, PAGE_SIZE));
-}
-#endif
-
-/*** FFMalloc extended API ***/
-
-// Duplicates the string into memory allocated by ffmalloc. The caller is
-// responsible for calling fffree
-char* ffstrdup(const char* s) {
-	if(s == NULL) {
-		return NULL;
-	}
-
-	size_t length = strlen(s) + 1;
-	char* newString = (char*)ffmalloc(length);
-	if(newString != NULL) {
-		// Visual C does *not* like strcpy, but we need to be portable so get the
-		// compiler to quit complaining just this one time
-#pragma warning( push )
-#pragma warning( disable : 4996 )
-		strcpy(newString, s);
-#pragma warning( pop )
-		return newString;
-	}
-
-	errno = ENOMEM;
-	return NULL;
-}
-
-// Duplicates the first n characters of the string into memory allocated by
-// ffmalloc. The caller is responsible for calling fffree
-char* ffstrndup(const char* s, size_t n) {
-	if(s == NULL || n == SIZE_MAX) {
-		return NULL;
-	}
-
-	char* newString = (char*)ffmalloc(n + 1);
-	if(newString != NULL) {
-#pragma warning( push )
-#pragma warning( disable : 4996 )
-		strncpy(newString, s, n);
-#pragma warning( pop )
-
-		// strncpy may not null terminate the string if there is no
-		// null byte in the first n characters of s
-		newString[n] = '\0';
-		return newString;
-	}
-
-	errno = ENOMEM;
-	return NULL;
-}
-
-#ifdef FF_PROFILE
-// Gets usage statistics for ffmalloc excluding custom arenas
-ffresult_t ffget_statistics(ffprofile_t* profile) {
-	if(profile == NULL) {
-		return FFBAD_PARAM;
-	}
-
-	memcpy(profile, &arenas[0]->profile, sizeof(ffprofile_t));
-
-	return FFSUCCESS;
-}
-
-// Gets usage statistics for a custom arena
-ffresult_t ffget_arena_statistics(ffprofile_t* profile, ffarena_t arenaKey) {
-	// Ensure that the arena key is in range and exists
-	if(arenaKey == 0 || arenaKey >= MAX_ARENAS || arenas[arenaKey] == NULL) {
-		return FFBAD_ARENA;
-	}
-
-	if(profile == NULL) {
-		return FFBAD_PARAM;
-	}
-
-	memcpy(profile, &arenas[arenaKey]->profile, sizeof(ffprofile_t));
-
-	return FFSUCCESS;
-}
-
-// Gets combined usage statistics for all arenas active or destroyed plus the
-// default allocation arena. Caller is responsible for freeing the returned
-// structure
-/* Not yet implemented. Need destroy_arena to save results to new global counter
-ffresult_t ffget_global_statistics(ffprofile_t* profile) {
-	if(profile == NULL) {
-		return FFBAD_PARAM;
-	}
-
-	return FFSUCCESS;
-}*/
-#endif
-
-// Creates a new allocation arena
-ffresult_t ffcreate_arena(ffarena_t* newArenaKey) {
-	// First make sure we've got some place to return this arena to
-	if(newArenaKey == NULL) {
-		return FFBAD_PARAM;
-	}
-
-	// Reserve metadata space for the arena
-	struct arena_t* newArena = (struct arena_t*)ffmetadata_alloc(sizeof(struct arena_t));
-
-	// Find a free slot in the arena array
-	for(ffarena_t i = 1; i < MAX_ARENAS; i++) {
-		if(arenas[i] == NULL) {
-			// Found a slot, try and claim it
-			if(FFAtomicCompareExchangePtr(&arenas[i], newArena, NULL)) {
-				// Slot succesfully claimed
-				ffresult_t result = create_arena(arenas[i]);
-				if(result == FFSUCCESS) {
-					*newArenaKey = i;
-				}
-				return result;
-			}
-		}
-	}
-
-	// No free slots left to put a new arena in
-	ffmetadata_free(newArena, sizeof(struct arena_t));
-	return FFMAX_ARENAS;
-}
-
-// Frees all memory allocated from a specific arena and then destroys the arena
-ffresult_t ffdestroy_arena(ffarena_t arena) {
-	// Ensure that the arena key is in range and exists. Also note that
-	// destroying the default arena is not allowed
-	if(arena == 0 || arena >= MAX_ARENAS || arenas[arena] == NULL) {
-		return FFBAD_ARENA;
-	}
-
-	// No attempt at thread safety - caller is responsible for ensuring
-	// this is called only once when finished
-	destroy_arena(arenas[arena]);
-	arenas[arena] = NULL;
-
-	return FFSUCCESS;
-}
-
-// Allocates memory with the same algorithm as ffmalloc but from a custom arena
-ffresult_t ffmalloc_arena(ffarena_t arenaKey, void** ptr, size_t size) {
-	struct arena_t* arena = NULL;
-
-	// Ensure the out pointer parameter is valid
-	if(ptr == NULL) {
-		return FFBAD_PARAM;
-	}
-
-	// Check that the arena key is in range and exists. Technically,
-	// nothing bad would happen by allowing allocation out of the default
-	// arena here. However, it would violate the spirit of the API which is
-	// that the arena key should be generated by ffcreate_arena. Second, 
-	// the caller should not depend on the default arena being zero since
-	// that's an internal implementation detail. Lastly, it would violate 
-	// principle of least surprise since zero definitely can't be used with
-	// ffdestroy_arena and the caller may be confused that zero can be
-	// allocated from but not destroyed
-	if(arenaKey == 0 || arenaKey >= MAX_ARENAS || arenas[arenaKey] == NULL) {
-		return FFBAD_ARENA;
-	}
-	else {
-		arena = arenas[arenaKey];
-	}
-	
-	// Prohibit zero byte allocations. It can't be realloc'ed to bigger
-	// than 8 anyways without a copy so just ask for what you need to start
-	// Also protect against overflow due to alignment below
-	if(size == 0 || size > SIZE_MAX - MIN_ALIGNMENT) {
-		return FFBAD_PARAM;
-	}
-
-#ifdef FF_PROFILE
-	FFAtomicIncrement(arena->profile.mallocCount);
-	FFAtomicAdd(arena->profile.totalBytesRequested, size);
-#endif
-	// Round size up to a multiple of 8 if needed
-	size = ALIGN_SIZE(size);
-
-	// Allocate from the right pool in the requested arena
-	if(size <= HALF_PAGE) {
-		*ptr = ffmalloc_small(size, arena);
-	}
-	else if(size < (POOL_SIZE - HALF_PAGE)) {
-		*ptr = ffmalloc_large(size, MIN_ALIGNMENT, arena);
-	}
-	else {
-		*ptr = ffmalloc_jumbo(size, arena);
-	}
-
-	return *ptr == NULL ? FFNOMEM : FFSUCCESS;
-}
-
-
-//#ifdef _DEBUG
-/**
- Frees all data and metadata allocated by an ffmalloc family function
- */
-void fffree_all() {
-	for (size_t l1 = 0; l1 < STEM_COUNT; l1++) {
-		if (poolTree.stems[l1] != NULL) {
-			for (size_t l2 = 0; l2 < LEAVES_PER_STEM; l2++) {
-				struct radixleaf_t* leaf = poolTree.stems[l1]->leaves[l2];
-				if (leaf != NULL) {
-					for (size_t l3 = 0; l3 < POOLS_PER_LEAF; l3++) {
-						if(leaf->poolStart[l3] != NULL) {
-							os_free(leaf->poolStart[l3]->start);
-							os_free(leaf->poolStart[l3]->tracking.pageMaps);
-						}
-					}
-				}
-			}
-		}
-	}
-}
-
-void ffdump_pool_details() {
-	printf("alloc count: %ld\n", os_alloc_count);
-	printf("alloc amount %ld\n", os_alloc_total);
-	printf("free count %ld\n", os_free_count);
-	for (size_t l1 = 0; l1 < STEM_COUNT; l1++) {
-		if (poolTree.stems[l1] != NULL) {
-			for (size_t l2 = 0; l2 < LEAVES_PER_STEM; l2++) {
-				struct radixleaf_t* leaf = poolTree.stems[l1]->leaves[l2];
-				if (leaf != NULL) {
-					for (size_t l3 = 0; l3 < POOLS_PER_LEAF; l3++) {
-						if (leaf->poolStart[l3] != NULL) {
-							size_t released = 0;
-							size_t pending = 0;
-							size_t inuse = 0;
-							size_t tcache = 0;
-							struct pagepool_t* pool = leaf->poolStart[l3];
-							//printf("Pool start: %p ", pool->start);
-							if (pool->nextFreeIndex == SIZE_MAX) {
-								byte* lastFreePage = pool->end < pool->nextFreePage ? pool->end : pool->nextFreePage;
-								for (size_t x = 0; x < (lastFreePage - pool->start) / PAGE_SIZE; x++) {
-									if ((pool->tracking.pageMaps[x].allocSize & THREE64) == 3) {
-										released++;
-									}
-									else if ((pool->tracking.pageMaps[x].allocSize & THREE64) == 1) {
-										pending++;
-									}
-									else if (pool->tracking.pageMaps[x].allocSize == 0) {
-										tcache++;
-									}
-									else {
-										inuse++;
-									}
-								}
-								size_t unassigned = (pool->end - lastFreePage) / PAGE_SIZE;
-								//if (pending > 0 || inuse > 0 || unassigned > 0 || tcache > 0) {
-									printf("Small pool addr: %p with %ld pages unassigned, ", pool->start, unassigned);
-									printf("%ld pending free, ", pending);
-									printf("%ld freed, ", released);
-									printf("%ld in tcache reserve, ", tcache);
-									printf("%ld in use\n", inuse);
-								//}
-									if (released == 1024) {
-										printf("startInUse: %p endInUse: %p\n", pool->startInUse, pool->endInUse);
-									}
-							}
-							else if (pool->nextFreeIndex == SIZE_MAX - 1) {
-								printf("Jumbo pool start: %p\n", pool->start);
-							}
-							else {
-								printf("Large pool start: %p with %ld bytes free\n", pool->start, (uintptr_t)pool->end - pool->tracking.allocations[pool->nextFreeIndex]);
-							}
-						}
-					}
-				}
-			}
-		}
-	}
-}
-
-/**
- Gets the number of pools currently active
- @return The number of pools ffmalloc has currently in use
- */
-size_t ffget_pool_count() {
-	return poolCount;
-}
-
-#ifdef FF_PROFILE
-void ffprint_stats_wrapper(void) {
-	ffprint_statistics(stderr);
-}
-
-#ifdef _WIN64
-void ffprint_statistics(FILE * const dest) {
-	ffprofile_t* stats = &arenas[0]->profile;
-	fprintf(dest, "*** FFMalloc Stats ***\n");
-    fprintf(dest, "Malloc:         %lld\n", stats->mallocCount);
-    fprintf(dest, "Realloc:        %lld\n", stats->reallocCount);
-    fprintf(dest, "Calloc:         %lld\n", stats->callocCount);
-    fprintf(dest, "Free:           %lld\n", stats->freeCount);
-    fprintf(dest, "POSIX Align:    %lld\n", stats->posixAlignCount);
-    fprintf(dest, "Alloc Align:    %lld\n", stats->allocAlignCount);
-    fprintf(dest, "TotBytes Reqst: %lld\n", stats->totalBytesRequested);
-    fprintf(dest, "TotBytes Alloc: %lld\n", stats->totalBytesAllocated);
-    fprintf(dest, "CurBytes Alloc: %lld\n", stats->currentBytesAllocated);
-    fprintf(dest, "MaxBytes Alloc: %lld\n", stats->maxBytesAllocated);
-    fprintf(dest, "CurOSBytes Map: %lld\n", stats->currentOSBytesMapped);
-    fprintf(dest, "MaxOSBytes Map: %lld\n\n", stats->maxOSBytesMapped);
-}
-#endif
-
-
-#ifdef FF_PROFILE
-void ffprint_statistics(FILE * const dest) {
-	ffprofile_t* stats = &arenas[0]->profile;
-	fprintf(dest, "*** FFMalloc Stats ***\n");
-	fprintf(dest, "Malloc:         %ld\n", stats->mallocCount);
-	fprintf(dest, "Realloc:        %ld\n", stats->reallocCount);
-#ifdef FF_GROWLARGEREALLOC
-	fprintf(dest, "Realloc Grow:   %ld\n", stats->reallocCouldGrow);
-#endif
-	fprintf(dest, "Calloc:         %ld\n", stats->callocCount);
-	fprintf(dest, "Free:           %ld\n", stats->freeCount);
-	fprintf(dest, "POSIX Align:    %ld\n", stats->posixAlignCount);
-	fprintf(dest, "Alloc Align:    %ld\n", stats->allocAlignCount);
-	fprintf(dest, "TotBytes Reqst: %ld\n", stats->totalBytesRequested);
-	fprintf(dest, "TotBytes Alloc: %ld\n", stats->totalBytesAllocated);
-	fprintf(dest, "CurBytes Alloc: %ld\n", stats->currentBytesAllocated);
-	fprintf(dest, "MaxBytes Alloc: %ld\n", stats->maxBytesAllocated);
-	fprintf(dest, "CurOSBytes Map: %ld\n", stats->currentOSBytesMapped);
-	fprintf(dest, "MaxOSBytes Map: %ld\n", stats->maxOSBytesMapped);
-
-	struct rusage usage;
-	getrusage(RUSAGE_SELF, &usage);
-	fprintf(dest, "Linux MaxRSS:   %ld\n\n", usage.ru_maxrss * 1024L);
-}
-#endif
-
-// Prints current usage statistics to the specified file each time the cummulative
-// number of calls to malloc/calloc/realloc (that caused a malloc) is a multiple
-// of interval
-void ffprint_usage_on_interval(FILE * const dest, unsigned int interval) {
-	usagePrintFile = dest;
-	if (interval == 0) {
-		usagePrintInterval = INT_MAX;
-	}
-	else {
-		usagePrintInterval = interval;
-	}
-}
-
-static void print_current_usage() {
-	// Should print: OS mem, current physical bytes, current alloc bytes, free bytes need release
-	// free bytes awaiting assign
-	size_t releasedPages = 0;
-	size_t pendingReleasePages = 0;
-	size_t pendingReleaseLargeBytes = 0;
-	size_t tcachePages = 0;
-	size_t inusePages = 0;
-	size_t unassignedPages = 0;
-	size_t unassignedLargeBytes = 0;
-	size_t currentOSReported = 0;
-	size_t smallFreeOnInUsePage = 0;
-	size_t poolMetadata = 0;
-	size_t smallPageWaste = 0;
-	size_t smallPoolCount = 0;
-	size_t largePoolCount = 0;
-	size_t jumboPoolCount = 0;
-	size_t largePoolAssigned = 0;
-	size_t numEmptyLargePool = 0;
-
-	if (usagePrintFile != NULL && (arenas[0]->profile.mallocCount % usagePrintInterval == 0)) {
-		for (size_t l1 = 0; l1 < STEM_COUNT; l1++) {
-			if (poolTree.stems[l1] != NULL) {
-				for (size_t l2 = 0; l2 < LEAVES_PER_STEM; l2++) {
-					struct radixleaf_t* leaf = poolTree.stems[l1]->leaves[l2];
-					if (leaf != NULL) {
-						for (size_t l3 = 0; l3 < POOLS_PER_LEAF; l3++) {
-							if (leaf->poolStart[l3] != NULL) {
-								struct pagepool_t* pool = leaf->poolStart[l3];
-								if (pool->nextFreeIndex == SIZE_MAX) {
-									// Small pool
-									size_t poolInUsePages = 0;
-									size_t smallNeedsReleasePages = 0;
-									smallPoolCount++;
-									poolMetadata += POOL_SIZE / PAGE_SIZE * sizeof(struct pagemap_t);
-									byte* lastFreePage = pool->end < pool->nextFreePage ? pool->end : pool->nextFreePage;
-									for (size_t x = 0; x < (lastFreePage - pool->start) / PAGE_SIZE; x++) {
-										if ((pool->tracking.pageMaps[x].allocSize & THREE64) == 3) {
-											releasedPages++;
-										}
-										else if ((pool->tracking.pageMaps[x].allocSize & THREE64) == 1) {
-											pendingReleasePages++;
-										}
-										else if (pool->tracking.pageMaps[x].allocSize == 0) {
-											tcachePages++;
-										}
-										else {
-											inusePages++;
-											poolInUsePages++;
-											size_t allocSize = (pool->tracking.pageMaps[x].allocSize & ~SEVEN64);
-											size_t maxAlloc = PAGE_SIZE / allocSize;
-											smallPageWaste += PAGE_SIZE - (maxAlloc * allocSize);
-											if (allocSize >= 64) {
-												size_t count = FFPOPCOUNT64(pool->tracking.pageMaps[x].bitmap.single);
-												smallFreeOnInUsePage += ((maxAlloc - count) * allocSize);
-												if(count == 0) {
-													smallNeedsReleasePages++;
-												}
-											}
-											else {
-												size_t bitmapCount = (maxAlloc & SIXTYTHREE64) ?
-													(maxAlloc >> 6) + 1 : (maxAlloc >> 6);
-												size_t totalCount = 0;
-												for (size_t index = 0; index < bitmapCount; index++) {
-													size_t count = FFPOPCOUNT64(pool->tracking.pageMaps[x].bitmap.array[index]);
-													totalCount += count;
-													if (index != (bitmapCount - 1)) {
-														smallFreeOnInUsePage += (64 - count) * allocSize;
-													}
-													else {
-														size_t lastBitmapMax = maxAlloc - ((bitmapCount - 1) * 64);
-														smallFreeOnInUsePage += (lastBitmapMax - count) * allocSize;
-													}
-												}
-												if(totalCount == 0) {
-													smallNeedsReleasePages++;
-												}
-											}
-										}
-									}
-									unassignedPages += (pool->end - lastFreePage) / PAGE_SIZE;
-									/*if(unassignedPages == 0 && smallNeedsReleasePages >= 1024) {
-										fprintf(stderr, "Small pool empty: %p\n", pool);
-										abort();
-									}*/
-								}
-								else if (pool->nextFreeIndex == SIZE_MAX - 1) {
-									// Jumbo pool
-									jumboPoolCount++;
-								}
-								else {
-									// Large pool
-									largePoolCount++;
-									poolMetadata += (POOL_SIZE >> 20) * PAGE_SIZE;
-									size_t thisPoolInUse = 0;
-									for (size_t index = 0; index < pool->nextFreeIndex; index++) {
-										if ((pool->tracking.allocations[index] & 2) == 2) {
-											// Freed and (at least partially) returned
-										}
-										else if ((pool->tracking.allocations[index] & 3) == 1) {
-											// Freed pending return
-											pendingReleaseLargeBytes += ((pool->tracking.allocations[index + 1] & ~SEVEN64) -
-												(pool->tracking.allocations[index] & ~SEVEN64));
-										}
-										else {
-											thisPoolInUse += (pool->tracking.allocations[index + 1] & ~SEVEN64) - pool->tracking.allocations[index];	
-										}
-									}
-									if(thisPoolInUse == 0) {
-										numEmptyLargePool++;
-										/*fprintf(stderr, "Empty pool: %p\n", pool);
-										if(numEmptyLargePool > 4) {
-											abort();
-										}*/
-									}
-									largePoolAssigned += thisPoolInUse;
-
-									if ((uintptr_t)pool->end > pool->tracking.allocations[pool->nextFreeIndex]) {
-										unassignedLargeBytes += ((uintptr_t)pool->end - (pool->tracking.allocations[pool->nextFreeIndex] & ~SEVEN64));
-									}
-								}
-							}
-						}
-					}
-				}
-			}
-		}
-
-#ifdef _WIN64
-		PROCESS_MEMORY_COUNTERS pmc;
-		if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
-			currentOSReported = pmc.PagefileUsage;
-			peakOSReported = pmc.PeakPagefileUsage;
-		}
-		char* fmtString = "%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld\n";
-#else
-		// This all is only valid so long as large OS pages are not supported
-		FILE* stat = fopen("/proc/self/statm", "r");
-		if (stat) {
-			fclose(stat);
-			currentOSReported *= 4096;
-		}
-		char* fmtString = "%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n";
-#endif
-
-		fprintf(usagePrintFile, fmtString, //peakOSReported,
-			arenas[0]->profile.mallocCount,
-			arenas[0]->profile.reallocCount,
-			currentOSReported,
-			arenas[0]->profile.currentOSBytesMapped, 
-			arenas[0]->profile.currentBytesAllocated,
-			poolMetadata,
-			smallPageWaste,
-			smallFreeOnInUsePage,
-			pendingReleasePages * PAGE_SIZE, 
-			pendingReleaseLargeBytes,
-			(unassignedPages + tcachePages) * PAGE_SIZE, 
-			unassignedLargeBytes,
-			largePoolAssigned,
-			smallPoolCount, largePoolCount, jumboPoolCount,
-			numEmptyLargePool);
-	}
-}
-#endif
+// FFMalloc - an experimental alternative memory allocator
+// Unlike conventional allocators, maximizing space efficiency
+// is not a design goal. Instead, FFMalloc makes exploiting
+// use-after-free bugs in calling applications impossible
+// because freed memory is never reused (only released back to
+// the operating system when possible). FFMalloc depends on the
+// extensive virtual address space available on 64-bit operating
+// systems and is unsuitable for a 32-bit OS
+
+#ifdef _WIN64
+#include <SDKDDKVer.h>
+#define WIN32_LEAN_AND_MEAN             // Exclude rarely-used stuff from Windows headers
+
+#include <Windows.h>
+#endif
+
+/*** Compilation control ***/
+// If the target application is single threaded then defining
+// FFSINGLE_THREADED will remove threading support which slightly
+// reduces the library size but also simplifies debugging.
+// On Windows, FFSINGLE_THREADED must be defined if FFmalloc is
+// compiled as a static library. Thread safety is only supported when
+// compiled as a DLL
+#if defined(_WIN64) && !defined(_WINDLL)
+#define FFSINGLE_THREADED
+#endif
+
+// To include statistics collection in the library, define
+// FF_PROFILE. There is a small size and time cost to doing so
+//#define FF_PROFILE
+
+// On x86_64 allocation alignment is usually 16-byte. However, this is only
+// required to support certain SSE instructions. If those are not used then
+// alignment can be 8-byte and therefore more efficient. Pointers don't seem
+// to ever require 16-byte allignment and so 8-byte alignment will always be 
+// used for allocations of 8 bytes or less. This is backed up in practice by
+// TCMalloc. To enable 8-byte alignment, define FF_EIGHTBYTEALIGN during
+// library compilation
+//#define FF_EIGHTBYTEALIGN
+
+/*** Headers ***/
+#include "ffmalloc.h"
+
+#include <stddef.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <stdbool.h>
+#include <pthread.h>
+#include <signal.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <sys/ioctl.h>
+#include <math.h>
+
+#if defined(__x86_64__)
+#include <immintrin.h>
+#elif defined(__aarch64__)
+#include <arm_neon.h>
+#endif
+
+#ifdef _WIN64
+#ifdef FF_PROFILE
+#include <Psapi.h>
+#endif
+#else
+#include <unistd.h>
+#include <sys/mman.h>
+#include <limits.h>
+#include <errno.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <linux/userfaultfd.h>
+
+#ifndef FFSINGLE_THREADED
+#include <sched.h>
+#include <pthread.h>
+#endif
+#ifdef FF_PROFILE
+#include <sys/time.h>
+#include <sys/resource.h>
+#endif
+
+// Building with FF_USDT adds static probes to the sweep for tools such as
+// bpftrace or perf. It needs sys/sdt.h from systemtap
+#ifdef FF_USDT
+#include <sys/sdt.h>
+#define FFPROBE0(NAME)                DTRACE_PROBE(hushvac, NAME)
+#define FFPROBE2(NAME, A, B)          DTRACE_PROBE2(hushvac, NAME, A, B)
+#define FFPROBE5(NAME, A, B, C, D, E) DTRACE_PROBE5(hushvac, NAME, A, B, C, D, E)
+#else
+#define FFPROBE0(NAME)
+#define FFPROBE2(NAME, A, B)
+#define FFPROBE5(NAME, A, B, C, D, E)
+#endif
+
+// Caution - defining this symbol allows cross compilation on older Linuxes
+// however running on those kernels risks ffmalloc overwriting other
+// memory allocations. ffmalloc is only intended for Linux kernel 4.17 or later
+#ifndef MAP_FIXED_NOREPLACE
+#define MAP_FIXED_NOREPLACE    0x100000
+#endif
+
+// The mbind policy is only declared by libnuma's headers, and prefaulting
+// with madvise needs Linux 5.14 or later
+#ifndef MPOL_PREFERRED
+#define MPOL_PREFERRED         1
+#endif
+#ifndef MADV_POPULATE_WRITE
+#define MADV_POPULATE_WRITE    23
+#endif
+#endif
+
+// MAP_POPULATE is Linux-specific.
+#ifndef MAP_POPULATE
+#define MAP_POPULATE 0
+#endif
+
+typedef unsigned char byte;
+
+/*** Library Constants ***/
+// GCC and Visual C++ disagree on how many bits "long" is. Define
+// key constants to make sure bitwise operations aren't truncated
+#define ONE64        UINT64_C(1)
+#define TWO64        UINT64_C(2)
+#define THREE64      UINT64_C(3)
+#define FOUR64       UINT64_C(4)
+#define SEVEN64      UINT64_C(7)
+#define EIGHT64      UINT64_C(8)
+#define FIFTEEN64    UINT64_C(15)
+#define SIXTYTHREE64 UINT64_C(63)
+
+// The maximum size of a single memory pool. Must be a power of
+// two greater than or equal to either 1MB or the size of a page if
+// large (2MB or 1GB) pages are used instead of 4KB
+#define POOL_SIZE_BITS 21
+#define POOL_SIZE (ONE64 << POOL_SIZE_BITS)
+
+// The size of a single page of memory from the OS
+#define PAGE_SIZE UINT64_C(4096)
+
+// Half of an OS memory page
+#define HALF_PAGE UINT64_C(2048)
+
+// The number of pages to assign from a pool to a thread cache
+// when a thread cache is out of free pages. Must be an integral
+// divisor of (POOL_SIZE / PAGE_SIZE)
+#define PAGES_PER_REFILL 128
+
+// The minimum number of consecutive pages ready to return to the
+// OS required before calling munmap/VirtualFree. Higher values
+// help mitigate against VMA growth on Linux and reduce expensive
+// system calls on either OS at the cost of holding onto unneeded
+// pages longer than strictly necessary.
+#define MIN_PAGES_TO_FREE 1
+
+// Freed large extents that a sweep proves unreferenced are handed out again
+// from one list per size class, starting at HALF_PAGE. Each power of two is
+// split into 1 << LARGE_REUSE_STEPS classes. Requests are rounded up to a
+// class boundary and extents are listed under the class their size rounds
+// down to, so every extent on a request's own list fits it
+#define LARGE_REUSE_SHIFT 11
+#define LARGE_REUSE_STEPS 3
+#define LARGE_REUSE_CLASSES ((POOL_SIZE_BITS - LARGE_REUSE_SHIFT + 1) << LARGE_REUSE_STEPS)
+
+// The maximum number of arenas allowed to exist at the same time
+#define MAX_ARENAS 256
+
+// The maximum number of large allocation pool lists allowed per
+// arena regardless of processor count
+#define MAX_LARGE_LISTS 8
+
+// The maximum number of large allocation pools per each arena per
+// CPU list. In other words, each arena including the default will
+// have at most MAX_LARGE_LISTS * MAX_POOLS_PER_LIST large pools in
+// use at any one time
+#define MAX_POOLS_PER_LIST 16
+
+// The maximum number of NUMA nodes given their own pools in each arena.
+// The large pool lists are divided between the nodes, so this should divide
+// MAX_LARGE_LISTS. Nodes beyond it share the pools of a lower one
+#define MAX_NUMA_NODES 4
+
+// The number of address bits covered by the pool map. Current x86_64 and
+// AArch64 hardware supports only 48-bits in a pointer. Depending on build
+// and processor, Windows might only support 44-bit pointers, but go ahead
+// and pretend it will always use 48 too
+#define ADDRESS_BITS 48
+
+// The pool map has one slot per POOL_SIZE of address space
+#define POOL_MAP_SLOTS (ONE64 << (ADDRESS_BITS - POOL_SIZE_BITS))
+
+#ifdef FFSINGLE_THREADED
+// For a single threaded process, making lots of small allocations
+// from the page pool to the one-and-only thread cache is pointless
+#undef PAGES_PER_REFILL
+#define PAGES_PER_REFILL (POOL_SIZE / PAGE_SIZE) 
+
+// When single threaded, having multiple parallel large pool lists has
+// no advantage and wastes resources
+#undef MAX_LARGE_LISTS
+#define MAX_LARGE_LISTS 1
+
+// Likewise, the one thread only ever allocates from one node at a time
+#undef MAX_NUMA_NODES
+#define MAX_NUMA_NODES 1
+#endif
+
+/*** Compiler compatibility ***/
+#ifdef _WIN64
+#define __attrUnusedParam
+#else
+// Disable warning about unused size parameter in non-profiling mode
+#define __attrUnusedParam __attribute__((unused))
+#endif
+
+/*** Alignment control constants and macros ***/
+
+#ifdef FF_EIGHTBYTEALIGN
+// Defines the minimum alignment
+#define MIN_ALIGNMENT 8
+
+// The number of small allocation bins in a thread cache when using 8-byte 
+// alignment
+#define BIN_COUNT 45
+
+// Used by init_tcache to indicate the inflection point between evenly spaced
+// bins and bins spaced by maximum packing
+#define BIN_INFLECTION 19
+
+// Rounds requested allocation size up to the next multiple of 8
+#define ALIGN_SIZE(SIZE) ((SIZE + SEVEN64) & ~SEVEN64)
+
+// Select the bin to allocate from based on the size. Below 208 bytes, bins are 
+// every 8 bytes. Above 208, bins are unevenly spaced based on the maximal size
+// that divides into PAGE_SIZE for a given number of slots then rounded down to 
+// the nearest multiple of 8
+#define GET_BIN(SIZE) (SIZE <= 208 ? BIN_COUNT - (SIZE >> 3) : PAGE_SIZE / SIZE)
+
+#else
+// Defines the minimum alignment
+#define MIN_ALIGNMENT 16
+
+// The number of small allocation bins in a thread cache when using 16-byte
+// alignment
+#define BIN_COUNT 32
+
+// Used by init_tcache to indicate the inflection point between evenly spaced
+// bins and bins spaced by maximum packing
+#define BIN_INFLECTION 13
+
+// Rounds requested allocation size up to the next multiple of 16
+#define ALIGN_SIZE(SIZE) (SIZE <= 8 ? 8 : ((SIZE + FIFTEEN64) & ~FIFTEEN64))
+
+// Select the bin to allocate from based on the size. Allocations smaller than
+// eight bytes always come from the eight byte bin. Otherwise, below 304 bytes,
+// bins are every 16 bytes. Above 304, bins are unevenly spaced based on the 
+// maximal size that divides into PAGE_SIZE for a given number of slots then 
+// rounded down to the nearest multiple of 16
+#define GET_BIN(SIZE) (SIZE <= 8 ? 0 : SIZE <= 304 ? BIN_COUNT - (SIZE >> 4) : PAGE_SIZE / SIZE)
+#endif
+
+#define ALIGN_TO(VALUE, ALIGNMENT) ((VALUE + (ALIGNMENT - 1)) & ~(ALIGNMENT - 1))
+
+// Size and alignment of a cache line, for metadata walked in arrays
+#define CACHE_LINE_SIZE UINT64_C(64)
+#ifdef _WIN64
+#define CACHE_ALIGNED __declspec(align(64))
+#else
+#define CACHE_ALIGNED __attribute__((aligned(64)))
+#endif
+
+
+/*** OS Intrinsic Translation Macros ***/
+
+#ifdef _WIN64
+// Counts the number of 1s in an integer. Useful for checking if an integer is
+// a power of two
+#define FFPOPCOUNT64 _mm_popcnt_u64
+
+// Counts the number of leading (most significant) zeros in a 64-bit integer.
+// Used to round up sizes to a power of two
+#define FFCOUNTLEADINGZEROS64 __lzcnt64
+
+// Counts the number of trailing (least significant) zeros in a 64-bit
+// integer. Used to find the first set bit of a bitmap word
+#define FFCOUNTTRAILINGZEROS64 _tzcnt_u64
+#else
+#define FFPOPCOUNT64 __builtin_popcountl
+#define FFCOUNTLEADINGZEROS64 __builtin_clzl
+#define FFCOUNTTRAILINGZEROS64 __builtin_ctzl
+#endif
+
+
+/*** OS Threading Translation Macros ***/
+
+// These macros substitute in the correct OS specific synchronization
+// functions. Or when the library is being compiled for single threading,
+// the macros disable the synchronization calls entirely eliminating the
+// need for repetative #ifdefs
+#ifdef FFSINGLE_THREADED
+// When single threaded on any OS, null out all synchronization calls
+#define FFEnterCriticalSection(LOCK)
+#define FFLeaveCriticalSection(LOCK)
+#define FFTryEnterCriticalSection(LOCK) 1
+#define FFInitializeCriticalSection(LOCK)
+#define FFDeleteCriticalSection(LOCK)
+
+// Atomic operations redefined as basic C statements
+#define FFAtomicAnd(DEST, VALUE)                DEST &= VALUE
+#define FFAtomicOr(DEST, VALUE)                 DEST |= VALUE
+#define FFAtomicFetchOr(DEST, VALUE)            ({ uint64_t _prev = DEST; DEST |= VALUE; _prev; })
+#define FFAtomicFetchAnd(DEST, VALUE)           ({ uint64_t _prev = DEST; DEST &= VALUE; _prev; })
+#define FFAtomicAdd(DEST, VALUE)                DEST += VALUE
+#define FFAtomicSub(DEST, VALUE)                DEST -= VALUE
+#define FFAtomicIncrement(DEST)                 DEST++
+#define FFAtomicExchangeAdvancePtr(DEST, VALUE) DEST; DEST += VALUE
+#define FFAtomicCompareExchangePtr(DEST, NEW, OLD) ((*DEST = *DEST == OLD ? NEW : *DEST) == NEW)
+
+// "Thread" local storage functions
+#define FFTlsAlloc(INDEX, FUNC) get_free_arena_index(&INDEX)
+#define FFTlsFree(INDEX) free_arena_index(INDEX)
+#define TLS_CLEANUP_CALLBACK NULL
+
+// Swallow the lock variable declaration
+#define FFLOCK(NAME)
+#define FFLOCKSTATIC(NAME)
+
+// "Thread" local storage key type
+#define FFTLSINDEX size_t
+
+// No threads so no need for volatile variables
+#define volatile
+
+#elif defined(_WIN64)
+// Synchronization functions on Windows
+#define FFEnterCriticalSection(LOCK)      EnterCriticalSection(LOCK)
+#define FFLeaveCriticalSection(LOCK)      LeaveCriticalSection(LOCK)
+#define FFTryEnterCriticalSection(LOCK)   TryEnterCriticalSection(LOCK)
+#define FFInitializeCriticalSection(LOCK) InitializeCriticalSection(LOCK)
+#define FFDeleteCriticalSection(LOCK)     DeleteCriticalSection(LOCK)
+
+// Atomic operations
+#define FFAtomicAnd(DEST, VALUE)                   InterlockedAnd64(&DEST, VALUE)
+#define FFAtomicOr(DEST, VALUE)                    InterlockedOr64(&DEST, VALUE)
+#define FFAtomicFetchOr(DEST, VALUE)               InterlockedOr64(&DEST, VALUE)
+#define FFAtomicFetchAnd(DEST, VALUE)              InterlockedAnd64(&DEST, VALUE)
+#define FFAtomicAdd(DEST, VALUE)                   InterlockedAdd64(&DEST, VALUE)
+#define FFAtomicSub(DEST, VALUE)                   InterlockedAdd64(&(LONG64)DEST, -(LONG64)(VALUE))
+#define FFAtomicIncrement(DEST)                    InterlockedIncrement64(&DEST);
+#define FFAtomicExchangeAdvancePtr(DEST, VALUE)    InterlockedExchangeAdd64(&(uintptr_t)DEST, VALUE)
+#define FFAtomicCompareExchangePtr(DEST, NEW, OLD) (InterlockedCompareExchangePointer(DEST, NEW, OLD) == OLD)
+
+// Thread local storage functions
+#define FFTlsAlloc(INDEX, FUNC) ((INDEX = TlsAlloc()) != TLS_OUT_OF_INDEXES)
+#define FFTlsFree(INDEX) TlsFree(INDEX)
+#define TLS_CLEANUP_CALLBACK NULL
+
+// Synchronization types
+#define FFLOCK(NAME)       CRITICAL_SECTION NAME;
+#define FFLOCKSTATIC(NAME) static CRITICAL_SECTION NAME;
+
+// Thread local storage key type
+#define FFTLSINDEX DWORD 
+
+#else
+// Synchronization functions on Linux
+#define FFEnterCriticalSection(LOCK)      pthread_mutex_lock(LOCK)
+#define FFLeaveCriticalSection(LOCK)      pthread_mutex_unlock(LOCK)
+#define FFTryEnterCriticalSection(LOCK)   (pthread_mutex_trylock(LOCK) == 0)
+#define FFInitializeCriticalSection(LOCK) pthread_mutex_init(LOCK, NULL)
+#define FFDeleteCriticalSection(LOCK)     pthread_mutex_destroy(LOCK)
+
+// Atomic Operations
+#define FFAtomicAnd(DEST, VALUE)                   __sync_and_and_fetch(&DEST, VALUE)
+#define FFAtomicOr(DEST, VALUE)                    __sync_or_and_fetch(&DEST, VALUE)
+#define FFAtomicFetchOr(DEST, VALUE)               __sync_fetch_and_or(&DEST, VALUE)
+#define FFAtomicFetchAnd(DEST, VALUE)              __sync_fetch_and_and(&DEST, VALUE)
+#define FFAtomicAdd(DEST, VALUE)                   __sync_add_and_fetch(&DEST, VALUE)
+#define FFAtomicSub(DEST, VALUE)                   __sync_sub_and_fetch(&DEST, VALUE)
+#define FFAtomicIncrement(DEST)                    __sync_add_and_fetch(&DEST, 1)
+#define FFAtomicExchangeAdvancePtr(DEST, VALUE)    __sync_fetch_and_add(&(DEST), (byte*)VALUE)
+#define FFAtomicCompareExchangePtr(DEST, NEW, OLD) __sync_bool_compare_and_swap(DEST, OLD, NEW)
+
+// Thread local storage functions
+#define FFTlsAlloc(INDEX, FUNC) (pthread_key_create(&INDEX, FUNC) == 0)
+#define FFTlsFree(INDEX) pthread_key_delete(INDEX)
+#define TLS_CLEANUP_CALLBACK cleanup_thread
+
+// Synchronization types
+#define FFLOCK(NAME)       pthread_mutex_t NAME;
+#define FFLOCKSTATIC(NAME) static pthread_mutex_t NAME;
+
+// Thread local storage key type
+#define FFTLSINDEX pthread_key_t
+#endif
+
+/*** Metadata Structures ***/
+
+// The number of 64-bit bitmap words needed for a page of the smallest
+// allocations and for a page of maxAlloc allocations. The smallest bin holds
+// 8 byte allocations whatever MIN_ALIGNMENT is
+#define PAGE_BITMAP_WORDS (PAGE_SIZE / 8 / 64)
+#define BITMAP_WORDS(MAXALLOC) (((MAXALLOC) + SIXTYTHREE64) >> 6)
+
+// A page map holds the metadata about a page that has been
+// allocated from a small allocation page pool. The page maps of a pool
+// are one array, so each is kept to whole cache lines with the fields
+// used by malloc, free and the scan first
+struct CACHE_ALIGNED pagemap_t {
+	// The starting address of the page. Guaranteed to be page aligned
+	byte* start;
+
+	// The size of allocations on this page; always a multiple of 8
+	size_t allocSize;
+
+	// Individual allocations on the page are tracked by setting
+	// or clearing the corresponding bit in the bitmap. Sized for the
+	// smallest allocations so that no page needs a separate array
+	uint64_t bitmap[PAGE_BITMAP_WORDS];
+
+#ifdef MARK_SWEEP
+#ifdef SUB_PAGE
+    struct pagemap_t *next;
+
+    // The reclaim pass during which the page last had a free
+    volatile int lastFreeEpoch;
+
+    // The reclaim pass that last put this page on a reuse list
+    unsigned int reuseGeneration;
+
+    // The pauseGeneration when a slot was last handed out from the page
+    // by a reuse claim or by filling it for the first time
+    unsigned int volatile allocGeneration;
+
+    // Safe and unallocated slots left when the page was listed, less
+    // the ones claimed since. Lets exhausted pages drop out at once
+    size_t volatile reuseCount;
+
+	uint64_t safemap[PAGE_BITMAP_WORDS];
+#endif
+#endif
+};
+
+// Interprets the metadata allocation for a pool as either and array
+// of page maps (small allocation pools) or an array of pointers to
+// the allocations (large allocation pools)
+union tracking_t {
+	struct pagemap_t* pageMaps;
+	uintptr_t* allocations;
+#ifdef MARK_SWEEP
+    struct pagepool_t* next;
+#endif
+};
+
+// A page pool is an initially contiguous region of memory
+// from which individual pages are assigned to the thread
+// cache's bins. "Holes" in the pool will develop over time
+// when enough allocations have been freed that entire pages
+// can be returned to the OS
+struct pagepool_t {
+	// The starting address of the pool. This value is constant
+	// and is not incremented even if the initial page is freed
+	byte* start;
+
+	// The final address (exclusive) of the pool
+	byte* end;
+
+	// The starting address of the next unallocated page in the pool
+	byte* nextFreePage;
+
+	// Pool metadata - either an array of page maps or of allocation pointers
+	union tracking_t tracking;
+
+	// The index of the next pointer in a large pool to be allocated.
+	// The pointer in this slot is not yet allocated, but it
+	// is needed so that the size of the last allocated 
+	// pointer can still be computed
+	size_t nextFreeIndex;
+
+	// The address of the first page not yet freed
+	byte* startInUse;
+
+	// The address of the free page block that is continguous to the end of the pool
+	byte* endInUse;
+
+	// The arena this pool is a part of
+	struct arena_t* arena;
+
+	// The NUMA node the pool's memory is bound to
+	unsigned int node;
+
+	// Critical section used to lock certain updates on the pool
+	FFLOCK(poolLock)
+
+#if defined(MARK_SWEEP) && defined(SUB_PAGE)
+	// One bit per page of a small pool. Frees set the dirty bit so that
+	// the sweep only re-evaluates pages that changed since the last one,
+	// and the reclaimer remembers the pages it listed for reuse so they
+	// can be listed again without visiting the rest of the pool
+	uint64_t volatile dirtyPages[POOL_SIZE / PAGE_SIZE / 64];
+	uint64_t reusablePages[POOL_SIZE / PAGE_SIZE / 64];
+#endif
+#ifdef MARK_SWEEP
+	// Tells a large pool apart from an earlier one at the same address, as
+	// freed extents are only looked at again a sweep later
+	uint64_t serial;
+
+	// Set once the reclaimer has registered the pool for userfaultfd
+	// dirty tracking
+	bool wpTracked;
+
+	// Scanners working on the pool while the mutators run, and whether a
+	// mutator is releasing or moving it. See pool_scan_enter
+	int volatile scanners;
+	int volatile scanBlocked;
+
+	// Freed bytes kept resident so as not to split the pool's huge page
+	size_t thpHeld;
+
+	// The reclaimer's queuePass when the pool was last queued for a scan
+	size_t queuedPass;
+#endif
+};
+
+// All small (less than half a page) allocations are assigned to a
+// size bin based on maximum packing of similar sizes. All allocations
+// on a single page are in the same bin.
+struct bin_t {
+	// Pointer to the next free slot for allocation
+	byte* nextAlloc;
+
+	// The size of allocations in this bin. Always a multiple of 8
+	size_t allocSize;
+
+	// The number of allocations made so far in this bin. It is
+	// reset to 0 when the page is filled and a new page is
+	// assigned to the bin
+	size_t allocCount;
+
+	// The maximum number of allocations that can be made on one
+	// page in this bin
+	size_t maxAlloc;
+
+	// Points to the page map object with the tracking bitmap
+	struct pagemap_t* page;
+
+#ifdef FF_PROFILE
+	// The cummulative number of allocations made from this bin
+	// across all pages
+	size_t totalAllocCount;
+#endif
+};
+
+#ifdef MARK_SWEEP
+// Allocation counters of one thread cache. Small allocations are counted
+// by bin and every larger one in the last class
+#define STAT_CLASSES (BIN_COUNT + 1)
+#define LARGE_STAT_CLASS BIN_COUNT
+
+struct tcachestats_t {
+	// Allocations made by the thread and frees it made, per class
+	size_t volatile mallocCount[STAT_CLASSES];
+	size_t volatile freeCount[STAT_CLASSES];
+
+	// Bytes of the large class. Small classes are measured by bin size
+	size_t volatile largeBytesAllocated;
+	size_t volatile largeBytesFreed;
+};
+#endif
+
+// Each thread is given its own cache of pages to allocate from
+struct threadcache_t {
+	// The array of small allocation bins for this thread
+	struct bin_t bins[BIN_COUNT];
+
+	// To reduce round trips to the page pool, a small number of
+	// blank pages are assigned to the thread cache to add to a 
+	// bin when it gets full. This points to the next available
+	// free page
+	struct pagemap_t* nextUnusedPage;
+
+	// The end address (exclusive) of the range of free pages
+	// available to the cache
+	struct pagemap_t* endUnusedPage;
+
+	// The arena this thread cache allocates from and the source of
+	// its free pages
+	struct arena_t* arena;
+
+#if defined(MARK_SWEEP) && defined(SUB_PAGE)
+	// The swept page each reuse bin is currently claiming slots
+	// from. Taken from the arena's published reuse list so that
+	// threads normally claim from different pages
+	struct pagemap_t* reusePage[256];
+#endif
+
+#ifdef MARK_SWEEP
+	// Allocation telemetry of this thread. Only the owning thread
+	// writes it, the reclaimer reads it without locking
+	struct tcachestats_t stats;
+
+	// Links in the list of live thread caches the reclaimer sums
+	struct threadcache_t* prevCache;
+	struct threadcache_t* nextCache;
+#endif
+};
+
+// A slot of the pool map, covering POOL_SIZE bytes of address space
+struct poolslot_t {
+	// A slot has two entries, one for a pool that starts in it and one for
+	// a pool that ends in it. The reason is that we can't assume that each
+	// pool allocation will be POOL_SIZE aligned (and in fact for ASLR
+	// purposes it's better that they aren't). Therefore, looking only at
+	// the high order bits of a pointer, we can't tell if its from a pool
+	// that starts in the middle of the slot or ends there
+
+	// Pointer to the pool that starts in this slot
+	struct pagepool_t* poolStart;
+
+	// Pointer to the pool that ends in this slot
+	struct pagepool_t* poolEnd;
+};
+
+// Node in a list of allocation pools
+struct poollistnode_t {
+	// Pointer to the next node in the list
+	struct poollistnode_t* next;
+
+	// Pointer to an allocation page pool
+	struct pagepool_t* pool;
+};
+
+// An arena is a collection of large and small pools that allocations can be
+// specifically drawn from using the ffmalloc extended API. Arenas allow the
+// calling application to free all allocations from that arena with one call
+// which benefits performance through fewer system calls to VirtualFree or
+// munmap and simplifies memory management since each allocation doesn't have
+// to be individually freed. Allocations from the standard malloc API come
+// from a default arena, but that arena is persistent and allocations need to
+// be individually freed.
+struct arena_t {
+	// Lists of small pools created in this arena, one per NUMA node. The
+	// head of each list is the pool that node is currently allocating from.
+	// Lists other than the first are only created once a thread on that
+	// node needs pages
+	struct poollistnode_t* volatile smallPoolList[MAX_NUMA_NODES];
+
+	// Array of lists of large pools created in this arena. Typically one
+	// list per CPU in the system, divided evenly between the NUMA nodes. The head of the list is usually where
+	// allocations come from but pools further down will be searched for
+	// available space if the first node is locked by another thread
+	struct poollistnode_t* volatile largePoolList[MAX_LARGE_LISTS];
+
+	// List of jumbo allocation pools create in this arena
+	struct poollistnode_t* volatile jumboPoolList;
+
+	// Index to get the correct thread local storage value for this arena
+	// which holds the pointer to the thread cache for invoking thread
+	FFTLSINDEX tlsIndex;
+
+	// Lock that protects modifying the small pool list header
+	FFLOCK(smallListLock)
+
+	// Locks that protect each large list
+	FFLOCK(largeListLock[MAX_LARGE_LISTS])
+
+#ifdef FF_PROFILE
+	// Structure to hold arena usage statistics
+	ffprofile_t profile;
+#endif
+
+#ifdef MARK_SWEEP
+    struct poollistnode_t* volatile largePoolListHead[MAX_LARGE_LISTS];
+
+    // The node moving from a large list to its head list, which neither
+    // list may reach while a mutator stopped in a pause is in the middle
+    // of the move
+    struct poollistnode_t* volatile largePoolRetiring[MAX_LARGE_LISTS];
+
+    // Pools destroyed in this arena that wait for a sweep to find no
+    // pointers into them. Pushed without a lock, the reclaimer takes the
+    // whole list at once
+    struct poollistnode_t* volatile quarantinedPools;
+
+    // The quarantined pools taken while the world was stopped, which the
+    // sweep that stopped it may release. Only the reclaimer uses it
+    struct poollistnode_t* sweptPools;
+
+    struct poollistnode_t* volatile freeHugeListHead;
+    struct poollistnode_t* volatile freeHugeListTail;
+
+    size_t volatile pendingPool;
+
+    // Told apart from every other arena created so far
+    size_t serial;
+
+#ifdef SUB_PAGE
+    // Pages with reclaimable slots, one tagged stack per size. Each
+    // sweep builds fresh lists and publishes them here; thread caches
+    // pop pages off the front without taking a lock
+    uint64_t volatile reuseMapHead[256];
+#endif
+
+    // Swept large extents, reserved again in their pools and zeroed, one
+    // tagged stack per NUMA node and size class. Nodes hold the extent in
+    // place of a pool
+    uint64_t volatile largeReuse[MAX_NUMA_NODES][LARGE_REUSE_CLASSES];
+#endif
+};
+
+// Reinterprets freed metadata allocations as a pointer to the next
+// available free block
+struct usedmd_t {
+	byte* next;
+};
+
+/*** Library Globals ***/
+static int isInit = 0;
+
+// Number of pools currently allocated
+// TODO: move this into future global profiling structure
+static size_t poolCount = 0;
+
+// The highest pool end address seen yet. The next pool will attempt
+// to start at this address
+//static byte* volatile poolHighWater;
+static byte* poolHighWater;
+#ifdef MARK_SWEEP
+static byte* poolLowAddr;
+#endif
+
+// Flat map from the address space to the pools in it. Reserved at startup
+// and only backed by memory where pools have been created, so that a
+// lookup is a single load
+static struct poolslot_t* poolMap;
+
+// The lowest and highest slots a pool was ever added to, bounding walks
+// over the whole map
+static size_t poolMapFirst = SIZE_MAX;
+static size_t poolMapLast;
+
+#ifdef _WIN64
+// Windows has no overcommit, so the pool map is only reserved and each page
+// of it is committed when a pool is first added to one of its slots. One
+// bit per page of the map marks the committed ones. Bits are never cleared
+#define POOL_MAP_PAGE_SLOTS (PAGE_SIZE / sizeof(struct poolslot_t))
+static uint64_t volatile poolMapCommitted[POOL_MAP_SLOTS / POOL_MAP_PAGE_SLOTS / 64];
+#endif
+
+// The number of NUMA nodes pools are placed on, at most MAX_NUMA_NODES.
+// Stays one on a single node host or when placement is turned off
+static unsigned int numaNodeCount = 1;
+
+// Array of arenas. The default arena used by the standard malloc API is
+// at index 0
+static struct arena_t* volatile arenas[MAX_ARENAS];
+
+#ifdef FF_PROFILE
+// Usage statistics of the arenas destroyed so far, for ffget_global_statistics
+static ffprofile_t retiredProfile;
+#endif
+
+// The start of the global metadata allocation pool
+static byte* metadataPool;
+
+// The top of the metadata pool - i.e. the next unallocated block
+static byte* metadataFree;
+
+// The end of the currently available metadata address space
+static byte* metadataEnd;
+
+// Bin headers for the metadata pool
+static byte* bins[256];
+static byte* metadatabins[2];
+
+#ifndef _WIN64
+// Per-thread magazines in front of the smaller metadata bins. A thread only
+// takes a bin lock to move half a magazine at a time
+#define MAGAZINE_BINS 16
+#define MAGAZINE_SLOTS 16
+#define MAGAZINE_BATCH (MAGAZINE_SLOTS / 2)
+
+struct magazine_t {
+	size_t count;
+	byte* slots[MAGAZINE_SLOTS];
+};
+
+static __thread struct magazine_t magazines[MAGAZINE_BINS];
+
+// Set once the thread's magazines have been given back at thread exit so
+// that metadata used by later destructors goes straight to the bins
+static __thread bool magazinesRetired;
+
+#ifndef FFSINGLE_THREADED
+// Key whose destructor gives a thread's magazines back. It is set when the
+// thread first uses its magazines, so that threads without a thread cache,
+// or whose cache is gone first, still return them
+static pthread_key_t magazineKey;
+static __thread bool magazinesHeld;
+#endif
+#endif
+
+// Lock that protects modifications to the pool map
+FFLOCKSTATIC(poolTreeLock)
+
+// Locks that protect access to the metadata allocation bins
+FFLOCKSTATIC(binLocks[256])
+FFLOCKSTATIC(mdBinLocks[2])
+
+// Lock that protects access to the metadata allocation pool
+FFLOCKSTATIC(mdPoolLock)
+
+FFLOCKSTATIC(poolAllocLock);
+
+#ifdef FF_PROFILE
+// The interval (in calls to malloc) to print usage statistics
+unsigned int usagePrintInterval;
+
+// The file that interval usage statistics will be sent to
+FILE * usagePrintFile;
+#endif // FF_PROFILE
+
+
+#ifdef MARK_SWEEP
+/*** Mark-Sweep Mode  ***/
+
+struct hugelistnode_t {
+    uint64_t start;
+    uint64_t end;
+    struct hugelistnode_t *next;
+
+    // Serial of the arena a quarantined jumbo pool came from, so that an
+    // arena sweep only releases its own. A serial is never reused, unlike
+    // the arena's metadata
+    size_t arenaSerial;
+};
+
+
+//
+// Runtime Options
+//
+// The sweeper's tuning knobs start from the compile time defaults below and
+// are overridden in initialize() by the matching HUSHVAC_* environment
+// variables, so that a workload can be tuned without rebuilding the library.
+// The environment is parsed with getenv and strtol only, as the heap doesn't
+// exist yet. After startup ffset_option changes everything except the values
+// that size structures created once
+//
+#define DELTA 10
+#define PERIOD_DELAY 1000000
+//#define PERIOD_DELAY 0
+//#define PERIOD_DELAY 250000
+//#define PERIOD_DELAY 500000
+//#define PERIOD_DELAY 750000
+//#define PERIOD_DELAY 2000000
+//#define PERIOD_DELAY 5000000
+
+// Upper bound on the scanner pool and the size used, capped by the number of
+// online CPUs, unless the scanners option says otherwise
+#define MAX_SCANNER 64
+#define DEFAULT_SCANNERS 10
+
+// Sub-page slots are only checked for reuse while the pool's reuse factor is
+// below this
+#define SUBPAGE_REUSE_FACTOR 100
+
+// Upper bound in nanoseconds on a stop-the-world pause, 0 for none. A pause
+// that runs over is abandoned and the cycle retried on a later period when
+// STW_BUDGET_ABORT is set. Otherwise the pass is completed and only counted
+#ifndef STW_PAUSE_BUDGET
+#define STW_PAUSE_BUDGET    0L
+#endif
+#ifndef STW_BUDGET_ABORT
+#define STW_BUDGET_ABORT    1
+#endif
+
+// Defaults of the memory pressure triggers, see Sweep Triggers
+#define QUARANTINE_MIN      0
+#define QUARANTINE_LIMIT    (256L << 20)
+#define RSS_GROWTH          50
+#define CGROUP_HIGH         90
+#define PSI_STALL           200000
+
+// When freed small slots are zeroed. Zeroing at free keeps stale pointers
+// in freed memory out of the next scan at the cost of free() latency.
+// Zeroing at reuse only writes the slots handed out again, and the lazy
+// mode has the reclaimer zero the freed slots of retired pages before it
+// marks, keeping most of the precision off the free path. Reused slots
+// are zero in every mode, as calloc relies on
+#define ZERO_ON_FREE        0
+#define ZERO_ON_REUSE       1
+#define ZERO_LAZY           2
+#ifndef ZERO_MODE
+#define ZERO_MODE           ZERO_ON_FREE
+#endif
+
+// How freed pages inside a live pool are given back to the OS. Remapping
+// them costs a VMA split and the mmap lock in write mode each time.
+// MADV_DONTNEED gives the same zero-filled pages without touching the VMAs,
+// and MADV_FREE lets the kernel take them only under pressure, so a page can
+// still be scanned, and hold stale pointers, until then. Queued decommits
+// are coalesced and issued by the reclaimer rather than the freeing thread,
+// which only applies to the madvise modes
+#define DECOMMIT_REMAP      0
+#define DECOMMIT_DONTNEED   1
+#define DECOMMIT_FREE       2
+#ifndef DECOMMIT_MODE
+#define DECOMMIT_MODE       DECOMMIT_DONTNEED
+#endif
+#ifndef DECOMMIT_QUEUE
+#define DECOMMIT_QUEUE      1
+#endif
+
+// Queued bytes or runs past which the queue is issued before the period
+// ends, so a long period or scan doesn't keep freed pages resident. Past
+// DECOMMIT_QUEUE_BACKSTOP times that the freeing thread issues it itself
+#ifndef DECOMMIT_QUEUE_LIMIT
+#define DECOMMIT_QUEUE_LIMIT (8L << 20)
+#endif
+#define DECOMMIT_QUEUE_RUNS 4096
+#define DECOMMIT_QUEUE_BACKSTOP 4
+
+// Whether freed large extents are handed out again once a sweep finds no
+// pointers into them, rather than only when their whole pool is released
+#ifndef LARGE_REUSE
+#define LARGE_REUSE         1
+#endif
+
+// Whether pools are bound to the NUMA node of the threads allocating from
+// them and the scanners are pinned next to the pools they sweep. Has no
+// effect on a host with a single node
+#ifndef NUMA_DEFAULT
+#define NUMA_DEFAULT        1
+#endif
+
+// Transparent huge pages. Pools are POOL_SIZE aligned and advised as huge,
+// as are the scanmap sub-maps, and pages freed from a pool stay resident
+// until the whole pool is released rather than split its huge pages
+#ifndef THP_DEFAULT
+#define THP_DEFAULT         0
+#endif
+
+// How the pause finds the pages written since the concurrent pass started.
+// Soft-dirty bits can only be cleared for the whole process, which
+// write-protects every page it has. The userfaultfd modes register just the
+// pools and the root ranges with an asynchronous write-protect userfaultfd
+// and protect those again, either whole with UFFDIO_WRITEPROTECT or only the
+// pages written since with PAGEMAP_SCAN. Without tracking the pause rescans
+// every resident page
+#define DIRTY_SOFT          0
+#define DIRTY_UFFD          1
+#define DIRTY_UFFD_SCAN     2
+#define DIRTY_NONE          3
+#ifndef DIRTY_TRACKING
+#define DIRTY_TRACKING      DIRTY_SOFT
+#endif
+
+#ifdef CONCURRENT
+#define CONCURRENT_DEFAULT  1
+#else
+#define CONCURRENT_DEFAULT  0
+#endif
+
+#ifdef NO_SCAN
+#define NO_SCAN_DEFAULT     1
+#else
+#define NO_SCAN_DEFAULT     0
+#endif
+
+enum {
+    OPT_START_DELAY,
+    OPT_PERIOD_DELAY,
+    OPT_RATE_WINDOW,
+    OPT_SCANNERS,
+    OPT_CONCURRENT,
+    OPT_NO_SCAN,
+    OPT_REUSE_FACTOR,
+    OPT_PAUSE_BUDGET,
+    OPT_BUDGET_ABORT,
+    OPT_QUARANTINE_MIN,
+    OPT_QUARANTINE_LIMIT,
+    OPT_RSS_GROWTH,
+    OPT_CGROUP_HIGH,
+    OPT_PSI_STALL,
+    OPT_ZERO_MODE,
+    OPT_DECOMMIT,
+    OPT_DECOMMIT_QUEUE,
+    OPT_DECOMMIT_QUEUE_LIMIT,
+    OPT_THP,
+    OPT_LARGE_REUSE,
+    OPT_NUMA,
+    OPT_DIRTY_TRACKING,
+    OPT_COUNT
+};
+
+struct runtimeoption_t {
+    const char *name;
+    long volatile value;
+    long min;
+    long max;
+
+    // Set for options that can only come from the environment
+    bool startupOnly;
+};
+
+static struct runtimeoption_t options[OPT_COUNT] = {
+    // Seconds the reclaimer waits before its first period
+    [OPT_START_DELAY]        = { "start_delay", STW_TIME_VAL, 0, 3600, true },
+    // Microseconds between two periods
+    [OPT_PERIOD_DELAY]       = { "period_delay", PERIOD_DELAY, 0, 60000000, false },
+    // Periods averaged by the allocation rate heuristic
+    [OPT_RATE_WINDOW]        = { "rate_window", DELTA, 2, 3600, false },
+    // Scanner threads, 0 for the default
+    [OPT_SCANNERS]           = { "scanners", 0, 0, MAX_SCANNER, true },
+    // Whether each sweep starts with a pass while the mutators run
+    [OPT_CONCURRENT]         = { "concurrent", CONCURRENT_DEFAULT, 0, 1, false },
+    // Stop and resume the world without scanning or sweeping
+    [OPT_NO_SCAN]            = { "no_scan", NO_SCAN_DEFAULT, 0, 1, false },
+    [OPT_REUSE_FACTOR]       = { "reuse_factor", SUBPAGE_REUSE_FACTOR, 0, INT_MAX, false },
+    [OPT_PAUSE_BUDGET]       = { "pause_budget", STW_PAUSE_BUDGET, 0, 60000000000L, false },
+    [OPT_BUDGET_ABORT]       = { "budget_abort", STW_BUDGET_ABORT, 0, 1, false },
+    // Bytes that must have been freed since the last sweep for any sweep
+    [OPT_QUARANTINE_MIN]     = { "quarantine_min", QUARANTINE_MIN, 0, LONG_MAX, false },
+    // Bytes freed since the last sweep that force one, 0 to disable
+    [OPT_QUARANTINE_LIMIT]   = { "quarantine_limit", QUARANTINE_LIMIT, 0, LONG_MAX, false },
+    // Percent of RSS growth since the last sweep that forces one, 0 to disable
+    [OPT_RSS_GROWTH]         = { "rss_growth", RSS_GROWTH, 0, 10000, false },
+    // Percent of the cgroup's memory.high that forces a sweep, 0 to disable
+    [OPT_CGROUP_HIGH]        = { "cgroup_high", CGROUP_HIGH, 0, 100, false },
+    // Microseconds of memory stall per PSI window that force a sweep, 0 to
+    // disable
+    [OPT_PSI_STALL]          = { "psi_stall", PSI_STALL, 0, 2000000, true },
+    // When freed small slots are zeroed. Fixed at startup since slots freed
+    // under one mode may be handed out under another
+    [OPT_ZERO_MODE]          = { "zero_mode", ZERO_MODE, ZERO_ON_FREE, ZERO_LAZY, true },
+    // How freed pages are returned to the OS
+    [OPT_DECOMMIT]           = { "decommit", DECOMMIT_MODE, DECOMMIT_REMAP, DECOMMIT_FREE, false },
+    // Whether the reclaimer issues the decommits of the madvise modes
+    [OPT_DECOMMIT_QUEUE]     = { "decommit_queue", DECOMMIT_QUEUE, 0, 1, false },
+    // Queued decommit bytes that get issued before the period ends, 0 to
+    // only issue them once a period
+    [OPT_DECOMMIT_QUEUE_LIMIT] = { "decommit_queue_limit", DECOMMIT_QUEUE_LIMIT, 0, LONG_MAX, false },
+    // Whether pools and the scanmap are backed by transparent huge pages
+    [OPT_THP]                = { "thp", THP_DEFAULT, 0, 1, true },
+    // Whether swept large extents are reused. Fixed at startup since
+    // reserved extents are only ever released by being handed out
+    [OPT_LARGE_REUSE]        = { "large_reuse", LARGE_REUSE, 0, 1, true },
+    // Whether pools and scanners are placed by NUMA node
+    [OPT_NUMA]               = { "numa", NUMA_DEFAULT, 0, 1, true },
+    // How pages written during the concurrent pass are found. Once the
+    // reclaimer starts it reads the mode in use, which falls back towards
+    // DIRTY_NONE when the kernel lacks the one asked for
+    [OPT_DIRTY_TRACKING]     = { "dirty_tracking", DIRTY_TRACKING, DIRTY_SOFT, DIRTY_NONE, true },
+};
+
+#define OPTION(id) (options[id].value)
+
+// Applies the HUSHVAC_* environment variables to the options
+static void init_options(void) {
+    char variable[64] = "HUSHVAC_";
+    const char *value;
+    const char *name;
+    char *end;
+    long parsed;
+    size_t i, j;
+
+    for (i = 0; i < OPT_COUNT; i++) {
+        name = options[i].name;
+        for (j = 0; name[j] != '\0'; j++) {
+            variable[8 + j] = (name[j] >= 'a' && name[j] <= 'z') ? name[j] - 'a' + 'A' : name[j];
+        }
+        variable[8 + j] = '\0';
+
+        value = getenv(variable);
+        if (value == NULL || *value == '\0') {
+            continue;
+        }
+
+        errno = 0;
+        parsed = strtol(value, &end, 0);
+        if (errno != 0 || *end != '\0' || parsed < options[i].min || parsed > options[i].max) {
+            fprintf(stderr, "HushVac: ignoring %s=%s, expected %ld to %ld\n",
+                    variable, value, options[i].min, options[i].max);
+            continue;
+        }
+
+        options[i].value = parsed;
+    }
+}
+
+static struct runtimeoption_t *find_option(const char *name) {
+    if (name == NULL) {
+        return NULL;
+    }
+
+    for (size_t i = 0; i < OPT_COUNT; i++) {
+        if (strcmp(options[i].name, name) == 0) {
+            return &options[i];
+        }
+    }
+
+    return NULL;
+}
+
+
+//
+// Recycled Pools
+//
+// Small pools that a sweep has cleared are handed back to os_alloc_highwater
+// instead of being unmapped. The recycled pools and the spare list nodes are
+// kept on lock-free stacks. A stack head packs the node pointer in its low
+// 48 bits with a counter above, bumped by every push and pop, so that a pop
+// racing with others can't be fooled by a node that was popped and pushed
+// back in the meantime. Nodes are metadata, which stays mapped, so reading
+// the next pointer of a node that was just taken is harmless
+//
+#define STACK_PTR_MASK  ((ONE64 << 48) - 1)
+#define STACK_TAG_ONE   (ONE64 << 48)
+
+// Both stacks are shared with the reclaimer even in single threaded builds
+static uint64_t volatile recycledPools;
+static uint64_t volatile spareNodes;
+
+// Pushes a node onto a tagged stack whose nodes keep their next pointer at
+// nextOffset
+static void stack_push_at(uint64_t volatile *head, void *node, size_t nextOffset) {
+    uint64_t old;
+    uint64_t new;
+
+    do {
+        old = *head;
+        *(void **)((byte *)node + nextOffset) = (void *)(old & STACK_PTR_MASK);
+        new = (uint64_t)node | ((old & ~STACK_PTR_MASK) + STACK_TAG_ONE);
+    } while (!__sync_bool_compare_and_swap(head, old, new));
+}
+
+static void stack_push(uint64_t volatile *head, struct poollistnode_t *node) {
+    stack_push_at(head, node, offsetof(struct poollistnode_t, next));
+}
+
+// Pops the top node off a tagged stack whose nodes keep their next pointer
+// at nextOffset, so that stacks of other metadata can share the same head
+static void *stack_pop_at(uint64_t volatile *head, size_t nextOffset) {
+    byte *node;
+    uint64_t old;
+    uint64_t new;
+
+    do {
+        old = *head;
+        node = (byte *)(old & STACK_PTR_MASK);
+        if (node == NULL) {
+            return NULL;
+        }
+        new = (uint64_t)*(void **)(node + nextOffset) | ((old & ~STACK_PTR_MASK) + STACK_TAG_ONE);
+    } while (!__sync_bool_compare_and_swap(head, old, new));
+
+    return node;
+}
+
+static struct poollistnode_t *stack_pop(uint64_t volatile *head) {
+    return stack_pop_at(head, offsetof(struct poollistnode_t, next));
+}
+
+// Replaces the whole stack with an already linked list, bumping the tag so
+// that pops that read the old top fail
+static void stack_replace(uint64_t volatile *head, void *top) {
+    uint64_t old;
+
+    do {
+        old = *head;
+    } while (!__sync_bool_compare_and_swap(head, old, (uint64_t)top | ((old & ~STACK_PTR_MASK) + STACK_TAG_ONE)));
+}
+
+// Returns the base of a recycled pool, or 0 if there is none
+static uint64_t pop_recycled_pool(void) {
+    struct poollistnode_t *node = stack_pop(&recycledPools);
+    uint64_t base;
+
+    if (node == NULL) {
+        return 0;
+    }
+
+    base = (uint64_t)node->pool;
+    stack_push(&spareNodes, node);
+    return base;
+}
+
+
+//
+// Pool Quarantine
+//
+// Destroyed pools wait on a list until a sweep finds no pointers into them:
+// small and large pools of POOL_SIZE on their arena's list, arbitrarily
+// sized jumbo pools on a global one. Pushes don't take a lock. The reclaimer
+// takes a whole list by swapping in NULL, so no pop can race with another.
+// It does so while the world is stopped, since the marks of a sweep only
+// cover pools destroyed before its pause
+//
+static struct hugelistnode_t* volatile quarantinedJumbos;
+static struct hugelistnode_t* sweptJumbos;
+
+static void quarantine_pool(struct poollistnode_t* volatile *head, struct poollistnode_t *first, struct poollistnode_t *last) {
+    struct poollistnode_t *old;
+
+    do {
+        old = *head;
+        last->next = old;
+    } while (!__sync_bool_compare_and_swap(head, old, first));
+}
+
+static void quarantine_jumbo(struct hugelistnode_t *first, struct hugelistnode_t *last) {
+    struct hugelistnode_t *old;
+
+    do {
+        old = quarantinedJumbos;
+        last->next = old;
+    } while (!__sync_bool_compare_and_swap(&quarantinedJumbos, old, first));
+}
+
+//
+// Large Extent Reuse
+//
+// A freed large extent is pushed on a global list without a lock. While the
+// world is stopped the reclaimer moves that list to its own, so the next
+// completed sweep only looks at extents freed before it started. Extents
+// with no marks are reserved again in their pool and published on their
+// arena's stacks, the rest wait for a later sweep
+//
+struct extentnode_t {
+    struct extentnode_t *next;
+    byte *start;
+    byte *end;
+    uint64_t serial;
+};
+
+static struct extentnode_t* volatile freedExtents;
+static struct extentnode_t *heldExtents;
+static uint64_t volatile largePoolSerial;
+
+//
+// Sub Page Reuse
+//
+#ifdef SUB_PAGE
+
+#define GET_REUSEBIN(SIZE) ((SIZE >> 3) - 1)
+#endif
+#endif
+
+/*** Forward declarations ***/
+static int create_pagepool(struct pagepool_t* newPool);
+static int create_largepagepool(struct pagepool_t* newPool);
+static void destroy_pool_list(struct poollistnode_t* node);
+static void destroy_arena(struct arena_t* arena);
+static struct pagepool_t* find_pool_for_ptr(const byte* ptr);
+static void init_tcache(struct threadcache_t* tcache, struct arena_t* arena);
+static inline struct threadcache_t* find_threadcache(struct arena_t* arena);
+static void initialize();
+static void init_threading();
+static void* ffmetadata_alloc(size_t size);
+static void ffmetadata_free(void* ptr, size_t size);
+static void free_large_pointer(struct pagepool_t* pool, size_t index, size_t size);
+void ffprint_stats_wrapper(void);
+
+#ifdef FF_PROFILE
+static void print_current_usage();
+#endif
+
+#if !defined(FFSINGLE_THREADED) && !defined(_WIN64)
+static void cleanup_thread(void* ptr);
+#endif
+
+#ifdef MARK_SWEEP
+static void scanmap_reserve(const byte* start, const byte* end);
+static size_t find_large_extent(const struct pagepool_t* pool, uintptr_t addr, size_t last);
+static void register_user_thread(void);
+static void release_arena_pools(struct arena_t* arena);
+struct reclaim_t;
+static void copy_root_set(struct reclaim_t* arg, bool paused);
+static uint64_t live_stack_start(uint64_t start, uint64_t end);
+static size_t read_counter(int fd, int field);
+#if !defined(FFSINGLE_THREADED) && !defined(_WIN64)
+static void deregister_user_thread(void);
+static void quarantine_flush(void);
+#endif
+#endif
+
+/*** OS compatibility functions ***/
+static size_t os_alloc_total = 0;
+static size_t os_alloc_count = 0;
+static size_t os_free_count = 0;
+#ifdef _WIN64
+#define MAP_FAILED NULL
+static inline LPVOID os_alloc(LPVOID startAddress, size_t size) {
+	void* alloc = VirtualAlloc(startAddress, size, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+	os_alloc_total += size;
+	os_alloc_count++;
+	return alloc;
+}
+
+// Obtains memory from the OS whose starting virtual address is no lower than
+// the previous highest address. Pools are not placed by NUMA node on Windows
+static inline LPVOID os_alloc_highwater(size_t size, unsigned int node __attrUnusedParam) {
+	MEM_ADDRESS_REQUIREMENTS addressReqs = { 0 };
+	MEM_EXTENDED_PARAMETER param = { 0 };
+
+	addressReqs.LowestStartingAddress = poolHighWater;
+
+	param.Type = MemExtendedParameterAddressRequirements;
+	param.Pointer = &addressReqs;
+
+	LPVOID result = VirtualAlloc2(NULL, NULL, size, MEM_RESERVE | MEM_COMMIT,
+		PAGE_READWRITE, &param, 1);
+
+	if (result != NULL) {
+		// Incrementing by extra 64K leaves guard pages in between pools for a weak
+		// buffer overflow protection
+		byte* newHigh = (byte*)result + size + 65536ULL;
+		byte* oldHigh = poolHighWater;
+		byte* update;
+		os_alloc_total += size;
+		os_alloc_count++;
+		while ((update = InterlockedCompareExchangePointer(&poolHighWater, newHigh, oldHigh)) < newHigh) {
+			oldHigh = update;
+		}
+	}
+
+	return result;
+}
+
+// Returns memory to the OS but holds onto the memory addresses
+static inline BOOL os_decommit(LPVOID startAddress, size_t size) {
+	return VirtualFree(startAddress, size, MEM_DECOMMIT);
+}
+
+// Returns memory to the OS and releases the virutal address space
+static inline BOOL os_free(LPVOID startAddress) {
+	os_free_count++;
+	return VirtualFree(startAddress, 0, MEM_RELEASE);
+}
+
+#else
+
+// Maps and unmaps memory for the allocator itself. The noprefix builds with
+// FF_WRAP_MMAP export the mmap and munmap wrappers under those names, so
+// internal mappings go straight to the kernel instead of moving the root set
+// generation
+static inline void* sys_mmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+#ifdef FF_WRAP_MMAP
+	return (void*)syscall(SYS_mmap, addr, length, prot, flags, fd, offset);
+#else
+	return mmap(addr, length, prot, flags, fd, offset);
+#endif
+}
+
+static inline int sys_munmap(void* addr, size_t length) {
+#ifdef FF_WRAP_MMAP
+	return (int)syscall(SYS_munmap, addr, length);
+#else
+	return munmap(addr, length);
+#endif
+}
+
+// Claims size bytes of address space at the high water mark. With huge pages
+// the claim starts on a POOL_SIZE boundary so that each pool is exactly one
+// huge page, leaving a gap after any jumbo pool of another size
+static inline byte* advance_highwater(size_t size) {
+#ifdef MARK_SWEEP
+	if (OPTION(OPT_THP)) {
+		byte* oldHigh;
+		byte* aligned;
+
+		do {
+			oldHigh = poolHighWater;
+			aligned = (byte*)ALIGN_TO((uintptr_t)oldHigh, POOL_SIZE);
+		} while (!FFAtomicCompareExchangePtr(&poolHighWater, aligned + size, oldHigh));
+
+		return aligned;
+	}
+#endif
+	// The single threaded exchange expands to two statements
+	byte* localHigh = FFAtomicExchangeAdvancePtr(poolHighWater, size);
+	return localHigh;
+}
+
+// Reads a kernel list of ids such as "0-3,8-11" from a sysfs file. The ids
+// are added to set if one is given. Returns one past the highest id, or
+// zero if the file can't be read
+static inline unsigned int read_id_list(const char* path, cpu_set_t* set) {
+	char text[1024];
+	char* cursor = text;
+	unsigned long first;
+	unsigned long last;
+	unsigned int count = 0;
+	ssize_t length;
+	int fd;
+
+	fd = open(path, O_RDONLY);
+	if (fd < 0) {
+		return 0;
+	}
+	length = read(fd, text, sizeof(text) - 1);
+	close(fd);
+	if (length <= 0) {
+		return 0;
+	}
+	text[length] = '\0';
+
+	while (*cursor >= '0' && *cursor <= '9') {
+		first = strtoul(cursor, &cursor, 10);
+		last = first;
+		if (*cursor == '-') {
+			last = strtoul(cursor + 1, &cursor, 10);
+		}
+		if (last >= CPU_SETSIZE) {
+			break;
+		}
+
+		if (set != NULL) {
+			for (; first <= last; first++) {
+				CPU_SET(first, set);
+			}
+		}
+		if (last + 1 > count) {
+			count = (unsigned int)last + 1;
+		}
+		if (*cursor == ',') {
+			cursor++;
+		}
+	}
+
+	return count;
+}
+
+// Prefers the pages of [start, start + size) to come from the given NUMA
+// node. Only a preference, so that a full node still falls back to the
+// others rather than failing the allocation
+static inline void bind_to_node(void* start, size_t size, unsigned int node) {
+	unsigned long nodeMask = 1UL << node;
+
+	if (numaNodeCount > 1) {
+		syscall(SYS_mbind, start, size, MPOL_PREFERRED, &nodeMask, sizeof(nodeMask) * 8, 0);
+	}
+}
+
+// Obtains memory from the OS whose starting virtual address is no lower than
+// the previous highest address, preferring pages from the given NUMA node
+static inline void* os_alloc_highwater(size_t size, unsigned int node) {
+	int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE;
+	void* result = NULL;
+	void* localHigh;
+	bool populate;
+
+	// If we need more space from the OS, its likely to get used immediately
+	// after, so go ahead and pre-fault the pages for faster access. Except
+	// don't do that for jumbo allocations since that could cause swapping if
+	// the allocation is sufficiently large and the system is under pressure.
+	// Nor with huge pages, as the pages would be faulted before the advice
+#ifdef MARK_SWEEP
+	populate = (size == POOL_SIZE && !OPTION(OPT_THP));
+#else
+	populate = (size == POOL_SIZE);
+#endif
+
+	// With several nodes the pages are faulted once the range is bound
+	if (populate && numaNodeCount == 1) {
+		flags |= MAP_POPULATE;
+	}
+
+#ifdef MARK_SWEEP
+    if (size == POOL_SIZE) {
+        uint64_t poolBase = pop_recycled_pool();
+        if (poolBase != 0) {
+            // The quarantine left a fresh mapping without the advice or the
+            // binding
+            if (OPTION(OPT_THP)) {
+                madvise((void *)poolBase, POOL_SIZE, MADV_HUGEPAGE);
+            }
+            bind_to_node((void *)poolBase, POOL_SIZE, node);
+            return (void *)poolBase;
+        }
+    }
+#endif
+	localHigh = advance_highwater(size);
+
+	while(result == NULL) {
+		// TODO: Add wrap around if we hit the top of address space
+		result = sys_mmap(localHigh, size, PROT_READ | PROT_WRITE,
+				flags, -1, 0);
+		if(result == MAP_FAILED) {
+			// If the failure was because the requested address already has
+			// a mapping associated then jump up by POOL_SIZE (since a new 
+			// pool created on another thread is the most likely reason)
+			// and try again
+			if(errno == EEXIST) {
+				localHigh = advance_highwater(POOL_SIZE);
+				result = NULL;
+			}
+			else {
+				fprintf(stderr, "[ffmalloc] Warning: os_alloc_highwater failed\n");
+				return MAP_FAILED;
+			}
+		}
+	}
+
+#ifdef MARK_SWEEP
+	if (size == POOL_SIZE && OPTION(OPT_THP)) {
+		madvise(result, size, MADV_HUGEPAGE);
+	}
+#endif
+
+	// Kernels without MADV_POPULATE_WRITE fault the pages on first use
+	if (numaNodeCount > 1) {
+		bind_to_node(result, size, node);
+		if (populate) {
+			madvise(result, size, MADV_POPULATE_WRITE);
+		}
+	}
+
+	return result;
+}
+
+#define FALSE -1
+#if defined(FFMALLOC_PLUS) && defined(MARK_SWEEP)
+// Cleared the first time the kernel rejects MADV_FREE (before 4.5) so that
+// the free mode falls back to MADV_DONTNEED
+static int volatile madvFreeSupported = 1;
+#endif
+
+static inline int os_decommit(void* startAddress, size_t size) {
+#ifdef FFMALLOC_PLUS
+#ifdef MARK_SWEEP
+    if (OPTION(OPT_DECOMMIT) == DECOMMIT_FREE && madvFreeSupported) {
+        if (madvise(startAddress, size, MADV_FREE) == 0) {
+            return 0;
+        }
+        if (errno != EINVAL) {
+            return FALSE;
+        }
+        madvFreeSupported = 0;
+    }
+
+    if (OPTION(OPT_DECOMMIT) != DECOMMIT_REMAP) {
+        return madvise(startAddress, size, MADV_DONTNEED);
+    }
+#endif
+
+    void *ret = (void *)sys_mmap(startAddress, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_FIXED | MAP_PRIVATE, -1, 0);
+    if ((int64_t)ret == -1) {
+        lf_dbg("Remap failed %016lx, %016lx(%d)", (uint64_t)ret, startAddress, size);
+        abort();
+    }
+
+    return 0;
+#else
+	// Surprisingly, benchmarking seems to suggest that unmapping is actually
+	// faster than madvise. Revisit in the future
+	return sys_munmap(startAddress, size);
+	//return madvise(startAddress, size, MADV_FREE);
+#endif
+}
+
+static inline int os_free(void* startAddress) {
+	// On Windows, this helper can only completely decommit and unreserve
+	// an entire reservation, so no size parameter. Here, we'll look for
+	// the pool getting the axe and figure out the size
+	struct pagepool_t* pool = find_pool_for_ptr((const byte*)startAddress);
+	if (pool != NULL) {
+#ifdef FFMALLOC_PLUS
+        void *ret = (void *)sys_mmap(pool->start, pool->end - pool->start, PROT_NONE, MAP_ANONYMOUS | MAP_FIXED | MAP_PRIVATE, -1, 0);
+        if ((int64_t)ret == -1) {
+            lf_dbg("Remap failed %016lx", (uint64_t)pool->start);
+            lf_dbg("Remap failed %016lx", (uint64_t)ret);
+            abort();
+        }
+
+        return 0;
+#else
+		return sys_munmap(pool->start, pool->end - pool->start);
+#endif
+	}
+	else {
+		// Wasn't a pool - that shouldn't happen
+		// Likely a bug if we get here
+		abort();
+	}
+
+	errno = EINVAL;
+	return -1; 
+}
+#endif
+
+#ifdef MARK_SWEEP
+//
+// Decommit Queue
+//
+// With a madvise decommit mode, free_page and free_large_pointer queue the
+// page runs they release instead of making a system call under the pool
+// lock. Once a period the reclaimer takes the whole queue, sorts it and
+// releases each run of adjacent pages with a single madvise. A queue that
+// grows past its limit wakes the reclaimer early, and the scanners issue it
+// between chunks of a concurrent pass. A freeing thread only issues it once
+// the reclaimer has fallen well behind. Flushes hold decommitLock, so one
+// the reclaimer starts also waits for those already taken. Pages are
+// marked released as they're queued and are never handed out again, so the
+// only constraint is that a pool's runs must be flushed before the pool
+// leaves the quarantine. Remapping isn't queued since a late remap would
+// restore access to a pool that was destroyed in the meantime
+//
+static struct hugelistnode_t* volatile decommitQueue;
+static size_t volatile decommitQueueBytes;
+static size_t volatile decommitQueueRuns;
+static bool volatile decommitWakeSent;
+static int decommitWake = -1;
+FFLOCKSTATIC(decommitLock);
+
+static void issue_decommits(void);
+
+// Whether the queue has grown past factor times its limit
+static inline bool decommit_queue_over(size_t factor) {
+    return OPTION(OPT_DECOMMIT_QUEUE_LIMIT) != 0 &&
+        (decommitQueueBytes >= factor * (size_t)OPTION(OPT_DECOMMIT_QUEUE_LIMIT) || decommitQueueRuns >= factor * DECOMMIT_QUEUE_RUNS);
+}
+
+static inline bool decommit_queue_full(void) {
+    return decommit_queue_over(1);
+}
+
+// Returns the pages of pool in [start, end) to the OS now or queues them
+// for the reclaimer
+static int decommit_range(struct pagepool_t* pool, byte* start, byte* end) {
+    struct hugelistnode_t *node;
+    struct hugelistnode_t *old;
+
+    // Releasing part of a huge page splits it, so that is put off until the
+    // pool is destroyed. But only while the pool holds back less than half
+    // of itself, past that the pages are worth more than the huge page. A
+    // range covering a whole huge page is released at once
+    if (OPTION(OPT_THP) && pool->thpHeld + (end - start) <= POOL_SIZE / 2 &&
+            ALIGN_TO((uintptr_t)start, POOL_SIZE) + POOL_SIZE > (uintptr_t)end) {
+        pool->thpHeld += end - start;
+        return 0;
+    }
+
+    if (!OPTION(OPT_DECOMMIT_QUEUE) || OPTION(OPT_DECOMMIT) == DECOMMIT_REMAP) {
+        return os_decommit(start, end - start);
+    }
+
+    node = (struct hugelistnode_t *)ffmetadata_alloc(sizeof(struct hugelistnode_t));
+    if (node == NULL) {
+        return os_decommit(start, end - start);
+    }
+    node->start = (uint64_t)start;
+    node->end = (uint64_t)end;
+
+    do {
+        old = decommitQueue;
+        node->next = old;
+    } while (!__sync_bool_compare_and_swap(&decommitQueue, old, node));
+
+    __sync_fetch_and_add(&decommitQueueBytes, end - start);
+    __sync_fetch_and_add(&decommitQueueRuns, 1);
+
+    // Nobody else is flushing if the lock is free
+    if (decommit_queue_over(DECOMMIT_QUEUE_BACKSTOP) && FFTryEnterCriticalSection(&decommitLock)) {
+        issue_decommits();
+        FFLeaveCriticalSection(&decommitLock);
+    }
+    // One wake up per flush is enough
+    else if (decommit_queue_full() && decommitWake >= 0 && !__sync_lock_test_and_set(&decommitWakeSent, true)) {
+        uint64_t wake = 1;
+        if (write(decommitWake, &wake, sizeof(wake)) < 0) {
+            // Issued at the end of the period instead
+        }
+    }
+
+    return 0;
+}
+
+// Merge sorts a decommit list by start address
+static struct hugelistnode_t *sort_decommits(struct hugelistnode_t *list) {
+    struct hugelistnode_t *slow = list;
+    struct hugelistnode_t *fast;
+    struct hugelistnode_t *right;
+    struct hugelistnode_t head;
+    struct hugelistnode_t *tail = &head;
+
+    if (list == NULL || list->next == NULL) {
+        return list;
+    }
+
+    for (fast = list->next; fast != NULL && fast->next != NULL; fast = fast->next->next) {
+        slow = slow->next;
+    }
+    right = slow->next;
+    slow->next = NULL;
+
+    list = sort_decommits(list);
+    right = sort_decommits(right);
+
+    while (list != NULL && right != NULL) {
+        if (list->start <= right->start) {
+            tail->next = list;
+            list = list->next;
+        }
+        else {
+            tail->next = right;
+            right = right->next;
+        }
+        tail = tail->next;
+    }
+    tail->next = list != NULL ? list : right;
+
+    return head.next;
+}
+
+// Issues every queued decommit, one system call per run of adjacent pages.
+// The caller holds decommitLock
+static void issue_decommits(void) {
+    struct hugelistnode_t *node;
+    struct hugelistnode_t *next;
+    uint64_t start;
+    uint64_t end;
+
+    // Reset before taking the queue, so runs queued in between are counted
+    // twice rather than not at all
+    __sync_lock_test_and_set(&decommitQueueBytes, 0);
+    __sync_lock_test_and_set(&decommitQueueRuns, 0);
+    __sync_lock_release(&decommitWakeSent);
+    node = sort_decommits(__sync_lock_test_and_set(&decommitQueue, NULL));
+
+    while (node != NULL) {
+        start = node->start;
+        end = node->end;
+
+        // Runs queued from neighbouring free_page calls touch each other
+        while (node != NULL && node->start <= end) {
+            if (node->end > end) {
+                end = node->end;
+            }
+            next = node->next;
+            ffmetadata_free(node, sizeof(struct hugelistnode_t));
+            node = next;
+        }
+
+        // Failures only leave the pages resident, the next free nearby
+        // may still release them
+        os_decommit((void *)start, end - start);
+    }
+}
+
+// Issues every queued decommit, including those another thread already took
+static void flush_decommits(void) {
+    FFEnterCriticalSection(&decommitLock);
+    issue_decommits();
+    FFLeaveCriticalSection(&decommitLock);
+}
+#else
+static inline int decommit_range(struct pagepool_t* pool, byte* start, byte* end) {
+    (void)pool;
+    return os_decommit(start, end - start);
+}
+#endif
+
+
+/*** Dynamic metadata allocation ***/
+// FFmalloc has several metadata structures that need to be dynamically allocated
+// If we restricted usage to Windows or requiring use of the ff prefix on Linux
+// then LocalAlloc or libc malloc respectively could be used. But, we'd like to 
+// allow non-prefixed usage via LD_PRELOAD on Linux (or static compilation so long
+// as we're the first library). Therefore, we have a mini-allocator for metadata
+// allocations. Because this should only be used internally, it does *not*
+// implement the forward-only principal. Also note that the "free" equivalent
+// requires a size parameter. This simplifies the amount of metadata for the 
+// metadata stored
+
+// Takes size bytes from the top of the metadata pool, making more of it
+// accessible if needed. The caller holds mdPoolLock
+static byte* metadata_carve(size_t size, size_t willNeedPages) {
+	byte* allocation = metadataFree;
+
+	if(allocation + size > metadataEnd) {
+		// Need to grow metadata pool space
+#ifdef _WIN64
+		VirtualAlloc(metadataEnd, POOL_SIZE, MEM_COMMIT, PAGE_READWRITE);
+#else
+		mprotect(metadataEnd, POOL_SIZE, PROT_READ | PROT_WRITE);
+		madvise(metadataEnd, PAGE_SIZE * willNeedPages, MADV_WILLNEED);
+#endif
+		metadataEnd += POOL_SIZE;
+#ifdef FF_PROFILE
+		FFAtomicAdd(arenas[0]->profile.currentOSBytesMapped, POOL_SIZE);
+		if(arenas[0]->profile.currentOSBytesMapped > arenas[0]->profile.maxOSBytesMapped) {
+			arenas[0]->profile.maxOSBytesMapped = arenas[0]->profile.currentOSBytesMapped;
+		}
+#endif
+	}
+	metadataFree += size;
+
+	return allocation;
+}
+
+static void* ffpoolmetadata_alloc(int isSmallPool) {
+	byte* allocation;
+	size_t size = isSmallPool ? (POOL_SIZE / PAGE_SIZE) * sizeof(struct pagemap_t) : 
+		(POOL_SIZE >> 20) * PAGE_SIZE;
+	size = ALIGN_SIZE(size);
+
+	FFEnterCriticalSection(&mdBinLocks[isSmallPool]);
+	if(metadatabins[isSmallPool] == NULL) {
+		FFEnterCriticalSection(&mdPoolLock);
+		// Page maps are laid out on cache lines
+		metadataFree = (byte*)ALIGN_TO((uintptr_t)metadataFree, CACHE_LINE_SIZE);
+		allocation = metadata_carve(size, 16);
+		FFLeaveCriticalSection(&mdPoolLock);
+	}
+	else {
+		allocation = metadatabins[isSmallPool];
+		metadatabins[isSmallPool] = ((struct usedmd_t*)allocation)->next;
+	}
+	FFLeaveCriticalSection(&mdBinLocks[isSmallPool]);
+
+	memset(allocation, 0, size);
+	return allocation;
+}
+
+static void ffpoolmetadata_free(void* ptr, int isSmallPool) {
+	size_t size = isSmallPool ? (POOL_SIZE / PAGE_SIZE) * sizeof(struct pagemap_t) : 
+		(POOL_SIZE >> 20) * PAGE_SIZE;
+	size = ALIGN_SIZE(size);
+
+	if (ptr > (void*)metadataFree || ptr < (void*)metadataPool) {
+		abort();
+	}
+
+	FFEnterCriticalSection(&mdBinLocks[isSmallPool]);
+
+	// Put the freed block at the front of the list and have it point to
+	// the former head of the line
+	((struct usedmd_t*)ptr)->next = metadatabins[isSmallPool];
+	metadatabins[isSmallPool] = (byte*)ptr;
+
+	FFLeaveCriticalSection(&mdBinLocks[isSmallPool]);
+}
+
+#ifndef _WIN64
+// Fills half of an empty magazine from its bin, carving whatever the bin
+// lacks from the top of the pool in one piece
+static void magazine_refill(struct magazine_t* magazine, size_t binID, size_t size) {
+	byte* allocation;
+
+	FFEnterCriticalSection(&binLocks[binID]);
+	while (magazine->count < MAGAZINE_BATCH && bins[binID] != NULL) {
+		magazine->slots[magazine->count++] = bins[binID];
+		bins[binID] = ((struct usedmd_t*)bins[binID])->next;
+	}
+	FFLeaveCriticalSection(&binLocks[binID]);
+
+	if (magazine->count < MAGAZINE_BATCH) {
+		FFEnterCriticalSection(&mdPoolLock);
+		allocation = metadata_carve((MAGAZINE_BATCH - magazine->count) * size, 4);
+		FFLeaveCriticalSection(&mdPoolLock);
+
+		while (magazine->count < MAGAZINE_BATCH) {
+			magazine->slots[magazine->count++] = allocation;
+			allocation += size;
+		}
+	}
+}
+
+// Returns the first count blocks of a magazine to its bin
+static void magazine_flush(struct magazine_t* magazine, size_t binID, size_t count) {
+	FFEnterCriticalSection(&binLocks[binID]);
+	for (size_t i = 0; i < count; i++) {
+		((struct usedmd_t*)magazine->slots[i])->next = bins[binID];
+		bins[binID] = magazine->slots[i];
+	}
+	FFLeaveCriticalSection(&binLocks[binID]);
+
+	magazine->count -= count;
+	memmove(magazine->slots, magazine->slots + count, magazine->count * sizeof(byte*));
+}
+
+#ifndef FFSINGLE_THREADED
+// Gives every block cached by the calling thread back to the bins. Called
+// when the thread exits
+static void retire_magazines(void* unused) {
+	(void)unused;
+	for (size_t binID = 0; binID < MAGAZINE_BINS; binID++) {
+		if (magazines[binID].count != 0) {
+			magazine_flush(&magazines[binID], binID, magazines[binID].count);
+		}
+	}
+	magazinesRetired = true;
+}
+#endif
+
+// Registers the thread for retire_magazines the first time it uses its
+// magazines. The flag goes first since setting the key may allocate
+static inline void hold_magazines(void) {
+#ifndef FFSINGLE_THREADED
+	if (!magazinesHeld) {
+		magazinesHeld = true;
+		pthread_setspecific(magazineKey, &magazinesHeld);
+	}
+#endif
+}
+#endif
+
+static void* ffmetadata_alloc(size_t size) {
+	// Ensure 16 byte alignment
+	size = ALIGN_TO(size, UINT64_C(16));
+
+	// Making the assumption that no metadata structure is bigger than a
+	// page. If that changes then we'll be in a bit of a bind here. But for
+	// now, go with it
+	size_t binID = size >=4096 ? 255 : (size >> 4) - 1;
+
+	byte* allocation;
+
+#ifndef _WIN64
+	if (binID < MAGAZINE_BINS && !magazinesRetired) {
+		struct magazine_t* magazine = &magazines[binID];
+		hold_magazines();
+		if (magazine->count == 0) {
+			magazine_refill(magazine, binID, size);
+		}
+		return magazine->slots[--magazine->count];
+	}
+#endif
+
+	FFEnterCriticalSection(&binLocks[binID]);
+	if (bins[binID] == NULL) {
+		// No freed chunks of this size exist. Allocate space from the top
+		// of the pool. Keeping things simple for now and not trying to 
+		// break a free 64-byte chunk into 4*16-byte chunks or whatever
+		FFEnterCriticalSection(&mdPoolLock);
+		allocation = metadata_carve(size, 4);
+		FFLeaveCriticalSection(&mdPoolLock);
+	}
+	else {
+		// Take the first available chunk from the front of the list
+		// and the advance the header to the next chunk
+		allocation = bins[binID];
+		bins[binID] = ((struct usedmd_t*)allocation)->next;
+	}
+
+	FFLeaveCriticalSection(&binLocks[binID]);
+
+	// Simplify logic elsewhere by guaranteeing zeroed blocks
+	//memset(allocation, 0, size);
+	return allocation;
+}
+
+static void ffmetadata_free(void* ptr, size_t size) {
+	// Ensure 16 byte alignment to find right bin
+	size = ALIGN_TO(size, UINT64_C(16));
+	size_t binID = size >= 4096 ? 255 : (size >> 4) - 1;
+
+	if (ptr > (void*)metadataFree || ptr < (void*)metadataPool) {
+		abort();
+	}
+
+#ifndef _WIN64
+	if (binID < MAGAZINE_BINS && !magazinesRetired) {
+		struct magazine_t* magazine = &magazines[binID];
+		hold_magazines();
+		if (magazine->count == MAGAZINE_SLOTS) {
+			magazine_flush(magazine, binID, MAGAZINE_BATCH);
+		}
+		magazine->slots[magazine->count++] = (byte*)ptr;
+		return;
+	}
+#endif
+
+	FFEnterCriticalSection(&binLocks[binID]);
+
+	// Put the freed block at the front of the list and have it point to
+	// the former head of the line
+	((struct usedmd_t*)ptr)->next = bins[binID];
+	bins[binID] = (byte*)ptr;
+
+	FFLeaveCriticalSection(&binLocks[binID]);
+}
+
+
+/*** Pool map implementation ***/
+
+// Gets the pool map slot at the given index. Returns NULL when the page
+// holding the slot is not committed, meaning no pool was ever added there
+static inline struct poolslot_t* pool_map_slot(size_t slot) {
+#ifdef _WIN64
+	size_t page = slot / POOL_MAP_PAGE_SLOTS;
+	if (!((poolMapCommitted[page >> 6] >> (page & SIXTYTHREE64)) & 1)) {
+		return NULL;
+	}
+#endif
+	return &poolMap[slot];
+}
+
+#ifdef _WIN64
+// Commits the page of the pool map holding the given slot. Called with the
+// pool tree lock held
+static void commit_pool_map_slot(size_t slot) {
+	size_t page = slot / POOL_MAP_PAGE_SLOTS;
+	if ((poolMapCommitted[page >> 6] >> (page & SIXTYTHREE64)) & 1) {
+		return;
+	}
+	if (VirtualAlloc(&poolMap[page * POOL_MAP_PAGE_SLOTS], PAGE_SIZE, MEM_COMMIT, PAGE_READWRITE) == NULL) {
+		abort();
+	}
+	poolMapCommitted[page >> 6] |= ONE64 << (page & SIXTYTHREE64);
+}
+#endif
+
+// Gets the page pool that matches the page prefix. Returns NULL if no matching
+// pool could be found
+struct pagepool_t* find_pool_for_ptr(const byte* ptr) {
+	// Pointers past the mapped address space can't belong to any pool
+	if ((uintptr_t)ptr >> ADDRESS_BITS) {
+		return NULL;
+	}
+
+	// Check if there is a pool that starts or ends in this slot that could
+	// possibly contain the given pointer
+	struct poolslot_t* slot = pool_map_slot((uintptr_t)ptr >> POOL_SIZE_BITS);
+	if (slot == NULL) {
+		return NULL;
+	}
+	struct pagepool_t* pool = slot->poolStart;
+	if (pool != NULL && ptr >= pool->start) {
+		return pool;
+	}
+	pool = slot->poolEnd;
+	if (pool != NULL && ptr < pool->end) {
+		return pool;
+	}
+
+	return NULL;
+}
+
+#ifdef MARK_SWEEP
+// One bit per pool map slot that has ever held part of a pool, including
+// the inside of jumbo pools that the map itself has no entry for. The
+// scanner drops candidates outside of them. A bit is only cleared once the
+// range is unmapped, and only for slots it covered entirely
+static uint64_t* heapSlots;
+
+static inline bool is_heap_slot(uint64_t addr) {
+	// The bitmap only spans the address bits the pool map covers
+	if (addr >> ADDRESS_BITS) {
+		return false;
+	}
+	return (heapSlots[addr >> (POOL_SIZE_BITS + 6)] >> ((addr >> POOL_SIZE_BITS) & SIXTYTHREE64)) & 1;
+}
+
+static void mark_heap_slots(const byte* start, const byte* end) {
+	for (uint64_t slot = (uint64_t)start >> POOL_SIZE_BITS; slot <= ((uint64_t)end - 1) >> POOL_SIZE_BITS; slot++) {
+		__sync_fetch_and_or(&heapSlots[slot >> 6], ONE64 << (slot & SIXTYTHREE64));
+	}
+}
+
+static void unmark_heap_slots(uint64_t start, uint64_t end) {
+	for (uint64_t slot = ALIGN_TO(start, POOL_SIZE) >> POOL_SIZE_BITS; slot < end >> POOL_SIZE_BITS; slot++) {
+		__sync_fetch_and_and(&heapSlots[slot >> 6], ~(ONE64 << (slot & SIXTYTHREE64)));
+	}
+}
+#endif
+
+// Inserts a newly created page pool into the pool map
+void add_pool_to_tree(struct pagepool_t* pool) {
+	// Pool creation should be infrequent enough that trying to come up
+	// with a fancy lock-free update structure probably isn't worth it
+	FFEnterCriticalSection(&poolTreeLock);
+
+#ifdef _WIN64
+	commit_pool_map_slot((uintptr_t)pool->start >> POOL_SIZE_BITS);
+	commit_pool_map_slot((uintptr_t)pool->end >> POOL_SIZE_BITS);
+#endif
+	poolMap[(uintptr_t)pool->start >> POOL_SIZE_BITS].poolStart = pool;
+	poolMap[(uintptr_t)pool->end >> POOL_SIZE_BITS].poolEnd = pool;
+	if (((uintptr_t)pool->start >> POOL_SIZE_BITS) < poolMapFirst) {
+		poolMapFirst = (uintptr_t)pool->start >> POOL_SIZE_BITS;
+	}
+	if (((uintptr_t)pool->end >> POOL_SIZE_BITS) > poolMapLast) {
+		poolMapLast = (uintptr_t)pool->end >> POOL_SIZE_BITS;
+	}
+
+	poolCount++;
+	FFLeaveCriticalSection(&poolTreeLock);
+
+#ifdef MARK_SWEEP
+	mark_heap_slots(pool->start, pool->end);
+#endif
+}
+
+// Removes a page pool from the pool map
+void remove_pool_from_tree(struct pagepool_t* pool) {
+	// Not checking that the pool is there. Caller is responsible for calling
+	// only if the pool has definitively been added to the map already
+	FFEnterCriticalSection(&poolTreeLock);
+	poolMap[(uintptr_t)pool->start >> POOL_SIZE_BITS].poolStart = NULL;
+	poolMap[(uintptr_t)pool->end >> POOL_SIZE_BITS].poolEnd = NULL;
+
+	poolCount--;
+	FFLeaveCriticalSection(&poolTreeLock);
+}
+
+
+#ifdef MARK_SWEEP
+//
+// Allocation Telemetry
+//
+// Each thread cache counts its own allocations and the frees made by its
+// thread, so the malloc path only writes lines the thread owns. The
+// reclaimer sums the caches on the list for the allocation rate. A cache
+// leaving the list adds its counts to the retired totals, which also take
+// the frees of threads that have no cache in the arena
+//
+static struct threadcache_t* tcacheList;
+static struct tcachestats_t retiredStats;
+static pthread_mutex_t tcacheListLock = PTHREAD_MUTEX_INITIALIZER;
+
+// The allocation size of each bin, the same in every cache
+static size_t statClassSize[BIN_COUNT];
+
+static void add_tcache_stats(struct tcachestats_t *dest, const struct tcachestats_t *src) {
+    for (size_t i = 0; i < STAT_CLASSES; i++) {
+        dest->mallocCount[i] += src->mallocCount[i];
+        dest->freeCount[i] += src->freeCount[i];
+    }
+    dest->largeBytesAllocated += src->largeBytesAllocated;
+    dest->largeBytesFreed += src->largeBytesFreed;
+}
+
+static void register_tcache(struct threadcache_t *tcache) {
+    memset((void *)&tcache->stats, 0, sizeof(tcache->stats));
+
+    pthread_mutex_lock(&tcacheListLock);
+    tcache->prevCache = NULL;
+    tcache->nextCache = tcacheList;
+    if (tcacheList != NULL) {
+        tcacheList->prevCache = tcache;
+    }
+    tcacheList = tcache;
+    pthread_mutex_unlock(&tcacheListLock);
+}
+
+// Takes the cache off the list and adds its counts to the retired totals.
+// The caller holds the list lock. The retired totals are also updated
+// without the lock by threads that have no cache
+static void unlink_tcache(struct threadcache_t *tcache) {
+    if (tcache->prevCache != NULL) {
+        tcache->prevCache->nextCache = tcache->nextCache;
+    }
+    else {
+        tcacheList = tcache->nextCache;
+    }
+    if (tcache->nextCache != NULL) {
+        tcache->nextCache->prevCache = tcache->prevCache;
+    }
+
+    for (size_t i = 0; i < STAT_CLASSES; i++) {
+        __sync_fetch_and_add(&retiredStats.mallocCount[i], tcache->stats.mallocCount[i]);
+        __sync_fetch_and_add(&retiredStats.freeCount[i], tcache->stats.freeCount[i]);
+    }
+    __sync_fetch_and_add(&retiredStats.largeBytesAllocated, tcache->stats.largeBytesAllocated);
+    __sync_fetch_and_add(&retiredStats.largeBytesFreed, tcache->stats.largeBytesFreed);
+}
+
+// Called before the cache is freed
+static void retire_tcache(struct threadcache_t *tcache) {
+    pthread_mutex_lock(&tcacheListLock);
+    unlink_tcache(tcache);
+    pthread_mutex_unlock(&tcacheListLock);
+}
+
+// Sums the counters of every cache, live or retired. Each counter only
+// grows, so the sum never goes backwards even when read mid-update
+static void sum_tcache_stats(struct tcachestats_t *total) {
+    struct threadcache_t *tcache;
+
+    memset(total, 0, sizeof(*total));
+    pthread_mutex_lock(&tcacheListLock);
+    add_tcache_stats(total, &retiredStats);
+    for (tcache = tcacheList; tcache != NULL; tcache = tcache->nextCache) {
+        add_tcache_stats(total, &tcache->stats);
+    }
+    pthread_mutex_unlock(&tcacheListLock);
+}
+
+// Counts a free in the calling thread's cache of the arena
+static inline void count_free(struct arena_t *arena, size_t statClass, size_t size) {
+    struct threadcache_t *tcache = find_threadcache(arena);
+
+    if (tcache != NULL) {
+        tcache->stats.freeCount[statClass]++;
+        if (statClass == LARGE_STAT_CLASS) {
+            tcache->stats.largeBytesFreed += size;
+        }
+        return;
+    }
+
+    __sync_fetch_and_add(&retiredStats.freeCount[statClass], 1);
+    if (statClass == LARGE_STAT_CLASS) {
+        __sync_fetch_and_add(&retiredStats.largeBytesFreed, size);
+    }
+}
+
+// Counts a large or jumbo allocation. These don't need a thread cache, so
+// one isn't created just to count them
+static void count_large_malloc(struct arena_t *arena, size_t size) {
+    struct threadcache_t *tcache = find_threadcache(arena);
+
+    if (tcache != NULL) {
+        tcache->stats.mallocCount[LARGE_STAT_CLASS]++;
+        tcache->stats.largeBytesAllocated += size;
+        return;
+    }
+
+    __sync_fetch_and_add(&retiredStats.mallocCount[LARGE_STAT_CLASS], 1);
+    __sync_fetch_and_add(&retiredStats.largeBytesAllocated, size);
+}
+#endif
+
+/*** Multi-threaded application support ***/
+#ifdef FFSINGLE_THREADED
+// Support single threaded applications only
+
+// Array of thread caches, one per arena. Thread caches are still needed even
+// when compiled without threading support because they serve as the interface
+// for small allocations.
+struct threadcache_t* arenaCaches[MAX_ARENAS];
+
+// Single threaded implementation of FFTlsAlloc
+static int get_free_arena_index(FFTLSINDEX* index) {
+	for(FFTLSINDEX i=0; i<MAX_ARENAS; i++) {
+		if(arenaCaches[i] == NULL) {
+			arenaCaches[i] = ffmetadata_alloc(sizeof(struct threadcache_t));
+			// The cache is set up on first use, which reused metadata
+			// would otherwise skip
+			arenaCaches[i]->arena = NULL;
+			*index = i;
+			return 1;
+		}
+	}
+
+	return 0;
+}
+
+// Single threaded implementation of FFTlsFree
+static int free_arena_index(FFTLSINDEX index) {
+#ifdef MARK_SWEEP
+	if (arenaCaches[index]->arena != NULL) {
+		retire_tcache(arenaCaches[index]);
+	}
+#endif
+	ffmetadata_free(arenaCaches[index], sizeof(struct threadcache_t));
+	arenaCaches[index] = NULL;
+	return 0;
+}
+
+// One time initialization of the default arena thread cache
+static void init_threading() {
+	arenaCaches[0] = ffmetadata_alloc(sizeof(struct threadcache_t));
+	init_tcache(arenaCaches[0], arenas[0]);
+}
+
+// Returns the thread cache for the associated arena
+static inline struct threadcache_t* get_threadcache(struct arena_t* arena) {
+	if(arenaCaches[arena->tlsIndex]->arena == NULL) {
+		init_tcache(arenaCaches[arena->tlsIndex], arena);
+	}
+	return arenaCaches[arena->tlsIndex];
+}
+
+// Returns the thread cache for the associated arena if it has been
+// initialized, without creating it
+static inline struct threadcache_t* find_threadcache(struct arena_t* arena) {
+	struct threadcache_t* tcache = arenaCaches[arena->tlsIndex];
+	return tcache != NULL && tcache->arena != NULL ? tcache : NULL;
+}
+
+// Returns the index of the large pool list to use - always zero
+static unsigned int get_large_list_index() {
+	return 0;
+}
+
+// Returns the NUMA node to allocate from - always zero
+static inline unsigned int get_numa_node() {
+	return 0;
+}
+
+// Pools are never placed by node when single threaded
+static void init_numa() {
+}
+
+// End FFSINGLE_THREADED
+#else
+// Multi-threaded but OS neutral code
+// TODO: this should be updated to be null-op for non-default arenas
+void destroy_tcache(struct threadcache_t* tcache) {
+#ifdef MARK_SWEEP
+	retire_tcache(tcache);
+#endif
+	if (tcache->nextUnusedPage != NULL && (tcache->nextUnusedPage < tcache->endUnusedPage)) {
+		// While it would be better to return unused pages to the pool of origin, that's more
+		// complicated than I want to handle right now. So, just give them back to the OS
+		os_decommit(tcache->nextUnusedPage->start, (tcache->endUnusedPage - tcache->nextUnusedPage) * PAGE_SIZE);
+	}
+}
+// End OS neutral multi-threaded 
+#ifdef _WIN64
+// Begin Windows specific multi-threaded support
+
+// Index that retrieves the pointer to the per-thread cache
+//static DWORD threadIndex;
+
+static void init_threading() {
+	// Nothing to do on Windows. All threading related initialization is handled
+	// in DllMain
+}
+
+// Windows DLL entry point - handles TLS allocation and cleanup
+BOOL APIENTRY DllMain(HMODULE hModule, DWORD ul_reason_for_call, LPVOID lpReserved)
+{
+	struct threadcache_t* tcache;
+	// Pretty much just following the skeleton code here:
+	// https://docs.microsoft.com/en-us/windows/desktop/Dlls/using-thread-local-storage-in-a-dynamic-link-library
+	switch (ul_reason_for_call)
+	{
+	case DLL_PROCESS_ATTACH:
+		// Initialize library and create the default arena
+		initialize();
+
+		break;
+	case DLL_THREAD_ATTACH:
+
+		break;
+	case DLL_THREAD_DETACH:
+		// Thread is shutting down. Look for any associated caches
+		// to clean up in all active arenas
+		for (int i = 0; i < MAX_ARENAS; i++) {
+			if(arenas[i] != NULL) {
+				tcache = (struct threadcache_t*)TlsGetValue(arenas[i]->tlsIndex);
+				if (tcache != NULL) {
+					destroy_tcache(tcache);
+					ffmetadata_free(tcache, sizeof(struct threadcache_t));
+				}
+			}
+		}
+		break;
+	case DLL_PROCESS_DETACH:
+		// The whole process is being shut down or this library is being unloaded
+		// Presents a philosophical question about what to clean up. Should all
+		// pages allocated from here be unmapped if they aren't yet freed?
+
+		// At least clean up any TLS
+		tcache = (struct threadcache_t*)TlsGetValue(arenas[0]->tlsIndex);
+		if (tcache != NULL) {
+			destroy_tcache(tcache);
+			ffmetadata_free(tcache, sizeof(struct threadcache_t));
+		}
+
+		// Give the TLS index back to the OS
+		TlsFree(arenas[0]->tlsIndex);
+		FFDeleteCriticalSection(&poolTreeLock);
+		break;
+	}
+	return TRUE;
+}
+
+// Gets the thread cache associated with the current thread. On the
+// first call from a given thread, a new cache is created 
+static inline struct threadcache_t* get_threadcache(struct arena_t* arena) {
+	struct threadcache_t* tcache = TlsGetValue(arena->tlsIndex);
+	if (tcache == NULL) {
+		// No thread cache found so create one
+		tcache = (struct threadcache_t*)ffmetadata_alloc(sizeof(struct threadcache_t));
+		init_tcache(tcache, arena);
+
+		// Save the pointer in the thread local storage
+		TlsSetValue(arena->tlsIndex, tcache);
+	}
+
+	return tcache;
+}
+
+// Gets the thread cache associated with the current thread if it has one
+static inline struct threadcache_t* find_threadcache(struct arena_t* arena) {
+	return (struct threadcache_t*)TlsGetValue(arena->tlsIndex);
+}
+
+// Returns the index of the large pool list to use based on the active CPU
+static inline unsigned int get_large_list_index() {
+	return GetCurrentProcessorNumber() % MAX_LARGE_LISTS;
+}
+
+// Returns the NUMA node to allocate from. Pools aren't placed by node on
+// Windows yet, so always zero
+static inline unsigned int get_numa_node() {
+	return 0;
+}
+
+static void init_numa() {
+	// Nothing to do on Windows
+}
+
+// End Windows specific threading
+#else
+// Start Linux specific threading
+
+// Key that retrieves the pointer to the per-thread cache
+//pthread_key_t threadKey;
+
+// The thread's cache of the default arena, also kept in its key. Reading it
+// here spares the free path a pthread_getspecific call for the common case
+static __thread struct threadcache_t* defaultCache;
+
+static __attribute__((constructor)) void linux_mt_init() {
+	// A malloc from an earlier constructor may have set up already. Doing
+	// it again would map a new pool map and lose every pool in the old one
+	if (!isInit) {
+		initialize();
+	}
+}
+
+// One time initialization of the per-thread local storage
+static void init_threading() {
+//	pthread_key_create(&threadKey, cleanup_thread);
+}
+
+// Thread exit cleanup. Every arena's key runs this, in no particular order.
+// The thread is only done with the allocator once its default arena cache
+// is gone too, so a custom arena's cache going first leaves the rest alone
+static void cleanup_thread(void* ptr) {
+	if (ptr != NULL) {
+		if (ptr == defaultCache) {
+			defaultCache = NULL;
+		}
+		destroy_tcache((struct threadcache_t*)ptr);
+		ffmetadata_free(ptr, sizeof(struct threadcache_t));
+	}
+	if (defaultCache != NULL) {
+		return;
+	}
+#ifdef MARK_SWEEP
+	deregister_user_thread();
+	quarantine_flush();
+#endif
+}
+
+// Retrieves the specific cache for the currently running thread
+static inline struct threadcache_t* get_threadcache(struct arena_t* arena) {
+	if (arena == arenas[0] && defaultCache != NULL) {
+		return defaultCache;
+	}
+
+	struct threadcache_t* tcache = (struct threadcache_t*)pthread_getspecific(arena->tlsIndex);
+	if (tcache == NULL) {
+		// No thread cache found so create one
+		tcache = (struct threadcache_t*)ffmetadata_alloc(sizeof(struct threadcache_t));
+		init_tcache(tcache, arena);
+
+		// Save the pointer in the thread local storage
+		pthread_setspecific(arena->tlsIndex, tcache);
+	}
+	if (arena == arenas[0]) {
+		defaultCache = tcache;
+	}
+
+	return tcache;
+}
+
+// Retrieves the cache for the currently running thread if it has one
+static inline struct threadcache_t* find_threadcache(struct arena_t* arena) {
+	if (arena == arenas[0]) {
+		return defaultCache;
+	}
+	return (struct threadcache_t*)pthread_getspecific(arena->tlsIndex);
+}
+
+// Returns the index of the large list index to use based on the current CPU.
+// With several NUMA nodes, each node has its own share of the lists
+static unsigned int get_large_list_index() {
+	unsigned int cpuId;
+	unsigned int nodeId;
+	unsigned int listsPerNode = MAX_LARGE_LISTS / numaNodeCount;
+
+	if (getcpu(&cpuId, &nodeId) != 0) {
+		return 0;
+	}
+	return (nodeId % numaNodeCount) * listsPerNode + cpuId % listsPerNode;
+}
+
+// Returns the NUMA node of the current CPU, which is the one the thread
+// allocates from
+static inline unsigned int get_numa_node() {
+	unsigned int cpuId;
+	unsigned int nodeId;
+
+	if (numaNodeCount == 1 || getcpu(&cpuId, &nodeId) != 0) {
+		return 0;
+	}
+	return nodeId % numaNodeCount;
+}
+
+// Finds how many NUMA nodes pools are placed on from the nodes online
+static void init_numa() {
+	unsigned int nodes;
+
+#ifdef MARK_SWEEP
+	if (!OPTION(OPT_NUMA)) {
+		return;
+	}
+#endif
+
+	nodes = read_id_list("/sys/devices/system/node/online", NULL);
+	if (nodes > MAX_NUMA_NODES) {
+		nodes = MAX_NUMA_NODES;
+	}
+	if (nodes > 1) {
+		numaNodeCount = nodes;
+	}
+}
+
+// End Linux specific threading
+#endif
+#endif
+
+/*** Page allocation ***/
+
+// Returns the NUMA node that the pools of a large pool list are placed on.
+// Lists past the last whole share are never picked, see get_large_list_index
+static inline unsigned int get_large_list_node(unsigned int listId) {
+	unsigned int node = listId / (MAX_LARGE_LISTS / numaNodeCount);
+	return node < numaNodeCount ? node : numaNodeCount - 1;
+}
+
+// Called when a thread cache is out of pages and needs to be assigned
+// more from a pool. Pages come from the small pool of the NUMA node the
+// thread is running on. When that pool is out of pages, or the node has
+// none yet, then a new small pool is created
+static void assign_pages_to_tcache(struct threadcache_t* tcache) {
+	size_t nextFreePageMapIndex = 0;
+	byte* nextFreePage = NULL;
+	struct arena_t* arena = tcache->arena;
+	const unsigned int node = get_numa_node();
+
+	// First, select which pool to assign pages from
+	struct poollistnode_t* head = arena->smallPoolList[node];
+	struct pagepool_t* pool = head != NULL ? head->pool : NULL;
+
+	// Advance the free page pointer atomically so that concurrent threads
+	// get distinct ranges
+	if (pool != NULL) {
+		nextFreePage = (byte*)FFAtomicExchangeAdvancePtr(pool->nextFreePage, (PAGES_PER_REFILL * PAGE_SIZE));
+		nextFreePageMapIndex = (nextFreePage - pool->start) / PAGE_SIZE;
+	}
+
+	// Make sure that the range of pages selected from the pool are
+	// actually within the pool. If not, then the pool is full and needs to
+	// be retired and a new one created.
+	// Counting on PAGES_PER_REFILL to evenly divide POOL_SIZE
+	while (pool == NULL || nextFreePage + (PAGES_PER_REFILL * PAGE_SIZE) > pool->end) {
+		FFEnterCriticalSection(&arena->smallListLock);
+		// Check that while waiting for the lock that the pool wasn't already
+		// replaced. If it wasn't, then we can create the new pool
+		head = arena->smallPoolList[node];
+		if (head == NULL || pool == head->pool) {
+			struct poollistnode_t* newListHeader = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
+			newListHeader->pool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
+			newListHeader->pool->arena = arena;
+			newListHeader->pool->node = node;
+			if (create_pagepool(newListHeader->pool) == -1) {
+				ffmetadata_free(newListHeader->pool, sizeof(struct pagepool_t));
+				ffmetadata_free(newListHeader, sizeof(struct poollistnode_t));
+				// TODO: handle failure more gracefully
+				abort();
+			}
+			add_pool_to_tree(newListHeader->pool);
+			newListHeader->next = head;
+			arena->smallPoolList[node] = newListHeader;
+		}
+		pool = arena->smallPoolList[node]->pool;
+		FFLeaveCriticalSection(&arena->smallListLock);
+
+		nextFreePage = (byte*)FFAtomicExchangeAdvancePtr(pool->nextFreePage, (PAGES_PER_REFILL * PAGE_SIZE));
+		nextFreePageMapIndex = (nextFreePage - pool->start) / PAGE_SIZE;
+	}
+
+	// Create new page maps
+	for (size_t i = 0; i < PAGES_PER_REFILL; i++) {
+		pool->tracking.pageMaps[nextFreePageMapIndex + i].start = nextFreePage + (i * PAGE_SIZE);
+	}
+
+	// Assign the new page maps to the thread cache
+	tcache->nextUnusedPage = pool->tracking.pageMaps + nextFreePageMapIndex;
+	tcache->endUnusedPage = tcache->nextUnusedPage + PAGES_PER_REFILL;
+}
+
+/*** Initialization functions ***/
+
+// Creates a new arena. Applications do not call this directly but rather
+// through the public ffcreate_arena function
+static ffresult_t create_arena(struct arena_t* newArena) {
+#ifdef MARK_SWEEP
+	static size_t arenaSerial;
+#endif
+
+	if(newArena == NULL) {
+		return FFBAD_PARAM;
+	}
+
+#ifdef MARK_SWEEP
+	newArena->serial = __sync_add_and_fetch(&arenaSerial, 1);
+#endif
+
+	// Each arena has a unique TLS index that allows the correct arena
+	// specific thread cache to be retrieved. Each OS has a unique
+	// initialization required before use
+	if(!FFTlsAlloc(newArena->tlsIndex, TLS_CLEANUP_CALLBACK)) {
+		ffmetadata_free(newArena, sizeof(struct arena_t));
+		return FFSYS_LIMIT;
+	}		
+
+	// Create the small pool list header of the first node. The other nodes
+	// get theirs when a thread there first needs pages
+	for (int i = 1; i < MAX_NUMA_NODES; i++) {
+		newArena->smallPoolList[i] = NULL;
+	}
+	newArena->smallPoolList[0] = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
+	if(newArena->smallPoolList[0] == NULL) {
+		ffmetadata_free(newArena, sizeof(struct arena_t));
+		return FFSYS_LIMIT;
+	}
+	newArena->smallPoolList[0]->next = NULL;
+
+	// Create the first small pool and put it in the header node
+	newArena->smallPoolList[0]->pool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
+	if(newArena->smallPoolList[0]->pool == NULL) {
+		ffmetadata_free(newArena->smallPoolList[0], sizeof(struct poollistnode_t));
+		ffmetadata_free(newArena, sizeof(struct arena_t));
+		return FFSYS_LIMIT;
+	}
+
+	// Initialize the first small pool
+	newArena->smallPoolList[0]->pool->arena = newArena;
+	newArena->smallPoolList[0]->pool->node = 0;
+	if(create_pagepool(newArena->smallPoolList[0]->pool) != 0) {
+		ffmetadata_free(newArena->smallPoolList[0]->pool, sizeof(struct pagepool_t));
+		ffmetadata_free(newArena->smallPoolList[0], sizeof(struct poollistnode_t));
+		ffmetadata_free(newArena, sizeof(struct arena_t));
+		return FFNOMEM;
+	}
+	add_pool_to_tree(newArena->smallPoolList[0]->pool);
+
+	// Initialize the lock that protects the small list header
+	FFInitializeCriticalSection(&newArena->smallListLock);
+
+	// Create the large pool lists
+	// TODO: limit to lesser of MAX_LARGE_LISTS and actual CPU count
+	for (int i = 0; i < MAX_LARGE_LISTS; i++) {
+		struct pagepool_t* pool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
+		pool->arena = newArena;
+		pool->node = get_large_list_node(i);
+		if (pool == NULL || create_largepagepool(pool) == -1) {
+			destroy_pool_list(newArena->smallPoolList[0]);
+			// TODO: deconstruct any 
+			// successfully created large pools
+			ffmetadata_free(newArena, sizeof(struct arena_t));
+			return FFNOMEM;
+		}
+		add_pool_to_tree(pool);
+		newArena->largePoolList[i] = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
+		newArena->largePoolList[i]->pool = pool;
+#ifdef MARK_SWEEP
+        newArena->largePoolList[i]->next = NULL;
+#endif
+		FFInitializeCriticalSection(&newArena->largeListLock[i]);
+	}
+
+	return FFSUCCESS;
+}
+
+// Creates a new page pool by asking the OS for a block of memory
+static int create_pagepool(struct pagepool_t* newPool) {
+	// Get an initial range of virtual address space to hold the page maps and bitmaps
+	void* metadata = ffpoolmetadata_alloc(1);
+	if(metadata == NULL) {
+		fprintf(stderr, "create_pagepool metadata alloc failed: %d\n", errno);
+		return -1;
+	}
+
+	// Get the virtual address space block for the pool itself
+	void* poolReserve = os_alloc_highwater(POOL_SIZE, newPool->node);
+	if (poolReserve == MAP_FAILED) {
+		ffpoolmetadata_free(metadata, 1);
+		return -1;
+	}
+#ifdef FF_PROFILE
+	FFAtomicAdd(newPool->arena->profile.currentOSBytesMapped, POOL_SIZE);
+	if(newPool->arena->profile.currentOSBytesMapped > newPool->arena->profile.maxOSBytesMapped) {
+		// TODO: need thread safety
+		newPool->arena->profile.maxOSBytesMapped = newPool->arena->profile.currentOSBytesMapped;
+	}
+#endif
+	newPool->tracking.pageMaps = (struct pagemap_t*)metadata;
+	newPool->start = (byte*)poolReserve;
+	newPool->nextFreePage = newPool->start;
+	newPool->end = newPool->start + POOL_SIZE;
+	newPool->startInUse = newPool->start;
+	newPool->endInUse = newPool->end;
+#ifdef MARK_SWEEP
+	scanmap_reserve(newPool->start, newPool->end);
+	newPool->wpTracked = false;
+	newPool->scanners = 0;
+	newPool->scanBlocked = 0;
+	newPool->thpHeld = 0;
+	newPool->queuedPass = 0;
+#ifdef SUB_PAGE
+	memset((void*)newPool->dirtyPages, 0, sizeof(newPool->dirtyPages));
+	memset(newPool->reusablePages, 0, sizeof(newPool->reusablePages));
+#endif
+#endif
+
+	// Since nextFreeIndex isn't used by a small pool, we'll set it to SIZE_MAX
+	// as a flag to distinguish between the two types of pools in the find
+	// pointer code
+	newPool->nextFreeIndex = SIZE_MAX;
+
+	FFInitializeCriticalSection(&newPool->poolLock);
+
+	return 0;
+}
+
+// Creates a new large allocation pool
+static int create_largepagepool(struct pagepool_t* newPool) {
+	// Reserve an address range for the metadata
+	// Metadata should max out at about a page per 1MB of actual data:
+	// (1MB / 2048 bytes/allocations) * (8 bytes/allocation) = 4096 bytes
+	void* metadata = ffpoolmetadata_alloc(0);
+	if (metadata == NULL) {
+		return -1;
+	}
+
+	// Reserve an address range for the large pool itself
+	void* storage = os_alloc_highwater(POOL_SIZE, newPool->node);
+	if (storage == MAP_FAILED) {
+		ffpoolmetadata_free(metadata, 0);
+		return -1;
+	}
+#ifdef FF_PROFILE
+	FFAtomicAdd(newPool->arena->profile.currentOSBytesMapped, POOL_SIZE);
+	while(newPool->arena->profile.currentOSBytesMapped > newPool->arena->profile.maxOSBytesMapped) {
+		// TODO: need thread safety
+		newPool->arena->profile.maxOSBytesMapped = newPool->arena->profile.currentOSBytesMapped;
+	}
+#endif
+	
+	// Add the metadata to the pool
+	newPool->tracking.allocations = (uintptr_t*)metadata;
+
+	// Add the storage to the pool
+	newPool->start = (byte*)storage;
+	newPool->end = (byte*)storage + POOL_SIZE;
+	newPool->nextFreePage = (byte*)storage;
+	newPool->startInUse = newPool->start;
+	newPool->endInUse = newPool->end;
+#ifdef MARK_SWEEP
+	scanmap_reserve(newPool->start, newPool->end);
+#endif
+
+	// There is always one more metadata entry than allocations so that size can
+	// be computed by subtracting the pointers. Record the first dummy entry now
+	// Pool metadata may be reused, so don't count on the index being zero
+	newPool->nextFreeIndex = 0;
+	newPool->tracking.allocations[0] = (uintptr_t)storage;
+
+#ifdef MARK_SWEEP
+	newPool->serial = __sync_add_and_fetch(&largePoolSerial, 1);
+	newPool->wpTracked = false;
+	newPool->scanners = 0;
+	newPool->scanBlocked = 0;
+	newPool->thpHeld = 0;
+	newPool->queuedPass = 0;
+#endif
+	FFInitializeCriticalSection(&newPool->poolLock);
+	return 0;
+}
+
+// Helper function to initialize a new jumbo page
+static inline int create_jumbopool(struct pagepool_t* newPool, size_t size) {
+	// The only metadata required for a jumbo pool is just the size since
+	// there will only ever just be the one allocation. Therefore don't
+	// allocate a metadata block. Mark it NULL here just to make the point
+	newPool->tracking.allocations = NULL;
+
+	// Just like the small pool we'll recycle the nextFreeIndex field as
+	// a flag that this isn't a normal pool
+	newPool->nextFreeIndex = SIZE_MAX - 1;
+
+	// Since this allocation is coming straight from the OS it needs to be
+	// page aligned
+	size = ALIGN_TO(size, PAGE_SIZE);
+
+	// Ask the OS for memory
+	void* storage;
+	storage = os_alloc_highwater(size, newPool->node);
+	if(storage == MAP_FAILED) {
+		return -1;
+	}
+
+#ifdef FF_PROFILE
+	// Update statistics
+	FFAtomicAdd(newPool->arena->profile.totalBytesAllocated, size);
+	FFAtomicAdd(newPool->arena->profile.currentBytesAllocated, size);
+	FFAtomicAdd(newPool->arena->profile.currentOSBytesMapped, size);
+	if(newPool->arena->profile.currentBytesAllocated > newPool->arena->profile.maxBytesAllocated) {
+		// TODO: thread safety
+		newPool->arena->profile.maxBytesAllocated = newPool->arena->profile.currentBytesAllocated;
+	}
+	if(newPool->arena->profile.currentOSBytesMapped > newPool->arena->profile.maxOSBytesMapped) {
+		// TODO: need thread safety
+		newPool->arena->profile.maxOSBytesMapped = newPool->arena->profile.currentOSBytesMapped;
+	}
+#endif
+
+	// Record the size of this oddball	
+	newPool->start = (byte*)storage;
+	newPool->end = (byte*)storage + size;
+	newPool->startInUse = newPool->start;
+	newPool->endInUse = newPool->end;
+#ifdef MARK_SWEEP
+	scanmap_reserve(newPool->start, newPool->end);
+	newPool->wpTracked = false;
+	newPool->scanners = 0;
+	newPool->scanBlocked = 0;
+	newPool->thpHeld = 0;
+	newPool->queuedPass = 0;
+#endif
+
+	// Return success
+	return 0;	
+}
+
+// Initializes a new thread cache by constructing the bins
+static void init_tcache(struct threadcache_t* tcache, struct arena_t* arena) {
+	// Initialize all of the bin headers
+	// First, the very small bins that are consecutive multiples of 8
+	// 8, 16, 24, 32, ... 192, 200, 208
+	// Or consecutive multiples of 16 after 16 when using 16 byte alignment
+	// 8, 16, 32, 48, ... 272, 288, 304
+	for (size_t b = 1; b <= (BIN_COUNT - BIN_INFLECTION); b++) {
+		tcache->bins[BIN_COUNT - b].allocSize = b * MIN_ALIGNMENT;
+		tcache->bins[BIN_COUNT - b].maxAlloc = PAGE_SIZE / (b * MIN_ALIGNMENT);
+
+		// Set allocCount equal to maxAlloc and not 0 even though its 
+		// empty so that the first allocation from bin will actually trigger
+		// allocating a page instead of pre-emptively doing that now and
+		// wasting it on a bin that might not get used
+		tcache->bins[BIN_COUNT - b].allocCount = tcache->bins[BIN_COUNT - b].maxAlloc;
+		tcache->bins[BIN_COUNT - b].page = NULL;
+#ifdef FF_PROFILE
+		tcache->bins[BIN_COUNT - b].totalAllocCount = 0;
+#endif
+	}
+
+	// Next, the bins that are consecutive in max allocation per page
+	// 336, 368, 400, ... 816, 1024, 1360, 2048, 4096+ when 16-byte aligned
+	// Note that additional bins in between wouldn't be any more space
+	// efficient. For example, you can get 3 * 1360 per page and 2 * 2048
+	// but also only 2 * 1536 so having a bin for that size is no more
+	// efficient than just dumping it into the 2048 bin
+	for (size_t b = 1; b < BIN_INFLECTION; b++) {
+		// Bin sizes need to be rounded down to correct alignment
+		tcache->bins[b].allocSize = ((PAGE_SIZE / b) & ~(MIN_ALIGNMENT - 1));
+		tcache->bins[b].maxAlloc = b;
+		tcache->bins[b].allocCount = b;
+		tcache->bins[b].page = NULL;
+#ifdef FF_PROFILE
+		tcache->bins[b].totalAllocCount = 0;
+#endif
+	}
+
+#ifndef FF_EIGHTBYTEALIGN
+	// The bin for 8 byte allocations doesn't fit the pattern when doing
+	// 16-byte alignment
+	tcache->bins[0].allocSize = 8;
+	tcache->bins[0].maxAlloc = PAGE_SIZE / 8;
+	tcache->bins[0].allocCount = PAGE_SIZE / 8;
+	tcache->bins[0].page = NULL;
+#ifdef FF_PROFILE
+	tcache->bins[0].totalAllocCount = 0;
+#endif
+#endif
+
+#ifdef MARK_SWEEP
+#ifdef SUB_PAGE
+    for (size_t b = 0; b < 256; b++) {
+        tcache->reusePage[b] = NULL;
+    }
+#endif
+
+    for (size_t b = 0; b < BIN_COUNT; b++) {
+        statClassSize[b] = tcache->bins[b].allocSize;
+    }
+    register_tcache(tcache);
+
+    // A thread getting its first cache is about to start mutating the heap
+    register_user_thread();
+#endif
+
+	// Remember which arena this cache is connected to
+	tcache->arena = arena;
+
+	// Get some pages for this new cache to use
+	assign_pages_to_tcache(tcache);
+}
+
+#ifdef MARK_SWEEP
+
+#define MAX_THREAD 1
+
+// Roots and pools are scanned in pieces of at most SCAN_CHUNK_SIZE bytes,
+// aligned to SCAN_CHUNK_SIZE so that a chunk never spans two pagemap batches.
+// The work array starts with room for SCAN_CHUNK_CAPACITY chunks and doubles
+// whenever it fills up
+#define SCAN_CHUNK_SIZE     (256UL * 1024UL)
+#define SCAN_CHUNK_CAPACITY (1UL << 16)
+
+// Root ranges are kept between passes along with the /proc/self/maps text
+// they were parsed from. Both start with the room below and double as needed
+#define SCAN_ROOT_CAPACITY  (1UL << 12)
+#define MAPS_BUFFER_SIZE    (1UL * 1048576UL)
+
+struct scanchunk_t {
+    uint64_t start;
+    uint64_t end;
+
+    // The pool the chunk belongs to or NULL for a root range
+    struct pagepool_t *pool;
+
+    // Set when the chunk was cut from the kernel's list of dirty pages, so
+    // every page in it is known to need scanning without another query
+    bool exact;
+
+    // Set on a root range right above a guard page or on the main stack.
+    // A pause only scans such a range from the lowest frame of a thread
+    // stopped in it
+    bool stack;
+};
+
+// Ranges given to ffregister_root and ffexclude_range
+#define MAX_ROOT_RANGES     64
+
+struct rootrange_t {
+    uint64_t start;
+    uint64_t end;
+};
+
+// A run of the work array owned by one scanner. The index of the first
+// remaining chunk is in the upper half of bounds and one past the last in the
+// lower half, so that taking from either end is a single compare and swap
+struct scandeque_t {
+    uint64_t volatile bounds;
+    byte pad[56];
+};
+
+struct markbuf_t;
+
+struct scanner_t {
+    pthread_t *t;
+    int id;
+    size_t group;
+    struct reclaim_t* volatile arg;
+    struct markbuf_t *marks;
+};
+
+struct reclaim_t {
+    // Common
+    int id;
+    pid_t owner;
+    pid_t tid;
+
+    bool volatile concurrent;
+
+    pthread_t thread;
+    pthread_attr_t attr;
+
+    struct arena_t *arena;
+
+    // Scanner pool. Between sweeps the scanners sleep on scanWake. Every
+    // start_scanner opens a new scanRound and stop_scanner sleeps on scanIdle
+    // until all scanners have finished it and scanBusy is back to zero. These
+    // are plain pthread objects because the scanners run in parallel even in
+    // single threaded builds
+    pthread_t scanner[MAX_SCANNER];
+    size_t scannerCount;
+    pthread_mutex_t scanLock;
+    pthread_cond_t scanWake;
+    pthread_cond_t scanIdle;
+    size_t scanRound;
+    size_t scanBusy;
+
+    // Scan work for the current pass. The reclaimer fills the array before
+    // waking the scanners and start_scanner splits it into one deque each
+    struct scanchunk_t *chunks;
+    size_t chunkCount;
+    size_t chunkCapacity;
+
+    // Counts the passes queued so far. A pool is queued once per pass even
+    // when a walk of one list runs into another
+    size_t queuePass;
+
+    struct scandeque_t deques[MAX_SCANNER];
+
+    // Set for the rest of the cycle once the work array, the root ranges or
+    // the maps text could not grow. Every pass then gives up at once, so
+    // nothing is released on marks that are missing a range
+    bool scanOverflow;
+
+    // NUMA placement. With one group per node, the scanners from
+    // scanFirst[g] up to scanFirst[g + 1] are pinned to the CPUs of node g
+    // and start on the chunks from chunkFirst[g] up to chunkFirst[g + 1],
+    // which are that node's pools and a share of the roots. Otherwise
+    // there is a single group
+    size_t scanGroups;
+    size_t scanFirst[MAX_NUMA_NODES + 1];
+    size_t chunkFirst[MAX_NUMA_NODES + 1];
+
+    // Set once a pause overruns its budget to make the scanners give up on
+    // the remaining chunks
+    bool volatile scanAbort;
+    size_t pauseOverruns;
+
+    // Root ranges from the last parse of /proc/self/maps. The text is read
+    // into the spare buffer and only parsed again if it differs from the one
+    // at mapsCurrent
+    struct scanchunk_t *roots;
+    size_t rootCount;
+    size_t rootCapacity;
+    char *mapsText[2];
+    size_t mapsLength;
+    size_t mapsCapacity;
+    int mapsCurrent;
+
+    // Set once the current root ranges are registered for userfaultfd dirty
+    // tracking
+    bool rootsTracked;
+
+    // The rootSetGeneration the roots were built at, with the registered and
+    // excluded ranges as of then. With the mmap wrappers also the mapped and
+    // data pages from statm, which glibc's own mappings move
+    size_t mapsGeneration;
+    struct rootrange_t userRoots[MAX_ROOT_RANGES];
+    size_t userRootCount;
+    struct rootrange_t excluded[MAX_ROOT_RANGES];
+    size_t excludedCount;
+#ifdef FF_WRAP_MMAP
+    size_t mapsSize;
+    size_t mapsData;
+#endif
+
+    // Memory pressure sources, -1 where unavailable, and the RSS right after
+    // the last sweep or 0 until it has been sampled
+    int statmFd;
+    int cgroupCurrentFd;
+    int cgroupHighFd;
+    int psiFd;
+    bool psiEvent;
+    size_t sweepRss;
+
+    sigset_t wait_mask;
+};
+
+
+
+static struct reclaim_t thread_list[MAX_THREAD];
+static int empty_thread = 0;
+static struct reclaim_t *reclaimer;
+
+static int volatile softDirty = 0;
+
+// Moved by anything that may change the roots: the mmap wrappers, the root
+// API and new threads. The roots are rebuilt once it has
+static size_t volatile rootSetGeneration = 1;
+
+// A scanner of a concurrent pass enters a pool before it reads it and a
+// mutator blocks the pool before it releases or moves it, so that a scanner
+// never reads a pool that goes away under it. Both sides announce themselves
+// before they look at the other, so either the scanner backs off or the
+// mutator waits for it to leave. Only the pool at hand is waited for, never
+// the whole pass
+static inline bool pool_scan_enter(struct pagepool_t *pool) {
+    __sync_fetch_and_add(&pool->scanners, 1);
+    if (pool->scanBlocked) {
+        __sync_fetch_and_sub(&pool->scanners, 1);
+        return false;
+    }
+    return true;
+}
+
+static inline void pool_scan_exit(struct pagepool_t *pool) {
+    __sync_fetch_and_sub(&pool->scanners, 1);
+}
+
+static void pool_scan_block(struct pagepool_t *pool) {
+    __sync_fetch_and_add(&pool->scanBlocked, 1);
+    while (pool->scanners != 0) {
+        sched_yield();
+    }
+}
+
+static inline void pool_scan_unblock(struct pagepool_t *pool) {
+    __sync_fetch_and_sub(&pool->scanBlocked, 1);
+}
+
+// What the sweep cycle in progress has done so far. Only the reclaimer and,
+// at the end of each round under scanLock, the scanners write it. Once the
+// cycle ends it is folded into sweepStats, which readers copy under
+// sweepStatsLock
+static ffsweepcycle_t sweepCycle;
+static ffsweepstats_t sweepStats;
+static pthread_mutex_t sweepStatsLock = PTHREAD_MUTEX_INITIALIZER;
+
+
+
+static void *reclaim_thread(void *data);
+
+
+
+static inline uint64_t bitCount(uint64_t v) {
+    return __builtin_popcountll(v);
+}
+
+/*** User-side Memory Scanner(from minesweeper) ***/
+
+//
+// Memory Scanning & Dirty Bits Handling
+//
+struct procmap_t {
+    void *startPtr;
+    void *endPtr;
+
+    bool readdable, writable, executable, CoW;
+    size_t offset;
+
+    uintptr_t inode;
+
+    bool has_path;
+    bool from_ffmalloc;
+    bool stack;
+    bool heap;
+
+    struct procmap_t *next;
+};
+
+static int uffdFd = -1;
+
+#ifndef UFFD_FEATURE_WP_ASYNC
+#define UFFD_FEATURE_WP_ASYNC   ((__u64)1 << 15)
+#endif
+
+// Opens the write-protect userfaultfd. In asynchronous mode the kernel
+// resolves the faults on protected pages itself, so nothing reads from it
+static bool init_uffd(void) {
+    struct uffdio_api api;
+    int fd = syscall(SYS_userfaultfd, O_CLOEXEC | O_NONBLOCK | UFFD_USER_MODE_ONLY);
+    if (fd < 0) {
+        return false;
+    }
+
+    memset(&api, 0, sizeof(api));
+    api.api = UFFD_API;
+    api.features = UFFD_FEATURE_WP_ASYNC;
+    if (ioctl(fd, UFFDIO_API, &api) < 0) {
+        close(fd);
+        return false;
+    }
+
+    uffdFd = fd;
+    return true;
+}
+
+// Checks that soft-dirty bits work by clearing them and writing a page of
+// its own. Some kernels accept the clear without ever setting the bit again,
+// which would leave every write made during a concurrent pass unscanned
+static bool init_soft_dirty(void) {
+    byte volatile *page;
+    uint64_t entry = 0;
+    bool works = false;
+    int clearFd, pagemapFd;
+
+    clearFd = open("/proc/self/clear_refs", O_WRONLY | O_CLOEXEC);
+    if (clearFd < 0) {
+        lf_dbg("cannot open clear_refs");
+        return false;
+    }
+    pagemapFd = open("/proc/self/pagemap", O_RDONLY | O_CLOEXEC);
+    page = (byte volatile *)sys_mmap(NULL, PAGE_SIZE, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+
+    if (pagemapFd >= 0 && page != MAP_FAILED) {
+        page[0] = 1;
+        if (write(clearFd, "4", 1) == 1) {
+            page[0] = 2;
+            if (pread(pagemapFd, &entry, sizeof(entry), ((uint64_t)page >> 12) * sizeof(entry)) == sizeof(entry)) {
+                works = ((entry >> 55) & 0x1) != 0;
+            }
+        }
+    }
+
+    if (page != MAP_FAILED) {
+        sys_munmap((void *)page, PAGE_SIZE);
+    }
+    if (pagemapFd >= 0) {
+        close(pagemapFd);
+    }
+    close(clearFd);
+
+    if (!works) {
+        lf_dbg("soft-dirty bits are not set on write");
+    }
+    return works;
+}
+
+// Settles the dirty tracking mode. The userfaultfd modes fall back to
+// soft-dirty and soft-dirty to none where the kernel or the container
+// doesn't allow them
+static void init_dirty_tracking(void) {
+    long mode = OPTION(OPT_DIRTY_TRACKING);
+
+    if ((mode == DIRTY_UFFD || mode == DIRTY_UFFD_SCAN) && !init_uffd()) {
+        lf_dbg("no asynchronous userfaultfd write-protect");
+        mode = DIRTY_SOFT;
+    }
+    if (mode == DIRTY_SOFT && !init_soft_dirty()) {
+        mode = DIRTY_NONE;
+    }
+
+    options[OPT_DIRTY_TRACKING].value = mode;
+}
+
+static void clear_softdirty(void) {
+    int fd = open("/proc/self/clear_refs", O_WRONLY);
+    int ret;
+    if (fd < 0) {
+        lf_dbg("error to open clear_refs");
+        exit(-1);
+    }
+    ret = write(fd,"4", 1);
+    if (ret < 0) {
+        exit(-1);
+    }
+    close(fd);
+}
+
+#ifdef UNUSED
+static void clear_dirty(void) {
+    int ret = 0;
+
+    ret = ioctl(kmscan_fd, _IOWR('G', 2, uint64_t), 0); 
+    if (ret < 0) {
+        fprintf(stderr, "fail to send ioctl order: CLEAR_DIRTY\n");
+        exit(-1);
+    }
+}
+
+
+static bool check_pgdirty(uint64_t addr) {
+    int ret = 0;
+
+    if (addr & 0xFFF) {
+        exit(-1);
+    }
+
+    ret = ioctl(kmscan_fd, _IOWR('G', 3, uint64_t), &addr); 
+    if (ret < 0) {
+        fprintf(stderr, "fail to send ioctl order: CHECK_DIRTY\n");
+        exit(-1);
+    }
+
+    return ret;
+}
+#endif
+
+
+static inline bool check_soft_dirty(int fd, uint64_t addr) {
+    uint64_t data;
+    int ret = 0;
+    if (addr & 0xFFF) {
+        fprintf(stderr, "invalid address %016lx\n", addr);
+        exit(-1);
+    }
+
+    ret = pread(fd, &data, sizeof(data), (addr >> 12) * sizeof(data));
+    if (ret == 0) {
+        // Not exist... end of file
+        return false;
+    }
+    if (ret != sizeof(data)) {
+        lf_dbg("pread error\n");
+        exit(-1);
+    }
+
+    return (((data >> 55) & 0x1) == 1);
+}
+
+
+static inline bool check_present(int fd, uint64_t addr) {
+    uint64_t data;
+    int ret = 0;
+    if (addr & 0xFFF) {
+        exit(-1);
+    }
+
+    ret = pread(fd, &data, sizeof(data), (addr >> 12) * sizeof(data));
+    if (ret == 0) {
+        // Not exist... end of file
+        return false;
+    }
+
+    if (ret != sizeof(data)) {
+        lf_dbg("pread error\n");
+        exit(-1);
+    }
+
+    return (((data >> 63) & 0x1) == 1);
+}
+
+
+//
+// Batched Page Status Queries
+//
+// The sweep only needs to read pages that are present and, during the STW
+// pass, soft-dirty. Rather than one pread per page, the status of up to a
+// pool's worth of pages is fetched at once into a bitmap holding one bit per
+// page worth scanning. Kernels with the PAGEMAP_SCAN ioctl (6.7+) walk the page
+// tables themselves and only report the matching runs of pages. Otherwise, the
+// pagemap entries for the whole batch are read with a single pread
+//
+#ifndef PAGEMAP_SCAN
+struct page_region {
+    uint64_t start;
+    uint64_t end;
+    uint64_t categories;
+};
+
+struct pm_scan_arg {
+    uint64_t size;
+    uint64_t flags;
+    uint64_t start;
+    uint64_t end;
+    uint64_t walk_end;
+    uint64_t vec;
+    uint64_t vec_len;
+    uint64_t max_pages;
+    uint64_t category_inverted;
+    uint64_t category_mask;
+    uint64_t category_anyof_mask;
+    uint64_t return_mask;
+};
+
+#define PAGEMAP_SCAN            _IOWR('f', 16, struct pm_scan_arg)
+#define PM_SCAN_WP_MATCHING     (1 << 0)
+#define PM_SCAN_CHECK_WPASYNC   (1 << 1)
+#define PAGE_IS_WRITTEN         (1 << 1)
+#define PAGE_IS_PRESENT         (1 << 3)
+#define PAGE_IS_SOFT_DIRTY      (1 << 7)
+#endif
+
+// The PAGEMAP_SCAN category of a page written since the last reset. Under
+// userfaultfd that is a page that isn't write-protected, which takes in every
+// page outside the registered ranges
+static inline uint64_t dirty_category(void) {
+    return OPTION(OPT_DIRTY_TRACKING) == DIRTY_SOFT ? PAGE_IS_SOFT_DIRTY : PAGE_IS_WRITTEN;
+}
+
+// The same test on a pagemap entry, bit 55 being soft-dirty and bit 57
+// userfaultfd write-protected
+static inline bool pagemap_entry_dirty(uint64_t entry) {
+    if (OPTION(OPT_DIRTY_TRACKING) == DIRTY_SOFT) {
+        return ((entry >> 55) & 0x1) != 0;
+    }
+    return ((entry >> 57) & 0x1) == 0;
+}
+
+// The number of pages covered by one status query and the number of 64-bit
+// words in the resulting page bitmap
+#define PAGEMAP_BATCH_PAGES     (POOL_SIZE / PAGE_SIZE)
+#define PAGEMAP_BATCH_WORDS     (PAGEMAP_BATCH_PAGES / 64)
+
+// The number of page runs the kernel may report per PAGEMAP_SCAN call
+#define PAGEMAP_SCAN_REGIONS    64
+
+// Cleared the first time the kernel rejects PAGEMAP_SCAN so that later queries
+// go straight to the pread fallback
+static int volatile pagemapScanSupported = 1;
+
+// Fills the page bitmap from the kernel's PAGEMAP_SCAN ioctl. Returns false if
+// the ioctl isn't supported by the running kernel
+static bool pagemap_scan_batch(int fd, uint64_t start, size_t pageCount, bool concurrent, uint64_t *pageBits) {
+    struct page_region regions[PAGEMAP_SCAN_REGIONS];
+    struct pm_scan_arg arg;
+    uint64_t end = start + pageCount * PAGE_SIZE;
+    uint64_t first, last;
+    long ret, index;
+
+    memset(&arg, 0, sizeof(arg));
+    arg.size = sizeof(arg);
+    arg.start = start;
+    arg.end = end;
+    arg.vec = (uint64_t)regions;
+    arg.vec_len = PAGEMAP_SCAN_REGIONS;
+    arg.category_mask = PAGE_IS_PRESENT | (concurrent ? 0 : dirty_category());
+    arg.return_mask = arg.category_mask;
+
+    while (arg.start < end) {
+        ret = ioctl(fd, PAGEMAP_SCAN, &arg);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            return false;
+        }
+
+        for (index = 0; index < ret; index++) {
+            first = (regions[index].start - start) / PAGE_SIZE;
+            last = (regions[index].end - start) / PAGE_SIZE;
+            for (; first < last; first++) {
+                pageBits[first >> 6] |= ONE64 << (first & SIXTYTHREE64);
+            }
+        }
+
+        // The walk stops early when the region vector is full
+        if (arg.walk_end <= arg.start) break;
+        arg.start = arg.walk_end;
+    }
+
+    return true;
+}
+
+// Fills the page bitmap by reading the pagemap entries of the whole batch at
+// once
+static void pagemap_read_batch(int fd, uint64_t start, size_t pageCount, bool concurrent, uint64_t *pageBits) {
+    uint64_t entries[PAGEMAP_BATCH_PAGES];
+    ssize_t ret;
+    size_t index, count;
+
+    ret = pread(fd, entries, pageCount * sizeof(uint64_t), (start >> 12) * sizeof(uint64_t));
+    if (ret < 0) {
+        fprintf(stderr, "pread error %d, %s, %d\n", (int)ret, strerror(errno), fd);
+        lf_dbg("pread error\n");
+        exit(-1);
+    }
+
+    // A short read means the end of the address space was reached
+    count = (size_t)ret / sizeof(uint64_t);
+    for (index = 0; index < count; index++) {
+        if (((entries[index] >> 63) & 0x1) && (concurrent || pagemap_entry_dirty(entries[index]))) {
+            pageBits[index >> 6] |= ONE64 << (index & SIXTYTHREE64);
+        }
+    }
+}
+
+// Sets a bit in pageBits for each of the pageCount pages starting at the page
+// aligned address start that is present and, unless concurrent, dirty.
+// pageCount must not exceed PAGEMAP_BATCH_PAGES
+static void pagemap_query(int fd, uint64_t start, size_t pageCount, bool concurrent, uint64_t *pageBits) {
+    if (start & 0xFFF) {
+        fprintf(stderr, "invalid address %016lx\n", start);
+        exit(-1);
+    }
+
+    memset(pageBits, 0, PAGEMAP_BATCH_WORDS * sizeof(uint64_t));
+
+    if (pagemapScanSupported) {
+        if (pagemap_scan_batch(fd, start, pageCount, concurrent, pageBits)) {
+            return;
+        }
+        pagemapScanSupported = 0;
+    }
+
+    pagemap_read_batch(fd, start, pageCount, concurrent, pageBits);
+}
+
+// Returns the index of the first page at or after index that is set in the
+// page bitmap, or pageCount if there are none left
+static inline size_t pagemap_next(const uint64_t *pageBits, size_t index, size_t pageCount) {
+    uint64_t word;
+
+    while (index < pageCount) {
+        word = pageBits[index >> 6] >> (index & SIXTYTHREE64);
+        if (word) {
+            return index + __builtin_ctzll(word);
+        }
+        index = (index | SIXTYTHREE64) + 1;
+    }
+
+    return pageCount;
+}
+
+
+static inline bool check_dirty(unsigned char *vec, uint64_t addr, uint64_t base) {
+    unsigned char data = vec[(addr - base) >> 12];
+    return data == 1; 
+}
+
+
+#define ALLOCA_ALIGN    3
+#define BIT_ALIGN       3
+#define BYTE_ALIGN      21
+#define MAP_ALIGN       21
+
+#define BIT_OFFSET      BIT_ALIGN
+#define BYTE_OFFSET     (BIT_OFFSET + ALLOCA_ALIGN)
+#define MAP_OFFSET      (BYTE_OFFSET + BYTE_ALIGN)
+
+#define ADDR_BITS       48
+
+#define ONE_MAP_SIZE    (1 << (MAP_OFFSET - BYTE_OFFSET))
+#define NUM_MAPS        (1 << MAP_ALIGN)
+
+// The number of sub-maps carved out of each address space reservation and
+// the maximum number of mappings owned by the scanmap itself
+#define SCANMAP_CHUNK_MAPS      512
+#define MAX_SCANMAP_RANGES      256
+
+struct scanmaprange_t {
+    uint64_t start;
+    uint64_t end;
+};
+
+struct pointermap_t {
+    uint8_t volatile *bitmap[NUM_MAPS];
+
+    // Summary level. Each sub-map has a word with one bit per POOL_SIZE region
+    // of the addresses it covers, set once any address in the region is
+    // marked. Sub-maps whose word went from zero to non-zero during the
+    // current sweep are listed in touched so that clearing only visits them
+    uint64_t volatile *summary;
+    uint32_t *touched;
+    size_t volatile touchedCount;
+
+    // Sub-maps are carved sequentially from large reservations
+    uint8_t *chunkNext;
+    uint8_t *chunkEnd;
+
+    // Registry of every mapping owned by the scanmap so that the root scan
+    // can skip them without searching the sub-map table
+    struct scanmaprange_t ranges[MAX_SCANMAP_RANGES];
+    size_t rangeCount;
+};
+
+typedef union {
+    struct {
+        uint64_t align  :   ALLOCA_ALIGN;
+        uint64_t bit    :   BIT_ALIGN;
+        uint64_t byte   :   BYTE_ALIGN;
+        uint64_t map    :   MAP_ALIGN;
+        uint64_t size   :   16;
+    };
+
+    uint64_t addr;
+} addr_t;
+
+static struct pointermap_t scanmap;
+FFLOCKSTATIC(scanmapLock);
+
+
+static void init_scan_kernel(void);
+
+// Records a mapping that belongs to the scanmap itself
+static void scanmap_register_range(void *start, size_t size) {
+    if (scanmap.rangeCount == MAX_SCANMAP_RANGES) {
+        fprintf(stderr, "scanmap: too many mappings\n");
+        abort();
+    }
+
+    scanmap.ranges[scanmap.rangeCount].start = (uint64_t)start;
+    scanmap.ranges[scanmap.rangeCount].end = (uint64_t)start + size;
+    scanmap.rangeCount++;
+}
+
+// Follows a registered mapping that was moved or resized by mremap
+static void scanmap_move_range(void *oldStart, void *newStart, size_t size) {
+    for (size_t i = 0; i < scanmap.rangeCount; i++) {
+        if (scanmap.ranges[i].start == (uint64_t)oldStart) {
+            scanmap.ranges[i].start = (uint64_t)newStart;
+            scanmap.ranges[i].end = (uint64_t)newStart + size;
+            return;
+        }
+    }
+}
+
+static void init_scanmap(void) {
+    size_t size = NUM_MAPS * (sizeof(uint64_t) + sizeof(uint32_t));
+    byte *control;
+
+    FFInitializeCriticalSection(&scanmapLock);
+
+    control = (byte *)sys_mmap(NULL, size, PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (control == MAP_FAILED) {
+        lf_dbg("fail to map the scanmap summary");
+        abort();
+    }
+    scanmap.summary = (uint64_t volatile *)control;
+    scanmap.touched = (uint32_t *)(control + NUM_MAPS * sizeof(uint64_t));
+    scanmap_register_range(control, size);
+
+    init_scan_kernel();
+}
+
+
+// Reserves the address space for SCANMAP_CHUNK_MAPS sub-maps. With huge pages
+// the reservation is trimmed so that each sub-map is one aligned huge page
+static uint8_t *scanmap_map_chunk(void) {
+    size_t size = SCANMAP_CHUNK_MAPS * ONE_MAP_SIZE;
+    size_t slack = OPTION(OPT_THP) ? ONE_MAP_SIZE : 0;
+    uint8_t *map;
+    uint8_t *aligned;
+
+    map = (uint8_t *)sys_mmap(NULL, size + slack, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (map == MAP_FAILED) {
+        lf_dbg("fail to map a sub-bitmap");
+        abort();
+    }
+
+    if (slack != 0) {
+        aligned = (uint8_t *)ALIGN_TO((uint64_t)map, (uint64_t)ONE_MAP_SIZE);
+        if (aligned > map) {
+            sys_munmap(map, aligned - map);
+        }
+        if (aligned + size < map + size + slack) {
+            sys_munmap(aligned + size, map + slack - aligned);
+        }
+        map = aligned;
+        madvise(map, size, MADV_HUGEPAGE);
+    }
+
+    return map;
+}
+
+// Creates the sub-maps covering a new pool up front so that marking never has
+// to allocate or take a lock. Sub-maps are never released, only cleared, so
+// every address that ever belonged to a pool has one
+static void scanmap_reserve(const byte* start, const byte* end) {
+    uint64_t mapId = (uint64_t)start >> MAP_OFFSET;
+    uint64_t lastMapId = ((uint64_t)end - 1) >> MAP_OFFSET;
+    uint8_t *map;
+
+    for (; mapId <= lastMapId; mapId++) {
+        if (scanmap.bitmap[mapId] != NULL) continue;
+
+        FFEnterCriticalSection(&scanmapLock);
+        if (scanmap.bitmap[mapId] == NULL) {
+            if (scanmap.chunkNext == scanmap.chunkEnd) {
+                map = scanmap_map_chunk();
+                scanmap_register_range(map, SCANMAP_CHUNK_MAPS * ONE_MAP_SIZE);
+                scanmap.chunkNext = map;
+                scanmap.chunkEnd = map + SCANMAP_CHUNK_MAPS * ONE_MAP_SIZE;
+            }
+
+            map = scanmap.chunkNext;
+            scanmap.chunkNext += ONE_MAP_SIZE;
+            scanmap.bitmap[mapId] = map;
+        }
+        FFLeaveCriticalSection(&scanmapLock);
+    }
+}
+
+
+//
+// Per-Scanner Mark Buffers
+//
+// Rather than setting a bit in the shared scanmap for each candidate pointer,
+// a scanner first collects its marks in a small private hash table. Marks for
+// the same scanmap byte are combined there, so each byte is merged into the
+// scanmap at most once per batch, and only if it is missing one of the bits.
+// The table is merged when it is half full and at the end of every scan pass
+//
+#define MARK_BUFFER_BITS    10
+#define MARK_BUFFER_SLOTS   (1 << MARK_BUFFER_BITS)
+#define MARK_BUFFER_LIMIT   (MARK_BUFFER_SLOTS / 2)
+
+struct markbuf_t {
+    // The number of occupied slots and their indices, in order of use
+    size_t count;
+    uint16_t used[MARK_BUFFER_LIMIT];
+
+    // Address of the scanmap byte (addr >> BYTE_OFFSET) or zero if empty
+    uint64_t key[MARK_BUFFER_SLOTS];
+    uint8_t mask[MARK_BUFFER_SLOTS];
+
+    // What the owning scanner did this round, for the sweep statistics
+    size_t marked;
+    size_t pagesScanned;
+    size_t pagesSkipped;
+};
+
+// Merges the buffered marks into the shared scanmap
+static void markbuf_flush(struct markbuf_t *marks) {
+    uint8_t volatile *map;
+    uint8_t volatile *entry;
+    addr_t ptr;
+    size_t i, slot;
+    uint64_t region;
+    uint8_t mask;
+
+    for (i = 0; i < marks->count; i++) {
+        slot = marks->used[i];
+        ptr.addr = marks->key[slot] << BYTE_OFFSET;
+        mask = marks->mask[slot];
+        marks->key[slot] = 0;
+
+        // No sub-map means the address never belonged to a pool
+        map = scanmap.bitmap[ptr.map];
+        if (map == NULL) continue;
+
+        // Scanners always run in parallel, even in single threaded builds
+        // where FFAtomicOr degrades to a plain read-modify-write
+        entry = map + ptr.byte;
+        if ((*entry & mask) != mask) {
+            __sync_fetch_and_or(entry, mask);
+        }
+
+        region = ONE64 << ((ptr.addr >> POOL_SIZE_BITS) & SIXTYTHREE64);
+        if (!(scanmap.summary[ptr.map] & region)) {
+            if (__sync_fetch_and_or(&scanmap.summary[ptr.map], region) == 0) {
+                scanmap.touched[__sync_fetch_and_add(&scanmap.touchedCount, 1)] = ptr.map;
+            }
+        }
+    }
+
+    marks->count = 0;
+}
+
+// Records a candidate pointer in the scanner's mark buffer
+static inline void scanmap_mark(struct markbuf_t *marks, uint64_t addr) {
+    addr_t ptr;
+    uint64_t key = addr >> BYTE_OFFSET;
+    size_t slot = (size_t)((key * UINT64_C(0x9E3779B97F4A7C15)) >> (64 - MARK_BUFFER_BITS));
+
+    // The range filter passes anything between the lowest and highest pool,
+    // gaps and unmapped quarantine included
+    if (!is_heap_slot(addr)) {
+        return;
+    }
+    marks->marked++;
+
+    while (marks->key[slot] != key) {
+        if (marks->key[slot] == 0) {
+            marks->key[slot] = key;
+            marks->mask[slot] = 0;
+            marks->used[marks->count++] = (uint16_t)slot;
+            break;
+        }
+        slot = (slot + 1) & (MARK_BUFFER_SLOTS - 1);
+    }
+
+    ptr.addr = addr;
+    marks->mask[slot] |= (uint8_t)(1 << ptr.bit);
+
+    if (marks->count == MARK_BUFFER_LIMIT) {
+        markbuf_flush(marks);
+    }
+}
+
+
+static inline uint64_t scanmap_check(addr_t ptr) {
+    uint8_t volatile *map;
+    uint8_t volatile *entry;
+    map = scanmap.bitmap[ptr.map];
+    if (map == NULL) return 0;
+
+    entry = map + ptr.byte;
+    return (*entry >> ptr.bit) & 0x1;
+}
+
+
+// Returns non-zero if any address in [start, end) was marked. Regions whose
+// summary bit is clear are skipped without touching the bitmap and the
+// remaining ones are read a word at a time
+static uint64_t scanmap_read_pagepool(uint64_t start, uint64_t end) {
+    uint64_t data = 0;
+    uint8_t volatile *map;
+    addr_t ptr;
+    uint64_t regionStart, regionEnd;
+    size_t first, last;
+
+    for (regionStart = start; regionStart < end && data == 0; regionStart = regionEnd) {
+        regionEnd = (regionStart | (POOL_SIZE - 1)) + 1;
+        if (regionEnd > end) {
+            regionEnd = end;
+        }
+
+        ptr.addr = regionStart;
+        map = scanmap.bitmap[ptr.map];
+        if (map == NULL) continue;
+
+        if (!(scanmap.summary[ptr.map] & (ONE64 << ((regionStart >> POOL_SIZE_BITS) & SIXTYTHREE64)))) {
+            continue;
+        }
+
+        first = ptr.byte;
+        ptr.addr = regionEnd - 1;
+        last = ptr.byte + 1;
+        for (; first < last && (first & SEVEN64); first++) {
+            data |= map[first];
+        }
+        for (; first + sizeof(uint64_t) <= last; first += sizeof(uint64_t)) {
+            data |= *(uint64_t volatile *)(map + first);
+        }
+        for (; first < last; first++) {
+            data |= map[first];
+        }
+    }
+
+    return data;
+}
+
+// Zeroes the parts of the bitmap marked during the last sweep along with their
+// summary words
+static void scanmap_clear(void) {
+    size_t i, mapId;
+    uint64_t regions;
+    uint8_t volatile *map;
+    size_t regionBytes = ONE_MAP_SIZE / 64;
+    int region;
+
+    for (i = 0; i < scanmap.touchedCount; i++) {
+        mapId = scanmap.touched[i];
+        map = scanmap.bitmap[mapId];
+        regions = scanmap.summary[mapId];
+        scanmap.summary[mapId] = 0;
+
+        // Releasing part of a huge page would only split it
+        if (OPTION(OPT_THP)) {
+            madvise((void *)map, ONE_MAP_SIZE, MADV_DONTNEED);
+            continue;
+        }
+
+        while (regions) {
+            region = __builtin_ctzll(regions);
+            regions &= regions - 1;
+            madvise((void *)(map + region * regionBytes), regionBytes, MADV_DONTNEED);
+        }
+    }
+
+    scanmap.touchedCount = 0;
+}
+
+// Returns the first scanmap mapping overlapping [start, end), or NULL if none
+static struct scanmaprange_t *scanmap_find_range(uint64_t start, uint64_t end) {
+    struct scanmaprange_t *found = NULL;
+    size_t i;
+
+    for (i = 0; i < scanmap.rangeCount; i++) {
+        if (scanmap.ranges[i].start < end && start < scanmap.ranges[i].end) {
+            if (found == NULL || scanmap.ranges[i].start < found->start) {
+                found = &scanmap.ranges[i];
+            }
+        }
+    }
+
+    return found;
+}
+
+
+//
+// Pointer Candidate Filter
+//
+// Scanning a block of memory means finding every word whose value falls
+// between poolLowAddr and poolHighWater and marking it. The range check is
+// done with the widest vector unit the CPU offers so that only the matching
+// words reach scanmap_mark. The kernel is selected once at startup. Matches
+// are marked from the loaded lanes rather than read again, since a mutator
+// may change the word in between during a concurrent pass
+//
+typedef void (*scan_kernel_t)(struct markbuf_t *marks, const uint64_t *ptr, const uint64_t *end, uint64_t low, uint64_t range);
+
+static void scan_kernel_scalar(struct markbuf_t *marks, const uint64_t *ptr, const uint64_t *end, uint64_t low, uint64_t range) {
+    uint64_t data;
+
+    for (; ptr < end; ptr++) {
+        data = *ptr;
+        if (data - low < range) {
+            scanmap_mark(marks, data);
+        }
+    }
+}
+
+#if defined(__x86_64__)
+// AVX2 has no unsigned 64-bit compare, so both sides are biased by the sign
+// bit and compared as signed integers instead
+__attribute__((target("avx2")))
+static void scan_kernel_avx2(struct markbuf_t *marks, const uint64_t *ptr, const uint64_t *end, uint64_t low, uint64_t range) {
+    const __m256i bias = _mm256_set1_epi64x(INT64_MIN);
+    const __m256i vlow = _mm256_set1_epi64x((int64_t)low);
+    const __m256i vlimit = _mm256_xor_si256(_mm256_set1_epi64x((int64_t)range), bias);
+    __m256i data, match;
+    uint64_t lanes[4];
+    unsigned int mask;
+
+    for (; ptr + 4 <= end; ptr += 4) {
+        data = _mm256_loadu_si256((const __m256i *)ptr);
+        match = _mm256_cmpgt_epi64(vlimit, _mm256_xor_si256(_mm256_sub_epi64(data, vlow), bias));
+        mask = (unsigned int)_mm256_movemask_pd(_mm256_castsi256_pd(match));
+        if (mask == 0) {
+            continue;
+        }
+
+        _mm256_storeu_si256((__m256i *)lanes, data);
+        while (mask) {
+            scanmap_mark(marks, lanes[__builtin_ctz(mask)]);
+            mask &= mask - 1;
+        }
+    }
+
+    scan_kernel_scalar(marks, ptr, end, low, range);
+}
+
+__attribute__((target("avx512f")))
+static void scan_kernel_avx512(struct markbuf_t *marks, const uint64_t *ptr, const uint64_t *end, uint64_t low, uint64_t range) {
+    const __m512i vlow = _mm512_set1_epi64((int64_t)low);
+    const __m512i vrange = _mm512_set1_epi64((int64_t)range);
+    __m512i data;
+    uint64_t lanes[8];
+    unsigned int mask;
+
+    for (; ptr + 8 <= end; ptr += 8) {
+        data = _mm512_loadu_si512((const void *)ptr);
+        mask = _mm512_cmplt_epu64_mask(_mm512_sub_epi64(data, vlow), vrange);
+        if (mask == 0) {
+            continue;
+        }
+
+        _mm512_storeu_si512((void *)lanes, data);
+        while (mask) {
+            scanmap_mark(marks, lanes[__builtin_ctz(mask)]);
+            mask &= mask - 1;
+        }
+    }
+
+    scan_kernel_scalar(marks, ptr, end, low, range);
+}
+#elif defined(__aarch64__)
+static void scan_kernel_neon(struct markbuf_t *marks, const uint64_t *ptr, const uint64_t *end, uint64_t low, uint64_t range) {
+    const uint64x2_t vlow = vdupq_n_u64(low);
+    const uint64x2_t vrange = vdupq_n_u64(range);
+    uint64x2_t lower, upper, first, second;
+
+    for (; ptr + 4 <= end; ptr += 4) {
+        lower = vld1q_u64(ptr);
+        upper = vld1q_u64(ptr + 2);
+        first = vcltq_u64(vsubq_u64(lower, vlow), vrange);
+        second = vcltq_u64(vsubq_u64(upper, vlow), vrange);
+        if (vmaxvq_u32(vreinterpretq_u32_u64(vorrq_u64(first, second))) == 0) {
+            continue;
+        }
+
+        if (vgetq_lane_u64(first, 0)) scanmap_mark(marks, vgetq_lane_u64(lower, 0));
+        if (vgetq_lane_u64(first, 1)) scanmap_mark(marks, vgetq_lane_u64(lower, 1));
+        if (vgetq_lane_u64(second, 0)) scanmap_mark(marks, vgetq_lane_u64(upper, 0));
+        if (vgetq_lane_u64(second, 1)) scanmap_mark(marks, vgetq_lane_u64(upper, 1));
+    }
+
+    scan_kernel_scalar(marks, ptr, end, low, range);
+}
+#endif
+
+static scan_kernel_t scanKernel = scan_kernel_scalar;
+
+// Picks the widest scanning kernel supported by the running CPU
+static void init_scan_kernel(void) {
+#if defined(__x86_64__)
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) {
+        scanKernel = scan_kernel_avx512;
+    }
+    else if (__builtin_cpu_supports("avx2")) {
+        scanKernel = scan_kernel_avx2;
+    }
+#elif defined(__aarch64__)
+    scanKernel = scan_kernel_neon;
+#endif
+}
+
+// Marks every word in [startPtr, endPtr) that may point into a page pool
+static inline void scan_block(struct markbuf_t *marks, uint64_t startPtr, uint64_t endPtr) {
+    uint64_t low = (uint64_t)poolLowAddr;
+
+    scanKernel(marks, (const uint64_t *)startPtr, (const uint64_t *)endPtr, low, (uint64_t)poolHighWater - low);
+}
+
+
+static void map_scan(struct markbuf_t *marks, uint64_t startPtr, uint64_t endPtr, bool concurrent) {
+    // scan memory
+    uint64_t pageBits[PAGEMAP_BATCH_WORDS];
+    uint64_t batchBase, pageBase;
+    size_t pageCount, index;
+
+    for (batchBase = startPtr; batchBase < endPtr; batchBase += PAGEMAP_BATCH_PAGES * PAGE_SIZE) {
+        pageCount = (endPtr - batchBase + PAGE_SIZE - 1) / PAGE_SIZE;
+        if (pageCount > PAGEMAP_BATCH_PAGES) {
+            pageCount = PAGEMAP_BATCH_PAGES;
+        }
+
+        pagemap_query(softDirty, batchBase, pageCount, concurrent, pageBits);
+        marks->pagesSkipped += pageCount;
+        for (index = pagemap_next(pageBits, 0, pageCount); index < pageCount;
+                index = pagemap_next(pageBits, index + 1, pageCount)) {
+            pageBase = batchBase + index * PAGE_SIZE;
+            scan_block(marks, pageBase, pageBase + PAGE_SIZE);
+            marks->pagesScanned++;
+            marks->pagesSkipped--;
+        }
+    }
+}
+
+
+static void heap_page_scan(struct markbuf_t *marks, struct pagemap_t *pageMap, uint64_t addr) {
+    size_t allocSize = pageMap->allocSize & ~SEVEN64;
+    size_t maxAlloc;
+    
+    size_t index;
+
+    size_t count = 0;
+
+    if (allocSize == 0) {
+        return;
+    }
+
+
+    maxAlloc = PAGE_SIZE / allocSize;
+    for (index = 0; index < BITMAP_WORDS(maxAlloc); index++) {
+        count += bitCount(FFAtomicAdd(pageMap->bitmap[index], 0));
+    }
+
+    if (count == 0) return;
+
+    scan_block(marks, addr, addr + PAGE_SIZE);
+}
+
+// Scans the live extents of a large pool that overlap [start, end). Freed
+// extents and the unallocated tail are skipped. Entries are read without
+// the pool lock, so an entry that a racing allocation hasn't written yet
+// makes the rest of the range scan as if it were live
+static void large_extent_scan(struct markbuf_t *marks, struct pagepool_t *pool, uint64_t start, uint64_t end) {
+    size_t last = pool->nextFreeIndex;
+    size_t index = find_large_extent(pool, start, last);
+    uint64_t extentStart, extentEnd;
+
+    for (; index < last; index++) {
+        extentStart = pool->tracking.allocations[index];
+        extentEnd = pool->tracking.allocations[index + 1] & ~SEVEN64;
+        if (extentEnd <= (extentStart & ~SEVEN64)) {
+            scan_block(marks, start, end);
+            return;
+        }
+        if (extentEnd <= start) {
+            continue;
+        }
+
+        if ((extentStart & ONE64) == 0) {
+            scan_block(marks, start, extentEnd < end ? extentEnd : end);
+        }
+        if (extentEnd >= end) {
+            return;
+        }
+        start = extentEnd;
+    }
+}
+
+// Scans the part of [start, end) that is still in use in a pool. Small pools
+// only scan pages holding live allocations, large pools the live extents on
+// resident pages and jumbo pools every resident page. A chunk is never
+// larger than a single pagemap batch and exact chunks skip the query
+// altogether
+static void pagepool_scan(struct markbuf_t *marks, struct pagepool_t *pool, uint64_t start, uint64_t end, bool concurrent, bool exact) {
+    uint64_t pageBits[PAGEMAP_BATCH_WORDS];
+    struct pagemap_t *pageMap;
+    uint64_t base, curr, next;
+    size_t pageCount, index;
+
+    // Released pools have startInUse >= endInUse
+    if (start < (uint64_t)pool->startInUse) {
+        start = (uint64_t)pool->startInUse;
+    }
+    if (end > (uint64_t)pool->endInUse) {
+        end = (uint64_t)pool->endInUse;
+    }
+    if (start >= end) {
+        return;
+    }
+
+    base = start & ~(PAGE_SIZE - 1);
+    pageCount = (end - base + PAGE_SIZE - 1) / PAGE_SIZE;
+    if (exact) {
+        memset(pageBits, 0xFF, sizeof(pageBits));
+    }
+    else {
+        pagemap_query(softDirty, base, pageCount, concurrent, pageBits);
+    }
+
+    marks->pagesSkipped += pageCount;
+    for (index = pagemap_next(pageBits, 0, pageCount); index < pageCount;
+            index = pagemap_next(pageBits, index + 1, pageCount)) {
+        curr = base + index * PAGE_SIZE;
+        marks->pagesScanned++;
+        marks->pagesSkipped--;
+
+        if (pool->nextFreeIndex == SIZE_MAX) {
+            pageMap = &pool->tracking.pageMaps[(curr - (uint64_t)pool->start) / PAGE_SIZE];
+            if (pageMap->allocSize & THREE64) {
+                continue;
+            }
+
+            heap_page_scan(marks, pageMap, curr);
+        }
+        else if (pool->nextFreeIndex != SIZE_MAX - 1) {
+            next = curr + PAGE_SIZE;
+            large_extent_scan(marks, pool, curr < start ? start : curr, next > end ? end : next);
+        }
+        else {
+            next = curr + PAGE_SIZE;
+            scan_block(marks, curr < start ? start : curr, next > end ? end : next);
+        }
+    }
+}
+
+
+// Parses the line of /proc/self/maps text at *cursor and moves the cursor
+// past it. Returns false once limit is reached
+static bool strict_parse_maps(const char **cursor, const char *limit, struct procmap_t *memInfo) {
+    const char *curr = *cursor;
+    const char *eol;
+    char *next;
+    size_t pathLength;
+
+    memset(memInfo, 0, sizeof(struct procmap_t));
+
+    if (curr >= limit) {
+        return false;
+    }
+
+    eol = (const char *)memchr(curr, '\n', limit - curr);
+    if (eol == NULL) {
+        eol = limit;
+    }
+    *cursor = eol + 1;
+
+    memInfo->startPtr = (void *)strtoul(curr, &next, 16); // start
+    memInfo->endPtr = (void *)strtoul(next + 1, &next, 16); // end
+    next++;
+
+    memInfo->readdable = (next[0] == 'r');
+    memInfo->writable = (next[1] == 'w');
+    memInfo->executable = (next[2] == 'x');
+    memInfo->CoW = (next[3] == 'p');
+    next += 5;
+
+    memInfo->offset = strtoul(next, &next, 16); // offset
+
+    // Device
+    // 00:00 or fd:01
+    next = (char *)memchr(next + 1, ' ', eol - next - 1);
+    if (next == NULL) {
+        return true;
+    }
+
+    memInfo->inode = strtoul(next + 1, &next, 10); // inode
+
+    while (next < eol && *next == ' ') {
+        next++;
+    }
+
+    pathLength = eol - next;
+    if (pathLength == 0) {
+        return true;
+    }
+
+    memInfo->has_path = (next[0] == '[') || (next[0] == '/');
+    memInfo->from_ffmalloc = (memmem(next, pathLength, "libffmalloc", 11) != NULL);
+    memInfo->stack = (pathLength == 7 && memcmp(next, "[stack]", 7) == 0);
+
+    return true;
+}
+
+//
+// Scan Work Scheduling
+//
+// Every pass starts with the reclaimer cutting the roots and all heap pools
+// into chunks, kept in address order. The array is split evenly between the
+// scanners. Each scanner works through its own run from the front and, once
+// it runs dry, steals from the back of the others, so one large mapping or
+// jumbo pool no longer ends up with a single thread.
+//
+// The pause rescan is incremental. The root ranges found by the concurrent
+// pass are reused unless /proc/self/maps has changed since, and only the
+// pages the kernel reports as dirty are queued, so the pause is spent on
+// what the mutators touched while the concurrent pass ran
+//
+// Maps one of the reclaimer's growable arrays. They hold heap addresses, so
+// the root scan must not find them
+static void *map_scan_array(size_t size) {
+    void *area = sys_mmap(NULL, size, PROT_READ | PROT_WRITE,
+            MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+    if (area == MAP_FAILED) {
+        fprintf(stderr, "reclaim: Fail to map the scan work list\n");
+        exit(4);
+    }
+
+    scanmap_register_range(area, size);
+    return area;
+}
+
+// Doubles an array made by map_scan_array, keeping its contents. Returns
+// NULL, leaving it as it was, if it can't be remapped
+static void *grow_scan_array(void *area, size_t size) {
+    void *grown = mremap(area, size, 2 * size, MREMAP_MAYMOVE);
+    if (grown == MAP_FAILED) {
+        return NULL;
+    }
+
+    scanmap_move_range(area, grown, 2 * size);
+    return grown;
+}
+
+static void init_scan_work(struct reclaim_t *arg) {
+    arg->chunks = (struct scanchunk_t *)map_scan_array(SCAN_CHUNK_CAPACITY * sizeof(struct scanchunk_t));
+    arg->chunkCount = 0;
+    arg->chunkCapacity = SCAN_CHUNK_CAPACITY;
+    arg->scanOverflow = false;
+    arg->roots = (struct scanchunk_t *)map_scan_array(SCAN_ROOT_CAPACITY * sizeof(struct scanchunk_t));
+    arg->rootCount = 0;
+    arg->rootCapacity = SCAN_ROOT_CAPACITY;
+    arg->mapsText[0] = (char *)map_scan_array(MAPS_BUFFER_SIZE);
+    arg->mapsText[1] = (char *)map_scan_array(MAPS_BUFFER_SIZE);
+    arg->mapsLength = 0;
+    arg->mapsCapacity = MAPS_BUFFER_SIZE;
+    arg->mapsCurrent = 0;
+    arg->mapsGeneration = 0;
+}
+
+// Doubles the work array. Returns false if it can't be remapped
+static bool grow_scan_work(struct reclaim_t *arg) {
+    void *chunks = grow_scan_array(arg->chunks, arg->chunkCapacity * sizeof(struct scanchunk_t));
+    if (chunks == NULL) {
+        return false;
+    }
+
+    arg->chunks = (struct scanchunk_t *)chunks;
+    arg->chunkCapacity *= 2;
+    return true;
+}
+
+// Appends [start, end) to the work array in SCAN_CHUNK_SIZE pieces
+static void push_scan_range(struct reclaim_t *arg, uint64_t start, uint64_t end, struct pagepool_t *pool, bool exact) {
+    uint64_t next;
+
+    for (; start < end; start = next) {
+        next = (start & ~(SCAN_CHUNK_SIZE - 1)) + SCAN_CHUNK_SIZE;
+        if (next > end) {
+            next = end;
+        }
+
+        if (arg->chunkCount == arg->chunkCapacity && !grow_scan_work(arg)) {
+            lf_dbg("reclaim: too much memory to scan, giving up on the sweep");
+            arg->scanOverflow = true;
+            return;
+        }
+
+        arg->chunks[arg->chunkCount].start = start;
+        arg->chunks[arg->chunkCount].end = next;
+        arg->chunks[arg->chunkCount].pool = pool;
+        arg->chunks[arg->chunkCount].exact = exact;
+        arg->chunkCount++;
+    }
+}
+
+// Appends the resident dirty pages of [start, end) as exact chunks.
+// Returns false, leaving the work array as it was, if the kernel can't list
+// them
+static bool push_dirty_range(struct reclaim_t *arg, uint64_t start, uint64_t end, struct pagepool_t *pool) {
+    struct page_region regions[PAGEMAP_SCAN_REGIONS];
+    struct pm_scan_arg scan;
+    size_t chunkCount = arg->chunkCount;
+    uint64_t first, last;
+    long ret, index;
+
+    if (!pagemapScanSupported) {
+        return false;
+    }
+
+    memset(&scan, 0, sizeof(scan));
+    scan.size = sizeof(scan);
+    scan.start = start & ~(PAGE_SIZE - 1);
+    scan.end = (end + PAGE_SIZE - 1) & ~(PAGE_SIZE - 1);
+    scan.vec = (uint64_t)regions;
+    scan.vec_len = PAGEMAP_SCAN_REGIONS;
+    scan.category_mask = PAGE_IS_PRESENT | dirty_category();
+    scan.return_mask = scan.category_mask;
+
+    while (scan.start < scan.end) {
+        ret = ioctl(softDirty, PAGEMAP_SCAN, &scan);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            pagemapScanSupported = 0;
+            arg->chunkCount = chunkCount;
+            return false;
+        }
+
+        for (index = 0; index < ret; index++) {
+            first = regions[index].start < start ? start : regions[index].start;
+            last = regions[index].end > end ? end : regions[index].end;
+            push_scan_range(arg, first, last, pool, true);
+        }
+
+        // The walk stops early when the region vector is full
+        if (scan.walk_end <= scan.start) break;
+        scan.start = scan.walk_end;
+    }
+
+    return true;
+}
+
+// Queues [start, end) for the current pass. A pause only queues the pages
+// dirtied since the concurrent pass whenever the kernel can list them
+static void push_work_range(struct reclaim_t *arg, uint64_t start, uint64_t end, struct pagepool_t *pool) {
+    if (arg->concurrent || !push_dirty_range(arg, start, end, pool)) {
+        push_scan_range(arg, start, end, pool, false);
+    }
+}
+
+// Queues a pool if it is swept by the given scanner group and this pass
+// hasn't queued it yet
+static void push_pool(struct reclaim_t *arg, struct pagepool_t *pool, size_t group) {
+    if (pool != NULL && pool->node % arg->scanGroups == group && pool->queuedPass != arg->queuePass) {
+        pool->queuedPass = arg->queuePass;
+        push_work_range(arg, (uint64_t)pool->start, (uint64_t)pool->end, pool);
+    }
+}
+
+// Queues the pools of a list that are swept by the given scanner group
+static void push_pool_list(struct reclaim_t *arg, struct poollistnode_t *node, size_t group) {
+    for (; node != NULL; node = node->next) {
+        push_pool(arg, node->pool, group);
+    }
+}
+
+static void push_root_range(struct reclaim_t *arg, uint64_t start, uint64_t end, bool stack) {
+    void *roots;
+
+    if (arg->rootCount == arg->rootCapacity) {
+        roots = grow_scan_array(arg->roots, arg->rootCapacity * sizeof(struct scanchunk_t));
+        if (roots == NULL) {
+            // Parse the mappings again next time rather than keep a
+            // partial root set
+            lf_dbg("reclaim: too many root mappings, giving up on the sweep");
+            arg->scanOverflow = true;
+            arg->mapsGeneration = 0;
+            return;
+        }
+        arg->roots = (struct scanchunk_t *)roots;
+        arg->rootCapacity *= 2;
+    }
+
+    arg->roots[arg->rootCount].start = start;
+    arg->roots[arg->rootCount].end = end;
+    arg->roots[arg->rootCount].pool = NULL;
+    arg->roots[arg->rootCount].exact = false;
+    arg->roots[arg->rootCount].stack = stack;
+    arg->rootCount++;
+}
+
+// Returns the first range excluded by the application that overlaps
+// [start, end), or NULL if none
+static struct rootrange_t *find_excluded_range(struct reclaim_t *arg, uint64_t start, uint64_t end) {
+    struct rootrange_t *found = NULL;
+
+    for (size_t i = 0; i < arg->excludedCount; i++) {
+        if (arg->excluded[i].start < end && start < arg->excluded[i].end) {
+            if (found == NULL || arg->excluded[i].start < found->start) {
+                found = &arg->excluded[i];
+            }
+        }
+    }
+
+    return found;
+}
+
+// Registers a root range minus any parts that belong to the scanmap or were
+// excluded by the application. The kernel may merge scanmap mappings with
+// neighbouring ones
+static void register_root_range(struct reclaim_t *arg, uint64_t start, uint64_t end, bool stack) {
+    struct scanmaprange_t *range;
+    struct rootrange_t *excluded;
+    uint64_t skipStart, skipEnd;
+
+    while (start < end) {
+        skipStart = skipEnd = end;
+
+        range = scanmap_find_range(start, end);
+        if (range != NULL) {
+            skipStart = range->start;
+            skipEnd = range->end;
+        }
+
+        excluded = find_excluded_range(arg, start, end);
+        if (excluded != NULL && excluded->start < skipStart) {
+            skipStart = excluded->start;
+            skipEnd = excluded->end;
+        }
+
+        if (skipStart > start) {
+            push_root_range(arg, start, skipStart, stack);
+        }
+        start = skipEnd;
+    }
+}
+
+// Takes one chunk off either end of a deque. Returns false once it is empty
+static bool scan_deque_take(struct scandeque_t *deque, bool fromBack, size_t *index) {
+    uint64_t bounds, front, back;
+
+    do {
+        bounds = deque->bounds;
+        front = bounds >> 32;
+        back = bounds & UINT32_MAX;
+        if (front >= back) {
+            return false;
+        }
+
+        if (fromBack) {
+            *index = --back;
+        }
+        else {
+            *index = front++;
+        }
+    } while (!__sync_bool_compare_and_swap(&deque->bounds, bounds, (front << 32) | back));
+
+    return true;
+}
+
+// Returns the next chunk for a scanner, or NULL when every deque is empty or
+// the pass has been abandoned. Scanners steal within their own group before
+// reaching across to another node
+static struct scanchunk_t *take_scan_chunk(struct reclaim_t *arg, size_t id, size_t group) {
+    const size_t first = arg->scanFirst[group];
+    const size_t span = arg->scanFirst[group + 1] - first;
+    size_t index;
+    size_t victim;
+
+    if (arg->scanAbort) {
+        return NULL;
+    }
+
+    if (scan_deque_take(&arg->deques[id], false, &index)) {
+        return &arg->chunks[index];
+    }
+
+    for (size_t i = 1; i < span; i++) {
+        victim = first + (id - first + i) % span;
+        if (scan_deque_take(&arg->deques[victim], true, &index)) {
+            return &arg->chunks[index];
+        }
+    }
+
+    for (size_t i = span; i < arg->scannerCount; i++) {
+        victim = (first + i) % arg->scannerCount;
+        if (scan_deque_take(&arg->deques[victim], true, &index)) {
+            return &arg->chunks[index];
+        }
+    }
+
+    return NULL;
+}
+
+// Doubles both maps text buffers. Returns false, leaving them as they
+// were, if either can't be remapped
+static bool grow_maps_text(struct reclaim_t *arg) {
+    void *text[2];
+
+    text[0] = grow_scan_array(arg->mapsText[0], arg->mapsCapacity);
+    if (text[0] == NULL) {
+        return false;
+    }
+    arg->mapsText[0] = (char *)text[0];
+
+    text[1] = grow_scan_array(arg->mapsText[1], arg->mapsCapacity);
+    if (text[1] == NULL) {
+        // The first one is kept at its new size, the capacity is the
+        // smaller of the two
+        return false;
+    }
+    arg->mapsText[1] = (char *)text[1];
+    arg->mapsCapacity *= 2;
+    return true;
+}
+
+// Reads all of /proc/self/maps into the spare buffer, growing both buffers
+// as needed, and returns its length. Returns SIZE_MAX if the text doesn't
+// fit
+static size_t read_maps(struct reclaim_t *arg) {
+    size_t length = 0;
+    ssize_t ret;
+    int mapsfd;
+
+    mapsfd = open("/proc/self/maps", O_RDONLY);
+    if (mapsfd < 0) {
+        lf_dbg("cannot open /proc/self/maps");
+        exit(-1);
+    }
+
+    while (true) {
+        ret = read(mapsfd, arg->mapsText[arg->mapsCurrent ^ 1] + length, arg->mapsCapacity - 1 - length);
+        if (ret < 0) {
+            if (errno == EINTR) continue;
+            fprintf(stderr, "reclaim: Fail to read /proc/self/maps\n");
+            exit(4);
+        }
+        if (ret == 0) {
+            break;
+        }
+
+        length += (size_t)ret;
+        if (length == arg->mapsCapacity - 1 && !grow_maps_text(arg)) {
+            lf_dbg("reclaim: /proc/self/maps is too large, giving up on the sweep");
+            close(mapsfd);
+            return SIZE_MAX;
+        }
+    }
+    arg->mapsText[arg->mapsCurrent ^ 1][length] = '\0';
+
+    close(mapsfd);
+    return length;
+}
+
+// Rebuilds the root ranges unless the mapping set and the ranges the
+// application registered or excluded are the same as the last time they
+// were parsed
+static void refresh_root_ranges(struct reclaim_t *arg, bool paused) {
+    char *text;
+    const char *cursor;
+    const size_t generation = __sync_fetch_and_add(&rootSetGeneration, 0);
+    size_t length;
+    uint64_t guardEnd = 0;
+    bool stack;
+
+    struct procmap_t memInfo;
+    const uint64_t reserveStart = (uint64_t)metadataPool;
+    const uint64_t reserveEnd = reserveStart + 1024UL * 1048576UL;
+
+#ifdef FF_WRAP_MMAP
+    // The application maps through the wrappers, which move the generation.
+    // The mappings glibc makes itself for thread stacks and libraries don't,
+    // but they change the sizes in statm. While neither has moved since the
+    // concurrent pass, the pause keeps the ranges that pass parsed
+    if (arg->statmFd >= 0) {
+        const size_t size = read_counter(arg->statmFd, 0);
+        const size_t data = read_counter(arg->statmFd, 5);
+        if (generation == arg->mapsGeneration && size == arg->mapsSize && data == arg->mapsData) {
+            return;
+        }
+        arg->mapsSize = size;
+        arg->mapsData = data;
+    }
+#endif
+
+    length = read_maps(arg);
+    if (length == SIZE_MAX) {
+        arg->scanOverflow = true;
+        arg->mapsGeneration = 0;
+        return;
+    }
+
+    // The buffers may have moved as they grew
+    text = arg->mapsText[arg->mapsCurrent ^ 1];
+    cursor = text;
+    if (generation == arg->mapsGeneration && length == arg->mapsLength && memcmp(text, arg->mapsText[arg->mapsCurrent], length) == 0) {
+        return;
+    }
+
+    if (generation != arg->mapsGeneration) {
+        copy_root_set(arg, paused);
+        arg->mapsGeneration = generation;
+    }
+
+    arg->mapsCurrent ^= 1;
+    arg->mapsLength = length;
+    arg->rootCount = 0;
+    arg->rootsTracked = false;
+
+    while (strict_parse_maps(&cursor, text + length, &memInfo)) {
+        // A mapping right above one without access is taken to be a stack
+        // above its guard page
+        stack = memInfo.stack || (uint64_t)memInfo.startPtr == guardEnd;
+        guardEnd = (!memInfo.readdable && !memInfo.writable && !memInfo.executable) ? (uint64_t)memInfo.endPtr : 0;
+
+        if ((uint64_t)memInfo.startPtr >= (uint64_t)poolLowAddr && 
+                (uint64_t)memInfo.startPtr < (uint64_t)poolHighWater
+           ) { 
+            continue;
+        }
+
+        if (!memInfo.readdable || !memInfo.writable || memInfo.executable) {
+            continue;
+        }
+
+        // Do not scan shared mappings to mmap'd files(should not contain pointers)
+        // Note: .text, .bss and .data are mapped as private file mappings
+        if (!memInfo.CoW) {
+            continue;
+        }
+            
+        // Ignore regions mapped from ffmalloc. These may be for meatadata that should be
+        // conceptually non-garbage-collected.
+        if (memInfo.from_ffmalloc) {
+            continue;
+        }
+        
+
+        // The metadata reserve can merge with the anonymous mapping next to
+        // it, so only its own part of the range is left out. Its large pool
+        // entries would otherwise mark every extent
+        if ((uint64_t)memInfo.startPtr < reserveEnd && (uint64_t)memInfo.endPtr > reserveStart) {
+            if ((uint64_t)memInfo.startPtr < reserveStart) {
+                register_root_range(arg, (uint64_t)memInfo.startPtr, reserveStart, false);
+            }
+            if ((uint64_t)memInfo.endPtr > reserveEnd) {
+                register_root_range(arg, reserveEnd, (uint64_t)memInfo.endPtr, false);
+            }
+            continue;
+        }
+
+        //map_scan(&memInfo, pagemapfd, NULL);
+        register_root_range(arg, (uint64_t)memInfo.startPtr, (uint64_t)memInfo.endPtr, stack);
+    }
+
+    for (size_t i = 0; i < arg->userRootCount; i++) {
+        register_root_range(arg, arg->userRoots[i].start, arg->userRoots[i].end, false);
+    }
+}
+
+// Queues the roots and the pools to scan. When only is not NULL, the pools
+// of the other arenas are left out. In a pause the stacks of the stopped
+// threads are only queued from where they stopped
+static void user_memory_maps(struct reclaim_t *arg, struct arena_t *only, bool paused) {
+    uint64_t start;
+
+    refresh_root_ranges(arg, paused);
+
+    arg->chunkCount = 0;
+    arg->queuePass++;
+
+    // Each scanner group gets a contiguous run of the work array
+    for (size_t group = 0; group < arg->scanGroups; group++) {
+        arg->chunkFirst[group] = arg->chunkCount;
+
+        // Register heap pools, including large pools that have been retired
+        // from allocation but still hold live objects
+        for (size_t arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
+            struct arena_t *arena = arenas[arenaID];
+            if (!arena || (only != NULL && arena != only)) continue;
+
+            for (size_t node = 0; node < MAX_NUMA_NODES; node++) {
+                push_pool_list(arg, arena->smallPoolList[node], group);
+            }
+
+            // A walk of a large list that reaches a pool as it is retired
+            // follows it into the head list, so the same pool can turn up
+            // again there. push_pool_list skips the pools already queued
+            for (size_t i = 0; i < MAX_LARGE_LISTS; i++) {
+                struct poollistnode_t *retiring = arena->largePoolRetiring[i];
+                push_pool_list(arg, arena->largePoolList[i], group);
+                push_pool_list(arg, arena->largePoolListHead[i], group);
+                if (retiring != NULL) {
+                    push_pool(arg, retiring->pool, group);
+                }
+            }
+            push_pool_list(arg, arena->jumboPoolList, group);
+        }
+
+        // Register other pages. Where they reside isn't known, so each
+        // group takes an even share
+        for (size_t i = arg->rootCount * group / arg->scanGroups; i < arg->rootCount * (group + 1) / arg->scanGroups; i++) {
+            start = arg->roots[i].start;
+            if (paused && arg->roots[i].stack) {
+                start = live_stack_start(start, arg->roots[i].end);
+            }
+            push_work_range(arg, start, arg->roots[i].end, NULL);
+        }
+    }
+    arg->chunkFirst[arg->scanGroups] = arg->chunkCount;
+}
+
+//
+// Userfaultfd Dirty Tracking
+//
+// Ranges are registered with the write-protect userfaultfd the first time
+// a pass queues them and protected again as each concurrent pass starts.
+// A page the kernel won't register or protect keeps reading as written,
+// so failures here only cost precision
+//
+static void track_range(uint64_t start, uint64_t end) {
+    struct uffdio_register reg;
+
+    memset(&reg, 0, sizeof(reg));
+    reg.range.start = start;
+    reg.range.len = end - start;
+    reg.mode = UFFDIO_REGISTER_MODE_WP;
+    if (ioctl(uffdFd, UFFDIO_REGISTER, &reg) < 0) {
+        lf_dbg("cannot track %lx-%lx: %d", start, end, errno);
+    }
+}
+
+// Write-protects the written pages of a registered range. PAGEMAP_SCAN only
+// visits those, while UFFDIO_WRITEPROTECT sets every resident page
+static void protect_range(uint64_t start, uint64_t end) {
+    struct uffdio_writeprotect wp;
+    struct pm_scan_arg scan;
+    long ret;
+
+    if (OPTION(OPT_DIRTY_TRACKING) == DIRTY_UFFD_SCAN && pagemapScanSupported) {
+        memset(&scan, 0, sizeof(scan));
+        scan.size = sizeof(scan);
+        scan.flags = PM_SCAN_WP_MATCHING | PM_SCAN_CHECK_WPASYNC;
+        scan.start = start;
+        scan.end = end;
+        scan.category_mask = PAGE_IS_WRITTEN;
+        scan.return_mask = PAGE_IS_WRITTEN;
+        do {
+            ret = ioctl(softDirty, PAGEMAP_SCAN, &scan);
+        } while (ret < 0 && errno == EINTR);
+
+        // A range that is only partly registered fails with EPERM
+        if (ret >= 0) {
+            return;
+        }
+    }
+
+    memset(&wp, 0, sizeof(wp));
+    wp.range.start = start;
+    wp.range.len = end - start;
+    wp.mode = UFFDIO_WRITEPROTECT_MODE_WP;
+    ioctl(uffdFd, UFFDIO_WRITEPROTECT, &wp);
+}
+
+static void protect_pool_list(struct poollistnode_t *node) {
+    struct pagepool_t *pool;
+
+    for (; node != NULL; node = node->next) {
+        pool = node->pool;
+        if (pool == NULL || pool->startInUse >= pool->endInUse) {
+            continue;
+        }
+
+        if (!pool->wpTracked) {
+            track_range((uint64_t)pool->start, (uint64_t)pool->end);
+            pool->wpTracked = true;
+        }
+        protect_range((uint64_t)pool->startInUse, (uint64_t)pool->endInUse);
+    }
+}
+
+// Starts tracking the writes made during a concurrent pass over the pools
+// and roots that user_memory_maps just queued
+static void reset_dirty_tracking(struct reclaim_t *arg) {
+    switch (OPTION(OPT_DIRTY_TRACKING)) {
+    case DIRTY_SOFT:
+        clear_softdirty();
+        return;
+    case DIRTY_NONE:
+        return;
+    }
+
+    for (size_t arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
+        struct arena_t *arena = arenas[arenaID];
+        if (!arena) continue;
+
+        for (size_t node = 0; node < MAX_NUMA_NODES; node++) {
+            protect_pool_list(arena->smallPoolList[node]);
+        }
+        for (size_t i = 0; i < MAX_LARGE_LISTS; i++) {
+            protect_pool_list(arena->largePoolList[i]);
+            protect_pool_list(arena->largePoolListHead[i]);
+        }
+        protect_pool_list(arena->jumboPoolList);
+    }
+
+    for (size_t i = 0; i < arg->rootCount; i++) {
+        if (!arg->rootsTracked) {
+            track_range(arg->roots[i].start, arg->roots[i].end);
+        }
+        protect_range(arg->roots[i].start, arg->roots[i].end);
+    }
+    arg->rootsTracked = true;
+}
+
+
+
+#define BILLION 1000000000L
+
+// Monotonic, so a wall clock step can't stretch or cut short a pause budget
+// or the waits measured against it
+long cal_nsclock(void) {
+    struct timespec curr;
+    clock_gettime(CLOCK_MONOTONIC, &curr);
+    return BILLION * curr.tv_sec + curr.tv_nsec;
+}
+
+static void save_caller_regs() { asm(""); }
+
+//
+// Thread Registry & Stop-the-World
+//
+// Every thread that allocates is recorded the first time it gets a thread
+// cache and forgotten when its cache is cleaned up. Stopping the world sends
+// SIGUSR1 to each registered thread with tgkill and waits until all of them
+// have acknowledged by parking in stop_handler. A thread that does not park
+// within STW_ACK_TIMEOUT makes the reclaimer give up on the sweep, so the
+// pause stays bounded even when a thread has the signal blocked. The registry
+// lock is held from stop to resume so that no thread can join halfway
+//
+#define MAX_USER_THREADS    4096
+#define STW_ACK_TIMEOUT     100000000L
+
+struct userthread_t {
+    pid_t volatile tid;
+    bool signalled;
+
+    // The frame of stop_handler while the thread is parked in it. The
+    // registers of the interrupted code are saved just above it
+    uint64_t volatile stackLow;
+};
+
+static struct userthread_t userThreads[MAX_USER_THREADS];
+static size_t userThreadHighWater;
+FFLOCKSTATIC(userThreadLock);
+
+static __thread struct userthread_t *currentUserThread;
+
+// Set by the reclaimer and scanner threads, which must never be stopped
+static __thread bool isCollectorThread;
+
+// Stop-the-world state shared with the signal handlers. These are always
+// accessed atomically as the handlers run concurrently with the reclaimer
+// even in single threaded builds
+static size_t volatile stwStopped;
+static size_t volatile stwAcked;
+
+static void register_user_thread(void) {
+    const pid_t tid = syscall(SYS_gettid);
+    size_t i;
+    size_t free = MAX_USER_THREADS;
+
+    if (currentUserThread != NULL || isCollectorThread) {
+        return;
+    }
+
+    // An entry with this tid was left by an earlier thread that exited
+    // without deregistering, for instance after its last thread cache was
+    // set up again by a later TLS destructor. Two entries for one thread
+    // would wait for an acknowledgement that never comes
+    FFEnterCriticalSection(&userThreadLock);
+    for (i = 0; i < userThreadHighWater; i++) {
+        if (userThreads[i].tid == tid) {
+            userThreads[i].tid = 0;
+        }
+        if (userThreads[i].tid == 0 && free == MAX_USER_THREADS) {
+            free = i;
+        }
+    }
+    if (free == MAX_USER_THREADS) {
+        free = userThreadHighWater;
+    }
+    i = free;
+
+    if (i == MAX_USER_THREADS) {
+        fprintf(stderr, "reclaim: too many threads\n");
+        abort();
+    }
+
+    userThreads[i].tid = tid;
+    if (i >= userThreadHighWater) {
+        userThreadHighWater = i + 1;
+    }
+    currentUserThread = &userThreads[i];
+    FFLeaveCriticalSection(&userThreadLock);
+
+    // Its stack may be a mapping the roots don't have yet
+    __sync_fetch_and_add(&rootSetGeneration, 1);
+}
+
+#if !defined(FFSINGLE_THREADED) && !defined(_WIN64)
+static void deregister_user_thread(void) {
+    if (currentUserThread == NULL) {
+        return;
+    }
+
+    FFEnterCriticalSection(&userThreadLock);
+    currentUserThread->tid = 0;
+    FFLeaveCriticalSection(&userThreadLock);
+    currentUserThread = NULL;
+}
+#endif
+
+// Registers a thread that calls into the allocator without having a thread
+// cache, such as one that only makes large allocations or only frees. It
+// changes the heap all the same, so it has to stop with the others
+static inline void note_user_thread(void) {
+    if (currentUserThread == NULL && !isCollectorThread) {
+        register_user_thread();
+    }
+}
+
+void stop_handler(int sigNum) {
+    int savedErrno = errno;
+
+    if (sigNum != SIGUSR1)
+        return;
+
+    // A signal left over from an abandoned stop finds the world running
+    if (__sync_fetch_and_add(&stwStopped, 0)) {
+        save_caller_regs();
+        if (currentUserThread != NULL) {
+            currentUserThread->stackLow = (uint64_t)__builtin_frame_address(0);
+        }
+        __sync_fetch_and_add(&stwAcked, 1);
+
+        // Wait until SIGUSR2 comes
+        while (__sync_fetch_and_add(&stwStopped, 0)) {
+            sigsuspend(&reclaimer->wait_mask);
+        }
+
+        if (currentUserThread != NULL) {
+            currentUserThread->stackLow = 0;
+        }
+    }
+
+    errno = savedErrno;
+}
+
+void resume_handler(int sigNum) {
+    if (sigNum != SIGUSR2)
+        return;
+}
+
+void init_stw(struct reclaim_t *arg) {
+    struct sigaction sig_action;
+    struct sigaction old_action;
+
+    memset(&sig_action, 0, sizeof(sig_action));
+
+    sigfillset(&sig_action.sa_mask);
+    if (sigdelset(&sig_action.sa_mask, SIGINT) < 0) 
+        exit(-1);
+
+    if (sigdelset(&sig_action.sa_mask, SIGQUIT) < 0) 
+        exit(-1);
+
+    if (sigdelset(&sig_action.sa_mask, SIGABRT) < 0) 
+        exit(-1);
+
+    if (sigdelset(&sig_action.sa_mask, SIGTERM) < 0) 
+        exit(-1);
+
+    if (sigdelset(&sig_action.sa_mask, SIGALRM) < 0) 
+        exit(-1);
+
+    sig_action.sa_flags = SA_RESTART | SA_SIGINFO;
+
+    sig_action.sa_sigaction =(void *) stop_handler;
+    sigaction(SIGUSR1, &sig_action, &old_action);
+
+    sig_action.sa_sigaction = (void *)resume_handler;
+    sigaction(SIGUSR2, &sig_action, &old_action);
+
+    sigfillset(&arg->wait_mask);
+    sigdelset(&arg->wait_mask, SIGUSR2);
+}
+
+
+// Suspends every registered thread. Returns false if some thread did not
+// acknowledge in time, in which case the world must be resumed without
+// scanning. Either way send_resume_signal has to follow
+bool send_stop_signal(struct reclaim_t *arg) {
+    size_t i;
+    size_t signalled = 0;
+    long deadline;
+
+    FFEnterCriticalSection(&userThreadLock);
+    __sync_lock_test_and_set(&stwAcked, 0);
+    __sync_lock_test_and_set(&stwStopped, 1);
+
+    for (i = 0; i < userThreadHighWater; i++) {
+        userThreads[i].signalled = false;
+        if (userThreads[i].tid == 0) {
+            continue;
+        }
+
+        if (syscall(SYS_tgkill, arg->owner, userThreads[i].tid, SIGUSR1) == 0) {
+            userThreads[i].signalled = true;
+            signalled++;
+        }
+        else if (errno == ESRCH) {
+            // Exited without running its thread cache cleanup
+            userThreads[i].tid = 0;
+        }
+    }
+
+    deadline = cal_nsclock() + STW_ACK_TIMEOUT;
+    while (__sync_fetch_and_add(&stwAcked, 0) < signalled) {
+        if (cal_nsclock() > deadline) {
+            lf_dbg("%zu of %zu threads stopped", stwAcked, signalled);
+            return false;
+        }
+        sched_yield();
+    }
+
+    return true;
+}
+
+void send_resume_signal(struct reclaim_t *arg) {
+    size_t i;
+
+    __sync_lock_test_and_set(&stwStopped, 0);
+
+    for (i = 0; i < userThreadHighWater; i++) {
+        if (userThreads[i].signalled && userThreads[i].tid != 0) {
+            syscall(SYS_tgkill, arg->owner, userThreads[i].tid, SIGUSR2);
+        }
+    }
+    FFLeaveCriticalSection(&userThreadLock);
+}
+
+//
+// Root Set
+//
+// The roots are the private writable mappings in /proc/self/maps other than
+// the heap and the collector's own, plus the ranges registered with
+// ffregister_root, less those excluded with ffexclude_range. The lists are
+// guarded by userThreadLock, which the reclaimer holds from stop to resume,
+// so a pause can read them without waiting on a stopped thread. Each change
+// moves rootSetGeneration and the reclaimer copies them as it rebuilds.
+//
+// A pause scans the stack of each thread it stopped from the frame of
+// stop_handler up. Below that is dead, and the signal frame above it holds
+// the interrupted registers. This is only done for the main stack and for
+// mappings right above a guard page, which glibc gives every thread stack.
+// Such a mapping is assumed to hold one stack, so stacks packed into one
+// mapping with no guard between them are not supported
+//
+static struct rootrange_t userRoots[MAX_ROOT_RANGES];
+static size_t userRootCount;
+static struct rootrange_t userExcluded[MAX_ROOT_RANGES];
+static size_t userExcludedCount;
+
+static void copy_root_set(struct reclaim_t *arg, bool paused) {
+    if (!paused) {
+        FFEnterCriticalSection(&userThreadLock);
+    }
+
+    memcpy(arg->userRoots, userRoots, userRootCount * sizeof(struct rootrange_t));
+    arg->userRootCount = userRootCount;
+    memcpy(arg->excluded, userExcluded, userExcludedCount * sizeof(struct rootrange_t));
+    arg->excludedCount = userExcludedCount;
+
+    if (!paused) {
+        FFLeaveCriticalSection(&userThreadLock);
+    }
+}
+
+// Returns the page where the live part of the stack range [start, end)
+// begins. Only called while the world is stopped
+static uint64_t live_stack_start(uint64_t start, uint64_t end) {
+    uint64_t low = end;
+
+    for (size_t i = 0; i < userThreadHighWater; i++) {
+        uint64_t frame = userThreads[i].stackLow;
+        if (userThreads[i].tid != 0 && frame >= start && frame < low) {
+            low = frame;
+        }
+    }
+
+    return low == end ? start : low & ~(PAGE_SIZE - 1);
+}
+
+// Adds [start, end) to one list, or if the other list has exactly that
+// range, takes it out of there instead
+static ffresult_t change_root_set(struct rootrange_t *list, size_t *count, struct rootrange_t *other, size_t *otherCount, uint64_t start, uint64_t end) {
+    ffresult_t result = FFSUCCESS;
+    bool cancelled = false;
+    size_t i;
+
+    FFEnterCriticalSection(&userThreadLock);
+    for (i = 0; i < *otherCount; i++) {
+        if (other[i].start == start && other[i].end == end) {
+            other[i] = other[--*otherCount];
+            cancelled = true;
+            break;
+        }
+    }
+
+    if (!cancelled) {
+        for (i = 0; i < *count; i++) {
+            if (list[i].start == start && list[i].end == end) {
+                break;
+            }
+        }
+
+        if (i == MAX_ROOT_RANGES) {
+            result = FFMAX_ROOTS;
+        }
+        else if (i == *count) {
+            list[i].start = start;
+            list[i].end = end;
+            (*count)++;
+        }
+    }
+    FFLeaveCriticalSection(&userThreadLock);
+
+    __sync_fetch_and_add(&rootSetGeneration, 1);
+    return result;
+}
+
+
+
+// Releases the quarantined pools taken off an arena that the sweep found no
+// pointers into. Small pools are kept for reuse, large ones are unmapped
+static void reclaim_arena_pools(struct arena_t *arena) {
+    struct poollistnode_t *currPoolNode = arena->sweptPools;
+    struct poollistnode_t *keptHead = NULL;
+    struct poollistnode_t *keptTail = NULL;
+
+    arena->sweptPools = NULL;
+
+    while (currPoolNode != NULL) {
+        struct poollistnode_t *node = currPoolNode;
+        uint64_t start = (uint64_t)node->pool;
+        bool isLarge = start & 0x1;
+        start = (start >> 1) << 1;
+        currPoolNode = node->next;
+
+        if (scanmap_read_pagepool(start, start + POOL_SIZE) != 0) {
+            // Still referenced, wait for a later sweep
+            node->next = NULL;
+            if (keptTail == NULL) {
+                keptHead = node;
+            }
+            else {
+                keptTail->next = node;
+            }
+            keptTail = node;
+            continue;
+        }
+
+        if (!isLarge) {
+            if (mprotect((void *)start, POOL_SIZE, PROT_READ | PROT_WRITE) < 0) {
+                fprintf(stderr, "mprotect error\n");
+                exit(-1);
+            }
+
+            node->pool = (struct pagepool_t *)start;
+            stack_push(&recycledPools, node);
+        }
+        else {
+            sys_munmap((void *)start, POOL_SIZE);
+            unmark_heap_slots(start, start + POOL_SIZE);
+            stack_push(&spareNodes, node);
+        }
+        sweepCycle.bytesReleased += POOL_SIZE;
+    }
+
+    if (keptHead != NULL) {
+        quarantine_pool(&arena->quarantinedPools, keptHead, keptTail);
+    }
+}
+
+// Unmaps the quarantined jumbo pools that the sweep found no pointers into.
+// When only is not NULL, the jumbo pools of other arenas wait for a later
+// sweep that scanned their arena
+static void reclaim_jumbos(struct arena_t *only) {
+    struct hugelistnode_t *currNode;
+    struct hugelistnode_t *keptHead = NULL;
+    struct hugelistnode_t *keptTail = NULL;
+
+    currNode = sweptJumbos;
+    sweptJumbos = NULL;
+
+    while (currNode != NULL) {
+        struct hugelistnode_t *node = currNode;
+        currNode = node->next;
+
+        if ((only != NULL && node->arenaSerial != only->serial) || scanmap_read_pagepool(node->start, node->end) != 0) {
+            node->next = NULL;
+            if (keptTail == NULL) {
+                keptHead = node;
+            }
+            else {
+                keptTail->next = node;
+            }
+            keptTail = node;
+            continue;
+        }
+
+        sys_munmap((void *)node->start, node->end - node->start);
+        unmark_heap_slots(node->start, node->end);
+        sweepCycle.bytesReleased += node->end - node->start;
+        ffmetadata_free(node, sizeof(struct hugelistnode_t));
+    }
+
+    if (keptHead != NULL) {
+        quarantine_jumbo(keptHead, keptTail);
+    }
+}
+
+// Releases the quarantined pools of every arena, or of only that one when
+// it is not NULL
+void reclaim_pagepool_handler(struct arena_t *only) {
+    // Runs queued before these pools were destroyed must not reach a
+    // pool after it's handed out again. The lists were taken in the
+    // pause, so one flush covers all of them
+    flush_decommits();
+
+    if (only != NULL) {
+        reclaim_arena_pools(only);
+    }
+    else {
+        for (size_t arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
+            if (arenas[arenaID] != NULL) {
+                reclaim_arena_pools(arenas[arenaID]);
+            }
+        }
+    }
+
+    reclaim_jumbos(only);
+}
+
+// Moves the large extents freed so far to the reclaimer's own list. Called
+// while the world is stopped, so all of them were freed before the marks
+// the next completed sweep ends with
+static void take_freed_extents(void) {
+    struct extentnode_t *node = __sync_lock_test_and_set(&freedExtents, NULL);
+    struct extentnode_t *next;
+
+    for (; node != NULL; node = next) {
+        next = node->next;
+        node->next = heldExtents;
+        heldExtents = node;
+    }
+}
+
+// Moves an arena's quarantined pools to the reclaimer's own list
+static void take_pool_quarantine(struct arena_t *arena) {
+    struct poollistnode_t *node = __sync_lock_test_and_set(&arena->quarantinedPools, NULL);
+    struct poollistnode_t *next;
+
+    for (; node != NULL; node = next) {
+        next = node->next;
+        node->next = arena->sweptPools;
+        arena->sweptPools = node;
+    }
+}
+
+// Moves the quarantined pools of every arena, or of only that one when it
+// is not NULL, and all quarantined jumbo pools to the reclaimer's own
+// lists. Called while the world is stopped, like take_freed_extents. What
+// an abandoned pause took is kept for the next one
+static void take_quarantine(struct arena_t *only) {
+    struct hugelistnode_t *node = __sync_lock_test_and_set(&quarantinedJumbos, NULL);
+    struct hugelistnode_t *next;
+
+    if (only != NULL) {
+        take_pool_quarantine(only);
+    }
+    else {
+        for (size_t arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
+            if (arenas[arenaID] != NULL) {
+                take_pool_quarantine(arenas[arenaID]);
+            }
+        }
+    }
+
+    for (; node != NULL; node = next) {
+        next = node->next;
+        node->next = sweptJumbos;
+        sweptJumbos = node;
+    }
+}
+
+// Zeroes a reserved extent before it is handed out again. Whole pages are
+// dropped rather than written, unless that would split a huge page
+// Returns the reuse class of an extent of size bytes, rounding down
+static inline size_t large_reuse_class(size_t size) {
+    const size_t log = 63 - FFCOUNTLEADINGZEROS64((uint64_t)size);
+
+    return ((log - LARGE_REUSE_SHIFT) << LARGE_REUSE_STEPS) |
+        ((size >> (log - LARGE_REUSE_STEPS)) & ((ONE64 << LARGE_REUSE_STEPS) - 1));
+}
+
+// Rounds a large request up to the next reuse class boundary
+static inline size_t large_reuse_size(size_t size) {
+    const size_t log = 63 - FFCOUNTLEADINGZEROS64((uint64_t)size);
+
+    return ALIGN_TO(size, (ONE64 << (log - LARGE_REUSE_STEPS)));
+}
+
+static void zero_extent(byte *start, byte *end) {
+    byte *first = (byte *)ALIGN_TO((uintptr_t)start, PAGE_SIZE);
+    byte *last = (byte *)((uintptr_t)end & ~(PAGE_SIZE - 1));
+
+    if (OPTION(OPT_THP) || first >= last || madvise(first, last - first, MADV_DONTNEED) != 0) {
+        memset(start, 0, end - start);
+        return;
+    }
+
+    memset(start, 0, first - start);
+    memset(last, 0, end - last);
+}
+
+// Reserves the held large extents that the sweep found no pointers into
+// again, so that their neighbours can no longer decommit into them, then
+// zeroes them and publishes them on their arena's stacks. Extents of pools
+// released since they were freed are dropped, marked ones are held for a
+// later sweep, as are those of other arenas when only is not NULL
+static void reclaim_large_extents(struct arena_t *only) {
+    struct extentnode_t *node = heldExtents;
+    struct extentnode_t *next;
+    struct extentnode_t *kept = NULL;
+    struct extentnode_t *reserved = NULL;
+    struct pagepool_t *pool;
+    uintptr_t value;
+    size_t index;
+    size_t sizeClass;
+
+    for (; node != NULL; node = next) {
+        next = node->next;
+
+        pool = find_pool_for_ptr(node->start);
+        if (pool == NULL || pool->nextFreeIndex >= SIZE_MAX - 1 || pool->serial != node->serial) {
+            ffmetadata_free(node, sizeof(struct extentnode_t));
+            continue;
+        }
+        if (only != NULL && pool->arena != only) {
+            node->next = kept;
+            kept = node;
+            continue;
+        }
+
+        FFEnterCriticalSection(&pool->poolLock);
+        if (pool->startInUse >= pool->endInUse) {
+            // Nothing in the pool is live, it is or is about to be released
+            FFLeaveCriticalSection(&pool->poolLock);
+            ffmetadata_free(node, sizeof(struct extentnode_t));
+            continue;
+        }
+
+        index = find_large_extent(pool, (uintptr_t)node->start, pool->nextFreeIndex);
+        value = pool->tracking.allocations[index];
+        if (index == pool->nextFreeIndex || (value & ~SEVEN64) != (uintptr_t)node->start || (value & ONE64) == 0) {
+            FFLeaveCriticalSection(&pool->poolLock);
+            ffmetadata_free(node, sizeof(struct extentnode_t));
+            continue;
+        }
+
+        node->end = (byte *)(pool->tracking.allocations[index + 1] & ~SEVEN64);
+        if (scanmap_read_pagepool((uint64_t)node->start, (uint64_t)node->end) != 0) {
+            FFLeaveCriticalSection(&pool->poolLock);
+            node->next = kept;
+            kept = node;
+            continue;
+        }
+
+        pool->tracking.allocations[index] = (uintptr_t)node->start;
+        if (node->start < pool->startInUse) {
+            pool->startInUse = node->start;
+        }
+        FFLeaveCriticalSection(&pool->poolLock);
+
+        node->next = reserved;
+        reserved = node;
+    }
+    heldExtents = kept;
+
+    if (reserved == NULL) {
+        return;
+    }
+
+    // A neighbour freed before its extent was reserved may have queued a
+    // decommit reaching into the shared page. Issue those before zeroing
+    flush_decommits();
+
+    // The node itself goes on the stack, so that a request that could not
+    // be rounded up can tell whether the extent is large enough
+    for (node = reserved; node != NULL; node = next) {
+        next = node->next;
+
+        zero_extent(node->start, node->end);
+        sizeClass = large_reuse_class(node->end - node->start);
+        pool = find_pool_for_ptr(node->start);
+        stack_push_at(&pool->arena->largeReuse[pool->node][sizeClass], node, offsetof(struct extentnode_t, next));
+        sweepCycle.bytesReusable += node->end - node->start;
+    }
+}
+
+#ifdef SUB_PAGE
+// The number of reclaim passes so far. Frees stamp the page with it so
+// the reuse heuristic can tell how many passes ago a page last had one
+static volatile int epochCounter = 256;
+static unsigned int reuseGeneration;
+
+// The number of pauses so far. A slot handed out after the latest pause
+// isn't covered by its marks, so its page is left to the next pass
+static unsigned int volatile pauseGeneration;
+
+// Scanmap words covering one page, a bit per 8-byte word
+#define PAGE_MARK_WORDS (PAGE_SIZE >> 9)
+
+// Counts the slots on the page that are both swept safe and currently
+// unallocated
+static size_t count_reusable_slots(struct pagemap_t *pageMap, size_t maxAlloc) {
+    size_t count = 0;
+    for (size_t i = 0; i < BITMAP_WORDS(maxAlloc); i++) {
+        count += bitCount(pageMap->safemap[i] & ~pageMap->bitmap[i]);
+    }
+    return count;
+}
+
+// Loads the scanmap bits of one page. Returns false when nothing on the
+// page was marked, in which case every slot is safe
+static bool scanmap_page_marks(uint64_t start, uint64_t marks[PAGE_MARK_WORDS]) {
+    uint8_t volatile *map;
+    uint64_t any = 0;
+    addr_t ptr;
+
+    ptr.addr = start;
+    map = scanmap.bitmap[ptr.map];
+    if (map == NULL || !(scanmap.summary[ptr.map] & (ONE64 << ((start >> POOL_SIZE_BITS) & SIXTYTHREE64)))) {
+        return false;
+    }
+
+    for (size_t i = 0; i < PAGE_MARK_WORDS; i++) {
+        marks[i] = *(uint64_t volatile *)(map + ptr.byte + i * sizeof(uint64_t));
+        any |= marks[i];
+    }
+    return any != 0;
+}
+
+// Returns true if any of count consecutive words starting at word first
+// of the page was marked
+static inline bool slot_marked(const uint64_t marks[PAGE_MARK_WORDS], size_t first, size_t count) {
+    size_t last = first + count;
+
+    while (first < last) {
+        size_t bit = first & SIXTYTHREE64;
+        size_t bits = last - first < 64 - bit ? last - first : 64 - bit;
+        uint64_t mask = bits == 64 ? ~UINT64_C(0) : ((ONE64 << bits) - 1) << bit;
+
+        if (marks[first >> 6] & mask) {
+            return true;
+        }
+        first += bits;
+    }
+    return false;
+}
+
+// Recomputes the safe slots of a page that had frees since the last pass
+// from the marks left by the sweep. Returns false, leaving no slot safe,
+// when a slot was handed out from the page since the pause
+static bool reclaim_dirty_page(struct pagemap_t *pageMap, size_t allocSize, size_t maxAlloc, size_t totalAlloc) {
+    uint64_t *safemap = pageMap->safemap;
+    size_t bitmapCount = BITMAP_WORDS(maxAlloc);
+    uint64_t marks[PAGE_MARK_WORDS];
+    bool marked;
+    int factor;
+
+    for (size_t i = 0; i < bitmapCount; i++) {
+        FFAtomicAnd(safemap[i], 0);
+    }
+    if (pageMap->allocGeneration == pauseGeneration) {
+        return false;
+    }
+
+    factor = (epochCounter - pageMap->lastFreeEpoch) * maxAlloc;
+    if (totalAlloc != 0) {
+        factor /= totalAlloc;
+    }
+    if (factor >= OPTION(OPT_REUSE_FACTOR)) {
+        return true;
+    }
+
+    // Only whole slots; a size that doesn't divide the page leaves a
+    // tail that belongs to no allocation
+    marked = scanmap_page_marks((uint64_t)pageMap->start, marks);
+    for (size_t i = 0; i < bitmapCount; i++) {
+        uint64_t safe = 0;
+        size_t loc = i << 6;
+        size_t end = loc + 64 < maxAlloc ? loc + 64 : maxAlloc;
+
+        for (; loc < end; loc++) {
+            if (!marked || !slot_marked(marks, loc * allocSize / sizeof(uint64_t), allocSize / sizeof(uint64_t))) {
+                safe |= ONE64 << (loc & SIXTYTHREE64);
+            }
+        }
+        if (safe != 0) {
+            FFAtomicOr(safemap[i], safe);
+        }
+    }
+
+    // A claim racing with this stamps the page before it clears the safe
+    // bit of its slot again, so either it undoes the bit set above or the
+    // stamp is seen here
+    if (pageMap->allocGeneration == pauseGeneration) {
+        for (size_t i = 0; i < bitmapCount; i++) {
+            FFAtomicAnd(safemap[i], 0);
+        }
+        return false;
+    }
+    return true;
+}
+
+// Records that a page had a free since the last pass
+static inline void mark_page_dirty(struct pagepool_t *pool, struct pagemap_t *pageMap) {
+    size_t mapID = pageMap - pool->tracking.pageMaps;
+    uint64_t bit = ONE64 << (mapID & SIXTYTHREE64);
+
+    pageMap->lastFreeEpoch = epochCounter;
+
+    // The reclaimer takes the dirty words concurrently even in single
+    // threaded builds
+    if (!(pool->dirtyPages[mapID >> 6] & bit)) {
+        __sync_fetch_and_or(&pool->dirtyPages[mapID >> 6], bit);
+    }
+}
+
+// Zeroes the freed slots of an arena's retired pages that had frees since
+// the last pass, before the sweep marks from them. Mutators may run meanwhile: a
+// claim sets the allocated bit before it takes the safe bit, so a slot
+// with both clear is free for good until the next reclaim pass. Pages
+// still being allocated from are left alone since not every clear bit
+// there was ever allocated
+static void zero_arena_slots(struct arena_t *arena) {
+    struct poollistnode_t *currPoolNode;
+    struct pagepool_t *pool;
+
+    for (size_t node = 0; node < MAX_NUMA_NODES; node++) {
+        for (currPoolNode = arena->smallPoolList[node]; currPoolNode != NULL; currPoolNode = currPoolNode->next) {
+            pool = currPoolNode->pool;
+            if (pool == NULL) {
+                continue;
+            }
+
+            if (!pool_scan_enter(pool)) {
+                continue;
+            }
+            if (pool->tracking.pageMaps == NULL || pool->startInUse >= pool->end) {
+                pool_scan_exit(pool);
+                continue;
+            }
+
+            for (size_t word = 0; word < POOL_SIZE / PAGE_SIZE / 64; word++) {
+                uint64_t dirty = pool->dirtyPages[word];
+
+                while (dirty != 0) {
+                    struct pagemap_t *page = &pool->tracking.pageMaps[(word << 6) + FFCOUNTTRAILINGZEROS64(dirty)];
+                    size_t allocSize = page->allocSize & ~SEVEN64;
+                    size_t maxAlloc, bitmapCount;
+                    uint64_t *bitmap, *safemap;
+                    dirty &= dirty - 1;
+
+                    if ((page->allocSize & SEVEN64) != FOUR64) {
+                        continue;
+                    }
+
+                    maxAlloc = PAGE_SIZE / allocSize;
+                    bitmap = page->bitmap;
+                    safemap = page->safemap;
+                    bitmapCount = BITMAP_WORDS(maxAlloc);
+
+                    for (size_t i = 0; i < bitmapCount && (page->allocSize & SEVEN64) == FOUR64; i++) {
+                        uint64_t freed = ~(bitmap[i] | safemap[i]);
+                        if (i == bitmapCount - 1 && (maxAlloc & SIXTYTHREE64)) {
+                            freed &= (ONE64 << (maxAlloc & SIXTYTHREE64)) - 1;
+                        }
+
+                        while (freed != 0) {
+                            size_t loc = (i << 6) + FFCOUNTTRAILINGZEROS64(freed);
+                            freed &= freed - 1;
+                            memset(page->start + loc * allocSize, 0, allocSize);
+                        }
+                    }
+                }
+            }
+            pool_scan_exit(pool);
+        }
+    }
+}
+
+static void zero_freed_slots(void) {
+    for (size_t arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
+        if (arenas[arenaID] != NULL) {
+            zero_arena_slots(arenas[arenaID]);
+        }
+    }
+}
+
+// Lists an arena's pages with slots that the sweep found safe to reuse
+static void reclaim_arena_subpage(struct arena_t *arena) {
+    struct poollistnode_t *currPoolNode = NULL;
+    struct pagemap_t *poolArray;
+    struct pagepool_t *pool;
+
+    // Built privately by the reclaimer, which is the only writer
+    struct pagemap_t *reuseHead[256];
+    struct pagemap_t *reuseTail[256];
+
+    for (size_t i = 0; i < 256; i++) {
+        reuseHead[i] = NULL;
+        reuseTail[i] = NULL;
+    }
+
+    for (size_t node = 0; node < MAX_NUMA_NODES; node++) {
+        for (currPoolNode = arena->smallPoolList[node]; currPoolNode != NULL; currPoolNode = currPoolNode->next) {
+            pool = currPoolNode->pool;
+            if (pool == NULL) {
+                continue;
+            }
+
+            poolArray = pool->tracking.pageMaps;
+            if (poolArray == NULL) {
+                continue;
+            }
+
+            // Only pages freed into since the last pass and those listed
+            // by it are visited, so the cost follows churn
+            for (size_t word = 0; word < POOL_SIZE / PAGE_SIZE / 64; word++) {
+                uint64_t dirty = __sync_fetch_and_and(&pool->dirtyPages[word], 0);
+                uint64_t candidates = dirty | pool->reusablePages[word];
+                pool->reusablePages[word] = 0;
+
+                while (candidates != 0) {
+                    size_t pos = FFCOUNTTRAILINGZEROS64(candidates);
+                    uint64_t bit = ONE64 << pos;
+                    struct pagemap_t *curr = &poolArray[(word << 6) + pos];
+                    uint64_t flag = curr->allocSize & SEVEN64;
+                    size_t allocSize, maxAlloc, totalAlloc, reusable;
+                    candidates &= candidates - 1;
+
+                    // 1. 0b001: all allocations are now freed, mark pages as ready to be released
+                    // 2. 0b010: all of pages have been returned to the OS
+                    // 4. 0b100: fully allocated
+                    // 5. 0b101: pages no longer actively being allocated, all allocations
+                    //           have been freed, but page has not been returned to OS
+                    if (flag != FOUR64) {
+                        // A page still being allocated from is revisited
+                        // until it fills
+                        if (flag == 0 && (dirty & bit)) {
+                            __sync_fetch_and_or(&pool->dirtyPages[word], bit);
+                        }
+                        continue;
+                    }
+
+                    allocSize = curr->allocSize & ~SEVEN64;
+                    maxAlloc = PAGE_SIZE / allocSize;
+                    totalAlloc = 0;
+                    for (size_t i = 0; i < BITMAP_WORDS(maxAlloc); i++) {
+                        totalAlloc += bitCount(FFAtomicAdd(curr->bitmap[i], 0));
+                    }
+                    if (totalAlloc >= maxAlloc) {
+                        continue;
+                    }
+
+                    if ((dirty & bit) && !reclaim_dirty_page(curr, allocSize, maxAlloc, totalAlloc)) {
+                        __sync_fetch_and_or(&pool->dirtyPages[word], bit);
+                        continue;
+                    }
+
+                    // Pages without frees since the last pass keep the safe
+                    // slots found then and are listed again, once per pass
+                    reusable = count_reusable_slots(curr, maxAlloc);
+                    if (reusable > 0 && curr->reuseGeneration != reuseGeneration) {
+                        size_t bin = GET_REUSEBIN(allocSize);
+                        curr->reuseGeneration = reuseGeneration;
+                        curr->reuseCount = reusable;
+                        curr->next = NULL;
+                        if (reuseTail[bin] == NULL) {
+                            reuseHead[bin] = curr;
+                        }
+                        else {
+                            reuseTail[bin]->next = curr;
+                        }
+                        reuseTail[bin] = curr;
+                        pool->reusablePages[word] |= bit;
+                        sweepCycle.bytesReusable += reusable * allocSize;
+                    }
+                }
+            }
+        }
+    }
+
+    // Publish the new lists. The tag bump fails any pop that read the
+    // previous heads. Until then a pop may still follow a relinked next
+    // pointer into these, which is harmless because every slot claim is
+    // atomic and rechecks the page state
+    for (size_t i = 0; i < 256; i++) {
+        stack_replace(&arena->reuseMapHead[i], reuseHead[i]);
+    }
+}
+
+// Lists the reusable pages of every arena, or of only that one when it is
+// not NULL. Only passes over every arena advance the epoch
+void reclaim_subpage(struct arena_t *only) {
+    reuseGeneration++;
+
+    if (only != NULL) {
+        reclaim_arena_subpage(only);
+        return;
+    }
+
+    for (size_t arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
+        if (arenas[arenaID] != NULL) {
+            reclaim_arena_subpage(arenas[arenaID]);
+        }
+    }
+
+    epochCounter++;
+}
+#endif
+
+
+//
+// Sweep metadata that are logically disable to free
+//
+#ifdef RECLAIM_META
+static void reclaim_metadata(struct reclaim_t *arg) {
+    struct poollistnode_t *currPoolNode = NULL;
+    struct poollistnode_t *prevPoolNode = NULL;
+
+    struct pagepool_t *pool;
+    struct arena_t *arena;
+    size_t arenaID;
+
+    size_t totalSize = 0;
+
+    for (arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
+        arena = arenas[arenaID];
+        if (!arena) continue;
+
+        for (size_t node = 0; node < MAX_NUMA_NODES; node++) {
+            currPoolNode = arena->smallPoolList[node];
+            prevPoolNode = NULL;
+            for (; currPoolNode != NULL; currPoolNode = currPoolNode->next) {
+                pool = currPoolNode->pool;
+                if (pool == NULL) {
+                    prevPoolNode = currPoolNode;
+                    continue;
+                }
+
+                if (pool->startInUse >= pool->endInUse) {
+                    prevPoolNode->next = currPoolNode->next;
+
+                    FFDeleteCriticalSection(&pool->poolLock);
+                    ffmetadata_free(pool, sizeof(struct pagepool_t));
+                    ffmetadata_free(currPoolNode, sizeof(struct poollistnode_t));
+                }
+                
+                prevPoolNode = currPoolNode;
+            }
+        }
+    }
+
+    for (arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
+        arena = arenas[arenaID];
+        if (!arena) continue;
+
+        currPoolNode = arena->jumboPoolList;
+        prevPoolNode = NULL;
+        for (; currPoolNode != NULL; currPoolNode = currPoolNode->next) {
+            pool = currPoolNode->pool;
+            if (pool == NULL) {
+                prevPoolNode = currPoolNode;
+                continue;
+            }
+
+            if (pool->startInUse >= pool->endInUse) {
+                prevPoolNode->next = currPoolNode->next;
+
+                FFDeleteCriticalSection(&pool->poolLock);
+                ffmetadata_free(pool, sizeof(struct pagepool_t));
+                ffmetadata_free(currPoolNode, sizeof(struct poollistnode_t));
+            }
+                
+            prevPoolNode = currPoolNode;
+        }
+    }
+
+    for (arenaID = 0; arenaID < MAX_ARENAS; arenaID++) {
+        arena = arenas[arenaID];
+        if (!arena) continue;
+
+        for (size_t i = 0; i < MAX_LARGE_LISTS; i++) {
+            currPoolNode = arena->largePoolList[i];
+            prevPoolNode = NULL;
+            for (; currPoolNode != NULL; currPoolNode = currPoolNode->next) {
+                pool = currPoolNode->pool;
+                if (pool == NULL) {
+                    prevPoolNode = currPoolNode;
+                    continue;
+                }
+
+                if (pool->startInUse >= pool->endInUse) {
+                    prevPoolNode->next = currPoolNode->next;
+
+                    FFDeleteCriticalSection(&pool->poolLock);
+                    ffmetadata_free(pool, sizeof(struct pagepool_t));
+                    ffmetadata_free(currPoolNode, sizeof(struct poollistnode_t));
+                }
+
+                prevPoolNode = currPoolNode;
+            }
+        }
+    }
+}
+#endif
+
+
+
+// Scanner Thread
+static void *scanner_thread(void *data) {
+    struct scanner_t *arg = (struct scanner_t *)data;
+    struct reclaim_t *reclaim = arg->arg;
+    struct scanchunk_t *chunk;
+
+    size_t round = 0;
+    bool concurrent;
+    bool running;
+    long start, now;
+    long rootTime, heapTime;
+
+    isCollectorThread = true;
+
+    while (true) {
+        // Sleep until the reclaimer opens the next round
+        pthread_mutex_lock(&reclaim->scanLock);
+        while (reclaim->scanRound == round) {
+            pthread_cond_wait(&reclaim->scanWake, &reclaim->scanLock);
+        }
+        round = reclaim->scanRound;
+        concurrent = reclaim->concurrent;
+        pthread_mutex_unlock(&reclaim->scanLock);
+
+        // A pause scans every resident page too when no concurrent pass ran
+        // before it. The mutators are stopped then, so the pools need not
+        // be entered
+        running = concurrent && __sync_fetch_and_add(&stwStopped, 0) == 0;
+
+        //lf_dbg("[%02d] scanning", arg->id);
+        rootTime = 0;
+        heapTime = 0;
+        start = cal_nsclock();
+        while ((chunk = take_scan_chunk(reclaim, arg->id, arg->group)) != NULL) {
+            if (chunk->pool == NULL) {
+                // text/data/BSS sections, stacks and other mappings
+                if (chunk->exact) {
+                    scan_block(arg->marks, chunk->start, chunk->end);
+                    arg->marks->pagesScanned += (chunk->end - chunk->start + PAGE_SIZE - 1) / PAGE_SIZE;
+                }
+                else {
+                    map_scan(arg->marks, chunk->start, chunk->end, concurrent);
+                }
+            }
+            else if (running) {
+                // heap scanning, the mutators may release the pool meanwhile
+                if (pool_scan_enter(chunk->pool)) {
+                    pagepool_scan(arg->marks, chunk->pool, chunk->start, chunk->end, concurrent, chunk->exact);
+                    pool_scan_exit(chunk->pool);
+                }
+            }
+            else {
+                // heap scanning
+                pagepool_scan(arg->marks, chunk->pool, chunk->start, chunk->end, concurrent, chunk->exact);
+            }
+
+            // The mutators keep freeing during a concurrent pass
+            if (running && decommit_queue_full()) {
+                flush_decommits();
+            }
+
+            now = cal_nsclock();
+            if (chunk->pool == NULL) {
+                rootTime += now - start;
+            }
+            else {
+                heapTime += now - start;
+            }
+            start = now;
+        }
+
+        // Publish whatever marks are still buffered before reporting done
+        markbuf_flush(arg->marks);
+
+        //lf_dbg("[%02d] scanning...done", arg->id);
+        pthread_mutex_lock(&reclaim->scanLock);
+        sweepCycle.phaseTime[FFPHASE_ROOTS] += rootTime;
+        sweepCycle.phaseTime[FFPHASE_HEAP] += heapTime;
+        sweepCycle.marks += arg->marks->marked;
+        sweepCycle.pagesScanned += arg->marks->pagesScanned;
+        sweepCycle.pagesSkipped += arg->marks->pagesSkipped;
+        arg->marks->marked = 0;
+        arg->marks->pagesScanned = 0;
+        arg->marks->pagesSkipped = 0;
+        if (--reclaim->scanBusy == 0) {
+            pthread_cond_signal(&reclaim->scanIdle);
+        }
+        pthread_mutex_unlock(&reclaim->scanLock);
+    }
+    return NULL;
+}
+
+// Splits the scan work of each group between its scanners and wakes them up
+static inline void start_scanner(struct reclaim_t *arg) {
+    uint64_t front, back;
+    size_t chunks, scanners, base;
+
+    for (size_t group = 0; group < arg->scanGroups; group++) {
+        base = arg->chunkFirst[group];
+        chunks = arg->chunkFirst[group + 1] - base;
+        scanners = arg->scanFirst[group + 1] - arg->scanFirst[group];
+        for (size_t i = 0; i < scanners; i++) {
+            front = base + chunks * i / scanners;
+            back = base + chunks * (i + 1) / scanners;
+            arg->deques[arg->scanFirst[group] + i].bounds = (front << 32) | back;
+        }
+    }
+
+    arg->scanAbort = arg->scanOverflow;
+
+    pthread_mutex_lock(&arg->scanLock);
+    arg->scanBusy = arg->scannerCount;
+    arg->scanRound++;
+    pthread_cond_broadcast(&arg->scanWake);
+    pthread_mutex_unlock(&arg->scanLock);
+}
+
+// Waits until every scanner has finished the current round. Once a non-zero
+// deadline on the cal_nsclock scale passes the overrun is counted and, with
+// the budget_abort option, the scanners drop the chunks they haven't started yet.
+// Returns false if the round was cut short
+static bool stop_scanner(struct reclaim_t *arg, long deadline) {
+    struct timespec limit;
+    bool overrun = (deadline == 0);
+
+    limit.tv_sec = deadline / BILLION;
+    limit.tv_nsec = deadline % BILLION;
+
+    pthread_mutex_lock(&arg->scanLock);
+    while (arg->scanBusy != 0) {
+        if (overrun) {
+            pthread_cond_wait(&arg->scanIdle, &arg->scanLock);
+        }
+        else if (pthread_cond_timedwait(&arg->scanIdle, &arg->scanLock, &limit) == ETIMEDOUT) {
+            overrun = true;
+            arg->pauseOverruns++;
+            arg->scanAbort = (OPTION(OPT_BUDGET_ABORT) != 0);
+        }
+    }
+    pthread_mutex_unlock(&arg->scanLock);
+
+    return !arg->scanAbort;
+}
+
+// Returns the scanner pool size from the scanners option or the default
+static size_t get_scanner_count(void) {
+    long count = OPTION(OPT_SCANNERS);
+
+    if (count == 0) {
+        count = sysconf(_SC_NPROCESSORS_ONLN);
+        if (count > DEFAULT_SCANNERS) {
+            count = DEFAULT_SCANNERS;
+        }
+        if (count < 1) {
+            count = 1;
+        }
+    }
+
+    return (size_t)count;
+}
+
+// Fills set with the CPUs of a NUMA node that the process may run on.
+// Returns false if there are none
+static bool get_node_cpus(size_t node, cpu_set_t *set) {
+    char path[64];
+    cpu_set_t allowed;
+
+    CPU_ZERO(set);
+    snprintf(path, sizeof(path), "/sys/devices/system/node/node%zu/cpulist", node);
+    read_id_list(path, set);
+    if (sched_getaffinity(0, sizeof(allowed), &allowed) == 0) {
+        CPU_AND(set, set, &allowed);
+    }
+
+    return CPU_COUNT(set) > 0;
+}
+
+static void create_and_stop_scanner(struct reclaim_t *arg) {
+    struct scanner_t *scanner;
+    pthread_attr_t attr;
+    pthread_condattr_t condAttr;
+    cpu_set_t cpus;
+    size_t group = 0;
+
+    pthread_mutex_init(&arg->scanLock, NULL);
+    pthread_cond_init(&arg->scanWake, NULL);
+    // stop_scanner waits for a deadline on the cal_nsclock scale
+    pthread_condattr_init(&condAttr);
+    pthread_condattr_setclock(&condAttr, CLOCK_MONOTONIC);
+    pthread_cond_init(&arg->scanIdle, &condAttr);
+    pthread_condattr_destroy(&condAttr);
+    arg->scanRound = 0;
+    arg->scanBusy = 0;
+    arg->scannerCount = get_scanner_count();
+    OPTION(OPT_SCANNERS) = (long)arg->scannerCount;
+    init_scan_work(arg);
+
+    // With several NUMA nodes and a scanner for each, every node gets a
+    // group of scanners running on its CPUs that sweeps its pools
+    arg->scanGroups = 1;
+    if (numaNodeCount > 1 && arg->scannerCount >= numaNodeCount) {
+        arg->scanGroups = numaNodeCount;
+    }
+    for (size_t g = 0; g <= arg->scanGroups; g++) {
+        arg->scanFirst[g] = arg->scannerCount * g / arg->scanGroups;
+    }
+
+    for (size_t i = 0; i < arg->scannerCount; i++) {
+        lf_dbg("create %d", i);
+        while (i >= arg->scanFirst[group + 1]) {
+            group++;
+        }
+
+        scanner = ffmetadata_alloc(sizeof(struct scanner_t));
+        scanner->t = &arg->scanner[i];
+        scanner->arg = arg;
+        scanner->id = i;
+        scanner->group = group;
+        scanner->marks = (struct markbuf_t *)sys_mmap(NULL, sizeof(struct markbuf_t), PROT_READ | PROT_WRITE, MAP_ANONYMOUS | MAP_PRIVATE, -1, 0);
+        if (scanner->marks == MAP_FAILED) {
+            fprintf(stderr, "reclaim: Fail to map a mark buffer %ld\n", i);
+            exit(4);
+        }
+
+        // A scanner is left unpinned if its node has no CPUs it may use
+        pthread_attr_init(&attr);
+        if (arg->scanGroups > 1 && get_node_cpus(group, &cpus)) {
+            pthread_attr_setaffinity_np(&attr, sizeof(cpus), &cpus);
+        }
+        if (pthread_create(&arg->scanner[i], &attr, scanner_thread, scanner) < 0) {
+            fprintf(stderr, "reclaim: Fail to create scanner %ld\n", i);
+            exit(4);
+        }
+        pthread_attr_destroy(&attr);
+    }
+
+}
+
+
+static volatile size_t prevSmallAlloc[3601];
+static volatile int counter = 1;
+static volatile int scanOrder = 0;
+static volatile size_t descent = 0;
+
+static int movingAverage(void) {
+    double avg = 0;
+    int i = 0;
+    int cnt = 0;
+    for (i = (counter - 1); i > (counter - OPTION(OPT_RATE_WINDOW)) && i >= 1; i--) {
+        avg += prevSmallAlloc[i];
+        cnt++;
+    }
+
+    avg /= (double)cnt;
+
+    return (int)avg;
+}
+
+// Returns the number of allocations made since the previous call
+static int sample_alloc_count(void) {
+    static size_t lastMallocCount;
+    struct tcachestats_t total;
+    size_t mallocCount = 0;
+    size_t delta;
+
+    sum_tcache_stats(&total);
+    for (size_t i = 0; i < STAT_CLASSES; i++) {
+        mallocCount += total.mallocCount[i];
+    }
+
+    delta = mallocCount - lastMallocCount;
+    lastMallocCount = mallocCount;
+    return delta > INT_MAX ? INT_MAX : (int)delta;
+}
+
+#ifdef MOVING_GEOMEAN
+static int movingGeomean(void) {
+    double avg = prevSmallAlloc[counter - 1];
+    int i = 0;
+    int cnt = 1;
+    for (i = (counter - 2); i > (counter - OPTION(OPT_RATE_WINDOW)) && i >= 1; i--) {
+        avg *= prevSmallAlloc[i];
+        cnt++;
+    }
+
+    avg = pow(avg, (double)1 / cnt);
+    return (int)avg;
+}
+#endif
+
+//
+// Sweep Triggers
+//
+// The allocation rate heuristic sweeps once the rate falls below its moving
+// average. Memory pressure forces a sweep on top of that: the bytes freed
+// since the last sweep reaching quarantine_limit, RSS growing by rss_growth
+// percent, the cgroup's usage nearing memory.high or a PSI memory stall
+// event. Whatever the trigger, nothing runs while less than quarantine_min
+// bytes have been freed since the last sweep as there is little it could
+// reclaim, although by default there is no such minimum. Between periods
+// the reclaimer waits on the PSI trigger, when the kernel provides one, so
+// that a stall wakes it up early
+//
+#define QUARANTINE_FLUSH    (256UL * 1024UL)
+
+// Unprivileged PSI triggers need a window that is a multiple of 2 seconds
+#define PSI_WINDOW          2000000
+
+// Bytes freed since the last completed sweep. Each thread adds its frees in
+// QUARANTINE_FLUSH steps to keep the shared counter off the free path
+static size_t volatile quarantineBytes;
+static __thread size_t pendingQuarantine;
+
+static inline void quarantine_add(size_t size) {
+    pendingQuarantine += size;
+    if (pendingQuarantine >= QUARANTINE_FLUSH) {
+        __sync_fetch_and_add(&quarantineBytes, pendingQuarantine);
+        pendingQuarantine = 0;
+    }
+}
+
+#if !defined(FFSINGLE_THREADED) && !defined(_WIN64)
+// Adds what an exiting thread freed since its last step
+static void quarantine_flush(void) {
+    __sync_fetch_and_add(&quarantineBytes, pendingQuarantine);
+    pendingQuarantine = 0;
+}
+#endif
+
+// Returns the field'th number in a small procfs or cgroup file, or SIZE_MAX
+// if it's "max" or can't be read
+static size_t read_counter(int fd, int field) {
+    char buffer[128];
+    char *curr = buffer;
+    ssize_t ret;
+
+    ret = pread(fd, buffer, sizeof(buffer) - 1, 0);
+    if (ret <= 0) {
+        return SIZE_MAX;
+    }
+    buffer[ret] = '\0';
+
+    for (; field > 0; field--) {
+        curr = strchr(curr, ' ');
+        if (curr == NULL) {
+            return SIZE_MAX;
+        }
+        curr++;
+    }
+
+    if (*curr < '0' || *curr > '9') {
+        return SIZE_MAX;
+    }
+    return strtoull(curr, NULL, 10);
+}
+
+// Opens a PSI memory trigger for the stall threshold. Returns -1 if the
+// kernel doesn't support or allow it
+static int open_psi_trigger(const char *path) {
+    char trigger[64];
+    int fd, length;
+
+    fd = open(path, O_RDWR | O_NONBLOCK | O_CLOEXEC);
+    if (fd < 0) {
+        return -1;
+    }
+
+    length = snprintf(trigger, sizeof(trigger), "some %ld %d", OPTION(OPT_PSI_STALL), PSI_WINDOW);
+    if (write(fd, trigger, length + 1) < 0) {
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void init_pressure(struct reclaim_t *arg) {
+    char buffer[4096];
+    char path[4200];
+    char *group, *end;
+    ssize_t ret;
+    int fd;
+
+    arg->statmFd = open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+    arg->cgroupCurrentFd = -1;
+    arg->cgroupHighFd = -1;
+    arg->psiFd = -1;
+    arg->psiEvent = false;
+    arg->sweepRss = 0;
+
+    // The cgroup v2 membership is the line starting with 0::
+    group = NULL;
+    fd = open("/proc/self/cgroup", O_RDONLY | O_CLOEXEC);
+    if (fd >= 0) {
+        ret = read(fd, buffer, sizeof(buffer) - 1);
+        close(fd);
+        if (ret > 0) {
+            buffer[ret] = '\0';
+            group = strstr(buffer, "0::/");
+            if (group != NULL && (group == buffer || group[-1] == '\n')) {
+                group += 3;
+                end = strchr(group, '\n');
+                if (end != NULL) {
+                    *end = '\0';
+                }
+            }
+            else {
+                group = NULL;
+            }
+        }
+    }
+
+    if (group != NULL) {
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.current", group);
+        arg->cgroupCurrentFd = open(path, O_RDONLY | O_CLOEXEC);
+        snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.high", group);
+        arg->cgroupHighFd = open(path, O_RDONLY | O_CLOEXEC);
+        if (arg->cgroupCurrentFd < 0 || arg->cgroupHighFd < 0) {
+            if (arg->cgroupCurrentFd >= 0) close(arg->cgroupCurrentFd);
+            if (arg->cgroupHighFd >= 0) close(arg->cgroupHighFd);
+            arg->cgroupCurrentFd = -1;
+            arg->cgroupHighFd = -1;
+        }
+    }
+
+    // Prefer the stalls of the process's own cgroup over system wide ones
+    if (OPTION(OPT_PSI_STALL) != 0) {
+        if (group != NULL) {
+            snprintf(path, sizeof(path), "/sys/fs/cgroup%s/memory.pressure", group);
+            arg->psiFd = open_psi_trigger(path);
+        }
+        if (arg->psiFd < 0) {
+            arg->psiFd = open_psi_trigger("/proc/pressure/memory");
+        }
+    }
+}
+
+// Returns true if memory pressure calls for a sweep whatever the allocation
+// rate says
+static bool check_pressure(struct reclaim_t *arg, size_t quarantined) {
+    size_t rss, current, high;
+
+    if (arg->psiEvent) {
+        arg->psiEvent = false;
+        return true;
+    }
+
+    if (OPTION(OPT_QUARANTINE_LIMIT) != 0 && quarantined >= (size_t)OPTION(OPT_QUARANTINE_LIMIT)) {
+        return true;
+    }
+
+    if (OPTION(OPT_RSS_GROWTH) != 0 && arg->statmFd >= 0) {
+        rss = read_counter(arg->statmFd, 1);
+        if (rss != SIZE_MAX) {
+            rss *= PAGE_SIZE;
+            if (arg->sweepRss == 0) {
+                arg->sweepRss = rss;
+            }
+            else if (rss > arg->sweepRss + arg->sweepRss / 100 * OPTION(OPT_RSS_GROWTH)) {
+                return true;
+            }
+        }
+    }
+
+    if (OPTION(OPT_CGROUP_HIGH) != 0 && arg->cgroupHighFd >= 0) {
+        high = read_counter(arg->cgroupHighFd, 0);
+        current = read_counter(arg->cgroupCurrentFd, 0);
+        if (high != SIZE_MAX && current != SIZE_MAX && current >= high / 100 * OPTION(OPT_CGROUP_HIGH)) {
+            return true;
+        }
+    }
+
+    return false;
+}
+
+//
+// Arena Sweeps
+//
+// ffsweep_arena and ffdestroy_arena hand their arena to the reclaimer, which
+// serves one request at a time between its own cycles and wakes early for
+// them. The caller waits for the result. A request posted after the
+// reclaimer has been shut down at exit is not swept
+//
+static pthread_mutex_t arenaSweepLock = PTHREAD_MUTEX_INITIALIZER;
+static pthread_cond_t arenaSweepCond = PTHREAD_COND_INITIALIZER;
+
+// Key of the arena of the request in flight, zero when there is none
+static ffarena_t arenaSweepKey;
+static bool arenaSweepDestroy;
+static bool arenaSweepDone;
+static bool arenaSweepClosed;
+static ffresult_t arenaSweepResult;
+
+// Written by requesters to cut the reclaimer's wait short
+static int arenaSweepWake = -1;
+
+// Posts a request for the reclaimer and waits for it to be served
+static ffresult_t request_arena_sweep(ffarena_t key, bool destroy) {
+    ffresult_t result;
+    uint64_t wake = 1;
+
+    pthread_mutex_lock(&arenaSweepLock);
+    while (arenaSweepKey != 0 && !arenaSweepClosed) {
+        pthread_cond_wait(&arenaSweepCond, &arenaSweepLock);
+    }
+    if (arenaSweepClosed) {
+        pthread_mutex_unlock(&arenaSweepLock);
+        if (!destroy) {
+            return FFBUSY;
+        }
+
+        // Without the reclaimer the pools are left in the quarantine
+        struct arena_t *arena = arenas[key];
+        arenas[key] = NULL;
+        destroy_arena(arena);
+        return FFSUCCESS;
+    }
+
+    arenaSweepKey = key;
+    arenaSweepDestroy = destroy;
+    arenaSweepDone = false;
+    if (write(arenaSweepWake, &wake, sizeof(wake)) < 0) {
+        // Served at the end of the current period instead
+    }
+
+    while (!arenaSweepDone) {
+        pthread_cond_wait(&arenaSweepCond, &arenaSweepLock);
+    }
+    result = arenaSweepResult;
+    arenaSweepKey = 0;
+    pthread_cond_broadcast(&arenaSweepCond);
+    pthread_mutex_unlock(&arenaSweepLock);
+
+    return result;
+}
+
+// Waits for up to the given number of microseconds. Returns early when an
+// arena sweep is requested or the PSI trigger fires. A full decommit queue
+// is issued without ending the wait
+static void wait_event(struct reclaim_t *arg, long micros) {
+    struct pollfd events[3];
+    struct timespec timeout;
+    nfds_t count = 2;
+    uint64_t value;
+    const long end = cal_nsclock() + micros * 1000;
+    long left;
+
+    events[0].fd = arenaSweepWake;
+    events[0].events = POLLIN;
+    events[1].fd = decommitWake;
+    events[1].events = POLLIN;
+    if (arg->psiFd >= 0) {
+        events[2].fd = arg->psiFd;
+        events[2].events = POLLPRI;
+        count = 3;
+    }
+
+    while ((left = end - cal_nsclock()) > 0) {
+        for (nfds_t i = 0; i < count; i++) {
+            events[i].revents = 0;
+        }
+
+        timeout.tv_sec = left / BILLION;
+        timeout.tv_nsec = left % BILLION;
+        if (ppoll(events, count, &timeout, NULL) <= 0) {
+            return;
+        }
+
+        if (events[1].revents & POLLIN) {
+            if (read(decommitWake, &value, sizeof(value)) < 0) {
+                // Another wake up already drained it
+            }
+            flush_decommits();
+        }
+
+        if ((events[0].revents & POLLIN) && read(arenaSweepWake, &value, sizeof(value)) < 0) {
+            // Another wake up already drained it
+        }
+
+        if (count > 2) {
+            if (events[2].revents & POLLERR) {
+                // The monitored cgroup is gone
+                close(arg->psiFd);
+                arg->psiFd = -1;
+                count = 2;
+            }
+            else if (events[2].revents & POLLPRI) {
+                arg->psiEvent = true;
+            }
+        }
+
+        if (events[0].revents != 0 || arg->psiEvent) {
+            return;
+        }
+    }
+}
+
+// Waits out a period or until the PSI trigger fires
+static void wait_period(struct reclaim_t *arg) {
+    wait_event(arg, OPTION(OPT_PERIOD_DELAY));
+}
+
+// How a sweep cycle ended: after a concurrent pass that found no reason to
+// pause, with a pause abandoned before its marks were complete, or with the
+// sweep releasing what it found unreferenced
+#define SWEEP_CONCURRENT 0
+#define SWEEP_ABANDONED  1
+#define SWEEP_COMPLETED  2
+
+// A completed sweep of a single arena
+#define SWEEP_ARENA      3
+
+// Adds the time since start to a phase of the cycle in progress. Returns
+// the current time so that consecutive phases can be chained
+static long end_phase(size_t phase, long start) {
+    long now = cal_nsclock();
+    sweepCycle.phaseTime[phase] += now - start;
+    return now;
+}
+
+// Returns the latency histogram bucket of a duration in nanoseconds
+static size_t sweep_bucket(size_t time) {
+    size_t micros = time / 1000;
+    size_t bucket = (micros == 0) ? 0 : (size_t)(63 - FFCOUNTLEADINGZEROS64(micros));
+    return bucket < FFSWEEP_BUCKETS ? bucket : FFSWEEP_BUCKETS - 1;
+}
+
+// Folds the cycle that just ended into the statistics and starts the next
+static void end_sweep_cycle(int outcome, bool concurrentPass) {
+    ffsweepcycle_t *total = &sweepStats.total;
+
+    pthread_mutex_lock(&sweepStatsLock);
+    if (concurrentPass) {
+        sweepStats.concurrentPasses++;
+        sweepStats.concurrentHistogram[sweep_bucket(sweepCycle.concurrentTime)]++;
+    }
+    if (outcome != SWEEP_CONCURRENT) {
+        sweepStats.pauses++;
+        sweepStats.pauseHistogram[sweep_bucket(sweepCycle.pauseTime)]++;
+        if (sweepCycle.pauseTime > sweepStats.maxPauseTime) {
+            sweepStats.maxPauseTime = sweepCycle.pauseTime;
+        }
+    }
+    if (outcome == SWEEP_COMPLETED) {
+        sweepStats.sweeps++;
+    }
+    else if (outcome == SWEEP_ARENA) {
+        sweepStats.arenaSweeps++;
+    }
+    else if (outcome == SWEEP_ABANDONED) {
+        sweepStats.abandoned++;
+    }
+
+    total->concurrentTime += sweepCycle.concurrentTime;
+    total->pauseTime += sweepCycle.pauseTime;
+    for (size_t i = 0; i < FFPHASE_COUNT; i++) {
+        total->phaseTime[i] += sweepCycle.phaseTime[i];
+    }
+    total->pagesScanned += sweepCycle.pagesScanned;
+    total->pagesSkipped += sweepCycle.pagesSkipped;
+    total->marks += sweepCycle.marks;
+    total->bytesReleased += sweepCycle.bytesReleased;
+    total->bytesReusable += sweepCycle.bytesReusable;
+    sweepStats.last = sweepCycle;
+    pthread_mutex_unlock(&sweepStatsLock);
+
+    FFPROBE5(sweep__end, outcome, sweepCycle.pauseTime, sweepCycle.concurrentTime,
+        sweepCycle.bytesReleased, sweepCycle.bytesReusable);
+    memset(&sweepCycle, 0, sizeof(ffsweepcycle_t));
+}
+
+// Sweeps one arena with the world stopped. The roots and the arena's pools
+// are scanned whole, and only the arena's quarantined pools, held extents
+// and freed slots are released or listed for reuse. A destroyed arena has
+// no pools left to scan or list, and as nothing may keep pointing into it
+// the pools of every other arena are scanned as well
+static ffresult_t sweep_arena(struct reclaim_t *arg, struct arena_t *arena, bool destroyed) {
+    long begin;
+    long curr;
+    long phase;
+    bool completed;
+
+#ifdef SUB_PAGE
+    if (!destroyed && OPTION(OPT_ZERO_MODE) == ZERO_LAZY) {
+        zero_arena_slots(arena);
+    }
+#endif
+
+    FFPROBE0(sweep__start);
+    arg->scanOverflow = false;
+
+    begin = cal_nsclock();
+    if (!send_stop_signal(arg)) {
+        send_resume_signal(arg);
+        sweepCycle.pauseTime = cal_nsclock() - begin;
+        FFPROBE2(pause__end, sweepCycle.pauseTime, false);
+        end_sweep_cycle(SWEEP_ABANDONED, false);
+        return FFBUSY;
+    }
+    take_freed_extents();
+    take_quarantine(arena);
+#ifdef SUB_PAGE
+    pauseGeneration++;
+#endif
+
+    arg->concurrent = true;
+    softDirty = open("/proc/self/pagemap", O_RDONLY);
+    if (softDirty < 0) {
+        lf_dbg("cannot open /proc/self/pagemap");
+        exit(-1);
+    }
+
+    phase = cal_nsclock();
+    user_memory_maps(arg, destroyed ? NULL : arena, true);
+    end_phase(FFPHASE_MAPS, phase);
+    start_scanner(arg);
+    completed = stop_scanner(arg, 0);
+
+    close(softDirty);
+    softDirty = -1;
+
+    send_resume_signal(arg);
+    curr = cal_nsclock();
+    sweepCycle.pauseTime = curr - begin;
+    FFPROBE2(pause__end, sweepCycle.pauseTime, completed);
+    if (!completed) {
+        scanmap_clear();
+        end_phase(FFPHASE_CLEAR, curr);
+        end_sweep_cycle(SWEEP_ABANDONED, false);
+        return FFBUSY;
+    }
+
+    reclaim_large_extents(arena);
+    phase = end_phase(FFPHASE_LARGE, curr);
+    reclaim_pagepool_handler(arena);
+    phase = end_phase(FFPHASE_POOLS, phase);
+
+#ifdef SUB_PAGE
+    if (!destroyed) {
+        reclaim_subpage(arena);
+        phase = end_phase(FFPHASE_SUBPAGE, phase);
+    }
+#endif
+
+    scanmap_clear();
+    end_phase(FFPHASE_CLEAR, phase);
+    end_sweep_cycle(SWEEP_ARENA, false);
+    return FFSUCCESS;
+}
+
+// Serves the arena sweep request in flight, if any. A destroyed arena's
+// pools are all quarantined and swept at once, and whatever is still
+// referenced is left to the global sweeps
+static void serve_arena_sweep(struct reclaim_t *arg) {
+    struct arena_t *arena;
+    ffarena_t key;
+    bool destroy;
+    ffresult_t result;
+
+    pthread_mutex_lock(&arenaSweepLock);
+    key = arenaSweepDone ? 0 : arenaSweepKey;
+    destroy = arenaSweepDestroy;
+    pthread_mutex_unlock(&arenaSweepLock);
+    if (key == 0) {
+        return;
+    }
+
+    arena = arenas[key];
+    if (arena == NULL) {
+        result = FFBAD_ARENA;
+    }
+    else if (destroy) {
+        arenas[key] = NULL;
+        release_arena_pools(arena);
+        sweep_arena(arg, arena, true);
+        destroy_arena(arena);
+        result = FFSUCCESS;
+    }
+    else {
+        result = sweep_arena(arg, arena, false);
+    }
+
+    pthread_mutex_lock(&arenaSweepLock);
+    arenaSweepResult = result;
+    arenaSweepDone = true;
+    pthread_cond_broadcast(&arenaSweepCond);
+    pthread_mutex_unlock(&arenaSweepLock);
+}
+
+static void *reclaim_thread(void *data)
+{
+    struct reclaim_t *arg = (struct reclaim_t *)data;
+
+    isCollectorThread = true;
+
+    init_pressure(arg);
+    init_dirty_tracking();
+
+    pthread_setcancelstate(PTHREAD_CANCEL_ENABLE, NULL);
+    pthread_setcanceltype(PTHREAD_CANCEL_ASYNCHRONOUS, NULL);
+
+    // Open pagemap file to check dirty bits
+    lf_dbg("open...done");
+
+    struct sigaction sig_action;
+
+#ifdef STW_TIME
+    sigfillset(&sig_action.sa_mask);
+    if (sigdelset(&sig_action.sa_mask, SIGALRM) < 0) 
+        exit(-1);
+#endif
+    long begin = cal_nsclock();
+    long curr;
+    long phase;
+    long passStart;
+
+    int currSmallAlloc = 0;
+    bool completed;
+    bool concurrentPass;
+    bool rateTrigger;
+    bool pressure;
+    size_t quarantined;
+    //long stwStart = 0;
+
+    // Arena sweeps are served during the start delay too
+    long startEnd = cal_nsclock() + OPTION(OPT_START_DELAY) * BILLION;
+    while ((curr = cal_nsclock()) < startEnd) {
+        wait_event(arg, (startEnd - curr) / 1000);
+        serve_arena_sweep(arg);
+    }
+
+    //size_t prevTotalSmallAlloc = 0;
+    prevSmallAlloc[0] = 1;
+
+
+    while (true) {
+        //long delta = cal_nsclock() - stwStart;
+
+        serve_arena_sweep(arg);
+        flush_decommits();
+
+        scanOrder = movingAverage();
+        //scanOrder = movingGeomean();
+        currSmallAlloc = sample_alloc_count();
+        //if (currSmallAlloc == 0) currSmallAlloc = 1;
+
+        quarantined = quarantineBytes;
+        pressure = check_pressure(arg, quarantined);
+        rateTrigger = (scanOrder > currSmallAlloc && currSmallAlloc > 0 && descent == 0);
+
+        if ((rateTrigger || pressure) && quarantined >= (size_t)OPTION(OPT_QUARANTINE_MIN)) {
+            
+            prevSmallAlloc[counter] = currSmallAlloc;
+            counter += 1;
+            if (counter > 3600) {
+                counter = 0;
+            }
+
+            if (OPTION(OPT_NO_SCAN)) {
+                descent = true;
+                send_stop_signal(arg);
+                send_resume_signal(arg);
+                usleep(500000);
+                continue;
+            }
+
+#ifdef SUB_PAGE
+            if (OPTION(OPT_ZERO_MODE) == ZERO_LAZY) {
+                zero_freed_slots();
+            }
+#endif
+
+            FFPROBE0(sweep__start);
+            arg->scanOverflow = false;
+
+            concurrentPass = (OPTION(OPT_CONCURRENT) != 0);
+            if (concurrentPass) {
+                arg->concurrent = true;
+                passStart = cal_nsclock();
+
+                softDirty = open("/proc/self/pagemap", O_RDONLY);
+                if (softDirty < 0) {
+                    lf_dbg("cannot open /proc/self/pagemap");
+                    exit(-1);
+                }
+
+                phase = cal_nsclock();
+                user_memory_maps(arg, NULL, false);
+                end_phase(FFPHASE_MAPS, phase);
+
+                // Anything written from here on is rescanned by the pause
+                reset_dirty_tracking(arg);
+                start_scanner(arg);
+                stop_scanner(arg, 0);
+
+                close(softDirty);
+                softDirty = -1;
+                sweepCycle.concurrentTime = cal_nsclock() - passStart;
+
+                //scanOrder = movingGeomean();
+                scanOrder = movingAverage();
+                currSmallAlloc = sample_alloc_count();
+                prevSmallAlloc[counter] = currSmallAlloc;
+                if (!pressure && (scanOrder <= currSmallAlloc || currSmallAlloc == 0)) {
+                    counter += 1;
+                    if (counter > 3600) {
+                        counter = 0;
+                    }
+
+                    if (scanOrder > currSmallAlloc) {
+                        descent = true;
+                    }
+                    else {
+                        descent = false;
+                    }
+
+                    end_sweep_cycle(SWEEP_CONCURRENT, true);
+                    wait_period(arg);
+                    continue;
+                }
+            }
+
+            descent = true;
+
+            begin = cal_nsclock();
+            if (!send_stop_signal(arg)) {
+                // A thread that never parked may still be mutating the heap,
+                // so the concurrent marks can't be completed. Drop them and
+                // retry on a later period
+                send_resume_signal(arg);
+                phase = cal_nsclock();
+                sweepCycle.pauseTime = phase - begin;
+                FFPROBE2(pause__end, sweepCycle.pauseTime, false);
+                scanmap_clear();
+                end_phase(FFPHASE_CLEAR, phase);
+                end_sweep_cycle(SWEEP_ABANDONED, concurrentPass);
+                wait_period(arg);
+                continue;
+            }
+            take_freed_extents();
+            take_quarantine(NULL);
+#ifdef SUB_PAGE
+            pauseGeneration++;
+#endif
+
+
+            // Without a concurrent pass this cycle, or without dirty tracking,
+            // the pause has to scan every resident page rather than only
+            // those dirtied since
+            arg->concurrent = !concurrentPass || OPTION(OPT_DIRTY_TRACKING) == DIRTY_NONE;
+
+            softDirty = open("/proc/self/pagemap", O_RDONLY);
+            if (softDirty < 0) {
+                lf_dbg("cannot open /proc/self/pagemap");
+                exit(-1);
+            }
+
+            phase = cal_nsclock();
+            user_memory_maps(arg, NULL, true);
+            end_phase(FFPHASE_MAPS, phase);
+            start_scanner(arg);
+            completed = stop_scanner(arg, OPTION(OPT_PAUSE_BUDGET) != 0 ? begin + OPTION(OPT_PAUSE_BUDGET) : 0);
+
+            close(softDirty);
+
+            send_resume_signal(arg);
+            curr = cal_nsclock();
+            //stwStart = curr;
+            sweepCycle.pauseTime = curr - begin;
+            FFPROBE2(pause__end, sweepCycle.pauseTime, completed);
+
+            if (!completed) {
+                // The pause ran over its budget before the marks were
+                // complete. Drop them and retry the cycle on a later period
+                lf_dbg("pause over budget (%zu)", arg->pauseOverruns);
+                scanmap_clear();
+                end_phase(FFPHASE_CLEAR, curr);
+                end_sweep_cycle(SWEEP_ABANDONED, concurrentPass);
+                wait_period(arg);
+                continue;
+            }
+
+            lf_dbg("reclaim");
+            reclaim_large_extents(NULL);
+            phase = end_phase(FFPHASE_LARGE, curr);
+            reclaim_pagepool_handler(NULL);
+            phase = end_phase(FFPHASE_POOLS, phase);
+            lf_dbg("reclaim...done");
+
+#ifdef SUB_PAGE
+            reclaim_subpage(NULL);
+            phase = end_phase(FFPHASE_SUBPAGE, phase);
+#endif
+
+#ifdef PG_POOL
+            reclaim_pagepool(arg);
+#endif
+
+            // Restart the pressure baselines from what this sweep left
+            __sync_fetch_and_sub(&quarantineBytes, quarantined);
+            arg->sweepRss = 0;
+
+            // Before resuming user thread
+            scanmap_clear();
+            end_phase(FFPHASE_CLEAR, phase);
+            end_sweep_cycle(SWEEP_COMPLETED, concurrentPass);
+
+            //
+            wait_period(arg);
+        }
+        else {
+            if (scanOrder > currSmallAlloc) {
+                descent = true;
+            }
+            else {
+                descent = false;
+            }
+
+            prevSmallAlloc[counter] = currSmallAlloc;
+            counter += 1;
+            if (counter > 3600) {
+                counter = 0;
+            }
+
+            wait_period(arg);
+        }
+    }
+
+    return NULL;
+}
+
+
+static volatile size_t initReclaimer = 0;
+int init_reclaim(struct arena_t *arena) {
+    if (!initReclaimer) {
+        initReclaimer = 1;
+
+        reclaimer = &thread_list[empty_thread];
+        reclaimer->id = empty_thread++;
+
+        reclaimer->owner = getpid();
+
+        reclaimer->tid = syscall(SYS_gettid);
+
+        reclaimer->arena = arena;
+
+
+        empty_thread += 1;
+
+        init_stw(reclaimer);
+
+        arenaSweepWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+        decommitWake = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+        // Create multiple threads
+        create_and_stop_scanner(reclaimer);
+        
+        pthread_attr_init(&reclaimer->attr);
+        pthread_attr_setdetachstate(&reclaimer->attr, PTHREAD_CREATE_DETACHED);
+        if (pthread_create(&reclaimer->thread, &reclaimer->attr, reclaim_thread, reclaimer) < 0) {
+            fprintf(stderr, "reclaim: Fail to create a reclaimer\n");
+            exit(4);
+        }
+        pthread_attr_destroy(&reclaimer->attr);
+    }
+    return 0;
+}
+
+void exit_reclaim(void) {
+    // Let an arena sweep in flight finish, later ones are not swept
+    pthread_mutex_lock(&arenaSweepLock);
+    arenaSweepClosed = true;
+    while (arenaSweepKey != 0 && !arenaSweepDone) {
+        pthread_cond_wait(&arenaSweepCond, &arenaSweepLock);
+    }
+    pthread_cond_broadcast(&arenaSweepCond);
+    pthread_mutex_unlock(&arenaSweepLock);
+
+    // Terminate the reclaimer thread directly
+    for (size_t i = 0; i < MAX_THREAD; i++) {
+        if (thread_list[i].id != 0) {
+            pthread_cancel(thread_list[i].thread);
+        }
+    }
+}
+
+#endif // MARK_SWEEP
+
+#ifdef FF_INSTRUMENTED
+// Number of trace records buffered before they are written out
+#define TRACE_BUFFER 4096
+
+// Trace file named by HUSHVAC_TRACE, -1 when not tracing
+static int traceFile = -1;
+
+// Non-zero while an API call runs another one internally, such as realloc
+// allocating the new block, so that only the outer call is recorded
+static int traceDepth;
+
+static fftrace_t traceBuffer[TRACE_BUFFER];
+static size_t traceCount;
+
+static void flush_trace(void) {
+	const char* next = (const char*)traceBuffer;
+	size_t remaining = traceCount * sizeof(fftrace_t);
+
+	while(remaining > 0) {
+		ssize_t written = write(traceFile, next, remaining);
+		if(written < 0) {
+			if(errno == EINTR) {
+				continue;
+			}
+			fprintf(stderr, "Trace write failed, tracing stopped\n");
+			close(traceFile);
+			traceFile = -1;
+			break;
+		}
+		next += written;
+		remaining -= (size_t)written;
+	}
+	traceCount = 0;
+}
+
+// Appends one call to the trace. The instrumented build is single threaded
+// so the buffer needs no lock
+static void trace_call(unsigned int op, size_t size, const void* ptr, const void* result) {
+	if(traceFile < 0 || traceDepth != 0) {
+		return;
+	}
+
+	traceBuffer[traceCount].info = ((unsigned long long)op << 56) | (size & 0x00FFFFFFFFFFFFFFULL);
+	traceBuffer[traceCount].ptr = (unsigned long long)(uintptr_t)ptr;
+	traceBuffer[traceCount].result = (unsigned long long)(uintptr_t)result;
+	if(++traceCount == TRACE_BUFFER) {
+		flush_trace();
+	}
+}
+
+static void init_trace(void) {
+	const char* path = getenv("HUSHVAC_TRACE");
+	if(path == NULL || *path == '\0') {
+		return;
+	}
+
+	traceFile = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+	if(traceFile < 0) {
+		fprintf(stderr, "Unable to open trace file %s\n", path);
+		return;
+	}
+	if(write(traceFile, FFTRACE_MAGIC, 8) != 8) {
+		close(traceFile);
+		traceFile = -1;
+		return;
+	}
+	atexit(flush_trace);
+}
+
+#define trace_enter() (traceDepth++)
+#define trace_leave() (traceDepth--)
+#else
+#define trace_call(op, size, ptr, result)
+#define trace_enter()
+#define trace_leave()
+#endif
+
+// Performs one-time setup of metadata structures
+static void initialize() {
+	isInit = 2;
+
+	// Set up lock that protects modifications to the pool map
+	FFInitializeCriticalSection(&poolTreeLock);
+
+	FFInitializeCriticalSection(&poolAllocLock);
+
+	// Initialize metadata pool locks
+	FFInitializeCriticalSection(&mdPoolLock);
+	for (int i = 0; i < 256; i++) {
+		FFInitializeCriticalSection(&binLocks[i]);
+	}
+	FFInitializeCriticalSection(&mdBinLocks[0]);
+	FFInitializeCriticalSection(&mdBinLocks[1]);
+
+	// The pool map is only touched where pools are, so reserving it for
+	// the whole address space costs no memory beyond those pages
+#ifndef _WIN64
+	poolMap = (struct poolslot_t*)sys_mmap(NULL, POOL_MAP_SLOTS * sizeof(struct poolslot_t), PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	if (poolMap == MAP_FAILED) {
+		abort();
+	}
+#else
+	poolMap = (struct poolslot_t*)VirtualAlloc(NULL, POOL_MAP_SLOTS * sizeof(struct poolslot_t), MEM_RESERVE, PAGE_READWRITE);
+	if (poolMap == NULL) {
+		abort();
+	}
+#endif
+
+#ifdef MARK_SWEEP
+	heapSlots = (uint64_t*)sys_mmap(NULL, POOL_MAP_SLOTS / 8, PROT_READ | PROT_WRITE,
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	if (heapSlots == MAP_FAILED) {
+		abort();
+	}
+
+	init_options();
+
+	FFInitializeCriticalSection(&userThreadLock);
+
+	// Pools reserve their scanmap sub-maps as they're created, so the scanmap
+	// has to be ready before the first arena
+	init_scanmap();
+#endif
+
+#ifndef _WIN64
+	// Find the top of the heap on Linux then add 1GB so that there is
+	// no contention with small mallocs from libc when used side-by-side
+	poolHighWater = (byte*)sbrk(0) + 0x40000000;
+#ifdef MARK_SWEEP
+    poolLowAddr = poolHighWater;
+#endif
+
+	// Create a large contiguous range of virtual address space but don't
+	// actually map the addresses to pages just yet
+	metadataPool = (byte*)sys_mmap(NULL, 1024UL * 1048576UL, PROT_NONE, 
+			MAP_ANONYMOUS | MAP_PRIVATE | MAP_NORESERVE, -1, 0);
+	metadataFree = metadataPool;
+	metadataEnd = metadataPool + POOL_SIZE;
+
+	mprotect(metadataPool, POOL_SIZE, PROT_READ | PROT_WRITE);
+
+#ifndef FFSINGLE_THREADED
+	// Before any metadata is allocated, as that fills the magazines
+	if (pthread_key_create(&magazineKey, retire_magazines) != 0) {
+		abort();
+	}
+#endif
+#else
+	metadataPool = (byte*)VirtualAlloc(NULL, 1024ULL * 1048576ULL, MEM_RESERVE, PAGE_NOACCESS);
+	VirtualAlloc(metadataPool, POOL_SIZE, MEM_COMMIT, PAGE_READWRITE);
+	metadataFree = metadataPool;
+	metadataEnd = metadataPool + POOL_SIZE;
+	poolHighWater = metadataPool + 1024ULL * 1048576ULL + 65536ULL;
+#endif
+
+	// Pools are placed by node from the first one on
+	init_numa();
+
+	// Create the default arena used to handle standard malloc API calls
+	//arenas[0] = (struct arena_t*)ffmetadata_alloc(sizeof(struct arena_t));
+	// Manually allocate initial arena to prevent segfault since ffmetadata_alloc
+	// relies on arenas[0] to be initialized when profiling is enabled
+	arenas[0] = (struct arena_t*)metadataPool;
+	metadataFree += ALIGN_TO(sizeof(struct arena_t), UINT64_C(16));
+#ifdef FF_PROFILE
+	arenas[0]->profile.currentOSBytesMapped = POOL_SIZE;
+#endif
+	if(create_arena(arenas[0]) != FFSUCCESS) {
+		// Bad news, not much to do except quit
+		abort();
+	}
+
+	// Initialize OS threading support
+	init_threading();
+
+#ifdef FF_PROFILE
+	atexit(ffprint_stats_wrapper);
+#ifdef FF_INSTRUMENTED
+	ffprint_usage_on_interval(stderr, FF_INTERVAL);
+	init_trace();
+#endif
+#endif
+
+	isInit = 1;
+
+#ifdef MARK_SWEEP
+    atexit(exit_reclaim);
+    init_reclaim(arenas[0]);
+#endif
+}
+
+// Destroys a page pool returning all memory to the OS
+static void destroy_pool(struct pagepool_t* pool) {
+#ifdef MARK_SWEEP
+    bool isLarge = false;
+
+    // Small and large pools are empty by now. Small and jumbo pools stay on
+    // their lists, mark them released so that the sweep no longer touches
+    // them. The pool stays blocked, so concurrent scanners and the lazy
+    // zeroing keep out of it for good
+    pool_scan_block(pool);
+    pool->startInUse = pool->end;
+#endif
+
+	// Return the pool memory itself
+	if(os_free(pool->start) != 0) {
+		abort();
+	}
+
+	// Return the metadata depending on the pool type
+	if(pool->nextFreeIndex == SIZE_MAX) {
+		// Small pool
+		// The bitmaps live in the page maps, so they go all at once
+		ffpoolmetadata_free(pool->tracking.pageMaps, 1);
+#ifdef MARK_SWEEP
+		// The pool stays on the arena's small pool list, so make sure
+		// the sweep skips it rather than read the freed page maps
+		pool->tracking.pageMaps = NULL;
+#endif
+	}
+	else if(pool->nextFreeIndex == SIZE_MAX - 1) {
+		// Jumbo pool
+		// Nothing else to do here since a jumbo pool has no additional
+		// metadata to clean up
+        
+#ifdef MARK_SWEEP
+        uint64_t start = (uint64_t)pool->start;
+        uint64_t end = (uint64_t)pool->end;
+
+        struct hugelistnode_t *newNode = (struct hugelistnode_t *)ffmetadata_alloc(sizeof(struct hugelistnode_t));
+        newNode->start = start;
+        newNode->end = end;
+        newNode->arenaSerial = pool->arena->serial;
+
+        quarantine_jumbo(newNode, newNode);
+#endif
+
+	    remove_pool_from_tree(pool);
+#ifndef MARK_SWEEP
+	    FFDeleteCriticalSection(&pool->poolLock);
+#endif
+        return;
+	}
+	else {
+		// Large pool
+		ffpoolmetadata_free(pool->tracking.allocations, 0);
+#ifdef MARK_SWEEP
+        isLarge = true;
+#endif
+	}
+
+	remove_pool_from_tree(pool);
+#ifndef MARK_SWEEP
+	FFDeleteCriticalSection(&pool->poolLock);
+#else
+    // The pool stays reachable from its list, and a thread that found it
+    // there or through the pool map may be about to take the lock. Its
+    // lock is only deleted with the pool itself
+#endif
+
+#ifdef MARK_SWEEP
+    if ((pool->end - pool->start) != POOL_SIZE) {
+        return;
+    }
+
+    // Reuse the node of a pool that left the quarantine if there is one
+    struct poollistnode_t *newNode = stack_pop(&spareNodes);
+    if (newNode == NULL) {
+        newNode = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
+    }
+    newNode->pool = (struct pagepool_t *)((uint64_t)pool->start | isLarge);
+
+    quarantine_pool(&pool->arena->quarantinedPools, newNode, newNode);
+#endif
+}
+
+#ifdef MARK_SWEEP
+// Checks whether a pool on an arena's lists is still mapped. Released pools
+// stay on the lists and their range may already belong to another pool
+static inline bool pool_is_live(struct pagepool_t* pool) {
+	return pool != NULL && find_pool_for_ptr(pool->start) == pool;
+}
+
+// Destroys the pools of a list that are still live and leaves the list
+static void release_pool_list(struct poollistnode_t* node) {
+	for(; node != NULL; node = node->next) {
+		if(pool_is_live(node->pool)) {
+			destroy_pool(node->pool);
+		}
+	}
+}
+
+// Moves every live pool of an arena that is being destroyed to the
+// quarantine, so that a sweep can release them at once. The arena must no
+// longer be reachable through the arena array
+static void release_arena_pools(struct arena_t* arena) {
+#ifndef FFSINGLE_THREADED
+	struct threadcache_t* tcache;
+	struct threadcache_t* next;
+
+	// The arena's key goes away with it, so no thread will run the cleanup
+	// of the caches it holds. Retire them here instead
+	pthread_mutex_lock(&tcacheListLock);
+	for(tcache = tcacheList; tcache != NULL; tcache = next) {
+		next = tcache->nextCache;
+		if(tcache->arena == arena) {
+			unlink_tcache(tcache);
+			ffmetadata_free(tcache, sizeof(struct threadcache_t));
+		}
+	}
+	pthread_mutex_unlock(&tcacheListLock);
+#endif
+
+	for(int i = 0; i < MAX_NUMA_NODES; i++) {
+		release_pool_list(arena->smallPoolList[i]);
+	}
+	for(int i = 0; i < MAX_LARGE_LISTS; i++) {
+		release_pool_list(arena->largePoolList[i]);
+		release_pool_list(arena->largePoolListHead[i]);
+	}
+	release_pool_list(arena->jumboPoolList);
+}
+
+// Hands what an arena that is being destroyed still holds for the sweeps
+// over to the default arena
+static void hand_over_quarantine(struct arena_t* arena) {
+	struct poollistnode_t* first;
+	struct poollistnode_t* last;
+	struct extentnode_t* extent;
+
+	// Including what an abandoned pause took
+	take_pool_quarantine(arena);
+	first = arena->sweptPools;
+	last = first;
+	arena->sweptPools = NULL;
+
+	if(first != NULL) {
+		while(last->next != NULL) {
+			last = last->next;
+		}
+		quarantine_pool(&arenas[0]->quarantinedPools, first, last);
+	}
+
+	// The arena's jumbo pools stay on the global quarantine. Their serial
+	// matches no later arena, so only the global sweeps release them
+
+	// The swept extents lie in pools that were just destroyed
+	for(int i = 0; i < MAX_NUMA_NODES; i++) {
+		for(int j = 0; j < LARGE_REUSE_CLASSES; j++) {
+			while((extent = stack_pop_at(&arena->largeReuse[i][j], offsetof(struct extentnode_t, next))) != NULL) {
+				ffmetadata_free(extent, sizeof(struct extentnode_t));
+			}
+		}
+	}
+}
+#endif
+
+// Destroys each pool in a pool list as well as the list itself
+static void destroy_pool_list(struct poollistnode_t* node) {
+	struct poollistnode_t* lastNode;
+
+	while(node != NULL) {
+#ifdef MARK_SWEEP
+		// Pools are kept after they are destroyed and may have been
+		// destroyed already. Their metadata goes with the list
+		if(pool_is_live(node->pool)) {
+			destroy_pool(node->pool);
+		}
+		FFDeleteCriticalSection(&node->pool->poolLock);
+		ffmetadata_free(node->pool, sizeof(struct pagepool_t));
+#else
+		destroy_pool(node->pool);
+#endif
+		lastNode = node;
+		node = node->next;
+		ffmetadata_free(lastNode, sizeof(struct poollistnode_t));
+	}
+}
+
+// Destroys an arena by freeing all pools and associated metadata
+static void destroy_arena(struct arena_t* arena) {
+#ifdef MARK_SWEEP
+	release_arena_pools(arena);
+	hand_over_quarantine(arena);
+	for(int i = 0; i < MAX_LARGE_LISTS; i++) {
+		destroy_pool_list(arena->largePoolListHead[i]);
+	}
+#endif
+	for(int i = 0; i < MAX_NUMA_NODES; i++) {
+		destroy_pool_list(arena->smallPoolList[i]);
+	}
+	destroy_pool_list(arena->jumboPoolList);
+	for(int i = 0; i < MAX_LARGE_LISTS; i++) {
+		if(arena->largePoolList[i] != NULL) {
+			destroy_pool_list(arena->largePoolList[i]);
+		}
+		FFDeleteCriticalSection(&arena->largeListLock[i]);
+	}
+
+	// TODO: When a thread ends before the arena is destroyed, the 
+	// appropriate OS specific handler will clean up its thread cache
+	// Here, we need to find a way to delete any thread caches for
+	// threads that haven't yet exited (but hopefully know not to
+	// allocate from this arena anymore)
+	
+	FFTlsFree(arena->tlsIndex);
+
+	FFDeleteCriticalSection(&arena->smallListLock);
+
+	ffmetadata_free(arena, sizeof(struct arena_t));
+}
+
+
+/*** Search functions ***/
+
+// Helper function to find the page within a pool that a small pointer was 
+// allocated from. On success, the function will return the index within the 
+// page where the pointer is located and pagemap will point to the pointer to
+// the pagemap. The return value will be less than 0 on failure
+static int64_t find_small_ptr(const byte* ptr, const struct pagepool_t* pool, struct pagemap_t** pageMap) {
+	// Find the location in the metadata where the page for this pointer is tracked
+	size_t mapIndex = (ptr - pool->start) / PAGE_SIZE;
+	struct pagemap_t* page = pool->tracking.pageMaps + mapIndex;
+	*pageMap = page;
+
+	// Found the page. Find the allocation's place in the bitmap
+	uint64_t index = (ptr - page->start) / (page->allocSize & ~SEVEN64);
+
+	// Validate that this is a potentially valid address - i.e. not an
+	// address in the middle of an allocation. Trusting compiler optimizations
+	// to not issue two divisions to keep things quick
+	if((ptr - page->start) % (page->allocSize & ~SEVEN64) != 0) {
+		return -2;
+	}
+	
+	// Is the pointer actually allocated?
+	if (!(page->bitmap[index >> 6] & (ONE64 << (index & SIXTYTHREE64)))) {
+		return -1;
+	}
+
+	return index;
+}
+
+// Helper function to find the location within a large allocation pool of a
+// specific allocation. Returns the size of the allocation on success or 0 if
+// the allocation is not found. Also, if the allocation is found then the 
+// index of the allocation in the metadata array is copied to the location 
+// pointed to by metadataIndex
+static size_t find_large_ptr(const byte* ptr, struct pagepool_t* pool, size_t* metadataIndex) {
+	size_t left = 0;
+	size_t right = pool->nextFreeIndex;
+	size_t current = (right - left) / 2;
+
+	// The metadata array is guaranteed to be sorted, so we can treat it like
+	// a binary search tree.
+	while (left != right) {
+		if (pool->tracking.allocations[current] == (uintptr_t)ptr) {
+			if (current == pool->nextFreeIndex) {
+				// The final entry in the metadata is not an actual allocation
+				return 0;
+			}
+			// Found the pointer
+			*metadataIndex = current;
+			return ((pool->tracking.allocations[current + 1] & ~SEVEN64) - pool->tracking.allocations[current]);
+		}
+		else if ((uintptr_t)ptr < pool->tracking.allocations[current]) {
+			// Search left
+			right = current;
+		}
+		else {
+			// Search right
+			left = current + 1;
+		}
+		current = left + ((right - left) / 2);
+	}
+
+	// The allocation was not found
+	return 0;
+}
+
+#ifdef MARK_SWEEP
+// Returns the index of the large pool entry whose extent holds addr, ignoring
+// the flag bits. Addresses at or past entry last return last
+static size_t find_large_extent(const struct pagepool_t* pool, uintptr_t addr, size_t last) {
+	size_t left = 0;
+	size_t right = last;
+
+	while (left < right) {
+		size_t current = left + ((right - left + 1) / 2);
+		if ((pool->tracking.allocations[current] & ~SEVEN64) <= addr) {
+			left = current;
+		}
+		else {
+			right = current - 1;
+		}
+	}
+
+	return left;
+}
+#endif
+
+
+/*** Malloc helper functions ***/
+
+#ifdef MARK_SWEEP
+#ifdef SUB_PAGE
+// Pops the next page off an arena's published reuse list. The list is
+// only rebuilt by the reclaimer, which relinks pages that may still be on
+// the old list. The tag keeps a pop from installing a next pointer it read
+// before the page was relinked
+static struct pagemap_t* take_reuse_page(struct arena_t* arena, size_t reuseBin) {
+    return stack_pop_at(&arena->reuseMapHead[reuseBin], offsetof(struct pagemap_t, next));
+}
+
+// Claims one swept slot on a reuse page, returning NULL once the page
+// has none left or is being released. Candidates are found a word at a
+// time as safe and not allocated and claimed with atomic bit operations,
+// so pages shared between threads are still safe
+static void* claim_reuse_slot(struct pagemap_t* page, size_t size) {
+    uint64_t *bitmap, *safemap;
+    size_t maxAlloc = PAGE_SIZE / size;
+    size_t bitmapCount;
+
+    if (page->reuseCount == 0 || page->allocSize != (size | FOUR64)) {
+        return NULL;
+    }
+
+    bitmap = page->bitmap;
+    safemap = page->safemap;
+    bitmapCount = BITMAP_WORDS(maxAlloc);
+
+    for (size_t word = 0; word < bitmapCount; word++) {
+        uint64_t candidates = safemap[word] & ~bitmap[word];
+        if (word == bitmapCount - 1 && (maxAlloc & SIXTYTHREE64)) {
+            candidates &= (ONE64 << (maxAlloc & SIXTYTHREE64)) - 1;
+        }
+
+        while (candidates != 0) {
+            size_t pos = FFCOUNTTRAILINGZEROS64(candidates);
+            uint64_t bit = ONE64 << pos;
+            candidates &= candidates - 1;
+
+            // Setting the allocated bit first keeps other claims and the
+            // lazy zeroing away from the slot. It is only ours if it is
+            // still safe; only the reclaimer sets safe bits, so a stale
+            // candidate that was claimed and freed again is given back
+            if (FFAtomicFetchOr(bitmap[word], bit) & bit) {
+                continue;
+            }
+            if (!(FFAtomicFetchAnd(safemap[word], ~bit) & bit)) {
+                FFAtomicAnd(bitmap[word], ~bit);
+                continue;
+            }
+            FFAtomicSub(page->reuseCount, 1);
+
+            // A free that emptied the page sets the release flag before
+            // checking the bitmap again, so one of the two always backs off.
+            // If both do, the empty page is simply found by the next sweep
+            if (page->allocSize & ONE64) {
+                FFAtomicAnd(bitmap[word], ~bit);
+                page->reuseCount = 0;
+                return NULL;
+            }
+
+            // The pointer has to be in a register before the stamp. A pause
+            // after the stamp then marks the slot, and the pass after a
+            // pause before it sees the stamp or has its safe bit cleared
+            byte* allocation = page->start + size * ((word << 6) + pos);
+            __asm__ __volatile__("" : : "r"(allocation) : "memory");
+            page->allocGeneration = pauseGeneration;
+            FFAtomicAnd(safemap[word], ~bit);
+
+            if (OPTION(OPT_ZERO_MODE) != ZERO_ON_FREE) {
+                memset(allocation, 0, size);
+            }
+            return allocation;
+        }
+    }
+
+    // Everything listed has been claimed by other threads
+    page->reuseCount = 0;
+    return NULL;
+}
+#endif
+#endif
+
+#ifdef MARK_SWEEP
+#ifdef SUB_PAGE
+// Claims a swept slot from this thread's reuse page, taking another from
+// the arena's published list once it runs out. Returns NULL when the
+// arena has no swept slots of this size left
+static inline void* claim_reuse(struct threadcache_t* tcache, struct arena_t* arena, size_t size) {
+    size_t reuseBin = GET_REUSEBIN(size);
+    while (tcache->reusePage[reuseBin] != NULL || (arena->reuseMapHead[reuseBin] & STACK_PTR_MASK) != 0) {
+        if (tcache->reusePage[reuseBin] == NULL) {
+            tcache->reusePage[reuseBin] = take_reuse_page(arena, reuseBin);
+            if (tcache->reusePage[reuseBin] == NULL) {
+                break;
+            }
+        }
+
+        void * ret = claim_reuse_slot(tcache->reusePage[reuseBin], size);
+        if (ret != NULL) {
+            return ret;
+        }
+        tcache->reusePage[reuseBin] = NULL;
+    }
+
+    return NULL;
+}
+#endif
+#endif
+
+// Flags a bin's page as fully allocated. The last pause's marks don't cover
+// slots handed out after it, so the page is stamped first for the reclaim
+// pass to leave it alone
+static inline void retire_bin_page(struct pagemap_t* page) {
+#if defined(MARK_SWEEP) && defined(SUB_PAGE)
+	page->allocGeneration = pauseGeneration;
+	__sync_synchronize();
+#endif
+	page->allocSize |= 4UL;
+}
+
+// Connects a full or unused bin to a fresh page from the thread cache
+static inline void refill_bin(struct threadcache_t* tcache, struct bin_t* bin) {
+	// Do we have any pages left in the local free page cache?
+	if (tcache->nextUnusedPage >= tcache->endUnusedPage) {
+		// Local cache is empty. Need to go refresh from a page pool
+		assign_pages_to_tcache(tcache);
+	}
+
+	// Connect the bin to the page map
+	bin->page = tcache->nextUnusedPage;
+
+	// Remove the page map from the local free cache
+	tcache->nextUnusedPage++;
+
+	// Update the size record on the page map
+	bin->page->allocSize = bin->allocSize;
+
+	// Reset the allocation pointers for the bin
+	bin->allocCount = 0;
+	bin->nextAlloc = bin->page->start;
+}
+
+// Actual implementation of malloc for small sizes
+static void* ffmalloc_small(size_t size, struct arena_t* arena) {
+	struct bin_t* bin;
+
+	// Get the correct thread cache. By allocating
+	// from a per-thread cache, we don't have to 
+	// acquire and release locks 
+	struct threadcache_t* tcache = get_threadcache(arena);
+
+	// Select the correct bin based on size and alignment
+	size_t binIndex = GET_BIN(size);
+	bin = &tcache->bins[binIndex];
+
+#ifdef FF_PROFILE
+	bin->totalAllocCount++;
+#endif
+#ifdef MARK_SWEEP
+	tcache->stats.mallocCount[binIndex]++;
+#endif
+
+#ifdef MARK_SWEEP
+#ifdef SUB_PAGE
+    // -- SMALL REUSE
+    void * ret = claim_reuse(tcache, arena, bin->allocSize);
+    if (ret != NULL) {
+        return ret;
+    }
+    // -- SMALL REUSE
+#endif
+#endif
+
+	// If the bin is full or first allocation then get a new page
+	if (bin->allocCount == bin->maxAlloc) {
+		refill_bin(tcache, bin);
+	}
+
+	// Mark the next allocation on the page as in use on the bitmap. 
+	// Must use atomic operations to mark the bitmap because even though this is
+	// the only cache that can allocate from here, any thread could be freeing a
+	// previous allocation
+	FFAtomicOr(bin->page->bitmap[bin->allocCount >> 6], (ONE64 << (bin->allocCount & SIXTYTHREE64)));
+
+	// Save pointer to allocation. Advance bin to next allocation
+	byte* thisAlloc = bin->nextAlloc;
+	bin->nextAlloc += bin->allocSize;
+	bin->allocCount++;
+
+	// Mark the page as full if so
+	if (bin->allocCount == bin->maxAlloc) {
+		retire_bin_page(bin->page);
+	}
+
+#ifdef FF_PROFILE
+	// Final statistics update
+	FFAtomicAdd(arena->profile.totalBytesAllocated, bin->allocSize);
+	FFAtomicAdd(arena->profile.currentBytesAllocated, bin->allocSize);
+	// TODO: thread safe update
+	if (arena->profile.currentBytesAllocated > arena->profile.maxBytesAllocated)
+		arena->profile.maxBytesAllocated = arena->profile.currentBytesAllocated;
+#endif
+
+	// Return successfully allocated buffer
+	return thisAlloc;
+}
+
+// Batch version of ffmalloc_small. Swept slots are claimed first, one at a
+// time as usual, then the rest are carved from the bin's page as runs of
+// consecutive slots so that each bitmap word is updated once per run
+static void ffmalloc_small_batch(size_t size, struct arena_t* arena, size_t count, void** out) {
+	struct threadcache_t* tcache = get_threadcache(arena);
+	size_t binIndex = GET_BIN(size);
+	struct bin_t* bin = &tcache->bins[binIndex];
+	size_t done = 0;
+
+#ifdef FF_PROFILE
+	bin->totalAllocCount += count;
+#endif
+#ifdef MARK_SWEEP
+	tcache->stats.mallocCount[binIndex] += count;
+#endif
+
+#ifdef MARK_SWEEP
+#ifdef SUB_PAGE
+    while (done < count) {
+        void * ret = claim_reuse(tcache, arena, bin->allocSize);
+        if (ret == NULL) {
+            break;
+        }
+        out[done++] = ret;
+    }
+#endif
+#endif
+
+	while (done < count) {
+		if (bin->allocCount == bin->maxAlloc) {
+			refill_bin(tcache, bin);
+		}
+
+		size_t first = bin->allocCount;
+		size_t last = bin->maxAlloc;
+		if (last - first > count - done) {
+			last = first + (count - done);
+		}
+
+		// Mark the run in use a bitmap word at a time. Frees of earlier
+		// allocations on the page can still race us, so stay atomic
+		for (size_t slot = first; slot < last; ) {
+			size_t wordEnd = (slot | SIXTYTHREE64) + 1;
+			size_t end = wordEnd < last ? wordEnd : last;
+			uint64_t bits = end - slot == 64 ? UINT64_MAX : ((ONE64 << (end - slot)) - 1) << (slot & SIXTYTHREE64);
+			FFAtomicOr(bin->page->bitmap[slot >> 6], bits);
+			slot = end;
+		}
+
+		for (size_t slot = first; slot < last; slot++) {
+			out[done++] = bin->nextAlloc;
+			bin->nextAlloc += bin->allocSize;
+		}
+		bin->allocCount = last;
+
+		if (bin->allocCount == bin->maxAlloc) {
+			retire_bin_page(bin->page);
+		}
+	}
+
+#ifdef FF_PROFILE
+	FFAtomicAdd(arena->profile.totalBytesAllocated, bin->allocSize * count);
+	FFAtomicAdd(arena->profile.currentBytesAllocated, bin->allocSize * count);
+	if (arena->profile.currentBytesAllocated > arena->profile.maxBytesAllocated)
+		arena->profile.maxBytesAllocated = arena->profile.currentBytesAllocated;
+#endif
+}
+
+// Helper to actually implement a large allocation from a specific pool
+// Note: caller is responsible for acquiring/releasing pool lock if needed
+// before calling this function
+static inline void* ffmalloc_large_from_pool(size_t size, size_t alignment, struct pagepool_t* pool) {
+	uintptr_t alignedNext = ALIGN_TO((uintptr_t)pool->nextFreePage, alignment);
+
+	// Record the metadata
+	// For a standard 8 or 16 byte allignment we just record the address of
+	// the next allocation to the end of the list. This allocation was already
+	// recorded on the previous call. The reason is that size is stored 
+	// implicitly as the difference between consecutive pointers therefore,
+	// for N allocations we need N+1 pointers in the metadata.
+	// When the alignment is greater than 8/16, the returned pointer could
+	// be greater than what was recorded last time so we also have to 
+	// update that pointer - effectively growing the previous allocation.
+	// The alternative would be to create and immediately mark free the
+	// little spacer allocation in between but there isn't any obvious
+	// benefit to doing so
+#ifdef FF_PROFILE
+	FFAtomicAdd(pool->arena->profile.totalBytesAllocated, size + ((byte*)alignedNext - pool->nextFreePage));
+	FFAtomicAdd(pool->arena->profile.currentBytesAllocated, size + ((byte*)alignedNext - pool->nextFreePage));
+	if(pool->arena->profile.currentBytesAllocated > pool->arena->profile.maxBytesAllocated) {
+		// TODO: need thread safe update here
+		pool->arena->profile.maxBytesAllocated = pool->arena->profile.currentBytesAllocated;
+	}
+#endif
+	pool->nextFreePage = ((byte*)alignedNext + size);
+	if(alignment > MIN_ALIGNMENT) {
+		pool->tracking.allocations[pool->nextFreeIndex] = alignedNext;
+	}
+	pool->tracking.allocations[++pool->nextFreeIndex] = (uintptr_t)pool->nextFreePage;
+
+	// If there is less than the minimum large size allocation left, then 
+	// change the last metadata entry so that this allocation gets the remaining
+	// space
+	if (pool->end - pool->nextFreePage < (ptrdiff_t)(HALF_PAGE + MIN_ALIGNMENT)) {
+#ifdef FF_PROFILE
+		FFAtomicAdd(pool->arena->profile.currentBytesAllocated, pool->end - pool->nextFreePage);
+		FFAtomicAdd(pool->arena->profile.totalBytesAllocated, pool->end - pool->nextFreePage);
+#endif
+		pool->tracking.allocations[pool->nextFreeIndex] = (uintptr_t)pool->end;
+		pool->nextFreePage = pool->end;
+	}
+
+	// Return the allocation
+	return (void*)alignedNext;
+}
+
+
+// Release any remaining unallocated space in the pool when the pool is being
+// removed from the active allocation list. The pool may be destroyed if all
+// allocations have also already been freed
+static inline void trim_large_pool(struct pagepool_t* pool) {
+	size_t remainingSize = 0;
+	bool empty;
+
+	// Threads that found the pool on the list before it was removed may
+	// still be allocating from it, so the slack is claimed under the lock
+	FFEnterCriticalSection(&pool->poolLock);
+	if(pool->tracking.allocations[pool->nextFreeIndex] < (uintptr_t)pool->end) {
+		remainingSize = (uintptr_t)pool->end - pool->tracking.allocations[pool->nextFreeIndex];
+#ifdef FF_PROFILE
+		// Must update counter here because it will be decremented
+		// inside call to free
+		FFAtomicAdd(pool->arena->profile.currentBytesAllocated, remainingSize);
+#endif
+		// Mark the balance of free space as a single allocation
+		pool->nextFreeIndex++;
+		pool->tracking.allocations[pool->nextFreeIndex] = (uintptr_t)pool->end;
+		pool->nextFreePage = pool->end;
+	}
+	FFLeaveCriticalSection(&pool->poolLock);
+
+	// Release the slack
+	if (remainingSize != 0) {
+		free_large_pointer(pool, pool->nextFreeIndex - 1, remainingSize);
+	}
+
+	// Mark the pool as no longer being allocated from. A later free destroys
+	// the pool once it is empty, so it's only destroyed here if it already is
+	FFEnterCriticalSection(&pool->poolLock);
+	pool->tracking.allocations[pool->nextFreeIndex] |= FOUR64;
+	empty = (pool->startInUse >= pool->endInUse);
+	FFLeaveCriticalSection(&pool->poolLock);
+
+	// Destroy the pool if completely released
+	if(empty) {
+		destroy_pool(pool);
+	}
+}
+
+#ifdef MARK_SWEEP
+// Pops a swept extent of at least size bytes, or returns NULL. Extents on
+// listNode come first, then those of the other nodes
+static byte* take_reused_extent(struct arena_t* arena, size_t size, unsigned int listNode) {
+	const size_t sizeClass = large_reuse_class(size);
+	const size_t nextOffset = offsetof(struct extentnode_t, next);
+	struct extentnode_t* extent;
+	uint64_t volatile* classes;
+	byte* start;
+
+	for (unsigned int i = 0; i < numaNodeCount; i++) {
+		classes = arena->largeReuse[(listNode + i) % numaNodeCount];
+
+		// Only a request too close to the pool size to be rounded up can be
+		// larger than an extent of its own class, put one that is back
+		extent = stack_pop_at(&classes[sizeClass], nextOffset);
+		if (extent != NULL && (size_t)(extent->end - extent->start) < size) {
+			stack_push_at(&classes[sizeClass], extent, nextOffset);
+			extent = NULL;
+		}
+		if (extent == NULL && sizeClass + 1 < LARGE_REUSE_CLASSES) {
+			extent = stack_pop_at(&classes[sizeClass + 1], nextOffset);
+		}
+
+		if (extent != NULL) {
+			start = extent->start;
+			ffmetadata_free(extent, sizeof(struct extentnode_t));
+			return start;
+		}
+	}
+
+	return NULL;
+}
+#endif
+
+// Finds a suitable large pool to allocate from, or creates a new pool 
+// if neccessary
+static void* ffmalloc_large(size_t size, size_t alignment, struct arena_t* arena) {
+	struct poollistnode_t* node;
+	struct poollistnode_t* tailNode;
+	struct pagepool_t* pool = NULL;
+	byte* alignedNext;
+	unsigned int loopCount = 0;
+	const unsigned int listId = get_large_list_index();
+
+#ifdef MARK_SWEEP
+	note_user_thread();
+
+	// A rounded request fits any extent listed under its class, and frees
+	// an extent that a later request of the same class fits in turn
+	if (OPTION(OPT_LARGE_REUSE) && (size >> LARGE_REUSE_SHIFT) != 0 && large_reuse_size(size) < POOL_SIZE - HALF_PAGE) {
+		size = large_reuse_size(size);
+	}
+	count_large_malloc(arena, size);
+
+	// Swept extents are already in a pool's metadata and zeroed, so one can
+	// be returned as is. They are only MIN_ALIGNMENT aligned
+	if (alignment <= MIN_ALIGNMENT && OPTION(OPT_LARGE_REUSE)) {
+		alignedNext = take_reused_extent(arena, size, get_large_list_node(listId));
+		if (alignedNext != NULL) {
+			return alignedNext;
+		}
+	}
+#endif
+
+	node = arena->largePoolList[listId];
+	tailNode = node;
+
+	// Loop through the large pools assigned to this processor looking for one
+	// that has space. There may be pools on other CPUs that would be a better
+	// fit but we don't check those
+	while (node != NULL) {
+		pool = node->pool;
+		alignedNext = (byte*)ALIGN_TO((uintptr_t)pool->nextFreePage, alignment);
+		if (alignedNext + size > pool->end) {
+			// No space in this pool, advance to the next one
+			tailNode = node;
+			node = node->next;
+			loopCount++;
+		}
+		else {
+			// Space available allocate from here if possible
+#ifdef FFSINGLE_THREADED
+			return ffmalloc_large_from_pool(size, alignment, pool);
+#else
+			FFEnterCriticalSection(&pool->poolLock);
+			void* allocation;
+
+			// Since we don't lock before checking the size (to avoid a lock pileup)
+			// we have to check the size again here inside the lock to make sure that
+			// there is still space available
+			alignedNext = (byte*)ALIGN_TO((uintptr_t)pool->nextFreePage, alignment);
+			if (alignedNext + size <= pool->end) {
+				allocation = ffmalloc_large_from_pool(size, alignment, pool);
+				FFLeaveCriticalSection(&pool->poolLock);
+				return allocation;
+			}
+			else {
+				// Lost the race, try the next bin
+				node = node->next;
+			}
+			FFLeaveCriticalSection(&pool->poolLock);
+#endif
+		}
+	}
+
+	// None of the current pools on this CPU have space
+	FFEnterCriticalSection(&arena->largeListLock[listId]);
+
+	// While waiting for the lock, was a new pool created? The tail seen above
+	// can't be trusted: another thread may have retired it to the head list
+	// since, so walk the list again now that it can't change
+	node = arena->largePoolList[listId];
+	while (node->next != NULL) {
+		node = node->next;
+	}
+	if (node != tailNode) {
+		tailNode = node;
+		pool = tailNode->pool;
+		FFEnterCriticalSection(&pool->poolLock);
+		alignedNext = (byte*)ALIGN_TO((uintptr_t)pool->nextFreePage, alignment);
+
+		// Does the new pool have enough space to service this request? If so,
+		// allocate and be done
+		if (alignedNext + size <= pool->end) {
+			void* allocation = ffmalloc_large_from_pool(size, alignment, pool);
+			FFLeaveCriticalSection(&pool->poolLock);
+			FFLeaveCriticalSection(&arena->largeListLock[listId]);
+			return allocation;
+		}
+		FFLeaveCriticalSection(&pool->poolLock);
+	}
+
+	// If we get here, either we entered the lock straight away or another pool
+	// was created while waiting for the lock, but we must have been in the back
+	// of the line because its already too small. Either way, create a new large
+	// allocation pool
+	pool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
+	if (pool == NULL) {
+		fprintf(stderr, "Out of metadata space creating large pool\n");
+		FFLeaveCriticalSection(&arena->largeListLock[listId]);
+		return NULL;
+	}
+	pool->arena = arena;
+	pool->node = get_large_list_node(listId);
+	if (create_largepagepool(pool) == -1) {
+		// Maybe there is a way to recover here, but for the moment
+		// the caller is just all out of luck
+		ffmetadata_free(pool, sizeof(struct pagepool_t));
+		FFLeaveCriticalSection(&arena->largeListLock[listId]);
+		return NULL;
+	}
+
+	// Pool creation successful so add it to the tree for later pointer lookup
+	add_pool_to_tree(pool);
+
+	// Finally allocate the block requested 
+	// No need for locks here because nobody else can see this until
+	// it's added to the list
+	void* allocation = ffmalloc_large_from_pool(size, alignment, pool);
+
+	node = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
+	node->pool = pool;
+#ifdef MARK_SWEEP
+    node->next = NULL;
+#endif
+
+	tailNode->next = node;
+
+	if (loopCount >= MAX_POOLS_PER_LIST) {
+		node = arena->largePoolList[listId];
+#ifdef MARK_SWEEP
+		arena->largePoolRetiring[listId] = node;
+#endif
+		arena->largePoolList[listId] = arena->largePoolList[listId]->next;
+		trim_large_pool(node->pool);
+		// TODO: Pool needs to be held onto for destroy arena. Save it where?
+
+#ifdef MARK_SWEEP
+        // Linked before it is published, so a walk of the head list never
+        // follows it back into the active one
+        node->next = arena->largePoolListHead[listId];
+        arena->largePoolListHead[listId] = node;
+        arena->largePoolRetiring[listId] = NULL;
+#endif
+	}
+	FFLeaveCriticalSection(&arena->largeListLock[listId]);
+
+	return allocation;
+}
+
+// Helper function to allocate larger than POOL_SIZE requests
+static void* ffmalloc_jumbo(size_t size, struct arena_t* arena) {
+#ifdef MARK_SWEEP
+	note_user_thread();
+#endif
+
+	// A larger than POOL_SIZE request will require its own oddly sized pool
+	// Start by creating the pool object
+	struct pagepool_t* jumboPool = (struct pagepool_t*)ffmetadata_alloc(sizeof(struct pagepool_t));
+
+	if(jumboPool == NULL) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	struct poollistnode_t* newNode = (struct poollistnode_t*)ffmetadata_alloc(sizeof(struct poollistnode_t));
+	if(newNode == NULL) {
+		ffmetadata_free(jumboPool, sizeof(struct pagepool_t));
+		errno = ENOMEM;
+		return NULL;
+	}
+	
+	// Connect page to caller's arena and initialize
+	jumboPool->arena = arena;
+	jumboPool->node = get_numa_node();
+	if(create_jumbopool(jumboPool, size) == -1) {
+		ffmetadata_free(jumboPool, sizeof(struct pagepool_t));
+		ffmetadata_free(newNode, sizeof(struct poollistnode_t));
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	// Record the pool in the global pool tree
+	add_pool_to_tree(jumboPool);
+
+	// Add to the list of jumbo pools in this arena
+	newNode->pool = jumboPool;
+#ifdef FFSINGLE_THREADED
+	newNode->next = arena->jumboPoolList;
+	arena->jumboPoolList = newNode;
+#else
+	struct poollistnode_t* currenthead;
+	do {
+		currenthead = arena->jumboPoolList;
+		newNode->next = currenthead;
+	} while (!FFAtomicCompareExchangePtr(&arena->jumboPoolList, newNode, currenthead));
+#endif
+
+#ifdef MARK_SWEEP
+	count_large_malloc(arena, (size_t)(jumboPool->end - jumboPool->start));
+#endif
+
+	// Return the start of the pool as the new allocation
+	return jumboPool->start;
+}
+
+#ifndef _WIN64
+// Grows a jumbo pool to size bytes, a multiple of the page size, without
+// copying. A pool that ends at the high water mark is extended in place,
+// others are moved to fresh address space. The old range of a moved pool
+// stays reserved without access and waits in the quarantine like a freed
+// jumbo pool. Returns false when the caller has to copy instead
+static bool grow_jumbo(struct pagepool_t* pool, size_t size) {
+	byte* oldStart = pool->start;
+	size_t oldSize = (size_t)(pool->end - pool->start);
+	byte* newStart = oldStart;
+	sigset_t blocked;
+	sigset_t saved;
+
+	// Nothing is mapped past the high water mark, so claiming the addresses
+	// after the pool there should let the kernel extend the mapping
+	if (pool->end != poolHighWater || !FFAtomicCompareExchangePtr(&poolHighWater, oldStart + size, pool->end)) {
+		newStart = (byte*)os_alloc_highwater(size, pool->node);
+		if (newStart == MAP_FAILED) {
+			return false;
+		}
+	}
+#ifdef MARK_SWEEP
+	scanmap_reserve(newStart, newStart + size);
+
+	// The stop signal is held off so that a pause can't find the pool half
+	// moved, and concurrent scanners are kept out as for a release
+	sigemptyset(&blocked);
+	sigaddset(&blocked, SIGUSR1);
+	pthread_sigmask(SIG_BLOCK, &blocked, &saved);
+	pool_scan_block(pool);
+#endif
+
+	if (newStart != oldStart || mremap(oldStart, oldSize, size, 0) == MAP_FAILED) {
+		if (newStart == oldStart) {
+			// Something else was mapped after the pool after all
+			newStart = (byte*)os_alloc_highwater(size, pool->node);
+#ifdef MARK_SWEEP
+			if (newStart != MAP_FAILED) {
+				scanmap_reserve(newStart, newStart + size);
+			}
+#endif
+		}
+		if (newStart == MAP_FAILED || mremap(oldStart, oldSize, size, MREMAP_MAYMOVE | MREMAP_FIXED, newStart) == MAP_FAILED) {
+#ifdef MARK_SWEEP
+			pool_scan_unblock(pool);
+			pthread_sigmask(SIG_SETMASK, &saved, NULL);
+#endif
+			if (newStart != MAP_FAILED) {
+				sys_munmap(newStart, size);
+			}
+			return false;
+		}
+	}
+
+	remove_pool_from_tree(pool);
+	pool->start = newStart;
+	pool->end = newStart + size;
+	pool->startInUse = pool->start;
+	pool->endInUse = pool->end;
+	add_pool_to_tree(pool);
+
+#ifdef MARK_SWEEP
+	// A moved mapping loses its userfaultfd registration
+	pool->wpTracked = false;
+	pool_scan_unblock(pool);
+	pthread_sigmask(SIG_SETMASK, &saved, NULL);
+	count_large_malloc(pool->arena, size - oldSize);
+#endif
+#ifdef FF_PROFILE
+	FFAtomicAdd(pool->arena->profile.currentBytesAllocated, size - oldSize);
+	FFAtomicAdd(pool->arena->profile.totalBytesAllocated, size - oldSize);
+	FFAtomicAdd(pool->arena->profile.currentOSBytesMapped, size - oldSize);
+#endif
+
+	if (newStart != oldStart) {
+		// Keep the old addresses from being handed out by the kernel. Should
+		// another mapping have taken them already, there's nothing to hold
+		if (sys_mmap(oldStart, oldSize, PROT_NONE, MAP_PRIVATE | MAP_ANONYMOUS | MAP_FIXED_NOREPLACE, -1, 0) != MAP_FAILED) {
+#ifdef MARK_SWEEP
+			struct hugelistnode_t *node = (struct hugelistnode_t *)ffmetadata_alloc(sizeof(struct hugelistnode_t));
+			if (node != NULL) {
+				node->start = (uint64_t)oldStart;
+				node->end = (uint64_t)oldStart + oldSize;
+				node->arenaSerial = pool->arena->serial;
+				quarantine_jumbo(node, node);
+			}
+#endif
+		}
+	}
+
+	return true;
+}
+#endif
+
+
+/*** Free helper functions ***/
+
+// Helper function to return a small pool page back to the OS
+static void free_page(struct pagepool_t* pool, struct pagemap_t* pageMap) {
+	byte* startAddress = pageMap->start;
+	byte* endAddress = startAddress + PAGE_SIZE;
+	unsigned int leftIsFreed = 0;
+	unsigned int rightIsFreed = 0;
+	struct pagemap_t* currentPage = pageMap;
+	struct pagemap_t* leftmostPage = pageMap;
+	struct pagemap_t* rightmostPage = pageMap;
+
+	FFEnterCriticalSection(&pool->poolLock);
+
+	// Check earlier pages to see if they are also unused but not yet returned
+	// to the OS. Stop when the beginning of the pool, an in use page, or a
+	// released page is reached
+	while (startAddress > pool->start) {
+		currentPage--;
+		if ((currentPage->allocSize & SEVEN64) == 5) {
+			// Page is no longer actively being allocated from, all allocations
+			// have been freed, but page has not been returned to OS
+			startAddress -= PAGE_SIZE;
+			leftmostPage = currentPage;
+		}
+		else if((currentPage->allocSize & SEVEN64) == 7) {
+			// Page has been returned to the OS
+			leftIsFreed++;
+			break;
+		}
+		else {
+			break;
+		}
+	}
+
+	if (startAddress == pool->start) {
+		leftIsFreed++;
+	}
+
+	// Same as above, except now check following pages
+	currentPage = pageMap;
+	while (endAddress < pool->end) {
+		currentPage++;
+		if ((currentPage->allocSize & SEVEN64) == 5) {
+			// Page is no longer actively being allocated from, all allocations
+			// have been freed, but page has not been returned to OS
+			endAddress += PAGE_SIZE;
+			rightmostPage = currentPage;
+		}
+		else if ((currentPage->allocSize & SEVEN64) == 7) {
+			// Page has been returned to the OS
+			rightIsFreed++;
+			break;
+		}
+		else {
+			break;
+		}
+	}
+
+	if (endAddress == pool->end) {
+		rightIsFreed++;
+	}
+
+	// Check if the computed range of pages meets either the minimum size 
+	// threshold or if the range constitutes an "island" connecting two
+	// freed regions. If so, then return the pages to the OS
+	if ((endAddress - startAddress >= (ptrdiff_t)(PAGE_SIZE * MIN_PAGES_TO_FREE)) || (leftIsFreed != 0 && rightIsFreed != 0)) {
+		if(decommit_range(pool, startAddress, endAddress) == FALSE) {
+			if(errno == ENOMEM) {
+				// Likely out of VMAs. Don't die here - continue on in the hopes that
+				// more frees will allow VMAs to retire completely
+				FFLeaveCriticalSection(&pool->poolLock);
+				return;
+			}
+			fprintf(stderr, "Error: %d Couldn't unmap %p to %p\n", errno, startAddress, endAddress);
+			fflush(stderr);
+			abort();
+		}
+#ifdef FF_PROFILE
+		FFAtomicSub(pool->arena->profile.currentOSBytesMapped, endAddress - startAddress);
+#endif
+
+		// Mark all of the pages as returned to the OS
+		for (currentPage = leftmostPage; currentPage <= rightmostPage; currentPage++) {
+			currentPage->allocSize |= 2UL;
+		}
+
+		// Update the "in use" pointers which measure the earliest and latest address
+		// not yet freed in the pool. When those meet or cross then the whole pool is
+		// completely freed and its metadata data can be freed
+		if (startAddress <= pool->startInUse) {
+			for (currentPage = rightmostPage; ((currentPage->allocSize & TWO64) != 0) && (currentPage->start < pool->endInUse) && (currentPage->start + PAGE_SIZE < pool->end); currentPage++) {
+			}
+			if (currentPage->start > pool->start) {
+				pool->startInUse = currentPage->start;
+			}
+		}
+		if (endAddress >= pool->endInUse) {
+			for (currentPage = leftmostPage; ((currentPage->allocSize & TWO64) != 0) && currentPage->start >= pool->startInUse && (currentPage->start > pool->start); currentPage--) {
+				if (currentPage->start > pool->start) {
+					if ((currentPage - 1)->start == NULL) {
+						currentPage--;
+						break;
+					}
+				}
+			}
+			// A page map only gets its start once the thread cache it was handed
+			// to fills it in, so take the address from the page map's position.
+			// Such a page is about to be used and must stay in use
+			pool->endInUse = pool->start + (currentPage - pool->tracking.pageMaps + 1) * PAGE_SIZE;
+		}
+		if (pool->startInUse >= pool->endInUse) {
+			// All space in the pool has been allocated and subsequently freed. Destroy
+			// this pool to free up metadata resources
+			FFLeaveCriticalSection(&pool->poolLock);
+			destroy_pool(pool);
+			return;
+		}
+	}
+	FFLeaveCriticalSection(&pool->poolLock);
+}
+
+#ifdef SUB_PAGE
+// Releases a page whose allocations all appear freed. A reuse claim can
+// race the free that emptied it, so the release flag is set first and
+// the bitmap checked again. Claims set their bit before checking the
+// flag, so at least one side sees the other and backs off
+static void release_swept_page(struct pagepool_t* pool, struct pagemap_t* pageMap, size_t bitmaps) {
+	if (FFAtomicFetchOr(pageMap->allocSize, ONE64) & ONE64) {
+		// Another free is already releasing the page
+		return;
+	}
+
+	for (size_t i = 0; i < bitmaps; i++) {
+		if (FFAtomicAdd(pageMap->bitmap[i], 0) != 0) {
+			FFAtomicAnd(pageMap->allocSize, ~ONE64);
+			return;
+		}
+	}
+
+	free_page(pool, pageMap);
+}
+#endif
+
+// Accounts for a small allocation about to be marked freed
+static inline void retire_small_slot(struct pagepool_t* pool, struct pagemap_t* pageMap, size_t index) {
+#ifdef FF_PROFILE
+	FFAtomicSub(pool->arena->profile.currentBytesAllocated, (pageMap->allocSize & ~SEVEN64));
+#endif
+#ifdef MARK_SWEEP
+	size_t allocSize = pageMap->allocSize & ~SEVEN64;
+	quarantine_add(allocSize);
+	count_free(pool->arena, GET_BIN(allocSize), allocSize);
+	if (OPTION(OPT_ZERO_MODE) == ZERO_ON_FREE) {
+		memset(pageMap->start + index * allocSize, 0, allocSize);
+	}
+#endif
+}
+
+// Releases a full page to the OS once frees have left it empty
+static inline void release_if_empty(struct pagepool_t* pool, struct pagemap_t* pageMap) {
+	if (pageMap->allocSize & 4UL) {
+		uint64_t result = 0;
+		size_t bitmaps = BITMAP_WORDS(PAGE_SIZE / (pageMap->allocSize & ~SEVEN64));
+		for (size_t i = 0; i < bitmaps; i++) {
+			result |= pageMap->bitmap[i];
+		}
+
+		if (result == 0) {
+			// All allocations are now freed
+			// Mark page as ready to be released
+#ifdef SUB_PAGE
+			release_swept_page(pool, pageMap, bitmaps);
+#else
+			pageMap->allocSize |= 1;
+			free_page(pool, pageMap);
+#endif
+		}
+	}
+}
+
+// Helper function to mark a small allocation freed
+static inline void free_small_ptr(struct pagepool_t* pool, struct pagemap_t* pageMap, size_t index) {
+	retire_small_slot(pool, pageMap, index);
+#ifdef SUB_PAGE
+    mark_page_dirty(pool, pageMap);
+#endif
+	// Clear the "allocated" flag
+	FFAtomicAnd(pageMap->bitmap[index >> 6], ~(ONE64 << (index & SIXTYTHREE64)));
+
+	// Check if the page can be released to the OS
+	release_if_empty(pool, pageMap);
+}
+
+// Marks a set of small allocations on one page freed. The slots are given
+// as a bitmap so each word is cleared once and the page is only checked
+// for release after the last of them
+static void free_small_run(struct pagepool_t* pool, struct pagemap_t* pageMap, const uint64_t* freed) {
+#ifdef SUB_PAGE
+    mark_page_dirty(pool, pageMap);
+#endif
+	for (size_t i = 0; i < PAGE_BITMAP_WORDS; i++) {
+		if (freed[i] != 0) {
+			FFAtomicAnd(pageMap->bitmap[i], ~freed[i]);
+		}
+	}
+
+	release_if_empty(pool, pageMap);
+}
+
+#ifdef MARK_SWEEP
+// Pushes a freed large extent for a later sweep to look at
+static void defer_large_extent(struct pagepool_t *pool, size_t index) {
+    struct extentnode_t *node = (struct extentnode_t *)ffmetadata_alloc(sizeof(struct extentnode_t));
+    struct extentnode_t *old;
+
+    // Without a node the extent is only released with its pool
+    if (node == NULL) {
+        return;
+    }
+
+    node->start = (byte *)(pool->tracking.allocations[index] & ~SEVEN64);
+    node->serial = pool->serial;
+    do {
+        old = freedExtents;
+        node->next = old;
+    } while (!__sync_bool_compare_and_swap(&freedExtents, old, node));
+}
+#endif
+
+// Helper function that frees a large pointer
+// A partially unmapped allocation may be smaller than a page, so the rest of
+// the page it shares with the allocations being freed can still hold a live
+// one. Returns whether everything from the start of the page up to the
+// allocation at index has been freed
+static bool large_page_free_before(const struct pagepool_t* pool, size_t index) {
+	const uintptr_t pageStart = (pool->tracking.allocations[index] & ~SEVEN64) & ~(PAGE_SIZE - 1);
+
+	while (index > 0) {
+		index--;
+		if ((pool->tracking.allocations[index] & ONE64) == 0) {
+			return false;
+		}
+		if ((pool->tracking.allocations[index] & ~SEVEN64) <= pageStart) {
+			return true;
+		}
+	}
+	return true;
+}
+
+// Returns whether everything from the allocation at index to the end of its
+// starting page has been freed
+static bool large_page_free_after(const struct pagepool_t* pool, size_t index) {
+	const uintptr_t pageEnd = ((pool->tracking.allocations[index] & ~SEVEN64) + PAGE_SIZE) & ~(PAGE_SIZE - 1);
+
+	for (; index < pool->nextFreeIndex; index++) {
+		if ((pool->tracking.allocations[index] & ONE64) == 0) {
+			return false;
+		}
+		if ((pool->tracking.allocations[index + 1] & ~SEVEN64) >= pageEnd) {
+			return true;
+		}
+	}
+	return (pool->tracking.allocations[index] & ~SEVEN64) >= (uintptr_t)pool->end;
+}
+
+static void free_large_pointer(struct pagepool_t* pool, size_t index, size_t size) {
+	size_t firstFreeIndex;
+	size_t lastFreeIndex;
+
+	// Lock this pool while the free happens
+	FFEnterCriticalSection(&pool->poolLock);
+
+	// Mark the allocation as freed in the metadata
+	pool->tracking.allocations[index] |= ONE64;
+
+#ifdef FF_PROFILE
+	FFAtomicSub(pool->arena->profile.currentBytesAllocated, size);
+#endif
+#ifdef MARK_SWEEP
+	quarantine_add(size);
+	count_free(pool->arena, LARGE_STAT_CLASS, size);
+	if (OPTION(OPT_LARGE_REUSE) && (size >> LARGE_REUSE_SHIFT) != 0) {
+		defer_large_extent(pool, index);
+	}
+#endif
+	// Start searching for the start of the contiguous free region. The search ends when
+	// the beginning of the list is reached, an in use block is found, or a block that
+	// has already at least partially been unmapped
+	firstFreeIndex = index;
+	while ((firstFreeIndex > 0) && ((pool->tracking.allocations[firstFreeIndex - 1] & THREE64) == 1)) {
+		firstFreeIndex--;
+	}
+
+	unsigned int leftIsFreed = 0;
+	unsigned int rightIsFreed = 0;
+
+	// This is potentially the location to start unmapping from. However, it might need to
+	// be adjusted forward or backwards depending on what the previous block was marked as
+	uintptr_t startFreeAddr = (pool->tracking.allocations[firstFreeIndex] & ~THREE64);
+	if ((startFreeAddr & (PAGE_SIZE - 1)) != 0) {
+		if ((pool->tracking.allocations[firstFreeIndex - 1] & TWO64) != 0 && large_page_free_before(pool, firstFreeIndex)) {
+			// The previous allocation has been at least partially unmapped
+			// but there is still the remaining bit in this page. So, adjust
+			// the start address backwards to the start of this frame
+			startFreeAddr = (startFreeAddr & ~(PAGE_SIZE - 1));
+			leftIsFreed++;
+		}
+		else {
+			// The previous allocation is still in use, so this page cannot
+			// be unmapped. Adjust the start address forward to the start
+			// of the next page
+			startFreeAddr = ((startFreeAddr + PAGE_SIZE) & ~(PAGE_SIZE - 1));
+		}
+	}
+	else if(firstFreeIndex == 0 || (pool->tracking.allocations[firstFreeIndex - 1] & TWO64)) {
+		leftIsFreed++;
+	}
+
+	// Now start searching for the end of the contiguous free region. As before, stop when
+	// the end of the list is reached, an allocated block is reached, or a partially
+	// unmapped allocation is found
+	lastFreeIndex = index;
+	while ((lastFreeIndex < pool->nextFreeIndex) && ((pool->tracking.allocations[lastFreeIndex + 1] & THREE64) == 1)) {
+		lastFreeIndex++;
+	}
+
+	// Potentially the end of the region to unmap. If it doesn't fall on a page boundary
+	// it will need to be adjusted forward or backwards
+	uintptr_t endFreeAddr = (pool->tracking.allocations[lastFreeIndex + 1] & ~SEVEN64);
+	if(endFreeAddr == 0) {
+		fprintf(stderr, "endFreeAddr == 0 test 1\n");
+		fflush(stderr);
+		abort();
+	}
+
+	if ((endFreeAddr & (PAGE_SIZE - 1)) != 0) {
+		if ((pool->tracking.allocations[lastFreeIndex + 1] & TWO64) != 0 && large_page_free_after(pool, lastFreeIndex + 1)) {
+			// The allocation following the region to be freed has already
+			// been partially freed, but the portion on this same page also
+			// needs to be freed so adjust the end address to the end of the page
+			endFreeAddr = ((endFreeAddr + PAGE_SIZE) & ~(PAGE_SIZE - 1));
+			if(endFreeAddr == 0) {
+				fprintf(stderr, "endFreeAddr == 0 test 2\n");
+				fflush(stderr);
+				abort();
+			}
+			rightIsFreed++;
+		}
+		else {
+			// The next allocation is still in use, so nothing on this page can
+			// be freed yet. Move the end address back to the start of the page
+			endFreeAddr = (endFreeAddr & ~(PAGE_SIZE - 1));
+		}
+	}
+	else {
+		if((byte*)endFreeAddr >= pool->end || (pool->tracking.allocations[lastFreeIndex + 1] & TWO64)) {
+			rightIsFreed++;
+		}
+	}
+
+	if((byte*)startFreeAddr <= pool->startInUse) {
+		if((byte*)endFreeAddr < pool->end) {
+			size_t contFreeIndex = lastFreeIndex; 
+			while(contFreeIndex < pool->nextFreeIndex && ((pool->tracking.allocations[contFreeIndex + 1] & TWO64) != 0)) {
+				contFreeIndex++;
+			}
+			pool->startInUse = (byte*)(pool->tracking.allocations[contFreeIndex + 1] & ~SEVEN64);
+		}
+		else {
+			pool->startInUse = pool->end;
+		}
+	}
+
+	// The whole pool is now empty, destroy it (which will also finish freeing up the indicated allocation)
+	if((pool->startInUse >= pool->endInUse) && (pool->tracking.allocations[pool->nextFreeIndex] >= (uintptr_t)pool->end + FOUR64)) {
+		FFLeaveCriticalSection(&pool->poolLock);
+		destroy_pool(pool);
+#ifdef FF_PROFILE
+		// Update the physical memory statistics
+		FFAtomicSub(pool->arena->profile.currentOSBytesMapped, (size_t)(endFreeAddr - startFreeAddr));
+#endif
+	}
+	else if (endFreeAddr > startFreeAddr) {
+		// Set a minimum number of pages before actually returning them to the OS
+		// On Linux, this helps reduce fragmentation which results in VMA bloat which
+		// can wrek our ability to request new pages. Alternately, if this is an island
+		// between two free regions, return it regardless of size so that 1) it doesn't
+		// get orphaned and 2) eliminates a VMA on Linux
+		if ((endFreeAddr - startFreeAddr >= (PAGE_SIZE * MIN_PAGES_TO_FREE)) || (leftIsFreed !=0 && rightIsFreed != 0)) {
+			if (decommit_range(pool, (byte*)startFreeAddr, (byte*)endFreeAddr) == FALSE) {
+#ifndef _WIN64
+				if(errno == ENOMEM) {
+					// Likely ran out of VMAs. Just continue without marking anything as
+					// being cleaned up, that way a future fffree can try again and hopefully
+					// make progress
+					FFLeaveCriticalSection(&pool->poolLock);
+					return;
+				}
+
+				fprintf(stderr, "Large pool decommit fail: %d, %p size: %ld\n", errno, (void*)startFreeAddr, endFreeAddr - startFreeAddr);
+#else
+				fprintf(stderr, "Large pool decommit fail: %d, %p size: %lld\n", GetLastError(), (void*)startFreeAddr, endFreeAddr - startFreeAddr);
+#endif
+				fflush(stderr);
+				abort();
+			}
+#ifdef FF_PROFILE
+			// Update the physical memory statistics
+			FFAtomicSub(pool->arena->profile.currentOSBytesMapped, (size_t)(endFreeAddr - startFreeAddr));
+#endif
+
+			// Lastly, mark all the pointers as unmapped
+			for (size_t i = firstFreeIndex; i <= lastFreeIndex; i++) {
+				pool->tracking.allocations[i] |= THREE64;
+			}
+		}
+	}
+	FFLeaveCriticalSection(&pool->poolLock);
+}
+
+// Frees a jumbo allocation by deleting the associated pool
+static inline void free_jumbo(struct pagepool_t* pool) {
+#ifdef FF_PROFILE
+	FFAtomicSub(pool->arena->profile.currentBytesAllocated, (size_t)(pool->end - pool->start));
+	FFAtomicSub(pool->arena->profile.currentOSBytesMapped, (size_t)(pool->end - pool->start));
+#endif
+#ifdef MARK_SWEEP
+	quarantine_add((size_t)(pool->end - pool->start));
+	count_free(pool->arena, LARGE_STAT_CLASS, (size_t)(pool->end - pool->start));
+#endif
+	destroy_pool(pool);
+}
+
+/*** Public API functions ***/
+
+// Replacement for malloc. Returns a pointer to an available
+// memory region >= size or NULL upon failure
+void* ffmalloc(size_t size) {
+	void* allocation;
+#if defined(FFSINGLE_THREADED) || !defined(_WIN64)
+	if (isInit == 2) {
+		abort();
+	}
+	if (!isInit) {
+		initialize();
+	}
+#endif
+
+	// Returning NULL when size==0 would be legal according to the man
+	// pages. This would be the preferred behavior because an allocation
+	// of zero is almost certain to turn into a call to realloc and that's
+	// expensive for this library. However, at least one of the PARSEC 
+	// benchmarks won't run if we do that so begrudingly return a minimum
+	// allocation for size 0
+	if (size == 0) {
+		size = 8;
+	}
+
+#ifdef FF_PROFILE
+	FFAtomicIncrement(arenas[0]->profile.mallocCount);
+	FFAtomicAdd(arenas[0]->profile.totalBytesRequested, size);
+#endif
+	// If size is very close to SIZE_MAX, the ALIGN_SIZE macro will 
+	// return 0
+	if(size > SIZE_MAX - MIN_ALIGNMENT) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+	// All allocations are at least 8 byte aligned. Round up if needed
+	size = ALIGN_SIZE(size);
+
+	// Small (less than half page size) allocations are allocated
+	// in matching sized bins per thread. Large allocations come
+	// out of a single central pool. Allocations larger than a single
+	// pool become their own pool
+	if (size <= (HALF_PAGE)) {
+		allocation = ffmalloc_small(size, arenas[0]);
+	}
+	else if (size < (POOL_SIZE - HALF_PAGE)) {
+		allocation = ffmalloc_large(size, MIN_ALIGNMENT, arenas[0]);
+	}
+	else {
+		allocation = ffmalloc_jumbo(size, arenas[0]);
+	}
+
+#ifdef FF_PROFILE
+	print_current_usage();
+#endif
+	if(allocation == NULL) {
+		errno = ENOMEM;
+	}
+
+	trace_call(FFTRACE_MALLOC, size, NULL, allocation);
+	return allocation;
+}
+
+// Replacement for realloc. Returns a pointer to a memory region
+// that is >= size and also contains the contents pointed to by ptr
+// if ptr is not NULL. The return value may be equal to ptr and will
+// be NULL on error.
+static void* realloc_internal(void* ptr, size_t size) {
+	// Per the man page for realloc, calling with ptr == NULL is
+	// equal to malloc(size). When ptr isn't NULL, calling
+	// realloc with size == 0 is the same as free(ptr)
+	if (ptr == NULL) {
+		return ffmalloc(size);
+	}
+	else if (size == 0) {
+		fffree(ptr);
+		return NULL;
+	}
+
+    size = ALIGN_SIZE(size);
+	
+	struct pagepool_t* pool = find_pool_for_ptr((const byte*)ptr);
+	if (pool == NULL) {
+		// Program is trying to free a bad pointer
+		// Or more likely there is a bug in this library
+		fprintf(stderr, "Attempt to realloc %p but no matching pool\n", ptr);
+		fflush(stderr);
+		abort();
+	}
+
+#ifdef FF_PROFILE
+	FFAtomicIncrement(arenas[0]->profile.reallocCount);
+#endif
+
+	// Was this a large or small allocation pool?
+	if (pool->nextFreeIndex < SIZE_MAX - 1) {
+		// Large allocation
+		size_t index = 0;
+		size_t oldSize = find_large_ptr((const byte*)ptr, pool, &index);
+
+		// Pointer not found - abort with extreme prejudice
+		// Likely a bug that needs cleaning up
+		if (oldSize == 0) {
+			fprintf(stderr, "realloc bad large ptr: %p\n", ptr);
+			fprintf(stderr, "pool:    %p\n", pool);
+			fprintf(stderr, "pool st: %p\n", pool->start);
+			fflush(stderr);
+			abort();
+		}
+
+		// When the reallocation size isn't bigger than the current size
+		// just quit and tell the app to keep using the same allocation.
+		// This includes growth into the headroom left by an earlier copy
+		if (size <= oldSize) {
+			return ptr;
+		}
+
+#ifdef FF_GROWLARGEREALLOC
+		// Check if the allocation happens to be at the end of the large
+		// pool and thus can be grown without extending into previously
+		// allocated space. It seems like this would be uncommon but
+		// profiling the SPECint PerlBench test says that its at least
+		// occassionally very common
+
+		// Potential integer overflow issue below. Since inplace resize 
+		// is only possible if the new size would still fit within the 
+		// pool, checking that size < POOL_SIZE should be sufficient
+		if(size < POOL_SIZE) {
+			FFEnterCriticalSection(&pool->poolLock);
+			size_t additionalSize = ALIGN_SIZE(size) - oldSize;
+			if(index == pool->nextFreeIndex-1 && (pool->nextFreePage + additionalSize <= pool->end)) {
+#ifdef FF_PROFILE
+				FFAtomicIncrement(arenas[0]->profile.reallocCouldGrow);
+				FFAtomicAdd(arenas[0]->profile.currentBytesAllocated, additionalSize);
+				FFAtomicAdd(arenas[0]->profile.totalBytesAllocated, additionalSize);
+				FFAtomicAdd(arenas[0]->profile.totalBytesRequested, size - oldSize);
+#endif
+				pool->nextFreePage += additionalSize;
+				pool->tracking.allocations[pool->nextFreeIndex] += additionalSize;
+				FFLeaveCriticalSection(&pool->poolLock);
+				return ptr;
+			}
+			FFLeaveCriticalSection(&pool->poolLock);
+		}
+#endif
+
+		// A bigger reallocation size requires copying the old data to
+		// the new location and then freeing the old allocation
+#ifdef FF_GROWLARGEREALLOC
+		// A buffer that grew once likely grows again, so leave half its new
+		// size as headroom. Pages past what gets written are never touched.
+		// Sizes already close to a pool stay large, bigger ones move on to
+		// a jumbo pool, which grows without copying from then on
+		if (size < POOL_SIZE - HALF_PAGE) {
+			size_t headroom = size + (size >> 1);
+			size = ALIGN_SIZE(headroom < POOL_SIZE - HALF_PAGE ? headroom : POOL_SIZE - HALF_PAGE - MIN_ALIGNMENT);
+		}
+#endif
+		void* temp = ffmalloc(size);
+		if (temp == NULL) {
+			return NULL;
+		}
+		memcpy(temp, ptr, oldSize);
+		free_large_pointer(pool, index, oldSize);
+		return temp;
+	}
+	else if (pool->nextFreeIndex == SIZE_MAX - 1) {
+		// Jumbo allocation - the pool is the allocation
+		// How big was it?
+		size_t jumboSize = pool->end - pool->start;
+
+		// Is it still big enough?
+		// TODO: Add code to trim pages from the end if the size is
+		// sufficiently smaller
+		// Also consider expansion if possible in the single threaded
+		// case
+		if(size <= jumboSize) {
+			return pool->start;
+		}
+
+#ifndef _WIN64
+		if(size <= SIZE_MAX - PAGE_SIZE && grow_jumbo(pool, ALIGN_TO(size, PAGE_SIZE))) {
+			return pool->start;
+		}
+#endif
+
+		// Not big enough so we'll have to create a new allocation
+		void* newJumbo = ffmalloc(size);
+		if(newJumbo == NULL) {
+			errno = ENOMEM;
+			return NULL;
+		}
+
+		// Copy into the new buffer
+		memcpy(newJumbo, ptr, jumboSize);
+
+		// Release memory associated with the old allocation and cleanup metadata
+		free_jumbo(pool);
+
+		// Return success
+		return newJumbo;
+	}
+	else {
+		// Small allocation
+		struct pagemap_t* pageMap = NULL;
+
+		// Find the specific page and index of this allocation
+		int64_t index = find_small_ptr((const byte*)ptr, pool, &pageMap);
+
+		// For now, fail violently if we can't find the pointer
+		// (likely a bug in the library somewhere)
+		if (index < 0) {
+			// Not a valid pointer
+			fprintf(stderr, "realloc bad small ptr: %p\n", ptr);
+			fprintf(stderr, "pool: %p\n", pool);
+			fprintf(stderr, "pageMap: %p\n", pageMap);
+			fflush(stderr);
+			abort();
+		}
+
+		if (size <= (pageMap->allocSize & ~SEVEN64)) {
+			return ptr;
+		}
+
+		void* temp = ffmalloc(size);
+		memcpy(temp, ptr, (pageMap->allocSize & ~SEVEN64));
+		free_small_ptr(pool, pageMap, index);
+		return temp;
+	}
+}
+
+// Wraps realloc_internal so that the allocation and free it may do are not
+// traced as calls of their own
+void* ffrealloc(void* ptr, size_t size) {
+	void* result;
+
+	trace_enter();
+	result = realloc_internal(ptr, size);
+	trace_leave();
+	trace_call(FFTRACE_REALLOC, size, ptr, result);
+
+	return result;
+}
+
+// Replacement for reallocarray. Equivalent to realloc(ptr, nmemb * size)
+// but will return NULL and signal ENOMEM if the multiplication overflows
+void* ffreallocarray(void* ptr, size_t nmemb, size_t size) {
+	// Overflow check. Existing allocation remains unaltered if there is overflow
+	if (nmemb && size > (SIZE_MAX / nmemb)) {
+		errno = ENOMEM;
+		return NULL;
+	}
+
+#ifdef FF_PROFILE
+	FFAtomicIncrement(arenas[0]->profile.reallocarrayCount);
+#endif
+
+	return ffrealloc(ptr, nmemb * size);
+}
+
+// Replacement for calloc. Returns a pointer to a memory region
+// that is >= nmemb * size and is guaranteed to be zeroed out.
+// Returns NULL on error
+void* ffcalloc(size_t nmemb, size_t size) {
+	// Ensure multiplication won't overflow
+	if (size > (SIZE_MAX / nmemb)) {
+        fprintf(stderr, "ffcalloc BUG\n");
+		return NULL;
+	}
+
+#if defined(FFSINGLE_THREADED) || !defined(_WIN64)
+	if(isInit == 2) {
+		abort();
+	}
+	if (!isInit) {
+		initialize();
+	}
+#endif
+#ifdef FF_PROFILE
+	FFAtomicIncrement(arenas[0]->profile.callocCount);
+#endif
+
+	// Either VirtualAlloc or mmap guarantee us zeroed pages and since
+	// we don't use mremap there is no chance of recycling a dirty
+	// page and therefore no need to explicitly zero out the allocation
+	//return ffmalloc(nmemb?nmemb * size:size);
+    void* result;
+    trace_enter();
+    result = ffmalloc(nmemb*size);
+    trace_leave();
+    trace_call(FFTRACE_CALLOC, nmemb * size, NULL, result);
+    return result;
+}
+
+// Reports a free of a small pointer that is not allocated
+static void bad_free_ptr(const void* ptr, const struct pagepool_t* pool, const struct pagemap_t* pageMap) {
+	fprintf(stderr, "free bad ptr: %p\n", ptr);
+	fprintf(stderr, "ptr size:     %ld\n", pageMap->allocSize & ~SEVEN64);
+	fprintf(stderr, "pool start:   %p\n", pool->start);
+	fprintf(stderr, "page start:   %p\n", pageMap->start);
+	fflush(stderr);
+	abort();
+}
+
+// Reports a free whose size hint is larger than the allocation. Either
+// the size or the pointer is wrong, so fail like any other bad free
+static void bad_free_size(const void* ptr, size_t size, size_t allocSize) {
+	fprintf(stderr, "free bad size: %p\n", ptr);
+	fprintf(stderr, "free size:     %zu\n", size);
+	fprintf(stderr, "alloc size:    %zu\n", allocSize);
+	fflush(stderr);
+	abort();
+}
+
+// Implements free and free_sized. A non zero size is the size the caller
+// allocated, which is checked against the allocation found
+static inline void free_internal(void* ptr, size_t size) {
+#ifdef MARK_SWEEP
+	note_user_thread();
+#endif
+	struct pagepool_t* pool = find_pool_for_ptr((const byte*)ptr);
+	if (pool == NULL) {
+		// Program is trying to free a bad pointer
+		// Or more likely there is a bug in this library
+		fprintf(stderr, "Attempt to free %p but no matching pool\n", ptr);
+		fflush(stderr);
+		abort();
+	}
+
+#ifdef FF_PROFILE
+	FFAtomicIncrement(arenas[0]->profile.freeCount);
+#endif
+
+	// Was this a large or small allocation pool?
+	if (pool->nextFreeIndex < SIZE_MAX - 1) {
+		// Large allocation
+		size_t index = 0;
+		size_t allocSize = find_large_ptr((const byte*)ptr, pool, &index);
+
+		// Pointer not found - abort with extreme prejudice
+		// Likely a bug that needs cleaning up
+		if (allocSize == 0) {
+			fprintf(stderr, "free bad large ptr: %p\n", ptr);
+			fprintf(stderr, "pool:    %p\n", pool);
+			fprintf(stderr, "pool st: %p\n", pool->start);
+			fflush(stderr);
+			abort();
+		}
+
+		if (size > allocSize) {
+			bad_free_size(ptr, size, allocSize);
+		}
+
+		free_large_pointer(pool, index, allocSize);
+	}
+	else if (pool->nextFreeIndex == SIZE_MAX - 1) {
+		// Jumbo allocation
+		if (size > (size_t)(pool->end - pool->start)) {
+			bad_free_size(ptr, size, pool->end - pool->start);
+		}
+		free_jumbo(pool);
+	}
+	else {
+		// Small allocation
+		struct pagemap_t* pageMap = NULL;
+
+		// Find the specific page and index of this allocation
+		int64_t index = find_small_ptr((const byte*)ptr, pool, &pageMap);
+
+		// For now, fail violently if we can't find the pointer
+		if (index < 0) {
+			bad_free_ptr(ptr, pool, pageMap);
+		}
+		if (size > (pageMap->allocSize & ~SEVEN64)) {
+			bad_free_size(ptr, size, pageMap->allocSize & ~SEVEN64);
+		}
+
+		free_small_ptr(pool, pageMap, index);
+	}
+}
+
+// Replacment for free. Marks an allocation previously returned by
+// ffmalloc, ffrealloc, or ffcalloc as no longer in use. The memory
+// page might be returned to the OS depending on the status of other
+// allocations from the same page
+void fffree(void* ptr) {
+	// Per the specification for free, calling with ptr == NULL is
+	// legal and is a no-op
+	if (ptr == NULL)
+		return;
+
+	trace_call(FFTRACE_FREE, 0, ptr, NULL);
+	free_internal(ptr, 0);
+}
+
+static inline void* ffmemalign_internal(size_t alignment, size_t size) {
+#ifdef FF_PROFILE
+	FFAtomicIncrement(arenas[0]->profile.posixAlignCount);
+	FFAtomicAdd(arenas[0]->profile.totalBytesRequested, size);
+#endif
+
+	// Allocation can be serviced from the small bin only if both the size
+	// and the alignment fit into the small bin
+	if(size <= HALF_PAGE && alignment <= HALF_PAGE) {
+		if(size <= alignment) {
+			// When size is less than alignment, just returning an
+			// allocation of size == alignment will guarantee the
+			// requested alignment
+			return ffmalloc_small(alignment, arenas[0]);
+		}
+		else {
+			// When size is greater than alignment, rounding size
+			// up to the next power of two will ensure alignment
+			return ffmalloc_small(ONE64<<(64-FFCOUNTLEADINGZEROS64(size-1)), arenas[0]);
+		}
+	}
+
+	// Either size or alignment won't fit into the normal small bins so
+	// even if the size is small, it will have to come out of the large
+	// allocation bin to get the requested alignment
+
+	// Round size up to a multiple of base alignment if needed
+	size = ALIGN_SIZE(size);
+
+	if(size >= POOL_SIZE) {
+		return ffmalloc_jumbo(size, arenas[0]);
+	}
+	else {
+		return ffmalloc_large(size, alignment, arenas[0]);
+	}
+
+	return NULL;
+}
+
+// Replacement for posix_memalign. Returns a pointer to a block of memory that
+// is >= size and that has at least the specified alignment, which must be a
+// power of two
+int ffposix_memalign(void** ptr, size_t alignment, size_t size) {
+	// Don't bother with zero byte allocations
+	// Also check against overflow below
+	if(size == 0 || (size >= SIZE_MAX - PAGE_SIZE )) {
+		*ptr = NULL;
+		return EINVAL;
+	}
+
+	// Alignment must be at least sizeof(void*) and alignment must be a
+	// power of two
+	if(alignment < 8 || FFPOPCOUNT64(alignment) != 1) {
+		*ptr = NULL;
+		return EINVAL;
+	}
+
+	// Current jumbo allocation code is missing alignment support but all
+	// jumbo allocations will be at least page aligned. For now it is an
+	// error to request more than page alignment for a jumbo allocation
+	if(size + PAGE_SIZE >= POOL_SIZE && alignment > PAGE_SIZE) {
+		*ptr = NULL;
+		return EINVAL;
+	}
+
+	*ptr = ffmemalign_internal(alignment, size);
+	trace_call(FFTRACE_MEMALIGN, size, (void*)alignment, *ptr);
+	if(*ptr == NULL) {
+		return ENOMEM;
+	}
+
+	return 0;
+}
+
+// Replacement for memalign. The man page says this is obsolete but it turns
+// up in PARSEC benchmark so here it is. The address of the returned allocation
+// will be a multiple of alignment and alignment must be a power of two.
+void* ffmemalign(size_t alignment, size_t size) {
+	// Forbid zero byte allocations
+	// Protect against integer overflow later
+	if(size == 0 || (size >= SIZE_MAX - PAGE_SIZE)) {
+		return NULL;
+	}
+
+	// Verify that alignment is a power of two
+	if(FFPOPCOUNT64(alignment) != 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	// The man page is silent on whether a minimum value for alignment is
+	// enforced (compare to posix_memalign). Since none is mentioned, 
+	// allow all values but anything less than pointer size will just be
+	// handled as a regular malloc
+	if(alignment <= sizeof(void*)) {
+		return ffmalloc(size);
+	}
+
+	// The jumbo allocation code doesn't support custom alignment right now
+	// but any jumbo alignment will be page aligned. So, error out if the
+	// request is bigger than page size otherwise carry on
+	if(size + PAGE_SIZE >= POOL_SIZE && alignment > PAGE_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	void* result = ffmemalign_internal(alignment, size);
+	trace_call(FFTRACE_MEMALIGN, size, (void*)alignment, result);
+	return result;
+}
+
+// Replacment for aligned_alloc. Alignment must be a power of two and size
+// must be a multiple of alignment. Returned pointer will point to a region
+// that is >= size and at least alignment aligned or NULL on failure
+void *ffaligned_alloc(size_t alignment, size_t size) {
+	// Don't allow zero byte allocations
+	// Protect against integer overflow
+	if(size == 0 || (size >= SIZE_MAX - PAGE_SIZE)) {
+		return NULL;
+	}
+
+	// Alignment must be at least sizeof(void*) and alignment must be a
+	// power of two
+	if(alignment < 8 || FFPOPCOUNT64(alignment) != 1) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	// Description of aligned_alloc says that size must be a multiple of
+	// alignment
+	if(size < alignment || (size % alignment != 0)) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+	// Missing alignment support in jumbo code so forbid greater than page
+	// alignment for jumbo allocations until that's fixed. All jumbo
+	// allocations will be page aligned anyways
+	if(size + PAGE_SIZE >= POOL_SIZE && alignment > PAGE_SIZE) {
+		errno = EINVAL;
+		return NULL;
+	}
+
+#ifdef FF_PROFILE
+	FFAtomicIncrement(arenas[0]->profile.allocAlignCount);
+	FFAtomicAdd(arenas[0]->profile.totalBytesRequested, size);
+#endif
+
+	void* result;
+	if (size >= POOL_SIZE) {
+		result = ffmalloc_jumbo(size, arenas[0]);
+	}
+	// Allocation can be serviced from the small bin only if both the size
+	// and the alignment fit into the small bin
+	else if(size <= HALF_PAGE && alignment <= HALF_PAGE) {
+		result = ffmalloc_small(ONE64<<(64-FFCOUNTLEADINGZEROS64(size-1)), arenas[0]);
+	}
+	else {
+		// Either size or alignment won't fit into the normal small bins so
+		// even if the size is small, it will have to come out of the large
+		// allocation bin to get the requested alignment
+		result = ffmalloc_large(size, alignment, arenas[0]);
+	}
+
+	trace_call(FFTRACE_MEMALIGN, size, (void*)alignment, result);
+	return result;
+}
+
+// Replacement for malloc_usable_size. Returns the actual amount of space
+// allocated to a given pointer which could be greater than the requested size
+size_t ffmalloc_usable_size(const void* ptr) {
+	// The man page for this function is vague on how this function handles
+	// errors other than being explicit that a NULL value for ptr should
+	// return zero
+	if(ptr == NULL) {
+		return 0;
+	}
+
+	// Follow above logic and any invalid pointer will result in size of
+	// zero and errno will not be set
+	struct pagepool_t* pool = find_pool_for_ptr((const byte*)ptr);
+	if (pool == NULL) {
+		return 0;
+	}
+
+	// Was this a large or small allocation pool?
+	if (pool->nextFreeIndex < SIZE_MAX - 1) {
+		// Large allocation
+		size_t index = 0;
+		return find_large_ptr((const byte*)ptr, pool, &index);
+	}
+	else if(pool->nextFreeIndex == SIZE_MAX - 1) {
+		// Jumbo allocation
+		return pool->end - pool->start;
+	}
+	else {
+		// Small allocation
+		struct pagemap_t* pageMap = NULL;
+
+		// Find the specific page and index of this allocation
+		int64_t index = find_small_ptr((const byte*)ptr, pool, &pageMap);
+
+		if (index < 0) {
+			// Not a valid pointer
+			return 0;
+		}
+
+		// Mask out the low order status bits before returning size
+		return (pageMap->allocSize & ~SEVEN64);
+	}
+}
+
+/*** Deprecated malloc API - only included when not using FF prefix ***/
+#ifndef USE_FF_PREFIX
+// Allocates size bytes. The returned address will be page size aligned
+// Equivalent to memalign(PAGE_SIZE, size)
+void* valloc(size_t size) {
+	return ffmemalign(PAGE_SIZE, size);
+}
+
+// Rounds size up to a multiple of PAGE_SIZE. Returned address will be
+// page size aligned
+void* pvalloc(size_t size) {
+	if(size >= SIZE_MAX - PAGE_SIZE) {
+		return NULL;
+	}
+	return ffmemalign(PAGE_SIZE, ALIGN_TO(size, PAGE_SIZE));
+}
+#endif
+
+/*** FFMalloc extended API ***/
+
+// Duplicates the string into memory allocated by ffmalloc. The caller is
+// responsible for calling fffree
+char* ffstrdup(const char* s) {
+	if(s == NULL) {
+		return NULL;
+	}
+
+	size_t length = strlen(s) + 1;
+	char* newString = (char*)ffmalloc(length);
+	if(newString != NULL) {
+		// Visual C does *not* like strcpy, but we need to be portable so get the
+		// compiler to quit complaining just this one time
+#pragma warning( push )
+#pragma warning( disable : 4996 )
+		strcpy(newString, s);
+#pragma warning( pop )
+		return newString;
+	}
+
+	errno = ENOMEM;
+	return NULL;
+}
+
+// Duplicates the first n characters of the string into memory allocated by
+// ffmalloc. The caller is responsible for calling fffree
+char* ffstrndup(const char* s, size_t n) {
+	if(s == NULL || n == SIZE_MAX) {
+		return NULL;
+	}
+
+	char* newString = (char*)ffmalloc(n + 1);
+	if(newString != NULL) {
+#pragma warning( push )
+#pragma warning( disable : 4996 )
+		strncpy(newString, s, n);
+#pragma warning( pop )
+
+		// strncpy may not null terminate the string if there is no
+		// null byte in the first n characters of s
+		newString[n] = '\0';
+		return newString;
+	}
+
+	errno = ENOMEM;
+	return NULL;
+}
+
+// Allocates count blocks of size bytes into out and returns how many were
+// allocated, which is fewer than count only when memory runs out. Small
+// blocks are carved as a run from the calling thread's bin page
+size_t ffmalloc_batch(size_t size, size_t count, void** out) {
+	size_t done = 0;
+
+	if(out == NULL || count == 0) {
+		return 0;
+	}
+
+#if defined(FFSINGLE_THREADED) || !defined(_WIN64)
+	if (isInit == 2) {
+		abort();
+	}
+	if (!isInit) {
+		initialize();
+	}
+#endif
+
+	// Same minimum and overflow check as ffmalloc
+	if (size == 0) {
+		size = 8;
+	}
+	if(size > SIZE_MAX - MIN_ALIGNMENT) {
+		errno = ENOMEM;
+		return 0;
+	}
+
+#ifdef FF_PROFILE
+	FFAtomicAdd(arenas[0]->profile.mallocCount, count);
+	FFAtomicAdd(arenas[0]->profile.totalBytesRequested, size * count);
+#endif
+	size = ALIGN_SIZE(size);
+
+	if (size <= HALF_PAGE) {
+		ffmalloc_small_batch(size, arenas[0], count, out);
+		done = count;
+	}
+	else {
+		// Large and jumbo allocations each take their own extent anyway
+		for (; done < count; done++) {
+			if (size < (POOL_SIZE - HALF_PAGE)) {
+				out[done] = ffmalloc_large(size, MIN_ALIGNMENT, arenas[0]);
+			}
+			else {
+				out[done] = ffmalloc_jumbo(size, arenas[0]);
+			}
+			if (out[done] == NULL) {
+				errno = ENOMEM;
+				break;
+			}
+		}
+	}
+
+#ifdef FF_PROFILE
+	print_current_usage();
+#endif
+	for (size_t i = 0; i < done; i++) {
+		trace_call(FFTRACE_MALLOC, size, NULL, out[i]);
+	}
+	return done;
+}
+
+// Frees count pointers, skipping NULLs. Consecutive pointers into the same
+// small allocation page, such as those from one ffmalloc_batch call, are
+// cleared from its bitmap together and the page is checked for release once
+void fffree_batch(void** ptrs, size_t count) {
+	size_t i = 0;
+
+	if(ptrs == NULL) {
+		return;
+	}
+#ifdef MARK_SWEEP
+	note_user_thread();
+#endif
+
+	while (i < count) {
+		byte* ptr = (byte*)ptrs[i];
+		if (ptr == NULL) {
+			i++;
+			continue;
+		}
+
+		struct pagepool_t* pool = find_pool_for_ptr(ptr);
+		if (pool == NULL || pool->nextFreeIndex != SIZE_MAX) {
+			// Large and jumbo allocations, and bad pointers, take the
+			// usual path
+			fffree(ptr);
+			i++;
+			continue;
+		}
+
+		size_t mapIndex = (ptr - pool->start) / PAGE_SIZE;
+		struct pagemap_t* pageMap = pool->tracking.pageMaps + mapIndex;
+		byte* pageStart = pool->start + mapIndex * PAGE_SIZE;
+		uint64_t freed[PAGE_BITMAP_WORDS] = { 0 };
+
+		for (; i < count; i++) {
+			ptr = (byte*)ptrs[i];
+			if (ptr == NULL) {
+				continue;
+			}
+			if (ptr < pageStart || ptr >= pageStart + PAGE_SIZE) {
+				break;
+			}
+
+			trace_call(FFTRACE_FREE, 0, ptr, NULL);
+#ifdef FF_PROFILE
+			FFAtomicIncrement(arenas[0]->profile.freeCount);
+#endif
+
+			// The bitmap is only cleared after the run, so a pointer given
+			// twice is caught here instead
+			int64_t index = find_small_ptr(ptr, pool, &pageMap);
+			uint64_t bit = ONE64 << (index & SIXTYTHREE64);
+			if (index < 0 || (freed[index >> 6] & bit)) {
+				bad_free_ptr(ptr, pool, pageMap);
+			}
+
+			freed[index >> 6] |= bit;
+			retire_small_slot(pool, pageMap, index);
+		}
+
+		free_small_run(pool, pageMap, freed);
+	}
+}
+
+// Frees an allocation of size bytes. The size is checked against the
+// allocation, which catches a free of the wrong pointer, but otherwise
+// the allocation is freed as by fffree
+void fffree_sized(void* ptr, size_t size) {
+	if (ptr == NULL)
+		return;
+
+	trace_call(FFTRACE_FREE, size, ptr, NULL);
+	free_internal(ptr, size);
+}
+
+#if !defined(USE_FF_PREFIX) && defined(FF_SIZED_DELETE)
+// The C++14 sized operator delete and operator delete[]. The default ones
+// in libstdc++ drop the size and call free. Opt in only, since a program
+// that replaces the unsized operator delete but not these would have its
+// own allocations sent here
+void _ZdlPvm(void* ptr, size_t size) {
+	fffree_sized(ptr, size);
+}
+
+void _ZdaPvm(void* ptr, size_t size) {
+	fffree_sized(ptr, size);
+}
+#endif
+
+#ifdef FF_PROFILE
+// Gets usage statistics for ffmalloc excluding custom arenas
+ffresult_t ffget_statistics(ffprofile_t* profile) {
+	if(profile == NULL) {
+		return FFBAD_PARAM;
+	}
+
+	memcpy(profile, &arenas[0]->profile, sizeof(ffprofile_t));
+
+	return FFSUCCESS;
+}
+
+// Gets usage statistics for a custom arena
+ffresult_t ffget_arena_statistics(ffprofile_t* profile, ffarena_t arenaKey) {
+	// Ensure that the arena key is in range and exists
+	if(arenaKey == 0 || arenaKey >= MAX_ARENAS || arenas[arenaKey] == NULL) {
+		return FFBAD_ARENA;
+	}
+
+	if(profile == NULL) {
+		return FFBAD_PARAM;
+	}
+
+	memcpy(profile, &arenas[arenaKey]->profile, sizeof(ffprofile_t));
+
+	return FFSUCCESS;
+}
+
+// Adds the usage statistics of one arena to a combined profile. Current
+// values are only added for arenas still alive. The combined maximums are
+// those of the busiest arena, or the combined current value if higher
+static void add_profile(ffprofile_t* sum, const ffprofile_t* profile, bool alive) {
+	sum->mallocCount += profile->mallocCount;
+	sum->reallocCount += profile->reallocCount;
+	sum->reallocarrayCount += profile->reallocarrayCount;
+	sum->callocCount += profile->callocCount;
+	sum->freeCount += profile->freeCount;
+	sum->posixAlignCount += profile->posixAlignCount;
+	sum->allocAlignCount += profile->allocAlignCount;
+	sum->totalBytesRequested += profile->totalBytesRequested;
+	sum->totalBytesAllocated += profile->totalBytesAllocated;
+	sum->reallocCouldGrow += profile->reallocCouldGrow;
+	if(alive) {
+		sum->currentBytesAllocated += profile->currentBytesAllocated;
+		sum->currentOSBytesMapped += profile->currentOSBytesMapped;
+	}
+	if(profile->maxBytesAllocated > sum->maxBytesAllocated) {
+		sum->maxBytesAllocated = profile->maxBytesAllocated;
+	}
+	if(sum->currentBytesAllocated > sum->maxBytesAllocated) {
+		sum->maxBytesAllocated = sum->currentBytesAllocated;
+	}
+	if(profile->maxOSBytesMapped > sum->maxOSBytesMapped) {
+		sum->maxOSBytesMapped = profile->maxOSBytesMapped;
+	}
+	if(sum->currentOSBytesMapped > sum->maxOSBytesMapped) {
+		sum->maxOSBytesMapped = sum->currentOSBytesMapped;
+	}
+}
+
+// Gets combined usage statistics for all arenas active or destroyed plus the
+// default allocation arena
+ffresult_t ffget_global_statistics(ffprofile_t* profile) {
+	if(profile == NULL) {
+		return FFBAD_PARAM;
+	}
+
+	memcpy(profile, &retiredProfile, sizeof(ffprofile_t));
+	for(ffarena_t i = 0; i < MAX_ARENAS; i++) {
+		if(arenas[i] != NULL) {
+			add_profile(profile, &arenas[i]->profile, true);
+		}
+	}
+
+	return FFSUCCESS;
+}
+#endif
+
+// Creates a new allocation arena
+ffresult_t ffcreate_arena(ffarena_t* newArenaKey) {
+	// First make sure we've got some place to return this arena to
+	if(newArenaKey == NULL) {
+		return FFBAD_PARAM;
+	}
+
+	// Single threaded builds set up on the first call, which may be this
+	if (!isInit) {
+		initialize();
+	}
+
+	// Reserve metadata space for the arena. Metadata isn't zeroed when
+	// it's reused, and a destroyed arena's lists and statistics must not
+	// show through
+	struct arena_t* newArena = (struct arena_t*)ffmetadata_alloc(sizeof(struct arena_t));
+	if(newArena == NULL) {
+		return FFNOMEM;
+	}
+	memset(newArena, 0, sizeof(struct arena_t));
+
+	// Find a free slot in the arena array
+	for(ffarena_t i = 1; i < MAX_ARENAS; i++) {
+		if(arenas[i] == NULL) {
+			// Found a slot, try and claim it
+			if(FFAtomicCompareExchangePtr(&arenas[i], newArena, NULL)) {
+				// Slot succesfully claimed
+				ffresult_t result = create_arena(arenas[i]);
+				if(result == FFSUCCESS) {
+					*newArenaKey = i;
+				}
+				return result;
+			}
+		}
+	}
+
+	// No free slots left to put a new arena in
+	ffmetadata_free(newArena, sizeof(struct arena_t));
+	return FFMAX_ARENAS;
+}
+
+// Frees all memory allocated from a specific arena and then destroys the arena
+ffresult_t ffdestroy_arena(ffarena_t arena) {
+	// Ensure that the arena key is in range and exists. Also note that
+	// destroying the default arena is not allowed
+	if(arena == 0 || arena >= MAX_ARENAS || arenas[arena] == NULL) {
+		return FFBAD_ARENA;
+	}
+
+	// No attempt at thread safety - caller is responsible for ensuring
+	// this is called only once when finished
+#ifdef FF_PROFILE
+	add_profile(&retiredProfile, &arenas[arena]->profile, false);
+#endif
+#ifdef MARK_SWEEP
+	// The reclaimer takes the arena out of the sweeps before it's freed
+	return request_arena_sweep(arena, true);
+#else
+	destroy_arena(arenas[arena]);
+	arenas[arena] = NULL;
+
+	return FFSUCCESS;
+#endif
+}
+
+// Allocates memory with the same algorithm as ffmalloc but from a custom arena
+ffresult_t ffmalloc_arena(ffarena_t arenaKey, void** ptr, size_t size) {
+	struct arena_t* arena = NULL;
+
+	// Ensure the out pointer parameter is valid
+	if(ptr == NULL) {
+		return FFBAD_PARAM;
+	}
+
+	// Check that the arena key is in range and exists. Technically,
+	// nothing bad would happen by allowing allocation out of the default
+	// arena here. However, it would violate the spirit of the API which is
+	// that the arena key should be generated by ffcreate_arena. Second, 
+	// the caller should not depend on the default arena being zero since
+	// that's an internal implementation detail. Lastly, it would violate 
+	// principle of least surprise since zero definitely can't be used with
+	// ffdestroy_arena and the caller may be confused that zero can be
+	// allocated from but not destroyed
+	if(arenaKey == 0 || arenaKey >= MAX_ARENAS || arenas[arenaKey] == NULL) {
+		return FFBAD_ARENA;
+	}
+	else {
+		arena = arenas[arenaKey];
+	}
+	
+	// Prohibit zero byte allocations. It can't be realloc'ed to bigger
+	// than 8 anyways without a copy so just ask for what you need to start
+	// Also protect against overflow due to alignment below
+	if(size == 0 || size > SIZE_MAX - MIN_ALIGNMENT) {
+		return FFBAD_PARAM;
+	}
+
+#ifdef FF_PROFILE
+	FFAtomicIncrement(arena->profile.mallocCount);
+	FFAtomicAdd(arena->profile.totalBytesRequested, size);
+#endif
+	// Round size up to a multiple of 8 if needed
+	size = ALIGN_SIZE(size);
+
+	// Allocate from the right pool in the requested arena
+	if(size <= HALF_PAGE) {
+		*ptr = ffmalloc_small(size, arena);
+	}
+	else if(size < (POOL_SIZE - HALF_PAGE)) {
+		*ptr = ffmalloc_large(size, MIN_ALIGNMENT, arena);
+	}
+	else {
+		*ptr = ffmalloc_jumbo(size, arena);
+	}
+
+	return *ptr == NULL ? FFNOMEM : FFSUCCESS;
+}
+
+#ifdef MARK_SWEEP
+// Sets a sweeper option. Takes effect from the reclaimer's next period
+ffresult_t ffset_option(const char* name, long value) {
+	struct runtimeoption_t* option;
+
+	// Make sure the environment has been read so that it doesn't later
+	// override the value set here
+	if (!isInit) {
+		initialize();
+	}
+
+	option = find_option(name);
+	if(option == NULL || value < option->min || value > option->max) {
+		return FFBAD_PARAM;
+	}
+
+	if(option->startupOnly) {
+		return FFREADONLY;
+	}
+
+	option->value = value;
+	return FFSUCCESS;
+}
+
+// Gets the current value of a sweeper option
+ffresult_t ffget_option(const char* name, long* value) {
+	struct runtimeoption_t* option;
+
+	if(value == NULL) {
+		return FFBAD_PARAM;
+	}
+
+	if (!isInit) {
+		initialize();
+	}
+
+	option = find_option(name);
+	if(option == NULL) {
+		return FFBAD_PARAM;
+	}
+
+	*value = option->value;
+	return FFSUCCESS;
+}
+
+// Gets the allocation counts of every thread cache, live or retired
+ffresult_t ffget_alloc_statistics(ffallocstats_t* stats) {
+	struct tcachestats_t total;
+	size_t classes[BIN_COUNT];
+	size_t count = 0;
+
+	if(stats == NULL) {
+		return FFBAD_PARAM;
+	}
+
+	memset(stats, 0, sizeof(ffallocstats_t));
+	sum_tcache_stats(&total);
+
+	// Order the bins by size, skipping any that aren't used with this
+	// alignment
+	for(size_t b = 0; b < BIN_COUNT; b++) {
+		size_t pos = count++;
+		if(statClassSize[b] == 0) {
+			count--;
+			continue;
+		}
+		while(pos > 0 && statClassSize[classes[pos - 1]] > statClassSize[b]) {
+			classes[pos] = classes[pos - 1];
+			pos--;
+		}
+		classes[pos] = b;
+	}
+
+	for(size_t i = 0; i < count; i++) {
+		size_t size = statClassSize[classes[i]];
+		stats->classSize[i] = size;
+		stats->classMallocCount[i] = total.mallocCount[classes[i]];
+		stats->classFreeCount[i] = total.freeCount[classes[i]];
+		stats->bytesAllocated += size * total.mallocCount[classes[i]];
+		stats->bytesFreed += size * total.freeCount[classes[i]];
+	}
+	stats->classMallocCount[count] = total.mallocCount[LARGE_STAT_CLASS];
+	stats->classFreeCount[count] = total.freeCount[LARGE_STAT_CLASS];
+	stats->bytesAllocated += total.largeBytesAllocated;
+	stats->bytesFreed += total.largeBytesFreed;
+	stats->classCount = count + 1;
+
+	for(size_t i = 0; i < stats->classCount; i++) {
+		stats->mallocCount += stats->classMallocCount[i];
+		stats->freeCount += stats->classFreeCount[i];
+	}
+	return FFSUCCESS;
+}
+
+// Gets the sweep statistics as of the end of the last cycle
+ffresult_t ffget_sweep_statistics(ffsweepstats_t* stats) {
+	if(stats == NULL) {
+		return FFBAD_PARAM;
+	}
+
+	pthread_mutex_lock(&sweepStatsLock);
+	memcpy(stats, &sweepStats, sizeof(ffsweepstats_t));
+	pthread_mutex_unlock(&sweepStatsLock);
+	return FFSUCCESS;
+}
+
+// Sweeps a custom arena on the reclaimer and waits for the result
+ffresult_t ffsweep_arena(ffarena_t arenaKey) {
+	// Same rules as ffmalloc_arena, the default arena is only swept whole
+	if(arenaKey == 0 || arenaKey >= MAX_ARENAS || arenas[arenaKey] == NULL) {
+		return FFBAD_ARENA;
+	}
+
+	return request_arena_sweep(arenaKey, false);
+}
+
+// Adds a range to the roots of every sweep, or takes back an exclusion of
+// exactly that range
+ffresult_t ffregister_root(void* start, size_t size) {
+	uint64_t begin = (uint64_t)start;
+
+	if(size == 0 || begin + size < begin) {
+		return FFBAD_PARAM;
+	}
+
+	if (!isInit) {
+		initialize();
+	}
+
+	// The heap is already scanned pool by pool, and a released pool can't
+	// be read
+	if(begin < (uint64_t)poolHighWater && begin + size > (uint64_t)poolLowAddr) {
+		return FFBAD_PARAM;
+	}
+
+	return change_root_set(userRoots, &userRootCount, userExcluded, &userExcludedCount, begin, begin + size);
+}
+
+// Leaves a range out of the roots of every sweep, or takes back a
+// registration of exactly that range
+ffresult_t ffexclude_range(void* start, size_t size) {
+	uint64_t begin = (uint64_t)start;
+
+	if(size == 0 || begin + size < begin) {
+		return FFBAD_PARAM;
+	}
+
+	return change_root_set(userExcluded, &userExcludedCount, userRoots, &userRootCount, begin, begin + size);
+}
+#endif
+
+#ifdef FF_WRAP_MMAP
+// Maps memory for the application. The sweeper rereads the mappings before
+// its next pass
+void* ffmmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset) {
+	void* result = sys_mmap(addr, length, prot, flags, fd, offset);
+#ifdef MARK_SWEEP
+	if(result != MAP_FAILED) {
+		__sync_fetch_and_add(&rootSetGeneration, 1);
+	}
+#endif
+	return result;
+}
+
+// Unmaps memory for the application. The sweeper rereads the mappings
+// before its next pass
+int ffmunmap(void* addr, size_t length) {
+	int result = sys_munmap(addr, length);
+#ifdef MARK_SWEEP
+	if(result == 0) {
+		__sync_fetch_and_add(&rootSetGeneration, 1);
+	}
+#endif
+	return result;
+}
+#endif
+
+
+//#ifdef _DEBUG
+/**
+ Frees all data and metadata allocated by an ffmalloc family function
+ */
+void fffree_all() {
+	for (size_t slot = poolMapFirst; slot <= poolMapLast; slot++) {
+		if(pool_map_slot(slot) != NULL && poolMap[slot].poolStart != NULL) {
+			os_free(poolMap[slot].poolStart->start);
+			os_free(poolMap[slot].poolStart->tracking.pageMaps);
+		}
+	}
+}
+
+void ffdump_pool_details() {
+	printf("alloc count: %ld\n", os_alloc_count);
+	printf("alloc amount %ld\n", os_alloc_total);
+	printf("free count %ld\n", os_free_count);
+	for (size_t slot = poolMapFirst; slot <= poolMapLast; slot++) {
+		if (pool_map_slot(slot) != NULL && poolMap[slot].poolStart != NULL) {
+			size_t released = 0;
+			size_t pending = 0;
+			size_t inuse = 0;
+			size_t tcache = 0;
+			struct pagepool_t* pool = poolMap[slot].poolStart;
+			//printf("Pool start: %p ", pool->start);
+			if (pool->nextFreeIndex == SIZE_MAX) {
+				byte* lastFreePage = pool->end < pool->nextFreePage ? pool->end : pool->nextFreePage;
+				for (size_t x = 0; x < (lastFreePage - pool->start) / PAGE_SIZE; x++) {
+					if ((pool->tracking.pageMaps[x].allocSize & THREE64) == 3) {
+						released++;
+					}
+					else if ((pool->tracking.pageMaps[x].allocSize & THREE64) == 1) {
+						pending++;
+					}
+					else if (pool->tracking.pageMaps[x].allocSize == 0) {
+						tcache++;
+					}
+					else {
+						inuse++;
+					}
+				}
+				size_t unassigned = (pool->end - lastFreePage) / PAGE_SIZE;
+				//if (pending > 0 || inuse > 0 || unassigned > 0 || tcache > 0) {
+					printf("Small pool addr: %p with %ld pages unassigned, ", pool->start, unassigned);
+					printf("%ld pending free, ", pending);
+					printf("%ld freed, ", released);
+					printf("%ld in tcache reserve, ", tcache);
+					printf("%ld in use\n", inuse);
+				//}
+					if (released == 1024) {
+						printf("startInUse: %p endInUse: %p\n", pool->startInUse, pool->endInUse);
+					}
+			}
+			else if (pool->nextFreeIndex == SIZE_MAX - 1) {
+				printf("Jumbo pool start: %p\n", pool->start);
+			}
+			else {
+				printf("Large pool start: %p with %ld bytes free\n", pool->start, (uintptr_t)pool->end - pool->tracking.allocations[pool->nextFreeIndex]);
+			}
+		}
+	}
+}
+
+/**
+ Gets the number of pools currently active
+ @return The number of pools ffmalloc has currently in use
+ */
+size_t ffget_pool_count() {
+	return poolCount;
+}
+
+#ifdef FF_PROFILE
+void ffprint_stats_wrapper(void) {
+	ffprint_statistics(stderr);
+}
+
+#ifdef _WIN64
+void ffprint_statistics(FILE * const dest) {
+	ffprofile_t* stats = &arenas[0]->profile;
+	fprintf(dest, "*** FFMalloc Stats ***\n");
+    fprintf(dest, "Malloc:         %lld\n", stats->mallocCount);
+    fprintf(dest, "Realloc:        %lld\n", stats->reallocCount);
+    fprintf(dest, "Calloc:         %lld\n", stats->callocCount);
+    fprintf(dest, "Free:           %lld\n", stats->freeCount);
+    fprintf(dest, "POSIX Align:    %lld\n", stats->posixAlignCount);
+    fprintf(dest, "Alloc Align:    %lld\n", stats->allocAlignCount);
+    fprintf(dest, "TotBytes Reqst: %lld\n", stats->totalBytesRequested);
+    fprintf(dest, "TotBytes Alloc: %lld\n", stats->totalBytesAllocated);
+    fprintf(dest, "CurBytes Alloc: %lld\n", stats->currentBytesAllocated);
+    fprintf(dest, "MaxBytes Alloc: %lld\n", stats->maxBytesAllocated);
+    fprintf(dest, "CurOSBytes Map: %lld\n", stats->currentOSBytesMapped);
+    fprintf(dest, "MaxOSBytes Map: %lld\n\n", stats->maxOSBytesMapped);
+}
+#endif
+
+
+#ifdef FF_PROFILE
+void ffprint_statistics(FILE * const dest) {
+	ffprofile_t* stats = &arenas[0]->profile;
+	fprintf(dest, "*** FFMalloc Stats ***\n");
+	fprintf(dest, "Malloc:         %ld\n", stats->mallocCount);
+	fprintf(dest, "Realloc:        %ld\n", stats->reallocCount);
+#ifdef FF_GROWLARGEREALLOC
+	fprintf(dest, "Realloc Grow:   %ld\n", stats->reallocCouldGrow);
+#endif
+	fprintf(dest, "Calloc:         %ld\n", stats->callocCount);
+	fprintf(dest, "Free:           %ld\n", stats->freeCount);
+	fprintf(dest, "POSIX Align:    %ld\n", stats->posixAlignCount);
+	fprintf(dest, "Alloc Align:    %ld\n", stats->allocAlignCount);
+	fprintf(dest, "TotBytes Reqst: %ld\n", stats->totalBytesRequested);
+	fprintf(dest, "TotBytes Alloc: %ld\n", stats->totalBytesAllocated);
+	fprintf(dest, "CurBytes Alloc: %ld\n", stats->currentBytesAllocated);
+	fprintf(dest, "MaxBytes Alloc: %ld\n", stats->maxBytesAllocated);
+	fprintf(dest, "CurOSBytes Map: %ld\n", stats->currentOSBytesMapped);
+	fprintf(dest, "MaxOSBytes Map: %ld\n", stats->maxOSBytesMapped);
+
+	struct rusage usage;
+	getrusage(RUSAGE_SELF, &usage);
+	fprintf(dest, "Linux MaxRSS:   %ld\n\n", usage.ru_maxrss * 1024L);
+}
+#endif
+
+// Prints current usage statistics to the specified file each time the cummulative
+// number of calls to malloc/calloc/realloc (that caused a malloc) is a multiple
+// of interval
+void ffprint_usage_on_interval(FILE * const dest, unsigned int interval) {
+	usagePrintFile = dest;
+	if (interval == 0) {
+		usagePrintInterval = INT_MAX;
+	}
+	else {
+		usagePrintInterval = interval;
+	}
+}
+
+static void print_current_usage() {
+	// Should print: OS mem, current physical bytes, current alloc bytes, free bytes need release
+	// free bytes awaiting assign
+	size_t releasedPages = 0;
+	size_t pendingReleasePages = 0;
+	size_t pendingReleaseLargeBytes = 0;
+	size_t tcachePages = 0;
+	size_t inusePages = 0;
+	size_t unassignedPages = 0;
+	size_t unassignedLargeBytes = 0;
+	size_t currentOSReported = 0;
+	size_t smallFreeOnInUsePage = 0;
+	size_t poolMetadata = 0;
+	size_t smallPageWaste = 0;
+	size_t smallPoolCount = 0;
+	size_t largePoolCount = 0;
+	size_t jumboPoolCount = 0;
+	size_t largePoolAssigned = 0;
+	size_t numEmptyLargePool = 0;
+
+	if (usagePrintFile != NULL && (arenas[0]->profile.mallocCount % usagePrintInterval == 0)) {
+		for (size_t slot = poolMapFirst; slot <= poolMapLast; slot++) {
+			if (pool_map_slot(slot) != NULL && poolMap[slot].poolStart != NULL) {
+				struct pagepool_t* pool = poolMap[slot].poolStart;
+				if (pool->nextFreeIndex == SIZE_MAX) {
+					// Small pool
+					size_t poolInUsePages = 0;
+					size_t smallNeedsReleasePages = 0;
+					smallPoolCount++;
+					poolMetadata += POOL_SIZE / PAGE_SIZE * sizeof(struct pagemap_t);
+					byte* lastFreePage = pool->end < pool->nextFreePage ? pool->end : pool->nextFreePage;
+					for (size_t x = 0; x < (lastFreePage - pool->start) / PAGE_SIZE; x++) {
+						if ((pool->tracking.pageMaps[x].allocSize & THREE64) == 3) {
+							releasedPages++;
+						}
+						else if ((pool->tracking.pageMaps[x].allocSize & THREE64) == 1) {
+							pendingReleasePages++;
+						}
+						else if (pool->tracking.pageMaps[x].allocSize == 0) {
+							tcachePages++;
+						}
+						else {
+							inusePages++;
+							poolInUsePages++;
+							size_t allocSize = (pool->tracking.pageMaps[x].allocSize & ~SEVEN64);
+							size_t maxAlloc = PAGE_SIZE / allocSize;
+							smallPageWaste += PAGE_SIZE - (maxAlloc * allocSize);
+							size_t bitmapCount = BITMAP_WORDS(maxAlloc);
+							size_t totalCount = 0;
+							for (size_t index = 0; index < bitmapCount; index++) {
+								size_t count = FFPOPCOUNT64(pool->tracking.pageMaps[x].bitmap[index]);
+								totalCount += count;
+								if (index != (bitmapCount - 1)) {
+									smallFreeOnInUsePage += (64 - count) * allocSize;
+								}
+								else {
+									size_t lastBitmapMax = maxAlloc - ((bitmapCount - 1) * 64);
+									smallFreeOnInUsePage += (lastBitmapMax - count) * allocSize;
+								}
+							}
+							if(totalCount == 0) {
+								smallNeedsReleasePages++;
+							}
+						}
+					}
+					unassignedPages += (pool->end - lastFreePage) / PAGE_SIZE;
+					/*if(unassignedPages == 0 && smallNeedsReleasePages >= 1024) {
+						fprintf(stderr, "Small pool empty: %p\n", pool);
+						abort();
+					}*/
+				}
+				else if (pool->nextFreeIndex == SIZE_MAX - 1) {
+					// Jumbo pool
+					jumboPoolCount++;
+				}
+				else {
+					// Large pool
+					largePoolCount++;
+					poolMetadata += (POOL_SIZE >> 20) * PAGE_SIZE;
+					size_t thisPoolInUse = 0;
+					for (size_t index = 0; index < pool->nextFreeIndex; index++) {
+						if ((pool->tracking.allocations[index] & 2) == 2) {
+							// Freed and (at least partially) returned
+						}
+						else if ((pool->tracking.allocations[index] & 3) == 1) {
+							// Freed pending return
+							pendingReleaseLargeBytes += ((pool->tracking.allocations[index + 1] & ~SEVEN64) -
+								(pool->tracking.allocations[index] & ~SEVEN64));
+						}
+						else {
+							thisPoolInUse += (pool->tracking.allocations[index + 1] & ~SEVEN64) - pool->tracking.allocations[index];	
+						}
+					}
+					if(thisPoolInUse == 0) {
+						numEmptyLargePool++;
+						/*fprintf(stderr, "Empty pool: %p\n", pool);
+						if(numEmptyLargePool > 4) {
+							abort();
+						}*/
+					}
+					largePoolAssigned += thisPoolInUse;
+
+					if ((uintptr_t)pool->end > pool->tracking.allocations[pool->nextFreeIndex]) {
+						unassignedLargeBytes += ((uintptr_t)pool->end - (pool->tracking.allocations[pool->nextFreeIndex] & ~SEVEN64));
+					}
+				}
+			}
+		}
+
+#ifdef _WIN64
+		PROCESS_MEMORY_COUNTERS pmc;
+		if (GetProcessMemoryInfo(GetCurrentProcess(), &pmc, sizeof(pmc))) {
+			currentOSReported = pmc.PagefileUsage;
+			peakOSReported = pmc.PeakPagefileUsage;
+		}
+		char* fmtString = "%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld\n";
+#else
+		// This all is only valid so long as large OS pages are not supported
+		FILE* stat = fopen("/proc/self/statm", "r");
+		if (stat) {
+			fclose(stat);
+			currentOSReported *= 4096;
+		}
+		char* fmtString = "%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld,%ld\n";
+#endif
+
+		fprintf(usagePrintFile, fmtString, //peakOSReported,
+			arenas[0]->profile.mallocCount,
+			arenas[0]->profile.reallocCount,
+			currentOSReported,
+			arenas[0]->profile.currentOSBytesMapped, 
+			arenas[0]->profile.currentBytesAllocated,
+			poolMetadata,
+			smallPageWaste,
+			smallFreeOnInUsePage,
+			pendingReleasePages * PAGE_SIZE, 
+			pendingReleaseLargeBytes,
+			(unassignedPages + tcachePages) * PAGE_SIZE, 
+			unassignedLargeBytes,
+			largePoolAssigned,
+			smallPoolCount, largePoolCount, jumboPoolCount,
+			numEmptyLargePool);
+	}
+}
+#endif
@@ -1,240 +1,419 @@
-// Header file for FFMalloc
-
-#pragma once
-#ifdef __cplusplus
-extern "C" {
-#endif
-
-// Need size_t
-#include <sys/types.h>
-
-
-#define FFMALLOC_PLUS
-#define MARK_SWEEP
-
-#define STW_TIME
-#define STW_TIME_VAL 3
-#define SYS_DIRTY
-#define SAFE_MODE
-
-//#define NO_SCAN
-#define SUB_PAGE
-#define CONCURRENT
-
-#ifdef DEBUG
-#define lf_dbg(fmt, args...)    fprintf(stderr, "<%s,%d,%s>: " fmt "\n", \
-                __FILE__, __LINE__, __func__, ## args)
-#define msg(fmt, args...)    fprintf(stderr, "<%s,%d,%s>: " fmt, \
-                __FILE__, __LINE__, __func__, ## args)
-#else
-#define lf_dbg(fmt, args...)
-#endif
-
-#ifdef FF_INSTRUMENTED
-#define FF_INTERVAL 5000
-#ifndef FF_PROFILE
-#define FF_PROFILE
-#endif
-#endif
-
-#ifdef FF_PROFILE
-// Need FILE
-#include <stdio.h>
-#endif
-
-// When compiling FFMalloc as a Windows DLL decorate the public API
-// functions with the needed symbols to export them through the link
-// library. Exclude these symbols on non-Windows or a Windows static
-// library with no threading support. Lastly, when used with a 
-// Windows application linking against the FFMalloc DLL, decorate
-// the API with the symbols needed for import
-#ifdef _WIN64
-#define USE_FF_PREFIX
-#ifdef FFMALLOC_EXPORTS
-#define FFMALLOC_API __declspec(dllexport)
-#elif !defined(FFSINGLE_THREADED)
-#define FFMALLOC_API __declspec(dllimport)
-#else
-#define FFMALLOC_API
-#endif
-#else
-#define FFMALLOC_API
-#endif
-
-
-// When USE_FF_PREFIX is not defined, the public API will match the names
-// of the standard allocation functions. Useful when using LD_PRELOAD to 
-// force an existing binary on Linux to use this allocator
-#ifndef USE_FF_PREFIX
-#define ffmalloc             malloc
-#define ffrealloc            realloc
-#define ffreallocarray       reallocarray
-#define ffcalloc             calloc
-#define fffree               free
-#define ffmemalign           memalign
-#define ffposix_memalign     posix_memalign
-#define ffaligned_alloc      aligned_alloc
-#define ffmalloc_usable_size malloc_usable_size
-#ifdef FF_WRAP_MMAP
-#define ffmmap               mmap
-#define ffmunmap             munmap	
-#endif
-#endif
-
-/*** Custom types for the extended API functions ***/
-
-// The returned success or error message from an extended API function
-typedef unsigned int ffresult_t;
-
-// Handle to a custom arena
-typedef unsigned int ffarena_t;
-
-#ifdef FF_PROFILE
-typedef struct ffprofiling_struct {
-	// The number of times that ffmalloc has been called including
-	// indirectly through ffrealloc, ffcalloc, or similar
-	size_t mallocCount;
-
-	// The number of times that ffrealloc has been called
-	size_t reallocCount;
-
-	// The number of times that ffreallocarray has been called
-	size_t reallocarrayCount;
-
-	// The number of times that ffcalloc has been called
-	size_t callocCount;
-
-	// The number of times that fffree has been called including
-	// indirectly through ffrealloc
-	size_t freeCount;
-
-	// The number of times that ffposix_memalign has been called
-	size_t posixAlignCount;
-
-	// The number of times that ffallign_alloc has been called
-	size_t allocAlignCount;
-
-	// The total number of bytes requested by as measured by ffmalloc
-	// This will exclude whenever ffrealloc is called with a size less
-	// than the current allocation size
-	size_t totalBytesRequested;
-
-	// The total number of bytes in memory consumed by allocations after
-	// adjusting requested sizes upwards for required alignments
-	size_t totalBytesAllocated;
-
-	// The number of bytes in memory associated with unfreed allocations
-	// at this point in time. This does not include "lost" bytes that have
-	// been fffree'd but whose pages have not yet been returned to the OS
-	size_t currentBytesAllocated;
-
-	// The highest seen value for currentBytesAllocated
-	size_t maxBytesAllocated;
-
-	// The sum of the sizes of all allocation ranges currently in use even
-	// if not yet faulted and mapped. Excludes pages mapped for metadata
-	size_t currentOSBytesMapped;
-
-	// The highest value for currentOSBytesMapped seen
-	size_t maxOSBytesMapped;
-	size_t reallocCouldGrow;
-} ffprofile_t;
-#endif
-
-/*** Extended API error codes ***/
-
-// Returned when the function completed successfully. Any out parameters will
-// have valid values
-#define FFSUCCESS 0
-
-// The supplied arena key was not created by ffcreate_arena or has already
-// been destroyed
-#define FFBAD_ARENA 1U
-
-// No additional arenas can be created because the limit has been reached
-#define FFMAX_ARENAS 2U
-
-// An additional arena could not be created because FFMalloc could not
-// get the required pages allocated from the OS
-#define FFNOMEM 3U
-
-// An additional arena could not be created because a system limitation
-// other than memory was reached, probably thread local storage indexes
-#define FFSYS_LIMIT 4U
-
-// A supplied parameter could not be validated, usually an out parameter
-// pointer that is NULL
-#define FFBAD_PARAM 5U
-
-/*** Declare standard malloc API functions ***/
-FFMALLOC_API void* ffmalloc(size_t size);
-FFMALLOC_API void* ffrealloc(void* ptr, size_t size);
-FFMALLOC_API void* ffreallocarray(void* ptr, size_t nmemb, size_t size);
-FFMALLOC_API void* ffcalloc(size_t nmemb, size_t size);
-FFMALLOC_API void fffree(void* ptr);
-FFMALLOC_API void* ffmemalign(size_t alignment, size_t size);
-FFMALLOC_API int ffposix_memalign(void **ptr, size_t alignment, size_t size);
-FFMALLOC_API void* ffaligned_alloc(size_t alignment, size_t size);
-FFMALLOC_API size_t ffmalloc_usable_size(const void* ptr);
-
-/*** Deprecated malloc API - only included in no-prefix mode ***/
-#ifndef FF_USE_PREFIX
-FFMALLOC_API void* valloc(size_t size);
-FFMALLOC_API void* pvalloc(size_t size);
-#endif
-
-/*** Optionally wrap mmap ***/
-#ifdef FF_WRAP_MMAP
-void* ffmmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset);
-int ffmunmap(void* addr, size_t length);
-#endif
-
-/*** Declare FFMalloc extended API ***/
-
-// Duplicates a string. Memory is allocated from ffmalloc so the caller is
-// responsible for fffreeing the string
-FFMALLOC_API char* ffstrdup(const char* s);
-
-// Duplicates the first n characters of a string. Memory is allocated 
-// from ffmalloc so the caller must fffree the string when finished
-FFMALLOC_API char* ffstrndup(const char* s, size_t n);
-
-// Creates a new allocation arena
-FFMALLOC_API ffresult_t ffcreate_arena(ffarena_t* newArena);
-
-// Destroys an allocation arena and frees all memory allocated from it
-FFMALLOC_API ffresult_t ffdestroy_arena(ffarena_t arenaKey);
-
-// Allocates memory in the same manner as ffmalloc except from a specific arena
-FFMALLOC_API ffresult_t ffmalloc_arena(ffarena_t arenaKey, void** ptr, size_t size);
-
-#ifdef FF_PROFILE
-// Gets usage statistics for ffmalloc excluding custom arenas
-FFMALLOC_API ffresult_t ffget_statistics(ffprofile_t* profileDestination);
-
-// Gets usage statistics for a custom arena
-FFMALLOC_API ffresult_t ffget_arena_statistics(ffprofile_t* profileDestination, ffarena_t arenaKey);
-
-// Gets combined usage statistics for all arenas active or destroyed plus the
-// default allocation arena. 
-// *** Not implemented yet ***
-//FFMALLOC_API ffresult_t ffget_global_statistics(ffprofile_t* profileDestination);
-
-// Outputs the same statistics as ffget_statistics to the supplied file
-FFMALLOC_API void ffprint_statistics(FILE * const dest);
-
-// Prints current usage statistics to the specified file each time the cummulative
-// number of calls to malloc/calloc/realloc (that caused a malloc) is a multiple
-// of interval
-FFMALLOC_API void ffprint_usage_on_interval(FILE * const dest, unsigned int interval);
-#endif
-
-//#ifdef _DEBUG
-FFMALLOC_API void fffree_all();
-FFMALLOC_API size_t ffget_pool_count();
-FFMALLOC_API void ffdump_pool_details();
-//#endif // DEBUG
-
-#ifdef __cplusplus
-}
-#endif
+// Header file for FFMalloc
+
+#pragma once
+#ifdef __cplusplus
+extern "C" {
+#endif
+
+// Need size_t
+#include <sys/types.h>
+
+
+#define FFMALLOC_PLUS
+#define MARK_SWEEP
+
+// STW_TIME_VAL, CONCURRENT and NO_SCAN only give the defaults of the
+// start_delay, concurrent and no_scan runtime options. See ffset_option
+#define STW_TIME
+#define STW_TIME_VAL 3
+#define SYS_DIRTY
+#define SAFE_MODE
+
+//#define NO_SCAN
+#define SUB_PAGE
+#define CONCURRENT
+
+#ifdef DEBUG
+#define lf_dbg(fmt, args...)    fprintf(stderr, "<%s,%d,%s>: " fmt "\n", \
+                __FILE__, __LINE__, __func__, ## args)
+#define msg(fmt, args...)    fprintf(stderr, "<%s,%d,%s>: " fmt, \
+                __FILE__, __LINE__, __func__, ## args)
+#else
+#define lf_dbg(fmt, args...)
+#endif
+
+#ifdef FF_INSTRUMENTED
+#define FF_INTERVAL 5000
+#ifndef FF_PROFILE
+#define FF_PROFILE
+#endif
+#endif
+
+#ifdef FF_PROFILE
+// Need FILE
+#include <stdio.h>
+#endif
+
+// When compiling FFMalloc as a Windows DLL decorate the public API
+// functions with the needed symbols to export them through the link
+// library. Exclude these symbols on non-Windows or a Windows static
+// library with no threading support. Lastly, when used with a 
+// Windows application linking against the FFMalloc DLL, decorate
+// the API with the symbols needed for import
+#ifdef _WIN64
+#define USE_FF_PREFIX
+#ifdef FFMALLOC_EXPORTS
+#define FFMALLOC_API __declspec(dllexport)
+#elif !defined(FFSINGLE_THREADED)
+#define FFMALLOC_API __declspec(dllimport)
+#else
+#define FFMALLOC_API
+#endif
+#else
+#define FFMALLOC_API
+#endif
+
+
+// When USE_FF_PREFIX is not defined, the public API will match the names
+// of the standard allocation functions. Useful when using LD_PRELOAD to 
+// force an existing binary on Linux to use this allocator
+#ifndef USE_FF_PREFIX
+#define ffmalloc             malloc
+#define ffrealloc            realloc
+#define ffreallocarray       reallocarray
+#define ffcalloc             calloc
+#define fffree               free
+#define ffmemalign           memalign
+#define ffposix_memalign     posix_memalign
+#define ffaligned_alloc      aligned_alloc
+#define ffmalloc_usable_size malloc_usable_size
+#define fffree_sized         free_sized
+#ifdef FF_WRAP_MMAP
+#define ffmmap               mmap
+#define ffmunmap             munmap	
+#endif
+#endif
+
+/*** Custom types for the extended API functions ***/
+
+// The returned success or error message from an extended API function
+typedef unsigned int ffresult_t;
+
+// Handle to a custom arena
+typedef unsigned int ffarena_t;
+
+#ifdef FF_PROFILE
+typedef struct ffprofiling_struct {
+	// The number of times that ffmalloc has been called including
+	// indirectly through ffrealloc, ffcalloc, or similar
+	size_t mallocCount;
+
+	// The number of times that ffrealloc has been called
+	size_t reallocCount;
+
+	// The number of times that ffreallocarray has been called
+	size_t reallocarrayCount;
+
+	// The number of times that ffcalloc has been called
+	size_t callocCount;
+
+	// The number of times that fffree has been called including
+	// indirectly through ffrealloc
+	size_t freeCount;
+
+	// The number of times that ffposix_memalign has been called
+	size_t posixAlignCount;
+
+	// The number of times that ffallign_alloc has been called
+	size_t allocAlignCount;
+
+	// The total number of bytes requested by as measured by ffmalloc
+	// This will exclude whenever ffrealloc is called with a size less
+	// than the current allocation size
+	size_t totalBytesRequested;
+
+	// The total number of bytes in memory consumed by allocations after
+	// adjusting requested sizes upwards for required alignments
+	size_t totalBytesAllocated;
+
+	// The number of bytes in memory associated with unfreed allocations
+	// at this point in time. This does not include "lost" bytes that have
+	// been fffree'd but whose pages have not yet been returned to the OS
+	size_t currentBytesAllocated;
+
+	// The highest seen value for currentBytesAllocated
+	size_t maxBytesAllocated;
+
+	// The sum of the sizes of all allocation ranges currently in use even
+	// if not yet faulted and mapped. Excludes pages mapped for metadata
+	size_t currentOSBytesMapped;
+
+	// The highest value for currentOSBytesMapped seen
+	size_t maxOSBytesMapped;
+	size_t reallocCouldGrow;
+} ffprofile_t;
+#endif
+
+#ifdef MARK_SWEEP
+// The most size classes ffget_alloc_statistics can report
+#define FFSTAT_CLASSES 46
+
+// Allocation counts summed over the thread caches of every arena,
+// including those of threads that have exited
+typedef struct ffallocstats_struct {
+	// The number of allocations and frees over all size classes
+	size_t mallocCount;
+	size_t freeCount;
+
+	// Bytes allocated and freed. Small allocations count the size of
+	// their class
+	size_t bytesAllocated;
+	size_t bytesFreed;
+
+	// The number of size classes below, smallest first. Each is a small
+	// allocation bin of classSize bytes except the last, which counts
+	// every larger allocation and has a classSize of 0
+	size_t classCount;
+	size_t classSize[FFSTAT_CLASSES];
+	size_t classMallocCount[FFSTAT_CLASSES];
+	size_t classFreeCount[FFSTAT_CLASSES];
+} ffallocstats_t;
+
+// The parts of a sweep cycle timed separately: reading /proc/self/maps and
+// queuing the scan work, scanning roots, scanning heap pools, reclaiming
+// large extents, releasing quarantined pools, listing sub-page slots for
+// reuse and clearing the marks
+#define FFPHASE_MAPS    0
+#define FFPHASE_ROOTS   1
+#define FFPHASE_HEAP    2
+#define FFPHASE_LARGE   3
+#define FFPHASE_POOLS   4
+#define FFPHASE_SUBPAGE 5
+#define FFPHASE_CLEAR   6
+#define FFPHASE_COUNT   7
+
+// The number of buckets in a sweep latency histogram. Bucket i counts the
+// durations from 2^i up to 2^(i+1) microseconds. The first also counts
+// shorter ones and the last longer ones
+#define FFSWEEP_BUCKETS 24
+
+// What one sweep cycle did, or the sum over several. Times are in
+// nanoseconds. The root and heap scan times are summed over the scanner
+// threads, so they can be longer than the passes they ran in
+typedef struct ffsweepcycle_struct {
+	// Wall time of the concurrent pass and of the pause
+	size_t concurrentTime;
+	size_t pauseTime;
+	size_t phaseTime[FFPHASE_COUNT];
+
+	// Pages the scanners read and those the dirty bits let them skip
+	size_t pagesScanned;
+	size_t pagesSkipped;
+
+	// Words found pointing into the heap
+	size_t marks;
+
+	// Bytes of quarantined pools returned, and bytes of large extents and
+	// sub-page slots handed back to the allocator
+	size_t bytesReleased;
+	size_t bytesReusable;
+} ffsweepcycle_t;
+
+// Sweep counters since startup
+typedef struct ffsweepstats_struct {
+	// Cycles that ran a concurrent pass, that stopped the world, and of
+	// those the ones that finished and the ones abandoned because a thread
+	// did not stop or the pause ran over its budget
+	size_t concurrentPasses;
+	size_t pauses;
+	size_t sweeps;
+	size_t abandoned;
+
+	// Sweeps of a single arena asked for by ffsweep_arena and
+	// ffdestroy_arena. Their pauses are counted with the others
+	size_t arenaSweeps;
+
+	// The longest pause so far
+	size_t maxPauseTime;
+
+	// The most recent cycle and the sum over all of them
+	ffsweepcycle_t last;
+	ffsweepcycle_t total;
+
+	// Pause and concurrent pass durations, see FFSWEEP_BUCKETS
+	size_t pauseHistogram[FFSWEEP_BUCKETS];
+	size_t concurrentHistogram[FFSWEEP_BUCKETS];
+} ffsweepstats_t;
+#endif
+
+// The instrumented build records every allocation call to the file named by
+// HUSHVAC_TRACE. The file starts with the 8 bytes of FFTRACE_MAGIC followed
+// by one record per call
+#define FFTRACE_MAGIC    "HVTRACE1"
+#define FFTRACE_MALLOC   1U
+#define FFTRACE_FREE     2U
+#define FFTRACE_REALLOC  3U
+#define FFTRACE_MEMALIGN 4U
+#define FFTRACE_CALLOC   5U
+
+typedef struct fftrace_struct {
+	// The FFTRACE_ call type in the top byte and the requested size below
+	unsigned long long info;
+
+	// The pointer passed in, or the alignment for FFTRACE_MEMALIGN
+	unsigned long long ptr;
+
+	// The pointer returned
+	unsigned long long result;
+} fftrace_t;
+
+/*** Extended API error codes ***/
+
+// Returned when the function completed successfully. Any out parameters will
+// have valid values
+#define FFSUCCESS 0
+
+// The supplied arena key was not created by ffcreate_arena or has already
+// been destroyed
+#define FFBAD_ARENA 1U
+
+// No additional arenas can be created because the limit has been reached
+#define FFMAX_ARENAS 2U
+
+// An additional arena could not be created because FFMalloc could not
+// get the required pages allocated from the OS
+#define FFNOMEM 3U
+
+// An additional arena could not be created because a system limitation
+// other than memory was reached, probably thread local storage indexes
+#define FFSYS_LIMIT 4U
+
+// A supplied parameter could not be validated, usually an out parameter
+// pointer that is NULL
+#define FFBAD_PARAM 5U
+
+// The option sizes structures created at startup and can only be set
+// through its environment variable
+#define FFREADONLY 6U
+
+// An arena sweep could not stop every thread and was given up. Nothing was
+// released and the call can be retried
+#define FFBUSY 7U
+
+// No more ranges can be registered or excluded as roots because the limit
+// has been reached
+#define FFMAX_ROOTS 8U
+
+/*** Declare standard malloc API functions ***/
+FFMALLOC_API void* ffmalloc(size_t size);
+FFMALLOC_API void* ffrealloc(void* ptr, size_t size);
+FFMALLOC_API void* ffreallocarray(void* ptr, size_t nmemb, size_t size);
+FFMALLOC_API void* ffcalloc(size_t nmemb, size_t size);
+FFMALLOC_API void fffree(void* ptr);
+FFMALLOC_API void* ffmemalign(size_t alignment, size_t size);
+FFMALLOC_API int ffposix_memalign(void **ptr, size_t alignment, size_t size);
+FFMALLOC_API void* ffaligned_alloc(size_t alignment, size_t size);
+FFMALLOC_API size_t ffmalloc_usable_size(const void* ptr);
+
+/*** Deprecated malloc API - only included in no-prefix mode ***/
+#ifndef FF_USE_PREFIX
+FFMALLOC_API void* valloc(size_t size);
+FFMALLOC_API void* pvalloc(size_t size);
+#endif
+
+/*** Optionally wrap mmap ***/
+#ifdef FF_WRAP_MMAP
+void* ffmmap(void* addr, size_t length, int prot, int flags, int fd, off_t offset);
+int ffmunmap(void* addr, size_t length);
+#endif
+
+/*** Declare FFMalloc extended API ***/
+
+// Duplicates a string. Memory is allocated from ffmalloc so the caller is
+// responsible for fffreeing the string
+FFMALLOC_API char* ffstrdup(const char* s);
+
+// Duplicates the first n characters of a string. Memory is allocated 
+// from ffmalloc so the caller must fffree the string when finished
+FFMALLOC_API char* ffstrndup(const char* s, size_t n);
+
+// Creates a new allocation arena
+FFMALLOC_API ffresult_t ffcreate_arena(ffarena_t* newArena);
+
+// Destroys an allocation arena and frees all memory allocated from it. With
+// the sweeper the arena's pools are released at once if a sweep of the
+// roots and of every other arena's pools finds no pointers into them. Memory
+// outside the heap that is neither a root nor registered with ffregister_root
+// is not scanned. Pools still referenced, or all of them if the world cannot
+// be stopped, are left to the global sweeps
+FFMALLOC_API ffresult_t ffdestroy_arena(ffarena_t arenaKey);
+
+// Allocates memory in the same manner as ffmalloc except from a specific arena
+FFMALLOC_API ffresult_t ffmalloc_arena(ffarena_t arenaKey, void** ptr, size_t size);
+
+// Allocates count blocks of size bytes into out in one call. Returns how
+// many were allocated, which is fewer than count only when out of memory
+FFMALLOC_API size_t ffmalloc_batch(size_t size, size_t count, void** out);
+
+// Frees count pointers in one call. NULL entries are skipped. Pointers into
+// the same page are handled together when they are next to each other
+FFMALLOC_API void fffree_batch(void** ptrs, size_t count);
+
+// Frees an allocation whose size is known, as C23 free_sized. Aborts if the
+// size is larger than the allocation. Building with FF_SIZED_DELETE also
+// routes the C++ sized operator delete here
+FFMALLOC_API void fffree_sized(void* ptr, size_t size);
+
+#ifdef MARK_SWEEP
+// Sets a sweeper option by name. Every option is also read at startup from
+// the environment variable of the same name in upper case prefixed with
+// HUSHVAC_, e.g. HUSHVAC_PERIOD_DELAY for "period_delay"
+FFMALLOC_API ffresult_t ffset_option(const char* name, long value);
+
+// Gets the current value of a sweeper option
+FFMALLOC_API ffresult_t ffget_option(const char* name, long* value);
+
+// Gets the allocation and free counts that feed the sweep heuristic
+FFMALLOC_API ffresult_t ffget_alloc_statistics(ffallocstats_t* stats);
+
+// Gets what the sweeps so far have done and how long they took
+FFMALLOC_API ffresult_t ffget_sweep_statistics(ffsweepstats_t* stats);
+
+// Sweeps a custom arena now and waits for it. Only the root mappings, such
+// as stacks and globals, and the arena's own pools are scanned, and only the
+// arena's freed memory is released or reused. Pointers into the arena kept
+// in the memory of other arenas are not seen, so use it for arenas that
+// only they and the roots point into
+FFMALLOC_API ffresult_t ffsweep_arena(ffarena_t arenaKey);
+
+// Adds a range that may hold heap pointers to the roots, such as shared
+// memory, which is not scanned otherwise. It must stay readable until it is
+// excluded again. Ranges inside the heap are rejected
+FFMALLOC_API ffresult_t ffregister_root(void* start, size_t size);
+
+// Leaves a range that never holds heap pointers, such as a large buffer of
+// plain data, out of the roots. Excluding exactly a registered range
+// unregisters it, and registering exactly an excluded range includes it
+// again
+FFMALLOC_API ffresult_t ffexclude_range(void* start, size_t size);
+#endif
+
+#ifdef FF_PROFILE
+// Gets usage statistics for ffmalloc excluding custom arenas
+FFMALLOC_API ffresult_t ffget_statistics(ffprofile_t* profileDestination);
+
+// Gets usage statistics for a custom arena
+FFMALLOC_API ffresult_t ffget_arena_statistics(ffprofile_t* profileDestination, ffarena_t arenaKey);
+
+// Gets combined usage statistics for all arenas active or destroyed plus the
+// default allocation arena
+FFMALLOC_API ffresult_t ffget_global_statistics(ffprofile_t* profileDestination);
+
+// Outputs the same statistics as ffget_statistics to the supplied file
+FFMALLOC_API void ffprint_statistics(FILE * const dest);
+
+// Prints current usage statistics to the specified file each time the cummulative
+// number of calls to malloc/calloc/realloc (that caused a malloc) is a multiple
+// of interval
+FFMALLOC_API void ffprint_usage_on_interval(FILE * const dest, unsigned int interval);
+#endif
+
+//#ifdef _DEBUG
+FFMALLOC_API void fffree_all();
+FFMALLOC_API size_t ffget_pool_count();
+FFMALLOC_API void ffdump_pool_details();
+//#endif // DEBUG
+
+#ifdef __cplusplus
+}
+#endif